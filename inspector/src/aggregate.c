@@ -0,0 +1,115 @@
+/**
+ *
+ * The windows of the --aggregate results (see aggregate.h).
+ *
+ */
+
+#include <string.h>
+
+#include "aggregate.h"
+
+void
+aggregator_init (Aggregator * aggregator, guint64 length)
+{
+  memset(aggregator, 0, sizeof(Aggregator));
+  aggregator->length = length;
+}
+
+/**
+ *
+ * This function adds a frame to the current window. When the frame is after
+ * the window, the window is done: it is copied to `done` (the function
+ * returns TRUE) and the frame starts the window it belongs to.
+ *
+ */
+gboolean
+aggregator_add (Aggregator * aggregator, const FrameInfo * ctx, gboolean resolutionChanged, AggregateWindow * done)
+{
+  AggregateWindow * window = &aggregator->window;
+  gboolean ended = FALSE;
+
+  if (window->frames > 0 && ctx->pts >= window->start + aggregator->length) {
+    *done = *window;
+    done->duration = aggregator->length;
+    ended = TRUE;
+    /* the windows stay aligned on the first one, also after a pause */
+    guint64 start = window->start + (ctx->pts - window->start) / aggregator->length * aggregator->length;
+    memset(window, 0, sizeof(AggregateWindow));
+    window->start = start;
+  } else if (window->frames == 0) {
+    window->start = ctx->pts;
+  }
+
+  if (window->frames == 0) {
+    window->firstPts = ctx->pts;
+  }
+  window->frames++;
+  window->bytes += ctx->size;
+  window->lastPts = MAX(window->lastPts, ctx->pts);
+  window->keyframes += ctx->keyframe;
+  window->hiddenFrames += !ctx->showFrame;
+  window->goldenRefreshes += ctx->refreshGoldenFrame;
+  window->altrefRefreshes += ctx->refreshAltrefFrame;
+  window->corruptFrames += !ctx->ok;
+  window->resolutionChanges += resolutionChanged;
+  window->width = ctx->resolution.width;
+  window->height = ctx->resolution.height;
+
+  if (ctx->keyframe) {
+    if (aggregator->keyframeSeen && ctx->pts > aggregator->lastKeyframe) {
+      window->keyframeIntervals++;
+      window->keyframeIntervalSum += ctx->pts - aggregator->lastKeyframe;
+    }
+    aggregator->lastKeyframe = ctx->pts;
+    aggregator->keyframeSeen = TRUE;
+  }
+  return ended;
+}
+
+/**
+ *
+ * This function ends the current window (the stream is removed), it returns
+ * FALSE when it has no frames. The window lasts until its last frame, plus
+ * the mean frame interval, so its rates are not inflated.
+ *
+ */
+gboolean
+aggregator_finish (Aggregator * aggregator, AggregateWindow * done)
+{
+  AggregateWindow * window = &aggregator->window;
+
+  if (window->frames == 0) {
+    return FALSE;
+  }
+
+  *done = *window;
+  done->duration = aggregator->length;
+  if (window->frames > 1 && window->lastPts > window->firstPts) {
+    guint64 interval = (window->lastPts - window->firstPts) / (window->frames - 1);
+    done->duration = MIN(window->lastPts - window->start + interval, aggregator->length);
+  }
+  memset(window, 0, sizeof(AggregateWindow));
+  return TRUE;
+}
+
+/**
+ *
+ * This function formats a window as a text line, like format_frame_info()
+ * does for a frame. It returns the length of the line.
+ *
+ */
+guint
+format_aggregate_window (gchar * buffer, gsize size, const gchar * ssrc, const AggregateWindow * window)
+{
+  gdouble seconds = window->duration / 1e9;
+  gint len = g_snprintf(buffer, size,
+    "ssrc: %s, window: %" G_GUINT64_FORMAT ", duration: %" G_GUINT64_FORMAT ", frames: %u, fps: %.2f, kbps: %.1f, keyframes: %u, keyframeInterval: %" G_GUINT64_FORMAT
+    ", hidden: %.3f, goldenRefreshes: %u, altrefRefreshes: %u, corrupt: %u, resolutionChanges: %u, width: %u, height: %u \n",
+    ssrc, window->start / 1000000, window->duration / 1000000, window->frames,
+    seconds > 0 ? window->frames / seconds : 0, seconds > 0 ? window->bytes * 8 / seconds / 1000 : 0,
+    window->keyframes, window->keyframeIntervals ? window->keyframeIntervalSum / window->keyframeIntervals / 1000000 : 0,
+    window->frames ? (gdouble) window->hiddenFrames / window->frames : 0, window->goldenRefreshes, window->altrefRefreshes,
+    window->corruptFrames, window->resolutionChanges, window->width, window->height);
+
+  return MIN((guint) len, size - 1);
+}
@@ -0,0 +1,65 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <glib.h>
+
+#include "vp8_parser.h"
+
+/**
+ *
+ * Windowed per-stream results (--aggregate).
+ *
+ * Instead of a line per frame, each stream gets a line per window of
+ * stream time (the frame PTS): the frames, fps, bitrate, keyframes and
+ * their mean interval, the hidden frames, the golden/altref refreshes,
+ * the corrupt frames and the resolution changes of the window. Only the
+ * notable frames (aggregate_notable()) still get their own line.
+ *
+ * A window is a handful of counters updated with each frame, nothing is
+ * kept per frame. A window ends with the first frame after it, the windows
+ * without frames (a pause of the stream) are not written. The last window
+ * of a stream is written when the stream is removed.
+ *
+ */
+
+typedef struct
+{
+  guint64 start;                /* PTS in nanoseconds, a multiple of the window length from the first frame */
+  guint64 duration;             /* the window length, or up to the last frame for the last window */
+  guint64 firstPts;
+  guint64 lastPts;
+  guint64 bytes;
+  guint frames;
+  guint keyframes;
+  guint hiddenFrames;           /* show_frame == 0 */
+  guint goldenRefreshes;
+  guint altrefRefreshes;
+  guint corruptFrames;          /* ok == 0 */
+  guint resolutionChanges;
+  guint keyframeIntervals;      /* keyframes of the window after another keyframe */
+  guint64 keyframeIntervalSum;  /* nanoseconds */
+  guint width;                  /* at the end of the window */
+  guint height;
+} AggregateWindow;
+
+typedef struct
+{
+  guint64 length;               /* nanoseconds, 0 when the frames are not aggregated */
+  guint64 lastKeyframe;         /* PTS of the previous keyframe, from any window */
+  gboolean keyframeSeen;
+  AggregateWindow window;
+} Aggregator;
+
+/* The frames that are still written one by one: keyframes (so the resolution changes) and corrupt frames */
+static inline gboolean
+aggregate_notable (const FrameInfo * ctx)
+{
+  return !ctx->ok || ctx->keyframe;
+}
+
+void aggregator_init(Aggregator * aggregator, guint64 length);
+gboolean aggregator_add(Aggregator * aggregator, const FrameInfo * ctx, gboolean resolutionChanged, AggregateWindow * done);
+gboolean aggregator_finish(Aggregator * aggregator, AggregateWindow * done);
+guint format_aggregate_window(gchar * buffer, gsize size, const gchar * ssrc, const AggregateWindow * window);
+
+#endif
@@ -0,0 +1,343 @@
+/**
+ *
+ * Batch inspection of many captures (see batch.h).
+ *
+ */
+
+#include <glob.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "log.h"
+#include "pcap_reader.h"
+#include "rtp_parser.h"
+
+static gint
+batch_compare_paths (gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const gchar **) a, *(const gchar **) b);
+}
+
+/* The biggest tasks first, a chunk costs its share of the file */
+static gint
+batch_compare_tasks (gconstpointer a, gconstpointer b)
+{
+  const BatchTask * taskA = *(const BatchTask **) a;
+  const BatchTask * taskB = *(const BatchTask **) b;
+  guint64 costA = taskA->size / taskA->chunks;
+  guint64 costB = taskB->size / taskB->chunks;
+
+  if (costA != costB) {
+    return costA > costB ? -1 : 1;
+  }
+  return strcmp(taskA->path, taskB->path) ?: (gint) taskA->chunk - (gint) taskB->chunk;
+}
+
+/* The captures of a directory, also the compressed ones (see pcap_stream.h) */
+static const gchar * captureSuffixes[] = { ".pcap", ".pcap.gz", ".pcap.zst" };
+
+/* The length of the capture suffix of `name`, 0 when it is not a capture */
+static guint
+batch_capture_suffix (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(captureSuffixes); i++) {
+    if (g_str_has_suffix(name, captureSuffixes[i])) {
+      return strlen(captureSuffixes[i]);
+    }
+  }
+  return 0;
+}
+
+/**
+ *
+ * This function appends to `paths` the .pcap (.pcap.gz, .pcap.zst) files of
+ * a directory, or the files that match a glob pattern, sorted by name.
+ *
+ */
+guint
+batch_collect (const gchar * pattern, GPtrArray * paths)
+{
+  guint first = paths->len;
+
+  if (g_file_test(pattern, G_FILE_TEST_IS_DIR)) {
+    GDir * dir = g_dir_open(pattern, 0, NULL);
+    const gchar * name;
+    while (dir && (name = g_dir_read_name(dir))) {
+      gchar * path = g_build_filename(pattern, name, NULL);
+      if (batch_capture_suffix(name) > 0 && g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+        g_ptr_array_add(paths, path);
+      } else {
+        g_free(path);
+      }
+    }
+    if (dir) {
+      g_dir_close(dir);
+    }
+  } else {
+    glob_t matches;
+    gsize i;
+    if (glob(pattern, 0, NULL, &matches) == 0) {
+      for (i = 0; i < matches.gl_pathc; i++) {
+        if (g_file_test(matches.gl_pathv[i], G_FILE_TEST_IS_REGULAR)) {
+          g_ptr_array_add(paths, g_strdup(matches.gl_pathv[i]));
+        }
+      }
+    }
+    globfree(&matches);
+  }
+
+  if (paths->len == first) {
+    return BATCH_ERROR_NO_FILES;
+  }
+  g_ptr_array_sort(paths, batch_compare_paths);
+  return BATCH_OK;
+}
+
+void
+batch_task_free (gpointer data)
+{
+  BatchTask * task = (BatchTask *) data;
+
+  g_free(task->path);
+  g_free(task->outputPath);
+  g_free(task);
+}
+
+/**
+ *
+ * This function makes the tasks of the files: one per file, or up to
+ * `maxChunks` per-SSRC chunks for the files bigger than `chunkBytes` (0 to
+ * never split them). With an outputPath, the results of each file go to
+ * <outputPath>/<file name without .pcap>/<ssrc>.log (-2, -3... when two
+ * files have the same name). The tasks are sorted biggest first. The size
+ * of a compressed file is its compressed size, and it is never split: each
+ * chunk would decompress the whole file.
+ *
+ */
+GPtrArray *
+batch_plan (GPtrArray * paths, const gchar * outputPath, guint64 chunkBytes, guint maxChunks)
+{
+  GPtrArray * tasks = g_ptr_array_new_with_free_func(batch_task_free);
+  GHashTable * names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  guint i, j;
+
+  for (i = 0; i < paths->len; i++) {
+    const gchar * path = g_ptr_array_index(paths, i);
+    gchar * folder = NULL;
+    struct stat st;
+    guint64 size = stat(path, &st) == 0 ? (guint64) st.st_size : 0;
+    guint chunks = 1;
+
+    if (chunkBytes > 0 && size > chunkBytes && pcap_file_compression(path) == PCAP_COMPRESSION_NONE) {
+      chunks = (guint) MIN((size + chunkBytes - 1) / chunkBytes, MAX(maxChunks, 1));
+    }
+
+    if (outputPath) {
+      gchar * base = g_path_get_basename(path);
+      gchar * name;
+      guint suffix = 2;
+      base[strlen(base) - batch_capture_suffix(base)] = '\0';
+      name = g_strdup(base);
+      while (g_hash_table_contains(names, name)) {
+        g_free(name);
+        name = g_strdup_printf("%s-%u", base, suffix++);
+      }
+      folder = g_build_filename(outputPath, name, NULL);
+      g_hash_table_add(names, name);
+      g_free(base);
+    }
+
+    for (j = 0; j < chunks; j++) {
+      BatchTask * task = g_new0(BatchTask, 1);
+      task->path = g_strdup(path);
+      task->outputPath = g_strdup(folder);
+      task->size = size;
+      task->chunk = j;
+      task->chunks = chunks;
+      g_ptr_array_add(tasks, task);
+    }
+    g_free(folder);
+  }
+
+  g_hash_table_destroy(names);
+  g_ptr_array_sort(tasks, batch_compare_tasks);
+  return tasks;
+}
+
+static void
+batch_queue_init (BatchQueue * queue)
+{
+  g_mutex_init(&queue->mutex);
+  queue->tasks = g_ptr_array_new();
+  queue->head = 0;
+}
+
+static void
+batch_queue_clear (BatchQueue * queue)
+{
+  g_ptr_array_free(queue->tasks, TRUE);
+  g_mutex_clear(&queue->mutex);
+}
+
+/* The owner takes the biggest task left, a thief the smallest one, so the last tasks are short */
+static BatchTask *
+batch_queue_take (BatchQueue * queue, gboolean steal)
+{
+  BatchTask * task = NULL;
+
+  g_mutex_lock(&queue->mutex);
+  if (queue->head < queue->tasks->len) {
+    if (steal) {
+      task = g_ptr_array_index(queue->tasks, queue->tasks->len - 1);
+      g_ptr_array_set_size(queue->tasks, queue->tasks->len - 1);
+    } else {
+      task = g_ptr_array_index(queue->tasks, queue->head++);
+    }
+  }
+  g_mutex_unlock(&queue->mutex);
+  return task;
+}
+
+static BatchTask *
+batch_next_task (BatchWorker * worker)
+{
+  BatchPool * pool = worker->pool;
+  BatchTask * task = batch_queue_take(&worker->queue, FALSE);
+  guint i;
+
+  for (i = 1; !task && i < pool->numWorkers; i++) {
+    task = batch_queue_take(&pool->workers[(worker->id + i) % pool->numWorkers].queue, TRUE);
+    worker->steals += task != NULL;
+  }
+  return task;
+}
+
+/* It inspects the file of a task (the SSRCs of its chunk) with a native engine of its own */
+static void
+batch_task_run (BatchWorker * worker, BatchTask * task)
+{
+  BatchPool * pool = worker->pool;
+  OutputSettings output = *pool->output;
+  NativeOptions options = *pool->options;
+  PcapReader reader;
+  PcapPacket packet;
+  RtpPacket rtp;
+  NativeWorker native;
+  gint64 start = g_get_monotonic_time();
+
+  output.outputPath = task->outputPath;
+  output.writer = worker->writer;
+  options.output = &output;
+
+  if (task->outputPath && g_mkdir_with_parents(task->outputPath, 0755) != 0) {
+    log_info("Failed to create the folder %s", task->outputPath);
+    task->failed = TRUE;
+    return;
+  }
+  if (pcap_reader_open(&reader, task->path) != PCAP_OK) {
+    log_info("Failed to open the PCAP file %s", task->path);
+    task->failed = TRUE;
+    return;
+  }
+
+  native_worker_init(&native, worker->id, &options);
+  reader.release = (PcapReleaseFunc) native_worker_detach;
+  reader.releaseData = &native;
+  while (!*pool->closing && pcap_reader_next(&reader, &packet)) {
+    if (!rtp_packet_parse(packet.payload, packet.payloadLen, &rtp) || !native_options_accept(&options, rtp.payloadType)) {
+      continue;
+    }
+    if (task->chunks > 1 && rtp.ssrc % task->chunks != task->chunk) {
+      continue;
+    }
+    rtp.arrival = packet.timestamp;
+    native_worker_push(&native, &rtp);
+  }
+  native_worker_flush(&native);
+
+  task->packets = native.packets;
+  task->frames = native.frames;
+  native_worker_clear(&native);
+  pcap_reader_close(&reader);
+
+  log_info("Batch file [path: %s, chunk: %u/%u, frames: %" G_GUINT64_FORMAT ", seconds: %.3f]",
+    task->path, task->chunk + 1, task->chunks, task->frames, (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC);
+}
+
+static gpointer
+batch_worker_run (gpointer data)
+{
+  BatchWorker * worker = (BatchWorker *) data;
+  BatchTask * task;
+
+  while (!*worker->pool->closing && (task = batch_next_task(worker))) {
+    batch_task_run(worker, task);
+    worker->tasks++;
+  }
+  return NULL;
+}
+
+/**
+ *
+ * This function inspects the tasks (see batch_plan()) with `jobs` threads
+ * and fills the summary. Each thread has its own output writer, so the
+ * results of a file are only written by one thread (the chunks of a file
+ * have different SSRCs).
+ *
+ */
+void
+batch_run (BatchPool * pool, GPtrArray * tasks, guint jobs, BatchSummary * summary)
+{
+  gint64 start = g_get_monotonic_time();
+  guint i;
+
+  memset(summary, 0, sizeof(BatchSummary));
+  pool->numWorkers = CLAMP(jobs, 1, MAX(tasks->len, 1));
+  pool->workers = g_new0(BatchWorker, pool->numWorkers);
+
+  for (i = 0; i < pool->numWorkers; i++) {
+    BatchWorker * worker = &pool->workers[i];
+    worker->id = i;
+    worker->pool = pool;
+    batch_queue_init(&worker->queue);
+    /* offline, the inspection waits for the writer instead of dropping results. The threads share the --ringSize budget */
+    worker->writer = output_writer_new(MAX(pool->ringSize / pool->numWorkers, BATCH_MIN_RING_SZ), pool->flushIntervalMs,
+      pool->flushBytes, TRUE);
+  }
+  for (i = 0; i < tasks->len; i++) {
+    g_ptr_array_add(pool->workers[i % pool->numWorkers].queue.tasks, g_ptr_array_index(tasks, i));
+  }
+
+  for (i = 0; i < pool->numWorkers; i++) {
+    pool->workers[i].thread = g_thread_new("batch", batch_worker_run, &pool->workers[i]);
+  }
+  /* the queues are cleared once every thread is done, an idle thread still looks into the others */
+  for (i = 0; i < pool->numWorkers; i++) {
+    g_thread_join(pool->workers[i].thread);
+  }
+  for (i = 0; i < pool->numWorkers; i++) {
+    BatchWorker * worker = &pool->workers[i];
+    output_writer_stop(worker->writer);
+    summary->steals += worker->steals;
+    batch_queue_clear(&worker->queue);
+  }
+
+  for (i = 0; i < tasks->len; i++) {
+    BatchTask * task = g_ptr_array_index(tasks, i);
+    summary->tasks++;
+    summary->packets += task->packets;
+    summary->frames += task->frames;
+    if (task->chunk == 0) {
+      summary->files++;
+      summary->bytes += task->size;
+    }
+    summary->failed += task->failed;
+  }
+  summary->seconds = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+
+  g_free(pool->workers);
+  pool->workers = NULL;
+}
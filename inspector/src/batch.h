@@ -0,0 +1,101 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <signal.h>
+#include <glib.h>
+
+#include "native_worker.h"
+#include "output_writer.h"
+
+/**
+ *
+ * Batch inspection of many captures (--batch).
+ *
+ * The files of a directory or a glob become tasks for a pool of threads,
+ * each one with its own native engine and output writer. Files bigger than
+ * chunkBytes are split in per-SSRC chunks (ssrc % chunks), each chunk is a
+ * task that reads the whole file but only inspects its SSRCs. Compressed
+ * files are not split, decompressing is most of their cost.
+ *
+ * The tasks are dealt biggest first to the per-thread queues, a thread
+ * takes its own tasks from the front and steals from the back of the
+ * others when its queue is empty.
+ *
+ */
+
+enum
+{
+  BATCH_OK = 0,
+  BATCH_ERROR_NO_FILES = 1,
+  BATCH_ERROR_OUTPUT = 2
+};
+
+enum
+{
+  BATCH_DEFAULT_CHUNK_MB = 256,
+  BATCH_MAX_JOBS = 256,
+  BATCH_MIN_RING_SZ = 1024    /* records, of the output writer of a thread */
+};
+
+typedef struct
+{
+  gchar * path;
+  gchar * outputPath;   /* the per-file folder, NULL without --outputPath */
+  guint64 size;
+  guint chunk;
+  guint chunks;
+  gboolean failed;
+  guint64 packets;
+  guint64 frames;
+} BatchTask;
+
+typedef struct
+{
+  GMutex mutex;
+  GPtrArray * tasks;
+  guint head;           /* the tasks before head were taken */
+} BatchQueue;
+
+struct _BatchPool;
+
+typedef struct
+{
+  guint id;
+  struct _BatchPool * pool;
+  BatchQueue queue;
+  OutputWriter * writer;
+  GThread * thread;
+  guint64 tasks;
+  guint64 steals;
+} BatchWorker;
+
+typedef struct _BatchPool
+{
+  const NativeOptions * options;   /* the output of each task replaces options->output */
+  const OutputSettings * output;   /* format and stdout, the writer and outputPath are per thread and task */
+  guint flushIntervalMs;
+  guint flushBytes;
+  guint ringSize;                  /* split between the output writers of the threads */
+  volatile sig_atomic_t * closing;
+  BatchWorker * workers;
+  guint numWorkers;
+} BatchPool;
+
+typedef struct
+{
+  guint files;
+  guint tasks;
+  guint failed;
+  guint64 bytes;
+  guint64 packets;
+  guint64 frames;
+  guint64 steals;
+  gdouble seconds;
+} BatchSummary;
+
+guint batch_collect(const gchar * pattern, GPtrArray * paths);
+GPtrArray * batch_plan(GPtrArray * paths, const gchar * outputPath, guint64 chunkBytes, guint maxChunks);
+void batch_task_free(gpointer data);
+void batch_run(BatchPool * pool, GPtrArray * tasks, guint jobs, BatchSummary * summary);
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ *
+ * Batch mode scaling benchmark.
+ *
+ * It writes a folder of synthetic PCAP files (Ethernet/IPv4/UDP, VP8 RTP
+ * from a few SSRCs per file, a keyframe every --gop frames) and inspects
+ * them like `inspector --native --batch` with 1 to N threads, without
+ * output files. It reports the frames/s and MB/s of each run and the
+ * speedup over a single thread.
+ *
+ * The files are read once before the runs, so they come from the page
+ * cache: it measures the inspection, not the disk.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "bench_common.h"
+
+enum
+{
+  BENCH_SSRCS_PER_FILE = 4
+};
+
+static gint maxJobs = 0;
+static gint files = 0;
+static gint frames = 2000;
+static gint gop = 30;
+
+static GOptionEntry entries[] =
+{
+  { "maxJobs", 'j', 0, G_OPTION_ARG_INT, &maxJobs, "Run with 1 to maxJobs threads (default: number of CPUs)", "8" },
+  { "files", 'f', 0, G_OPTION_ARG_INT, &files, "Synthetic PCAP files (default: 2 per CPU)", "16" },
+  { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per file", "2000" },
+  { "gop", 'g', 0, G_OPTION_ARG_INT, &gop, "Frames between keyframes", "30" },
+  { NULL }
+};
+
+/* It inspects the files with `jobs` threads and reports the run, unless baseline is NULL */
+static void
+bench_run (GPtrArray * tasks, guint jobs, gdouble * baseline)
+{
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  BatchPool pool = { &options, &output, OUTPUT_WRITER_DEFAULT_FLUSH_INTERVAL_MS, OUTPUT_WRITER_DEFAULT_FLUSH_BYTES,
+    OUTPUT_WRITER_DEFAULT_RING_SZ, &closing };
+  BatchSummary summary;
+  gdouble framesPerSecond;
+
+  batch_run(&pool, tasks, jobs, &summary);
+  if (!baseline) {
+    return;
+  }
+  framesPerSecond = summary.frames / summary.seconds;
+  if (jobs == 1) {
+    *baseline = framesPerSecond;
+  }
+
+  printf("{ \"jobs\": %u, \"files\": %u, \"frames\": %" G_GUINT64_FORMAT ", \"seconds\": %.3f, \"frames/s\": %.0f, \"MB/s\": %.1f, \"steals\": %" G_GUINT64_FORMAT ", \"speedup\": %.2f }\n",
+    jobs, summary.files, summary.frames, summary.seconds, framesPerSecond, summary.bytes / summary.seconds / 1e6,
+    summary.steals, framesPerSecond / *baseline);
+  fflush(stdout);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector batch benchmark");
+  gchar folder[] = "/tmp/vp8-inspector-bench-XXXXXX";
+  GPtrArray * paths = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray * tasks;
+  gdouble baseline = 0;
+  guint i;
+
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+
+  if (maxJobs <= 0) {
+    maxJobs = g_get_num_processors();
+  }
+  maxJobs = MIN(maxJobs, BATCH_MAX_JOBS);
+  if (files <= 0) {
+    files = 2 * g_get_num_processors();
+  }
+  if (frames <= 0 || gop <= 0) {
+    fprintf(stderr, "Invalid frames or gop\n");
+    exit(1);
+  }
+
+  if (!mkdtemp(folder)) {
+    fprintf(stderr, "Failed to create the folder %s\n", folder);
+    exit(1);
+  }
+  for (i = 0; i < (guint) files; i++) {
+    gchar * path = g_strdup_printf("%s/capture-%03u.pcap", folder, i);
+    if (!bench_write_capture(path, 0x10000000 + i * BENCH_SSRCS_PER_FILE, BENCH_SSRCS_PER_FILE, (guint) frames, (guint) gop, NULL)) {
+      fprintf(stderr, "Failed to write %s\n", path);
+      exit(1);
+    }
+    g_free(path);
+  }
+
+  batch_collect(folder, paths);
+  tasks = batch_plan(paths, NULL, 0, 1);
+
+  /* a first run to load the files in the page cache */
+  bench_run(tasks, maxJobs, NULL);
+  for (gint jobs = 1; jobs <= maxJobs; jobs++) {
+    bench_run(tasks, jobs, &baseline);
+  }
+
+  for (i = 0; i < paths->len; i++) {
+    unlink(g_ptr_array_index(paths, i));
+  }
+  rmdir(folder);
+  g_ptr_array_free(tasks, TRUE);
+  g_ptr_array_free(paths, TRUE);
+  return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ *
+ * Bool decoder microbenchmark.
+ *
+ * It decodes the frame headers (segmentation, loop filter, partitions,
+ * quantizer and reference flags) of a synthetic set of frames with the
+ * reference decoder (bool_decoder_reference.h) and with the word-at-a-time
+ * decoder (bool_decoder.h), and reports the ns/frame of each one, plus the
+ * ns/frame of the whole vp8_parse_header().
+ *
+ * The frames are random bytes, so every header field takes random values
+ * and the headers have a realistic mix of present and absent fields.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "bool_decoder.h"
+#include "vp8_parser.h"
+
+enum
+{
+  BENCH_FRAMES = 4096,
+  BENCH_FRAME_SZ = 128
+};
+
+static gint iterations = 200;
+
+static BenchRun run;
+
+static GOptionEntry entries[] =
+{
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Passes over the synthetic frames", "200" },
+  BENCH_PERF_COUNTERS_ENTRY(run)
+  { NULL }
+};
+
+/*
+ * The same reads as vp8_parse_header_prefix(), for both decoders.
+ * It returns the decoded values mixed, so the compiler can't skip the work.
+ */
+#define BENCH_HEADER_WALK(NAME, DECODER, INIT, GET_BIT, GET_UINT, MAYBE_GET_INT)   \
+static int                                                                        \
+NAME (const unsigned char * data, size_t len, int keyframe)                       \
+{                                                                                 \
+  DECODER bool;                                                                   \
+  int sum = 0, i;                                                                 \
+                                                                                  \
+  INIT(&bool, data, len);                                                         \
+  if (keyframe) {                                                                 \
+    sum += GET_UINT(&bool, 2);                                                    \
+  }                                                                               \
+  if (GET_BIT(&bool)) {                                                           \
+    int updateMap = GET_BIT(&bool);                                               \
+    if (GET_BIT(&bool)) {                                                         \
+      sum += GET_BIT(&bool);                                                      \
+      for (i = 0; i < MAX_MB_SEGMENTS; i++) sum += MAYBE_GET_INT(&bool, 7);       \
+      for (i = 0; i < MAX_MB_SEGMENTS; i++) sum += MAYBE_GET_INT(&bool, 6);       \
+    }                                                                             \
+    if (updateMap) {                                                              \
+      for (i = 0; i < MB_FEATURE_TREE_PROBS; i++)                                 \
+        sum += GET_BIT(&bool) ? GET_UINT(&bool, 8) : 255;                         \
+    }                                                                             \
+  }                                                                               \
+  sum += GET_BIT(&bool) + GET_UINT(&bool, 6) + GET_UINT(&bool, 3);                \
+  if (GET_BIT(&bool) && GET_BIT(&bool)) {                                         \
+    for (i = 0; i < BLOCK_CONTEXTS; i++) sum += MAYBE_GET_INT(&bool, 6);          \
+    for (i = 0; i < BLOCK_CONTEXTS; i++) sum += MAYBE_GET_INT(&bool, 6);          \
+  }                                                                               \
+  sum += GET_UINT(&bool, 2) + GET_UINT(&bool, 7);                                 \
+  for (i = 0; i < 5; i++) sum += MAYBE_GET_INT(&bool, 4);                         \
+  if (!keyframe) {                                                                \
+    sum += GET_BIT(&bool) + GET_BIT(&bool);                                       \
+  }                                                                               \
+  return sum;                                                                     \
+}
+
+BENCH_HEADER_WALK(walk_reference, struct ref_bool_decoder, ref_init_bool_decoder, ref_bool_get_bit, ref_bool_get_uint, ref_bool_maybe_get_int)
+BENCH_HEADER_WALK(walk_word, struct bool_decoder, init_bool_decoder, bool_get_bit, bool_get_uint, bool_maybe_get_int)
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector bool decoder benchmark");
+  guint8 (*frames)[BENCH_FRAME_SZ] = g_malloc(BENCH_FRAMES * BENCH_FRAME_SZ);
+  guint64 total;
+  int sum;
+  gint it, i, j;
+
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+
+  srand(42);
+  for (i = 0; i < BENCH_FRAMES; i++) {
+    guint8 * frame = frames[i];
+    gboolean keyframe = i % 30 == 0;
+    guint partSize = BENCH_FRAME_SZ / 2;
+    guint header = keyframe ? FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ : FRAME_HEADER_SZ;
+
+    for (j = 0; j < BENCH_FRAME_SZ; j++) {
+      frame[j] = rand();
+    }
+    bench_write_frame_tag(frame, keyframe, partSize);
+    if (keyframe) {
+      bench_write_keyframe_header(frame + FRAME_HEADER_SZ, 640, 480);
+    }
+    // a first partition starting with 0xff is not a valid bool-coded stream
+    if (frame[header] == 0xff) {
+      frame[header] = 0x7f;
+    }
+  }
+  total = (guint64) iterations * BENCH_FRAMES;
+
+  sum = 0;
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < BENCH_FRAMES; i++) {
+      gboolean keyframe = i % 30 == 0;
+      guint header = keyframe ? FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ : FRAME_HEADER_SZ;
+      sum += walk_reference(frames[i] + header, BENCH_FRAME_SZ / 2, keyframe);
+    }
+  }
+  bench_run_report(&run, "bool_decoder_reference", total, sum);
+
+  sum = 0;
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < BENCH_FRAMES; i++) {
+      gboolean keyframe = i % 30 == 0;
+      guint header = keyframe ? FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ : FRAME_HEADER_SZ;
+      sum += walk_word(frames[i] + header, BENCH_FRAME_SZ / 2, keyframe);
+    }
+  }
+  bench_run_report(&run, "bool_decoder_word", total, sum);
+
+  sum = 0;
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < BENCH_FRAMES; i++) {
+      FrameInfo frame;
+      memset(&frame, 0, sizeof(frame));
+      sum += vp8_parse_header(frames[i], BENCH_FRAME_SZ, &frame) + frame.refreshGoldenFrame;
+    }
+  }
+  bench_run_report(&run, "vp8_parse_header", total, sum);
+
+  g_free(frames);
+  return 0;
+}
@@ -0,0 +1,220 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "perf_counters.h"
+#include "vp8_parser.h"
+
+/**
+ *
+ * Synthetic VP8 frames, RTP packets and captures of the benchmarks and
+ * the load generator (not part of the inspector), and the report of the
+ * microbenchmarks.
+ *
+ * The packets carry 640x360 frames with a BENCH_PART_SZ bytes first
+ * partition: the first packet of a frame has the frame tag (and the
+ * keyframe header), the rest of the payload is left to the caller.
+ * Nothing is checked, the buffers must be big enough.
+ *
+ */
+
+enum
+{
+  BENCH_RTP_HEADER_SZ = 12 + 1,  /* RTP header, VP8 payload descriptor */
+  BENCH_PART_SZ = 16,
+  BENCH_WIDTH = 640,
+  BENCH_HEIGHT = 360,
+  BENCH_PACKET_SZ = 1200,
+  BENCH_PACKETS_PER_FRAME = 4,
+  BENCH_PCAP_HEADERS_SZ = 16 + 14 + 20 + 8  /* pcap record, Ethernet, IPv4, UDP */
+};
+
+/* A timed microbenchmark run, with --perfCounters (BENCH_PERF_COUNTERS_ENTRY) the hardware counters too */
+typedef struct
+{
+  gboolean perfCounters;
+  gint64 start;
+  PerfSample perfStart;
+} BenchRun;
+
+#ifdef INSPECTOR_NO_STATS
+#define BENCH_PERF_COUNTERS_ENTRY(run)
+#else
+#define BENCH_PERF_COUNTERS_ENTRY(run) \
+  { "perfCounters", 0, 0, G_OPTION_ARG_NONE, &(run).perfCounters, "Add the hardware counters per frame (perf_event_open)", NULL },
+#endif
+
+/* Frame tag: keyframe flag, version 0, shown, first partition size */
+static inline void
+bench_write_frame_tag (guint8 * out, gboolean keyframe, guint partSize)
+{
+  out[0] = (keyframe ? 0 : 1) | (1 << 4) | ((partSize & 0x7) << 5);
+  out[1] = partSize >> 3;
+  out[2] = partSize >> 11;
+}
+
+/* Keyframe start code and dimensions, without scaling */
+static inline void
+bench_write_keyframe_header (guint8 * out, guint width, guint height)
+{
+  out[0] = 0x9d;
+  out[1] = 0x01;
+  out[2] = 0x2a;
+  out[3] = width & 0xff;
+  out[4] = (width >> 8) & 0x3f;
+  out[5] = height & 0xff;
+  out[6] = (height >> 8) & 0x3f;
+}
+
+/* RTP header, the marker bit at the last packet of the frame, and VP8 payload descriptor, the S bit at the first one */
+static inline void
+bench_write_rtp_header (guint8 * p, guint8 payloadType, guint32 ssrc, guint16 seq, guint32 timestamp, gboolean first, gboolean last)
+{
+  p[0] = 0x80;
+  p[1] = (last ? 0x80 : 0x00) | payloadType;
+  p[2] = seq >> 8;
+  p[3] = seq & 0xff;
+  p[4] = timestamp >> 24;
+  p[5] = timestamp >> 16;
+  p[6] = timestamp >> 8;
+  p[7] = timestamp & 0xff;
+  p[8] = ssrc >> 24;
+  p[9] = ssrc >> 16;
+  p[10] = ssrc >> 8;
+  p[11] = ssrc & 0xff;
+  p[12] = first ? 0x10 : 0x00;
+}
+
+/* A VP8 RTP packet, with the frame tag when it is the first one of the frame. It returns the bytes written */
+static inline guint
+bench_write_vp8_packet (guint8 * p, guint8 payloadType, guint32 ssrc, guint16 seq, guint32 timestamp, gboolean first, gboolean last,
+  gboolean keyframe)
+{
+  guint len = BENCH_RTP_HEADER_SZ;
+
+  bench_write_rtp_header(p, payloadType, ssrc, seq, timestamp, first, last);
+  if (first) {
+    bench_write_frame_tag(p + len, keyframe, BENCH_PART_SZ);
+    len += FRAME_HEADER_SZ;
+    if (keyframe) {
+      bench_write_keyframe_header(p + len, BENCH_WIDTH, BENCH_HEIGHT);
+      len += KEYFRAME_HEADER_SZ;
+    }
+  }
+  return len;
+}
+
+/* xorshift32, the payloads of the synthetic captures */
+static inline guint32
+bench_random (guint32 * state)
+{
+  guint32 x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/* A pcap record with a VP8 RTP packet of BENCH_PACKET_SZ bytes, 127.0.0.1:50000 -> 127.0.0.1:55555 */
+static inline void
+bench_write_pcap_packet (FILE * fd, guint32 ssrc, guint16 seq, guint32 timestamp, guint part, gboolean keyframe, guint64 usec,
+  guint32 * random)
+{
+  guint8 p[BENCH_PCAP_HEADERS_SZ + BENCH_PACKET_SZ];
+  guint8 * rtp = p + BENCH_PCAP_HEADERS_SZ;
+  guint udpLen = 8 + BENCH_PACKET_SZ;
+  guint ipLen = 20 + udpLen;
+  guint captured = 14 + ipLen;
+  guint32 header[4] = { (guint32) (usec / G_USEC_PER_SEC), (guint32) (usec % G_USEC_PER_SEC), captured, captured };
+  guint8 network[] = {
+    0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 2, 0x08, 0x00, // ethernet, ethertype = IPv4
+    0x45, 0x00, ipLen >> 8, ipLen & 0xff, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00, // IPv4, DF, UDP
+    127, 0, 0, 1, 127, 0, 0, 1,
+    0xc3, 0x50, 0xd9, 0x03, udpLen >> 8, udpLen & 0xff, 0x00, 0x00, // 50000 -> 55555
+  };
+  guint i;
+
+  memset(p, 0, sizeof(p));
+  memcpy(p, header, sizeof(header));  /* little endian, like the file header */
+  memcpy(p + sizeof(header), network, sizeof(network));
+  for (i = 12; random && i + 4 <= BENCH_PACKET_SZ; i += 4) {
+    guint32 value = bench_random(random);
+    memcpy(rtp + i, &value, 4);
+  }
+  bench_write_vp8_packet(rtp, 96, ssrc, seq, timestamp, part == 0, part == BENCH_PACKETS_PER_FRAME - 1, keyframe);
+  fwrite(p, 1, sizeof(p), fd);
+}
+
+/**
+ *
+ * This function writes a synthetic capture: `frames` frames (a keyframe
+ * every `gop`) of the SSRCs firstSsrc to firstSsrc + ssrcs - 1, in turns,
+ * at 30 fps. The payloads are zeros, or pseudo-random with a `random`
+ * state (they compress about as badly as real VP8 data).
+ *
+ */
+static inline gboolean
+bench_write_capture (const gchar * path, guint32 firstSsrc, guint ssrcs, guint frames, guint gop, guint32 * random)
+{
+  guint8 fileHeader[] = {
+    0xd4, 0xc3, 0xb2, 0xa1, 0x02, 0x00, 0x04, 0x00, // magic, version 2.4
+    0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0x01, 0, 0, 0, // snaplen, linktype = ethernet
+  };
+  FILE * fd = fopen(path, "w");
+  guint frame, part, i;
+
+  if (!fd) {
+    return FALSE;
+  }
+  fwrite(fileHeader, 1, sizeof(fileHeader), fd);
+  for (frame = 0; frame < frames; frame++) {
+    for (i = 0; i < ssrcs; i++) {
+      for (part = 0; part < BENCH_PACKETS_PER_FRAME; part++) {
+        bench_write_pcap_packet(fd, firstSsrc + i, (guint16) (frame * BENCH_PACKETS_PER_FRAME + part), frame * 3000, part,
+          frame % gop == 0, (guint64) frame * 33333 + i * 100 + part * 10, random);
+      }
+    }
+  }
+  return fclose(fd) == 0;
+}
+
+static inline void
+bench_run_start (BenchRun * run)
+{
+#ifndef INSPECTOR_NO_STATS
+  if (run->perfCounters && !perf_counters_read(&run->perfStart)) {
+    fprintf(stderr, "Failed to open the performance counters (kernel.perf_event_paranoid?)\n");
+    exit(1);
+  }
+#endif
+  run->start = g_get_monotonic_time();
+}
+
+/* It prints the ns/frame since bench_run_start() and with --perfCounters the counters per frame (user space only) */
+static inline void
+bench_run_report (const BenchRun * run, const gchar * name, guint64 frames, gint64 sum)
+{
+  gdouble ns = (g_get_monotonic_time() - run->start) * 1000.0;
+#ifndef INSPECTOR_NO_STATS
+  PerfSample end;
+  guint i;
+#endif
+
+  printf("{ \"bench\": \"%s\", \"frames\": %" G_GUINT64_FORMAT ", \"ns/frame\": %.1f, \"frames/s\": %.0f, \"checksum\": %" G_GINT64_FORMAT,
+    name, frames, ns / frames, frames / (ns / 1e9), sum);
+#ifndef INSPECTOR_NO_STATS
+  if (run->perfCounters && perf_counters_read(&end)) {
+    for (i = 0; i < PERF_COUNTER_COUNT; i++) {
+      printf(", \"%s/frame\": %.2f", perf_counter_name(i), (end.value[i] - run->perfStart.value[i]) / (gdouble) frames);
+    }
+  }
+#endif
+  printf(" }\n");
+  fflush(stdout);
+}
+
+#endif
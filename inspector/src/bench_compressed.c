@@ -0,0 +1,262 @@
+/**
+ *
+ * Compressed capture benchmark.
+ *
+ * It compresses a capture (--file, or a synthetic one: Ethernet/IPv4/UDP,
+ * VP8 RTP with pseudo-random payloads, which compress about as badly as
+ * real VP8 data) with gzip, and zstd when built with it, and inspects it
+ * like `inspector --native --file` without output files:
+ *
+ *  - pcap: the uncompressed capture, memory-mapped (the baseline)
+ *  - decompress: the capture is decompressed to a file first, then inspected
+ *  - stream: the compressed capture is inspected while being decompressed
+ *
+ * It reports the seconds, frames/s and (decompressed) MB/s of each run.
+ * The files come from the page cache, so the decompress runs never wait
+ * for the disk: it is their best case.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef INSPECTOR_ZSTD
+#include <zstd.h>
+#endif
+
+#include "bench_common.h"
+#include "native_worker.h"
+#include "pcap_reader.h"
+
+enum
+{
+  BENCH_SSRCS = 2,
+  BENCH_IO_SZ = 1 << 18
+};
+
+static gchar * inputFile = NULL;
+static gint frames = 5000;
+static gint gop = 30;
+static gint level = 6;
+
+static GOptionEntry entries[] =
+{
+  { "file", 'f', 0, G_OPTION_ARG_STRING, &inputFile, "PCAP file to compress (default: a synthetic one)", "./sample.pcap" },
+  { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per SSRC of the synthetic capture", "5000" },
+  { "gop", 'g', 0, G_OPTION_ARG_INT, &gop, "Frames between keyframes", "30" },
+  { "level", 'l', 0, G_OPTION_ARG_INT, &level, "Compression level", "6" },
+  { NULL }
+};
+
+static gboolean
+bench_compress (const gchar * path, const gchar * compressedPath, guint compression)
+{
+  gchar * data;
+  gsize len;
+  gboolean res = FALSE;
+
+  if (!g_file_get_contents(path, &data, &len, NULL)) {
+    return FALSE;
+  }
+
+  if (compression == PCAP_COMPRESSION_GZIP) {
+    gchar mode[8];
+    gzFile gz;
+    g_snprintf(mode, sizeof(mode), "wb%d", CLAMP(level, 1, 9));
+    gz = gzopen(compressedPath, mode);
+    res = gz && gzwrite(gz, data, len) == (int) len;
+    res = gz && gzclose(gz) == Z_OK && res;
+  }
+#ifdef INSPECTOR_ZSTD
+  if (compression == PCAP_COMPRESSION_ZSTD) {
+    gsize bound = ZSTD_compressBound(len);
+    gchar * compressed = g_malloc(bound);
+    gsize compressedLen = ZSTD_compress(compressed, bound, data, len, level);
+    res = !ZSTD_isError(compressedLen) && g_file_set_contents(compressedPath, compressed, compressedLen, NULL);
+    g_free(compressed);
+  }
+#endif
+
+  g_free(data);
+  return res;
+}
+
+/* It decompresses the capture to a file, like gunzip or unzstd would */
+static gboolean
+bench_decompress (const gchar * compressedPath, const gchar * path, guint compression)
+{
+  guint8 * output = g_malloc(BENCH_IO_SZ);
+  FILE * out = fopen(path, "w");
+  gboolean res = out != NULL;
+
+  if (res && compression == PCAP_COMPRESSION_GZIP) {
+    gzFile gz = gzopen(compressedPath, "rb");
+    int len;
+    gzbuffer(gz, BENCH_IO_SZ);
+    while ((len = gzread(gz, output, BENCH_IO_SZ)) > 0) {
+      fwrite(output, 1, len, out);
+    }
+    res = len == 0;
+    gzclose(gz);
+  }
+#ifdef INSPECTOR_ZSTD
+  if (res && compression == PCAP_COMPRESSION_ZSTD) {
+    guint8 * input = g_malloc(BENCH_IO_SZ);
+    ZSTD_DStream * stream = ZSTD_createDStream();
+    FILE * in = fopen(compressedPath, "r");
+    gsize len;
+    ZSTD_initDStream(stream);
+    while (res && in && (len = fread(input, 1, BENCH_IO_SZ, in)) > 0) {
+      ZSTD_inBuffer inBuffer = { input, len, 0 };
+      while (res && inBuffer.pos < inBuffer.size) {
+        ZSTD_outBuffer outBuffer = { output, BENCH_IO_SZ, 0 };
+        res = !ZSTD_isError(ZSTD_decompressStream(stream, &outBuffer, &inBuffer));
+        fwrite(output, 1, outBuffer.pos, out);
+      }
+    }
+    if (in) {
+      fclose(in);
+    }
+    ZSTD_freeDStream(stream);
+    g_free(input);
+  }
+#endif
+
+  if (out && fclose(out) != 0) {
+    res = FALSE;
+  }
+  g_free(output);
+  return res;
+}
+
+/* It inspects the capture like run_native_file(), the frames are only counted */
+static guint64
+bench_inspect (const gchar * path, guint64 * readerWaits, guint64 * decoderWaits)
+{
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  PcapReader reader;
+  PcapPacket packet;
+  RtpPacket rtp;
+  NativeWorker worker;
+  guint64 inspected;
+
+  if (pcap_reader_open(&reader, path) != PCAP_OK) {
+    return 0;
+  }
+  native_worker_init(&worker, 0, &options);
+  reader.release = (PcapReleaseFunc) native_worker_detach;
+  reader.releaseData = &worker;
+  while (pcap_reader_next(&reader, &packet)) {
+    if (!rtp_packet_parse(packet.payload, packet.payloadLen, &rtp) || rtp.payloadType != options.payloadType) {
+      continue;
+    }
+    rtp.arrival = packet.timestamp;
+    native_worker_push(&worker, &rtp);
+  }
+  native_worker_flush(&worker);
+
+  inspected = worker.frames;
+  *readerWaits = reader.stream ? reader.stream->readerWaits : 0;
+  *decoderWaits = reader.stream ? reader.stream->decoderWaits : 0;
+  native_worker_clear(&worker);
+  pcap_reader_close(&reader);
+  return inspected;
+}
+
+static void
+bench_report (const gchar * format, const gchar * mode, guint64 bytes, guint64 compressed, guint64 inspected, gdouble seconds,
+  guint64 readerWaits, guint64 decoderWaits)
+{
+  printf("{ \"format\": \"%s\", \"mode\": \"%s\", \"bytes\": %" G_GUINT64_FORMAT ", \"compressed\": %" G_GUINT64_FORMAT ", \"frames\": %" G_GUINT64_FORMAT
+    ", \"seconds\": %.3f, \"frames/s\": %.0f, \"MB/s\": %.1f, \"reader waits\": %" G_GUINT64_FORMAT ", \"decoder waits\": %" G_GUINT64_FORMAT " }\n",
+    format, mode, bytes, compressed, inspected, seconds, inspected / seconds, bytes / seconds / 1e6, readerWaits, decoderWaits);
+  fflush(stdout);
+}
+
+static guint64
+bench_file_size (const gchar * path)
+{
+  struct stat st;
+  return stat(path, &st) == 0 ? (guint64) st.st_size : 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector compressed capture benchmark");
+  gchar folder[] = "/tmp/vp8-inspector-bench-XXXXXX";
+  guint compressions[] = { PCAP_COMPRESSION_GZIP, PCAP_COMPRESSION_ZSTD };
+  guint64 readerWaits, decoderWaits, inspected, bytes;
+  guint32 random = 2463534242u;
+  gchar * path;
+  gint64 start;
+  guint i;
+
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+  if (frames <= 0 || gop <= 0) {
+    fprintf(stderr, "Invalid frames or gop\n");
+    exit(1);
+  }
+  if (!mkdtemp(folder)) {
+    fprintf(stderr, "Failed to create the folder %s\n", folder);
+    exit(1);
+  }
+
+  path = inputFile ? g_strdup(inputFile) : g_build_filename(folder, "capture.pcap", NULL);
+  if (!inputFile && !bench_write_capture(path, 0x10000000, BENCH_SSRCS, (guint) frames, (guint) gop, &random)) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    exit(1);
+  }
+  bytes = bench_file_size(path);
+
+  /* a first run to load the file in the page cache */
+  bench_inspect(path, &readerWaits, &decoderWaits);
+  start = g_get_monotonic_time();
+  inspected = bench_inspect(path, &readerWaits, &decoderWaits);
+  bench_report("none", "pcap", bytes, bytes, inspected, (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC, 0, 0);
+
+  for (i = 0; i < G_N_ELEMENTS(compressions); i++) {
+    const gchar * format = pcap_compression_name(compressions[i]);
+    gchar * compressedPath = g_strdup_printf("%s/capture.pcap.%s", folder, compressions[i] == PCAP_COMPRESSION_GZIP ? "gz" : "zst");
+    gchar * decompressedPath = g_build_filename(folder, "decompressed.pcap", NULL);
+    guint64 compressed;
+
+    if (!bench_compress(path, compressedPath, compressions[i])) {
+      fprintf(stderr, "Skipping %s, not available\n", format);
+      g_free(compressedPath);
+      g_free(decompressedPath);
+      continue;
+    }
+    compressed = bench_file_size(compressedPath);
+
+    start = g_get_monotonic_time();
+    inspected = bench_decompress(compressedPath, decompressedPath, compressions[i]) ? bench_inspect(decompressedPath, &readerWaits, &decoderWaits) : 0;
+    bench_report(format, "decompress", bytes, compressed, inspected, (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC, 0, 0);
+    unlink(decompressedPath);
+
+    start = g_get_monotonic_time();
+    inspected = bench_inspect(compressedPath, &readerWaits, &decoderWaits);
+    bench_report(format, "stream", bytes, compressed, inspected, (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC, readerWaits, decoderWaits);
+    unlink(compressedPath);
+
+    g_free(compressedPath);
+    g_free(decompressedPath);
+  }
+
+  if (!inputFile) {
+    unlink(path);
+  }
+  rmdir(folder);
+  g_free(path);
+  return 0;
+}
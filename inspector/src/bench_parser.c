@@ -0,0 +1,336 @@
+/**
+ *
+ * Parser microbenchmark (make bench).
+ *
+ * It builds a synthetic corpus of VP8 frames with the bool encoder: a
+ * keyframe every --gop frames and interframes in between, with random
+ * segmentation (map and feature data), loop filter deltas, quantizer
+ * indices and deltas, DCT partitions, reference flags and probability
+ * updates, so every optional branch of the header parser is taken.
+ *
+ * Then it reports the ns/frame and frames/s of the frame tag parse
+ * (vp8_parse_frame_header()), of the header parse up to the reference flags
+ * (vp8_parse_header()) and to the end of the header, and of the whole
+ * inspect_frame_info() path (prefix and partition table copy, parse, and
+ * a result callback instead of the output writer), one JSON object per line.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_common.h"
+#include "bool_encoder.h"
+#include "stream_inspector.h"
+#include "vp8_parser.h"
+#include "vp8_tables.h"
+
+enum
+{
+  BENCH_MAX_FRAME_SZ = 16384,
+  BENCH_MAX_PARTITION_SZ = 1500
+};
+
+typedef struct
+{
+  guint8 * data;
+  guint len;
+  gboolean keyframe;
+} BenchFrame;
+
+typedef struct
+{
+  guint keyframes;
+  guint segmentation;
+  guint loopFilterDeltas;
+  guint quantizerDeltas;
+  guint64 bytes;
+} BenchCorpus;
+
+static gint iterations = 200;
+static gint corpusFrames = 2048;
+static gint gop = 30;
+static gint seed = 42;
+
+static BenchRun run;
+
+static GOptionEntry entries[] =
+{
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Passes over the corpus", "200" },
+  { "frames", 0, 0, G_OPTION_ARG_INT, &corpusFrames, "Frames in the synthetic corpus", "2048" },
+  { "gop", 0, 0, G_OPTION_ARG_INT, &gop, "A keyframe every N frames", "30" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed of the synthetic corpus", "42" },
+  BENCH_PERF_COUNTERS_ENTRY(run)
+  { NULL }
+};
+
+static inline gboolean
+bench_chance (guint percent)
+{
+  return (guint) (rand() % 100) < percent;
+}
+
+static inline gint
+bench_signed (guint bits)
+{
+  gint value = rand() % (1 << bits);
+  return rand() % 2 ? -value : value;
+}
+
+static void
+bench_put_maybe_delta (struct bool_encoder * e, guint percent, guint bits)
+{
+  bool_put_maybe_int(e, bench_chance(percent) ? bench_signed(bits) : 0, bits);
+}
+
+/* It writes a frame with random header settings and returns its size */
+static guint
+bench_write_frame (guint8 * out, gboolean keyframe, BenchCorpus * corpus)
+{
+  struct bool_encoder e;
+  guint header = keyframe ? FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ : FRAME_HEADER_SZ;
+  guint i, j, k, l, partitions;
+
+  init_bool_encoder(&e, out + header);
+  if (keyframe) {
+    bool_put_uint(&e, 0, 2); // color_space, clamping_type
+  }
+
+  gboolean segmentation = bench_chance(keyframe ? 40 : 20);
+  bool_put_bit(&e, segmentation); // segmentation_enabled
+  if (segmentation) {
+    gboolean updateMap = keyframe || bench_chance(30);
+    gboolean updateData = keyframe || bench_chance(30);
+    bool_put_bit(&e, updateMap);
+    bool_put_bit(&e, updateData);
+    if (updateData) {
+      bool_put_bit(&e, rand() % 2); // segment_feature_mode
+      for (i = 0; i < MAX_MB_SEGMENTS; i++) bench_put_maybe_delta(&e, 70, 7);
+      for (i = 0; i < MAX_MB_SEGMENTS; i++) bench_put_maybe_delta(&e, 50, 6);
+    }
+    if (updateMap) {
+      for (i = 0; i < MB_FEATURE_TREE_PROBS; i++) {
+        gboolean update = bench_chance(70);
+        bool_put_bit(&e, update);
+        if (update) bool_put_uint(&e, rand() % 256, 8);
+      }
+    }
+    corpus->segmentation++;
+  }
+
+  bool_put_bit(&e, rand() % 2); // filter_type
+  bool_put_uint(&e, rand() % 64, 6); // loop_filter_level
+  bool_put_uint(&e, rand() % 8, 3); // sharpness_level
+  gboolean deltas = bench_chance(60);
+  bool_put_bit(&e, deltas); // loop_filter_adj_enable
+  if (deltas) {
+    gboolean update = keyframe || bench_chance(20);
+    bool_put_bit(&e, update); // mode_ref_lf_delta_update
+    if (update) {
+      for (i = 0; i < BLOCK_CONTEXTS; i++) bench_put_maybe_delta(&e, 60, 6);
+      for (i = 0; i < BLOCK_CONTEXTS; i++) bench_put_maybe_delta(&e, 60, 6);
+      corpus->loopFilterDeltas++;
+    }
+  }
+
+  guint log2Partitions = rand() % 4;
+  partitions = 1 << log2Partitions;
+  bool_put_uint(&e, log2Partitions, 2);
+  bool_put_uint(&e, rand() % 128, 7); // y_ac_qi
+  gboolean quantizerDeltas = bench_chance(30);
+  for (i = 0; i < 5; i++) bench_put_maybe_delta(&e, quantizerDeltas ? 50 : 0, 4);
+  corpus->quantizerDeltas += quantizerDeltas;
+
+  if (!keyframe) {
+    gboolean refreshGolden = bench_chance(10);
+    gboolean refreshAltref = bench_chance(10);
+    bool_put_bit(&e, refreshGolden);
+    bool_put_bit(&e, refreshAltref);
+    if (!refreshGolden) bool_put_uint(&e, rand() % 3, 2); // copy_buffer_to_golden
+    if (!refreshAltref) bool_put_uint(&e, rand() % 3, 2); // copy_buffer_to_alternate
+    bool_put_bit(&e, rand() % 2); // sign_bias_golden
+    bool_put_bit(&e, rand() % 2); // sign_bias_alternate
+  }
+  bool_put_bit(&e, bench_chance(20)); // refresh_entropy_probs
+  if (!keyframe) {
+    bool_put_bit(&e, bench_chance(90)); // refresh_last
+  }
+
+  for (i = 0; i < BLOCK_TYPES; i++)
+    for (j = 0; j < COEF_BANDS; j++)
+      for (k = 0; k < PREV_COEF_CONTEXTS; k++)
+        for (l = 0; l < ENTROPY_NODES; l++) {
+          gboolean update = bench_chance(keyframe ? 10 : 2);
+          bool_put(&e, coeff_update_probs[i][j][k][l], update);
+          if (update) bool_put_uint(&e, rand() % 256, 8);
+        }
+
+  gboolean skip = bench_chance(80);
+  bool_put_bit(&e, skip); // mb_no_coeff_skip
+  if (skip) bool_put_uint(&e, rand() % 256, 8); // prob_skip_false
+  if (!keyframe) {
+    bool_put_uint(&e, rand() % 256, 8); // prob_intra
+    bool_put_uint(&e, rand() % 256, 8); // prob_last
+    bool_put_uint(&e, rand() % 256, 8); // prob_gf
+    gboolean intra = bench_chance(10);
+    bool_put_bit(&e, intra);
+    if (intra) for (i = 0; i < INTRA_16X16_PROBS; i++) bool_put_uint(&e, rand() % 256, 8);
+    intra = bench_chance(10);
+    bool_put_bit(&e, intra);
+    if (intra) for (i = 0; i < INTRA_CHROMA_PROBS; i++) bool_put_uint(&e, rand() % 256, 8);
+    for (i = 0; i < MV_COMPONENTS; i++)
+      for (j = 0; j < MV_PROB_COUNT; j++) {
+        gboolean update = bench_chance(5);
+        bool_put(&e, mv_update_probs[i][j], update);
+        if (update) bool_put_uint(&e, rand() % 128, 7);
+      }
+  }
+
+  /* the first partition would carry the macroblock headers, a few random bytes stand for them */
+  guint partSize = bool_flush_encoder(&e);
+  guint offset = header + partSize;
+  for (i = 0; i < 16; i++) out[offset++] = rand();
+  partSize += 16;
+  if (keyframe) {
+    bench_write_keyframe_header(out + FRAME_HEADER_SZ, 640, 480);
+    corpus->keyframes++;
+  }
+  bench_write_frame_tag(out, keyframe, partSize);
+
+  guint sizes[8];
+  for (i = 0; i < partitions; i++) {
+    sizes[i] = 50 + rand() % (keyframe ? BENCH_MAX_PARTITION_SZ : BENCH_MAX_PARTITION_SZ / 4);
+  }
+  for (i = 0; i + 1 < partitions; i++, offset += PARTITION_SIZE_SZ) {
+    out[offset] = sizes[i];
+    out[offset + 1] = sizes[i] >> 8;
+    out[offset + 2] = sizes[i] >> 16;
+  }
+  for (i = 0; i < partitions; i++) {
+    memset(out + offset, rand(), sizes[i]);
+    offset += sizes[i];
+  }
+
+  corpus->bytes += offset;
+  return offset;
+}
+
+static void
+bench_on_frame (guint32 ssrc, const FrameInfo * ctx, gpointer userData)
+{
+  *(guint64 *) userData += ctx->ok + ctx->partitions;
+}
+
+/* The way the native engine hands a frame to inspect_frame_info() */
+static void
+bench_inspect (StreamInspector * streamInspector, const BenchFrame * frame, guint64 pts)
+{
+  guint8 prefix[FRAME_HEADER_FULL_PREFIX_SZ];
+  guint8 table[PARTITION_TABLE_SZ];
+  guint available = MIN(frame->len, vp8_header_prefix_size(streamInspector->parseDepth));
+  guint tableOffset, tableAvailable;
+
+  memcpy(prefix, frame->data, available);
+  tableOffset = vp8_partition_table_offset(prefix, available);
+  tableAvailable = tableOffset < frame->len ? MIN(frame->len - tableOffset, sizeof(table)) : 0;
+  memcpy(table, frame->data + tableOffset, tableAvailable);
+  inspect_frame_info(streamInspector, prefix, available, table, tableAvailable, frame->len, pts, 0);
+}
+
+static void
+bench_inspect_frame_info (const BenchFrame * frames, guint parseDepth, const gchar * name)
+{
+  OutputSettings output;
+  guint64 sum = 0;
+  gint it, i;
+
+  memset(&output, 0, sizeof(output));
+  output.callback = bench_on_frame;
+  output.userData = &sum;
+  StreamInspector * streamInspector = stream_inspector_initialize("recv_rtp_src_0_1_96", parseDepth, &output);
+
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < corpusFrames; i++) {
+      bench_inspect(streamInspector, &frames[i], (guint64) i * FRAME_PTS_MSECOND);
+    }
+  }
+  bench_run_report(&run, name, (guint64) iterations * corpusFrames, sum);
+  stream_inspector_destroy(streamInspector);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector parser benchmark");
+  BenchCorpus corpus;
+  BenchFrame * frames;
+  guint8 * buffer;
+  guint64 sum;
+  gint it, i;
+
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error) || iterations < 1 || corpusFrames < 1 || gop < 1) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+
+  memset(&corpus, 0, sizeof(corpus));
+  frames = g_new0(BenchFrame, corpusFrames);
+  buffer = g_malloc0(BENCH_MAX_FRAME_SZ);
+  srand(seed);
+  for (i = 0; i < corpusFrames; i++) {
+    frames[i].keyframe = i % gop == 0;
+    frames[i].len = bench_write_frame(buffer, frames[i].keyframe, &corpus);
+    frames[i].data = g_malloc(frames[i].len);
+    memcpy(frames[i].data, buffer, frames[i].len);
+  }
+  printf("{ \"corpus\": \"synthetic\", \"frames\": %i, \"keyframes\": %u, \"segmentation\": %u, \"loopFilterDeltas\": %u, "
+    "\"quantizerDeltas\": %u, \"bytes/frame\": %.0f, \"seed\": %i }\n", corpusFrames, corpus.keyframes, corpus.segmentation,
+    corpus.loopFilterDeltas, corpus.quantizerDeltas, corpus.bytes / (gdouble) corpusFrames, seed);
+
+  sum = 0;
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < corpusFrames; i++) {
+      FrameInfo frame;
+      memset(&frame, 0, sizeof(frame));
+      sum += vp8_parse_frame_header(frames[i].data, frames[i].len, &frame) + frame.keyframe;
+    }
+  }
+  bench_run_report(&run, "vp8_parse_frame_header", (guint64) iterations * corpusFrames, sum);
+
+  sum = 0;
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < corpusFrames; i++) {
+      FrameInfo frame;
+      memset(&frame, 0, sizeof(frame));
+      sum += vp8_parse_header(frames[i].data, frames[i].len, &frame) + frame.refreshGoldenFrame;
+    }
+  }
+  bench_run_report(&run, "vp8_parse_header", (guint64) iterations * corpusFrames, sum);
+
+  sum = 0;
+  bench_run_start(&run);
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < corpusFrames; i++) {
+      FrameInfo frame;
+      memset(&frame, 0, sizeof(frame));
+      sum += vp8_parse_header_prefix(frames[i].data, frames[i].len, frames[i].len, VP8_PARSE_DEPTH_FULL, &frame) + frame.probs.coeffUpdates;
+    }
+  }
+  bench_run_report(&run, "vp8_parse_header_full", (guint64) iterations * corpusFrames, sum);
+
+  bench_inspect_frame_info(frames, VP8_PARSE_DEPTH_REFERENCE, "inspect_frame_info");
+  bench_inspect_frame_info(frames, VP8_PARSE_DEPTH_FULL, "inspect_frame_info_full");
+
+  for (i = 0; i < corpusFrames; i++) {
+    g_free(frames[i].data);
+  }
+  g_free(frames);
+  g_free(buffer);
+  return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ *
+ * Native engine SSRC scaling benchmark.
+ *
+ * For 100, 1000 and 10000 SSRCs (or --ssrcs), it pushes a synthetic load of
+ * VP8 RTP packets to a single NativeWorker, in batches that reuse the same
+ * buffers like the UDP receiver does. The packets of the SSRCs are interleaved,
+ * so every stream has an incomplete frame at the end of each batch and is
+ * detached, the worst case for the per-stream state.
+ *
+ * It reports the heap memory per stream (mallinfo2(), after the first packet
+ * of every SSRC) and how many packets/s and frames/s the worker inspected.
+ * By default the results go to a callback that only counts them, with
+ * --outputPath each stream also has its output file.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "bench_common.h"
+#include "native_worker.h"
+
+enum
+{
+  BENCH_BATCH_SZ = 64
+};
+
+static gint ssrcs = 0;
+static gint packets = 4000000;
+static gchar * outputPath = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "ssrcs", 's', 0, G_OPTION_ARG_INT, &ssrcs, "Number of synthetic SSRCs (default: 100, 1000 and 10000)", "10000" },
+  { "packets", 'n', 0, G_OPTION_ARG_INT, &packets, "Packets pushed in each run", "4000000" },
+  { "outputPath", 'o', 0, G_OPTION_ARG_STRING, &outputPath, "Write the results to this folder too", "/tmp" },
+  { NULL }
+};
+
+static void
+bench_count_frame (guint32 ssrc, const FrameInfo * frame, gpointer userData)
+{
+  (*(guint64 *) userData)++;
+}
+
+/* The n-th packet of the load: the SSRCs take turns, one packet each */
+static void
+bench_write_packet (guint8 * p, guint64 n, guint numSsrcs)
+{
+  guint index = n % numSsrcs;
+  guint64 round = n / numSsrcs;
+  guint part = round % BENCH_PACKETS_PER_FRAME;
+  guint32 ssrc = 0x10000000 + index;
+  guint16 seq = (guint16) round;
+  guint32 timestamp = (guint32) (round / BENCH_PACKETS_PER_FRAME) * 3000;
+
+  bench_write_vp8_packet(p, 96, ssrc, seq, timestamp, part == 0, part == BENCH_PACKETS_PER_FRAME - 1, TRUE);
+  if (part != 0) {
+    memset(p + BENCH_RTP_HEADER_SZ, 0, FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ);
+  }
+}
+
+static glong
+bench_rss_kb (void)
+{
+  glong size = 0, resident = 0;
+  FILE * f = fopen("/proc/self/statm", "r");
+
+  if (f) {
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(f);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void
+bench_push (NativeWorker * worker, guint8 (*buffers)[BENCH_PACKET_SZ], UdpPacket * batch, guint64 from, guint64 count, guint numSsrcs)
+{
+  guint64 n = from;
+  guint i;
+
+  while (n < from + count) {
+    guint len = MIN(BENCH_BATCH_SZ, from + count - n);
+    for (i = 0; i < len; i++, n++) {
+      bench_write_packet(buffers[i], n, numSsrcs);
+    }
+    native_worker_push_batch(worker, batch, len, 0);
+  }
+}
+
+static void
+bench_run (guint numSsrcs)
+{
+  volatile sig_atomic_t closing = 0;
+  guint64 frames = 0;
+  OutputSettings output = { outputPath, FALSE, OUTPUT_FORMAT_BINARY, NULL, outputPath ? NULL : bench_count_frame, &frames };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  guint8 (*buffers)[BENCH_PACKET_SZ] = g_malloc0(BENCH_BATCH_SZ * BENCH_PACKET_SZ);
+  UdpPacket batch[BENCH_BATCH_SZ];
+  NativeWorker worker;
+  guint i;
+
+  for (i = 0; i < BENCH_BATCH_SZ; i++) {
+    batch[i].data = buffers[i];
+    batch[i].len = BENCH_PACKET_SZ;
+    batch[i].timestamp = 1;
+  }
+
+  native_worker_init(&worker, 0, &options);
+
+  /* the first packet of every SSRC creates its stream */
+  glong rssBefore = bench_rss_kb();
+  size_t heapBefore = mallinfo2().uordblks;
+  bench_push(&worker, buffers, batch, 0, numSsrcs, numSsrcs);
+  size_t heapAfter = mallinfo2().uordblks;
+  glong rssAfter = bench_rss_kb();
+
+  guint64 count = MAX((guint64) packets, numSsrcs * BENCH_PACKETS_PER_FRAME);
+  guint64 framesBefore = worker.frames;
+  gint64 start = g_get_monotonic_time();
+  bench_push(&worker, buffers, batch, numSsrcs, count, numSsrcs);
+  gdouble seconds = (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC;
+
+  printf("{ \"ssrcs\": %u, \"heapBytes/stream\": %.0f, \"rssBytes/stream\": %.0f, \"packets/s\": %.0f, \"frames/s\": %.0f }\n",
+    numSsrcs, (heapAfter - heapBefore) / (gdouble) numSsrcs, (rssAfter - rssBefore) * 1024 / (gdouble) numSsrcs,
+    count / seconds, (worker.frames - framesBefore) / seconds);
+  fflush(stdout);
+
+  native_worker_clear(&worker);
+  g_free(buffers);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector SSRC scaling benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+
+  if (outputPath) {
+    /* one output file per stream */
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
+    }
+  }
+
+  if (ssrcs > 0) {
+    bench_run(ssrcs);
+  } else {
+    bench_run(100);
+    bench_run(1000);
+    bench_run(10000);
+  }
+  return 0;
+}
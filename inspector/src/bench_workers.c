@@ -0,0 +1,204 @@
+/**
+ *
+ * Native realtime workers scaling benchmark.
+ *
+ * For 1 to N workers, it binds the workers sockets to a local port (like
+ * `inspector --native --workers N`) and sends a synthetic load of VP8 RTP
+ * packets from many SSRCs to it, as fast as possible, for a few seconds.
+ * Then it reports how many packets/s and frames/s the workers inspected
+ * and how many packets the kernel dropped.
+ *
+ * NOTE: the senders run in the same machine, so they compete with the
+ * workers for CPU. Use the results to compare the scaling, not as the
+ * absolute capacity of the inspector.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+#include "native_worker.h"
+
+enum
+{
+  BENCH_BASE_PORT = 47000,
+  BENCH_SEND_BATCH_SZ = 64
+};
+
+static gint maxWorkers = 0;
+static gint ssrcs = 256;
+static gint seconds = 2;
+static gint senders = 0;
+
+static GOptionEntry entries[] =
+{
+  { "maxWorkers", 'w', 0, G_OPTION_ARG_INT, &maxWorkers, "Run with 1 to maxWorkers workers (default: number of CPUs)", "8" },
+  { "ssrcs", 's', 0, G_OPTION_ARG_INT, &ssrcs, "Number of synthetic SSRCs", "256" },
+  { "seconds", 'd', 0, G_OPTION_ARG_INT, &seconds, "Duration of each run", "2" },
+  { "senders", 0, 0, G_OPTION_ARG_INT, &senders, "Sender threads (default: same as workers)", "1" },
+  { NULL }
+};
+
+typedef struct
+{
+  guint id;
+  guint port;
+  guint numSsrcs;
+  volatile sig_atomic_t * closing;
+  guint64 sent;
+} BenchSender;
+
+/**
+ *
+ * Each sender owns ssrcs/senders SSRCs and sends frames of BENCH_PACKETS_PER_FRAME
+ * packets round robin between them. The first packet of each frame has a
+ * keyframe header, so the workers really parse the frames.
+ *
+ */
+static gpointer
+bench_sender_run (gpointer data)
+{
+  BenchSender * sender = (BenchSender *) data;
+  guint8 (*packets)[BENCH_PACKET_SZ] = g_malloc0(BENCH_SEND_BATCH_SZ * BENCH_PACKET_SZ);
+  struct mmsghdr messages[BENCH_SEND_BATCH_SZ];
+  struct iovec iovecs[BENCH_SEND_BATCH_SZ];
+  struct sockaddr_in address;
+  guint numSsrcs = sender->numSsrcs;
+  guint16 * seqs = g_new0(guint16, numSsrcs);
+  guint32 * timestamps = g_new0(guint32, numSsrcs);
+  guint packet = 0, i;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(sender->port);
+
+  memset(messages, 0, sizeof(messages));
+  for (i = 0; i < BENCH_SEND_BATCH_SZ; i++) {
+    iovecs[i].iov_base = packets[i];
+    iovecs[i].iov_len = BENCH_PACKET_SZ;
+    messages[i].msg_hdr.msg_iov = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+    messages[i].msg_hdr.msg_name = &address;
+    messages[i].msg_hdr.msg_namelen = sizeof(address);
+  }
+
+  while (!*sender->closing) {
+    for (i = 0; i < BENCH_SEND_BATCH_SZ; i++, packet++) {
+      guint index = (packet / BENCH_PACKETS_PER_FRAME) % numSsrcs;
+      guint part = packet % BENCH_PACKETS_PER_FRAME;
+      guint32 ssrc = 0x10000000 + sender->id * numSsrcs + index;
+      guint16 seq = seqs[index]++;
+
+      if (part == 0) {
+        timestamps[index] += 3000;
+      }
+      bench_write_vp8_packet(packets[i], 96, ssrc, seq, timestamps[index], part == 0, part == BENCH_PACKETS_PER_FRAME - 1, TRUE);
+    }
+
+    int res = sendmmsg(fd, messages, BENCH_SEND_BATCH_SZ, 0);
+    if (res > 0) {
+      sender->sent += res;
+    }
+  }
+
+  close(fd);
+  g_free(seqs);
+  g_free(timestamps);
+  g_free(packets);
+  return NULL;
+}
+
+static void
+bench_run (guint numWorkers, guint port)
+{
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  NativeWorker * workers = g_new0(NativeWorker, numWorkers);
+  guint numSenders = senders > 0 ? senders : numWorkers;
+  BenchSender * benchSenders = g_new0(BenchSender, numSenders);
+  GThread ** senderThreads = g_new0(GThread *, numSenders);
+  guint numCpus = g_get_num_processors();
+  guint64 packets = 0, frames = 0, sent = 0, drops = 0;
+  guint i;
+
+  for (i = 0; i < numWorkers; i++) {
+    native_worker_init(&workers[i], i, &options);
+    workers[i].cpu = numWorkers > 1 ? (gint) (i % numCpus) : -1;
+    if (udp_receiver_open(&workers[i].receiver, port, UDP_RECEIVER_DEFAULT_BATCH_SZ, FALSE, numWorkers > 1) != UDP_RECEIVER_OK) {
+      fprintf(stderr, "Failed to listen to port %u\n", port);
+      exit(1);
+    }
+  }
+  if (numWorkers > 1) {
+    udp_receiver_steer_by_ssrc(&workers[0].receiver, numWorkers);
+  }
+
+  for (i = 0; i < numWorkers; i++) {
+    workers[i].thread = g_thread_new("bench-worker", native_worker_run, &workers[i]);
+  }
+
+  for (i = 0; i < numSenders; i++) {
+    benchSenders[i].id = i;
+    benchSenders[i].port = port;
+    benchSenders[i].numSsrcs = MAX(1, ssrcs / numSenders);
+    benchSenders[i].closing = &closing;
+    senderThreads[i] = g_thread_new("bench-sender", bench_sender_run, &benchSenders[i]);
+  }
+
+  g_usleep(seconds * G_USEC_PER_SEC);
+  closing = 1;
+
+  for (i = 0; i < numSenders; i++) {
+    g_thread_join(senderThreads[i]);
+    sent += benchSenders[i].sent;
+  }
+
+  for (i = 0; i < numWorkers; i++) {
+    g_thread_join(workers[i].thread);
+    packets += workers[i].packets;
+    frames += workers[i].frames;
+    drops += workers[i].receiver.kernelDrops;
+    native_worker_clear(&workers[i]);
+  }
+
+  printf("{ \"workers\": %u, \"senders\": %u, \"ssrcs\": %i, \"sentPackets/s\": %.0f, \"packets/s\": %.0f, \"frames/s\": %.0f, \"kernelDrops\": %" G_GUINT64_FORMAT " }\n",
+    numWorkers, numSenders, ssrcs, sent / (gdouble) seconds, packets / (gdouble) seconds, frames / (gdouble) seconds, drops);
+  fflush(stdout);
+
+  g_free(senderThreads);
+  g_free(benchSenders);
+  g_free(workers);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector workers benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+
+  if (maxWorkers <= 0) {
+    maxWorkers = g_get_num_processors();
+  }
+  maxWorkers = MIN(maxWorkers, NATIVE_MAX_WORKERS);
+
+  for (gint workers = 1; workers <= maxWorkers; workers++) {
+    /* a new port for each run, so the previous SO_REUSEPORT group is gone */
+    bench_run(workers, BENCH_BASE_PORT + workers);
+  }
+  return 0;
+}
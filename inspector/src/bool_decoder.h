@@ -11,90 +11,182 @@
 #ifndef BOOL_DECODER_H
 #define BOOL_DECODER_H
 #include <stddef.h>
+#include <limits.h>
+
+#include "bool_decoder_reference.h"
+
+/*
+ * Word-at-a-time bool decoder (like libvpx dboolhuff).
+ *
+ * The value is a machine word window whose top 8 bits are compared with
+ * the split. It is refilled with as many whole bytes as fit at once, and
+ * the renormalization after each bool is a single shift looked up in
+ * bool_norm[] instead of a one bit loop.
+ *
+ * It is bit-exact with the reference decoder (bool_decoder_reference.h):
+ * after the end of the input, zeros are shifted in, and a partition with
+ * less than 2 bytes is read as an empty one. It never reads past
+ * start_partition + sz.
+ *
+ * A partition starting with 0xff is not a valid bool-coded stream (the
+ * value is not below the range) and the reference decoder results depend
+ * on its 32 bits value overflowing. Those corrupt partitions are simply
+ * decoded by the reference decoder.
+ */
+
+typedef size_t bool_value;
+
+#define BOOL_VALUE_SIZE ((int) sizeof(bool_value) * CHAR_BIT)
+
+/* added to count when the input is over, so we never try to refill again */
+#define BOOL_LOTS_OF_BITS 0x40000000
 
 struct bool_decoder
 {
     const unsigned char *input;      /* next compressed data byte */
-    size_t               input_len;  /* length of the input buffer */
+    const unsigned char *input_end;  /* end of the input buffer */
+    bool_value           value;      /* window, the top 8 bits are
+                                      * compared with the split */
+    int                  count;      /* # of valid bits in value
+                                      * after the top 8 bits */
     unsigned int         range;      /* identical to encoder's
                                       * range */
-    unsigned int         value;      /* contains at least 8
-                                      * significant bits */
-    int                  bit_count;  /* # of bits shifted out of
-                                      * value, max 7 */
+    int                  corrupt;    /* decoded by the reference
+                                      * decoder */
+    struct ref_bool_decoder reference;
+};
+
+/* number of left shifts needed to bring range back to [128, 255] */
+static const unsigned char bool_norm[256] =
+{
+    0, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
 
+static bool_value
+bool_load_be(const unsigned char *p)
+{
+    bool_value v = 0;
+    size_t     i;
+
+    /* compilers turn this into a single (byte swapped) load */
+    for (i = 0; i < sizeof(bool_value); i++)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+
 static void
-init_bool_decoder(struct bool_decoder *d,
-                  const unsigned char *start_partition,
-                  size_t               sz)
+bool_fill(struct bool_decoder *d)
 {
-    if (sz >= 2)
+    /* position of the next byte: right below the valid bits */
+    int    shift = BOOL_VALUE_SIZE - CHAR_BIT - (d->count + CHAR_BIT);
+    size_t bytes_left = d->input_end - d->input;
+
+    if (bytes_left >= sizeof(bool_value))
     {
-        d->value = (start_partition[0] << 8) /* first 2 input
-                                              * bytes */
-                   | start_partition[1];
-        d->input = start_partition + 2;      /* ptr to next byte */
-        d->input_len = sz - 2;
+        /* whole bytes that fit in the window, all from a single load */
+        int bytes = (shift >> 3) + 1;
+        int bits = bytes * CHAR_BIT;
+
+        d->value |= (bool_load_be(d->input) >> (BOOL_VALUE_SIZE - bits))
+                    << (shift + CHAR_BIT - bits);
+        d->input += bytes;
+        d->count += bits;
+        return;
     }
-    else
+
+    while (shift >= 0 && d->input < d->input_end)
     {
-        d->value = 0;
-        d->input = NULL;
-        d->input_len = 0;
+        d->value |= (bool_value) *d->input++ << shift;
+        d->count += CHAR_BIT;
+        shift -= CHAR_BIT;
     }
 
+    if (d->input == d->input_end)
+        d->count += BOOL_LOTS_OF_BITS;
+}
+
+
+static void
+init_bool_decoder(struct bool_decoder *d,
+                  const unsigned char *start_partition,
+                  size_t               sz)
+{
+    /* like the reference decoder, less than 2 bytes is an empty partition */
+    d->input = start_partition;
+    d->input_end = sz >= 2 ? start_partition + sz : start_partition;
+    d->value = 0;
+    d->count = -CHAR_BIT;
     d->range = 255;    /* initial range is full */
-    d->bit_count = 0;  /* have not yet shifted out any bits */
+    d->corrupt = sz >= 2 && start_partition[0] == 0xff;
+
+    if (d->corrupt)
+        ref_init_bool_decoder(&d->reference, start_partition, sz);
+    else
+        bool_fill(d);
 }
 
 
-static int bool_get(struct bool_decoder *d, int probability)
+static inline int bool_get(struct bool_decoder *d, int probability)
 {
     /* range and split are identical to the corresponding values
        used by the encoder when this bool was written */
 
     unsigned int  split = 1 + (((d->range - 1) * probability) >> 8);
-    unsigned int  SPLIT = split << 8;
+    bool_value    bigsplit;
+    unsigned int  shift;
     int           retval;           /* will be 0 or 1 */
 
-    if (d->value >= SPLIT)    /* encoded a one */
-    {
-        retval = 1;
-        d->range -= split;  /* reduce range */
-        d->value -= SPLIT;  /* subtract off left endpoint of
-                             * interval */
-    }
-    else                  /* encoded a zero */
-    {
-        retval = 0;
-        d->range = split; /* reduce range, no change in left
-                           * endpoint */
-    }
+    if (__builtin_expect(d->corrupt, 0))
+        return ref_bool_get(&d->reference, probability);
 
-    while (d->range < 128)    /* shift out irrelevant value bits */
-    {
-        d->value <<= 1;
-        d->range <<= 1;
-
-        if (++d->bit_count == 8)  /* shift in new bits 8 at a time */
-        {
-            d->bit_count = 0;
-
-            if (d->input_len)
-            {
-                d->value |= *d->input++;
-                d->input_len--;
-            }
-        }
-    }
+    if (d->count < 0)
+        bool_fill(d);
+
+    bigsplit = (bool_value) split << (BOOL_VALUE_SIZE - CHAR_BIT);
+
+    /* branchless: the decoded bools are hard to predict */
+    retval = d->value >= bigsplit;
+    d->range = retval ? d->range - split : split;
+    d->value -= bigsplit & -(bool_value) retval;
+
+    shift = bool_norm[d->range];
+    d->range <<= shift;
+    d->value <<= shift;
+    d->count -= shift;
 
     return retval;
 }
 
 
-static int bool_get_bit(struct bool_decoder *br)
+/* true when bits after the end of the input were already shifted in */
+static int bool_overrun(const struct bool_decoder *d)
+{
+    if (d->corrupt)
+        return d->reference.input_len == 0;
+
+    return d->count >= BOOL_LOTS_OF_BITS / 2 && d->count - BOOL_LOTS_OF_BITS < 0;
+}
+
+
+static inline int bool_get_bit(struct bool_decoder *br)
 {
     return bool_get(br, 128);
 }
@@ -0,0 +1,125 @@
+#ifndef BOOL_ENCODER_H
+#define BOOL_ENCODER_H
+
+/*
+ * Bool encoder (https://datatracker.ietf.org/doc/html/rfc6386#section-7.3).
+ *
+ * It is not used by the inspector itself, only to build synthetic frame
+ * headers for the tests and benchmarks. The output buffer must be big
+ * enough, nothing is checked.
+ */
+
+struct bool_encoder
+{
+    unsigned char *output;     /* next byte to write */
+    unsigned char *start;
+    unsigned int   range;
+    unsigned int   bottom;
+    int            bit_count;
+};
+
+
+static void
+init_bool_encoder(struct bool_encoder *e, unsigned char *start_partition)
+{
+    e->output = start_partition;
+    e->start = start_partition;
+    e->range = 255;
+    e->bottom = 0;
+    e->bit_count = 24;
+}
+
+
+static void
+bool_add_one_to_output(unsigned char *q)
+{
+    while (*--q == 255)
+        *q = 0;
+    ++*q;
+}
+
+
+static void
+bool_put(struct bool_encoder *e, int probability, int value)
+{
+    unsigned int split = 1 + (((e->range - 1) * probability) >> 8);
+
+    if (value)
+    {
+        e->bottom += split;
+        e->range -= split;
+    }
+    else
+        e->range = split;
+
+    while (e->range < 128)
+    {
+        e->range <<= 1;
+
+        if (e->bottom & (1u << 31))
+            bool_add_one_to_output(e->output);
+
+        e->bottom <<= 1;
+
+        if (!--e->bit_count)
+        {
+            *e->output++ = (unsigned char) (e->bottom >> 24);
+            e->bottom &= (1 << 24) - 1;
+            e->bit_count = 8;
+        }
+    }
+}
+
+
+/* It returns the size of the partition */
+static unsigned int
+bool_flush_encoder(struct bool_encoder *e)
+{
+    int          c = e->bit_count;
+    unsigned int v = e->bottom;
+
+    if (v & (1u << (32 - c)))
+        bool_add_one_to_output(e->output);
+
+    v <<= c & 7;
+    c >>= 3;
+    while (--c >= 0)
+        v <<= 8;
+
+    c = 4;
+    while (--c >= 0)
+    {
+        *e->output++ = (unsigned char) (v >> 24);
+        v <<= 8;
+    }
+
+    return e->output - e->start;
+}
+
+
+static inline void bool_put_bit(struct bool_encoder *e, int value)
+{
+    bool_put(e, 128, value);
+}
+
+
+static void bool_put_uint(struct bool_encoder *e, int value, int bits)
+{
+    int bit;
+
+    for (bit = bits - 1; bit >= 0; bit--)
+        bool_put_bit(e, (value >> bit) & 1);
+}
+
+
+/* the opposite of bool_maybe_get_int(), zero is not written */
+static void bool_put_maybe_int(struct bool_encoder *e, int value, int bits)
+{
+    bool_put_bit(e, value != 0);
+    if (value != 0)
+    {
+        bool_put_uint(e, value < 0 ? -value : value, bits);
+        bool_put_bit(e, value < 0);
+    }
+}
+#endif
@@ -0,0 +1,566 @@
+/**
+ *
+ * The daemon mode (--daemon): a long-lived native engine driven by a
+ * Unix-domain control socket, so the ports, payload types and outputs can
+ * change without restarting the inspector (and without paying the GStreamer
+ * init for every room).
+ *
+ * The control protocol is line based, every command is answered by zero or
+ * more data lines and a final "ok" or "error: <reason>" line:
+ *
+ *   add-port <port> <pt> [pt...]    listen to a UDP port for these payload types
+ *   remove-port <port>              stop listening, the streams of the port are closed
+ *   add-pt <port> <pt>              accept one more payload type on a port
+ *   remove-pt <port> <pt>
+ *   output <ssrc> <path|stdout|default>
+ *                                   where the results of a SSRC go (now or when it arrives)
+ *   ports                           "port <port> pts <pt,...> streams <n>" lines
+ *   list                            "ssrc <ssrc> port <port> frames <n> output <path>" lines
+ *
+ * Everything runs in one thread: a poll() loop over the control socket,
+ * its clients and the UDP receivers. So the commands change the ports and
+ * the streams between two batches, without any locking. The replies are
+ * sent without blocking: what does not fit in the socket buffer is kept
+ * and sent when the client reads, a client that stops reading is closed.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "log.h"
+
+/* payloadType of the daemon ports, so a port without payload types accepts nothing */
+#define DAEMON_NO_PAYLOAD_TYPE 128
+
+static gboolean
+parse_uint (const gchar * token, guint64 max, guint64 * value)
+{
+  gchar * end = NULL;
+
+  if (!token || !g_ascii_isdigit(token[0])) {
+    return FALSE;
+  }
+  *value = g_ascii_strtoull(token, &end, 10);
+  return *end == '\0' && *value <= max;
+}
+
+static gboolean
+parse_payload_type (const gchar * token, guint * payloadType)
+{
+  guint64 value;
+
+  if (!parse_uint(token, 127, &value)) {
+    return FALSE;
+  }
+  *payloadType = (guint) value;
+  return TRUE;
+}
+
+static void
+daemon_port_free (DaemonPort * port)
+{
+  if (port->worker.latency.total > 0) {
+    gchar name[64];
+    g_snprintf(name, sizeof(name), "Port %i arrival to result latency", port->port);
+    latency_histogram_log(&port->worker.latency, name);
+  }
+  native_worker_clear(&port->worker);
+  g_free(port);
+}
+
+void
+daemon_init (Daemon * daemon, guint parseDepth, guint batchSize, OutputSettings * output, volatile sig_atomic_t * closing)
+{
+  memset(daemon, 0, sizeof(Daemon));
+  daemon->fd = -1;
+  daemon->parseDepth = parseDepth;
+  daemon->batchSize = batchSize;
+  daemon->output = output;
+  daemon->closing = closing;
+  daemon->ports = g_ptr_array_new_with_free_func((GDestroyNotify) daemon_port_free);
+  if (!output->targets) {
+    output->targets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    daemon->ownTargets = TRUE;
+  }
+}
+
+static void
+daemon_client_close (DaemonClient * client)
+{
+  close(client->fd);
+  g_string_free(client->pending, TRUE);
+}
+
+void
+daemon_clear (Daemon * daemon)
+{
+  guint i;
+
+  for (i = 0; i < daemon->clientCount; i++) {
+    daemon_client_close(&daemon->clients[i]);
+  }
+  daemon->clientCount = 0;
+  g_ptr_array_free(daemon->ports, TRUE);
+  if (daemon->fd >= 0) {
+    close(daemon->fd);
+    unlink(daemon->socketPath);
+  }
+  g_free(daemon->socketPath);
+  if (daemon->ownTargets) {
+    g_hash_table_destroy(daemon->output->targets);
+    daemon->output->targets = NULL;
+  }
+}
+
+/**
+ *
+ * This function creates the control socket (a stale socket file is replaced).
+ *
+ */
+guint
+daemon_listen (Daemon * daemon, const gchar * socketPath)
+{
+  struct sockaddr_un address;
+
+  if (strlen(socketPath) >= sizeof(address.sun_path)) {
+    return DAEMON_ERROR_BIND;
+  }
+
+  daemon->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (daemon->fd < 0) {
+    return DAEMON_ERROR_SOCKET;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  g_strlcpy(address.sun_path, socketPath, sizeof(address.sun_path));
+  unlink(socketPath);
+  if (bind(daemon->fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(daemon->fd, DAEMON_MAX_CLIENTS) < 0) {
+    close(daemon->fd);
+    daemon->fd = -1;
+    return DAEMON_ERROR_BIND;
+  }
+
+  daemon->socketPath = g_strdup(socketPath);
+  return DAEMON_OK;
+}
+
+DaemonPort *
+daemon_find_port (Daemon * daemon, gint port)
+{
+  guint i;
+
+  for (i = 0; i < daemon->ports->len; i++) {
+    DaemonPort * daemonPort = g_ptr_array_index(daemon->ports, i);
+    if (daemonPort->port == port) {
+      return daemonPort;
+    }
+  }
+  return NULL;
+}
+
+static void
+daemon_set_payload_type (DaemonPort * port, guint payloadType, gboolean accept)
+{
+  guint64 bit = G_GUINT64_CONSTANT(1) << (payloadType & 63);
+
+  if (accept) {
+    port->options.payloadTypes[payloadType >> 6] |= bit;
+  } else {
+    port->options.payloadTypes[payloadType >> 6] &= ~bit;
+  }
+}
+
+static gboolean
+daemon_add_port (Daemon * daemon, gchar ** args, guint argc, GString * reply)
+{
+  guint64 port;
+  guint payloadType, i;
+
+  if (argc < 3 || !parse_uint(args[1], 65535, &port) || port == 0) {
+    g_string_append(reply, "error: usage: add-port <port> <pt> [pt...]\n");
+    return FALSE;
+  }
+  if (daemon->ports->len == DAEMON_MAX_PORTS) {
+    g_string_append_printf(reply, "error: too many ports (%u)\n", DAEMON_MAX_PORTS);
+    return FALSE;
+  }
+  if (daemon_find_port(daemon, (gint) port)) {
+    g_string_append_printf(reply, "error: port %u is already open\n", (guint) port);
+    return FALSE;
+  }
+
+  DaemonPort * daemonPort = g_new0(DaemonPort, 1);
+  daemonPort->port = (gint) port;
+  daemonPort->options.payloadType = DAEMON_NO_PAYLOAD_TYPE;
+  daemonPort->options.parseDepth = daemon->parseDepth;
+  daemonPort->options.output = daemon->output;
+  daemonPort->options.closing = daemon->closing;
+  daemonPort->options.reorderWindow = daemon->reorderWindow;
+  daemonPort->options.reorderLatencyMs = daemon->reorderLatencyMs;
+  for (i = 2; i < argc; i++) {
+    if (!parse_payload_type(args[i], &payloadType)) {
+      g_string_append_printf(reply, "error: invalid payload type %s\n", args[i]);
+      g_free(daemonPort);
+      return FALSE;
+    }
+    daemon_set_payload_type(daemonPort, payloadType, TRUE);
+  }
+
+  native_worker_init(&daemonPort->worker, daemon->ports->len, &daemonPort->options);
+  daemonPort->worker.measureLatency = TRUE;
+  guint res = udp_receiver_open(&daemonPort->worker.receiver, daemonPort->port, daemon->batchSize, FALSE, FALSE);
+  if (res != UDP_RECEIVER_OK) {
+    g_string_append_printf(reply, "error: failed to listen to port %u (error %u)\n", (guint) port, res);
+    daemon_port_free(daemonPort);
+    return FALSE;
+  }
+
+  g_ptr_array_add(daemon->ports, daemonPort);
+  log_info("daemon_add_port: listening to port %u", (guint) port);
+  return TRUE;
+}
+
+static gboolean
+daemon_remove_port (Daemon * daemon, gchar ** args, guint argc, GString * reply)
+{
+  guint64 port;
+
+  if (argc != 2 || !parse_uint(args[1], 65535, &port)) {
+    g_string_append(reply, "error: usage: remove-port <port>\n");
+    return FALSE;
+  }
+
+  DaemonPort * daemonPort = daemon_find_port(daemon, (gint) port);
+  if (!daemonPort) {
+    g_string_append_printf(reply, "error: port %u is not open\n", (guint) port);
+    return FALSE;
+  }
+
+  log_info("daemon_remove_port: closing port %u", (guint) port);
+  g_ptr_array_remove_fast(daemon->ports, daemonPort);
+  return TRUE;
+}
+
+static gboolean
+daemon_payload_type (Daemon * daemon, gchar ** args, guint argc, gboolean accept, GString * reply)
+{
+  guint64 port;
+  guint payloadType;
+
+  if (argc != 3 || !parse_uint(args[1], 65535, &port) || !parse_payload_type(args[2], &payloadType)) {
+    g_string_append_printf(reply, "error: usage: %s <port> <pt>\n", args[0]);
+    return FALSE;
+  }
+
+  DaemonPort * daemonPort = daemon_find_port(daemon, (gint) port);
+  if (!daemonPort) {
+    g_string_append_printf(reply, "error: port %u is not open\n", (guint) port);
+    return FALSE;
+  }
+
+  daemon_set_payload_type(daemonPort, payloadType, accept);
+  return TRUE;
+}
+
+static gboolean
+daemon_output (Daemon * daemon, gchar ** args, guint argc, GString * reply)
+{
+  guint64 ssrc;
+  gchar key[STREAM_INSPECTOR_SSRC_SZ];
+  guint i;
+
+  if (argc != 3 || !parse_uint(args[1], G_MAXUINT32, &ssrc)) {
+    g_string_append(reply, "error: usage: output <ssrc> <path|stdout|default>\n");
+    return FALSE;
+  }
+
+  g_snprintf(key, sizeof(key), "%u", (guint32) ssrc);
+  if (g_strcmp0(args[2], "default") == 0) {
+    g_hash_table_remove(daemon->output->targets, key);
+  } else {
+    const gchar * outputPath = g_strcmp0(args[2], "stdout") == 0 ? OUTPUT_SETTINGS_STDOUT : args[2];
+    g_hash_table_replace(daemon->output->targets, g_strdup(key), g_strdup(outputPath));
+  }
+
+  /* a stream that is already there switches now, the others when they arrive */
+  for (i = 0; i < daemon->ports->len; i++) {
+    DaemonPort * daemonPort = g_ptr_array_index(daemon->ports, i);
+    NativeStream * stream = ssrc_table_lookup(&daemonPort->worker.streams, (guint32) ssrc);
+    if (stream) {
+      stream_inspector_set_target(stream->streamInspector, daemon->output);
+    }
+  }
+  return TRUE;
+}
+
+static void
+daemon_ports (Daemon * daemon, GString * reply)
+{
+  guint i, payloadType;
+
+  for (i = 0; i < daemon->ports->len; i++) {
+    DaemonPort * daemonPort = g_ptr_array_index(daemon->ports, i);
+    const gchar * separator = "";
+    g_string_append_printf(reply, "port %i pts ", daemonPort->port);
+    for (payloadType = 0; payloadType < 128; payloadType++) {
+      if (native_options_accept(&daemonPort->options, payloadType)) {
+        g_string_append_printf(reply, "%s%u", separator, payloadType);
+        separator = ",";
+      }
+    }
+    g_string_append_printf(reply, "%s streams %u\n", *separator ? "" : "-", daemonPort->worker.streams.size);
+  }
+}
+
+static void
+daemon_list (Daemon * daemon, GString * reply)
+{
+  guint i, slot;
+
+  for (i = 0; i < daemon->ports->len; i++) {
+    DaemonPort * daemonPort = g_ptr_array_index(daemon->ports, i);
+    const SsrcTable * streams = &daemonPort->worker.streams;
+    for (slot = 0; slot < streams->capacity; slot++) {
+      if (!streams->slots[slot].value) {
+        continue;
+      }
+      StreamInspector * streamInspector = ((NativeStream *) streams->slots[slot].value)->streamInspector;
+      const gchar * outputPath = g_hash_table_lookup(daemon->output->targets, streamInspector->ssrc);
+      if (g_strcmp0(outputPath, OUTPUT_SETTINGS_STDOUT) == 0) {
+        outputPath = "stdout";
+      }
+      g_string_append_printf(reply, "ssrc %s port %i frames %u output %s\n",
+        streamInspector->ssrc, daemonPort->port, streamInspector->frameNumber, outputPath ? outputPath : "default");
+    }
+  }
+}
+
+/**
+ *
+ * This function runs a control command, appending its answer to `reply`.
+ * It returns FALSE when the command failed.
+ *
+ */
+gboolean
+daemon_command (Daemon * daemon, const gchar * line, GString * reply)
+{
+  gchar ** tokens = g_strsplit_set(line, " \t\r\n", -1);
+  gchar * args[8];
+  guint argc = 0, i;
+  gboolean ok = TRUE;
+
+  for (i = 0; tokens[i] && argc < G_N_ELEMENTS(args); i++) {
+    if (*tokens[i]) {
+      args[argc++] = tokens[i];
+    }
+  }
+
+  if (argc == 0) {
+    ok = FALSE;
+    g_string_append(reply, "error: empty command\n");
+  } else if (g_strcmp0(args[0], "add-port") == 0) {
+    ok = daemon_add_port(daemon, args, argc, reply);
+  } else if (g_strcmp0(args[0], "remove-port") == 0) {
+    ok = daemon_remove_port(daemon, args, argc, reply);
+  } else if (g_strcmp0(args[0], "add-pt") == 0) {
+    ok = daemon_payload_type(daemon, args, argc, TRUE, reply);
+  } else if (g_strcmp0(args[0], "remove-pt") == 0) {
+    ok = daemon_payload_type(daemon, args, argc, FALSE, reply);
+  } else if (g_strcmp0(args[0], "output") == 0) {
+    ok = daemon_output(daemon, args, argc, reply);
+  } else if (g_strcmp0(args[0], "ports") == 0) {
+    daemon_ports(daemon, reply);
+  } else if (g_strcmp0(args[0], "list") == 0) {
+    daemon_list(daemon, reply);
+  } else {
+    ok = FALSE;
+    g_string_append_printf(reply, "error: unknown command %s\n", args[0]);
+  }
+
+  if (ok) {
+    g_string_append(reply, "ok\n");
+  }
+  g_strfreev(tokens);
+  return ok;
+}
+
+static void
+daemon_accept (Daemon * daemon)
+{
+  int fd = accept4(daemon->fd, NULL, NULL, SOCK_CLOEXEC);
+
+  if (fd < 0) {
+    return;
+  }
+  if (daemon->clientCount == DAEMON_MAX_CLIENTS) {
+    log_info("daemon_accept: too many control clients");
+    close(fd);
+    return;
+  }
+
+  daemon->clients[daemon->clientCount].fd = fd;
+  daemon->clients[daemon->clientCount].lineLen = 0;
+  daemon->clients[daemon->clientCount].pending = g_string_new(NULL);
+  daemon->clientCount++;
+}
+
+/* It returns FALSE when the client is gone or does not read its replies */
+static gboolean
+daemon_flush_client (DaemonClient * client)
+{
+  gssize len;
+
+  if (client->pending->len == 0) {
+    return TRUE;
+  }
+  len = send(client->fd, client->pending->str, client->pending->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (len < 0 && errno != EAGAIN && errno != EINTR) {
+    return FALSE;
+  }
+  if (len > 0) {
+    g_string_erase(client->pending, 0, len);
+  }
+  if (client->pending->len > DAEMON_PENDING_MAX_SZ) {
+    log_info("daemon_flush_client: the control client does not read its replies, closing it");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* It returns FALSE when the client is gone */
+static gboolean
+daemon_read_client (Daemon * daemon, DaemonClient * client, GString * reply)
+{
+  gssize len = recv(client->fd, client->line + client->lineLen, sizeof(client->line) - client->lineLen - 1, MSG_DONTWAIT);
+  gchar * start, * end;
+
+  if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+    return FALSE;
+  }
+  if (len < 0) {
+    return TRUE;
+  }
+
+  client->lineLen += len;
+  client->line[client->lineLen] = '\0';
+  start = client->line;
+  while ((end = strchr(start, '\n'))) {
+    *end = '\0';
+    g_string_truncate(reply, 0);
+    daemon_command(daemon, start, reply);
+    g_string_append_len(client->pending, reply->str, reply->len);
+    start = end + 1;
+  }
+  if (!daemon_flush_client(client)) {
+    return FALSE;
+  }
+
+  client->lineLen -= start - client->line;
+  memmove(client->line, start, client->lineLen);
+  if (client->lineLen == sizeof(client->line) - 1) {
+    log_info("daemon_read_client: command too long, closing the control client");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* The poll timeout (ms): the housekeeping interval, or less when a reorder window must release its held packets before */
+static gint
+daemon_poll_timeout (Daemon * daemon)
+{
+  guint64 deadline = G_MAXUINT64;
+  guint i;
+
+  for (i = 0; i < daemon->ports->len; i++) {
+    deadline = MIN(deadline, native_worker_next_deadline(&((DaemonPort *) g_ptr_array_index(daemon->ports, i))->worker));
+  }
+  if (deadline == G_MAXUINT64) {
+    return NATIVE_STATS_INTERVAL_MS;
+  }
+
+  guint64 now = (guint64) g_get_real_time() * 1000;
+  if (deadline <= now) {
+    return 0;
+  }
+  /* rounded up, so the deadline has passed when poll() returns */
+  return (gint) MIN((deadline - now + 999999) / 1000000, (guint64) NATIVE_STATS_INTERVAL_MS);
+}
+
+/**
+ *
+ * This function runs the daemon until *closing is set (SIGINT).
+ *
+ */
+void
+daemon_run (Daemon * daemon)
+{
+  struct pollfd fds[1 + DAEMON_MAX_CLIENTS + DAEMON_MAX_PORTS];
+  GString * reply = g_string_sized_new(4096);
+  gint64 lastHousekeeping = g_get_monotonic_time();
+  guint i, count;
+
+  while (!*daemon->closing) {
+    guint clients = daemon->clientCount;
+    guint ports = daemon->ports->len;
+
+    fds[0].fd = daemon->fd;
+    fds[0].events = POLLIN;
+    for (i = 0; i < clients; i++) {
+      fds[1 + i].fd = daemon->clients[i].fd;
+      fds[1 + i].events = daemon->clients[i].pending->len > 0 ? POLLIN | POLLOUT : POLLIN;
+    }
+    for (i = 0; i < ports; i++) {
+      fds[1 + clients + i].fd = ((DaemonPort *) g_ptr_array_index(daemon->ports, i))->worker.receiver.fd;
+      fds[1 + clients + i].events = POLLIN;
+    }
+
+    count = 1 + clients + ports;
+    if (poll(fds, count, daemon_poll_timeout(daemon)) < 0 && errno != EINTR) {
+      log_info("daemon_run: poll failed");
+      break;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    /* the packets first: the commands can remove ports */
+    for (i = 0; i < ports; i++) {
+      NativeWorker * worker = &((DaemonPort *) g_ptr_array_index(daemon->ports, i))->worker;
+      gint received = fds[1 + clients + i].revents & POLLIN ? udp_receiver_receive(&worker->receiver) : 0;
+      if (received > 0) {
+        native_worker_push_batch(worker, worker->receiver.packets, received, now);
+      } else if (worker->holding->len > 0) {
+        /* like the realtime workers on a receive timeout, a gap is not waited for longer than the latency */
+        native_worker_push_batch(worker, NULL, 0, now);
+      }
+    }
+
+    for (i = clients; i-- > 0;) {
+      DaemonClient * client = &daemon->clients[i];
+      if (((fds[1 + i].revents & POLLOUT) && !daemon_flush_client(client)) ||
+          ((fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) && !daemon_read_client(daemon, client, reply))) {
+        daemon_client_close(client);
+        daemon->clients[i] = daemon->clients[--daemon->clientCount];
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      daemon_accept(daemon);
+    }
+
+    if (now - lastHousekeeping >= NATIVE_STATS_INTERVAL_MS * 1000) {
+      lastHousekeeping = now;
+      for (i = 0; i < daemon->ports->len; i++) {
+        native_worker_expire(&((DaemonPort *) g_ptr_array_index(daemon->ports, i))->worker, now);
+      }
+    }
+  }
+
+  g_string_free(reply, TRUE);
+}
@@ -0,0 +1,65 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <signal.h>
+#include <glib.h>
+
+#include "native_worker.h"
+#include "stream_inspector.h"
+
+enum
+{
+  DAEMON_OK = 0,
+  DAEMON_ERROR_SOCKET = 1,
+  DAEMON_ERROR_BIND = 2
+};
+
+enum
+{
+  DAEMON_MAX_CLIENTS = 16,
+  DAEMON_MAX_PORTS = 256,
+  DAEMON_LINE_SZ = 1024,
+  DAEMON_PENDING_MAX_SZ = 8 * 1024 * 1024  /* unsent replies of a client before it is closed */
+};
+
+/* A listening port, with its own worker (SSRC table) and payload types */
+typedef struct
+{
+  gint port;
+  NativeOptions options;
+  NativeWorker worker;
+} DaemonPort;
+
+typedef struct
+{
+  int fd;
+  gchar line[DAEMON_LINE_SZ];
+  guint lineLen;
+  GString * pending;       /* replies not sent yet, the socket buffer was full */
+} DaemonClient;
+
+typedef struct
+{
+  gchar * socketPath;
+  int fd;
+  guint parseDepth;
+  guint batchSize;
+  guint reorderWindow;     /* NativeOptions of the new ports */
+  guint reorderLatencyMs;
+  OutputSettings * output;
+  gboolean ownTargets;     /* output->targets was created by daemon_init() */
+  volatile sig_atomic_t * closing;
+  GPtrArray * ports;
+  DaemonClient clients[DAEMON_MAX_CLIENTS];
+  guint clientCount;
+} Daemon;
+
+
+void daemon_init(Daemon * daemon, guint parseDepth, guint batchSize, OutputSettings * output, volatile sig_atomic_t * closing);
+void daemon_clear(Daemon * daemon);
+guint daemon_listen(Daemon * daemon, const gchar * socketPath);
+gboolean daemon_command(Daemon * daemon, const gchar * line, GString * reply);
+DaemonPort * daemon_find_port(Daemon * daemon, gint port);
+void daemon_run(Daemon * daemon);
+
+#endif
@@ -0,0 +1,491 @@
+/**
+ *
+ * Follow mode for captures that are still being written (see follow.h).
+ *
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "follow.h"
+#include "log.h"
+#include "rtp_parser.h"
+
+G_STATIC_ASSERT(sizeof(FollowCheckpointHeader) == 48);
+G_STATIC_ASSERT(sizeof(FollowStreamState) == 56);
+
+gchar *
+follow_checkpoint_path (const gchar * pcapPath)
+{
+  return g_strconcat(pcapPath, FOLLOW_CHECKPOINT_SUFFIX, NULL);
+}
+
+static guint
+follow_open_file (Follower * follower)
+{
+  struct stat st;
+
+  if (pcap_reader_open(&follower->reader, follower->path) != PCAP_OK) {
+    return FOLLOW_ERROR_OPEN;
+  }
+  fstat(follower->reader.fd, &st);
+  follower->device = st.st_dev;
+  follower->inode = st.st_ino;
+  follower->opened = TRUE;
+
+  if (follower->inotify >= 0) {
+    if (follower->watch >= 0) {
+      inotify_rm_watch(follower->inotify, follower->watch);
+    }
+    follower->watch = inotify_add_watch(follower->inotify, follower->path, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+  }
+  return FOLLOW_OK;
+}
+
+/**
+ *
+ * This function restores the streams of the checkpoint, when it is for
+ * the same capture file and payload type. It returns TRUE when the
+ * follower resumes from it.
+ *
+ */
+static gboolean
+follow_checkpoint_load (Follower * follower)
+{
+  FollowCheckpointHeader header;
+  FollowStreamState * states = NULL;
+  FILE * fd = fopen(follower->checkpointPath, "r");
+  guint64 first;
+  guint64 i;
+
+  if (!fd) {
+    return FALSE;
+  }
+  if (fread(&header, sizeof(header), 1, fd) != 1 || memcmp(header.magic, FOLLOW_CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != FOLLOW_CHECKPOINT_VERSION || header.streams > G_MAXUINT32) {
+    log_info("Ignoring the checkpoint %s, it is not a checkpoint of this version", follower->checkpointPath);
+    fclose(fd);
+    return FALSE;
+  }
+  states = g_new(FollowStreamState, MAX(header.streams, 1));
+  if (fread(states, sizeof(FollowStreamState), header.streams, fd) != header.streams) {
+    log_info("Ignoring the checkpoint %s, it is truncated", follower->checkpointPath);
+    g_free(states);
+    fclose(fd);
+    return FALSE;
+  }
+  fclose(fd);
+
+  if (header.device != follower->device || header.inode != follower->inode || header.payloadType != follower->options.payloadType ||
+      header.offset < PCAP_GLOBAL_HEADER_SZ || header.offset > follower->reader.size) {
+    log_info("Ignoring the checkpoint %s, it is for another capture or payload type", follower->checkpointPath);
+    g_free(states);
+    return FALSE;
+  }
+
+  /* the results of the restored streams go after the ones of the previous run */
+  follower->output.append = TRUE;
+  first = header.offset;
+  for (i = 0; i < header.streams; i++) {
+    const FollowStreamState * state = &states[i];
+    NativeStream * stream = native_worker_stream(&follower->worker, state->ssrc, follower->options.payloadType);
+    StreamInspector * streamInspector = stream->streamInspector;
+    guint64 * resume = g_new(guint64, 1);
+
+    streamInspector->frameNumber = state->frameNumber;
+    streamInspector->lastResolution.width = state->width;
+    streamInspector->lastResolution.widthScale = state->widthScale;
+    streamInspector->lastResolution.height = state->height;
+    streamInspector->lastResolution.heightScale = state->heightScale;
+    stream->firstTimestamp = state->firstTimestamp;
+    stream->lastTimestamp = state->lastTimestamp;
+    stream->firstArrival = state->firstArrival;
+    /* without its last capture time, a stream only expires after its next packet */
+    stream->lastActivity = state->lastActivity ? (gint64) state->lastActivity : G_MAXINT64;
+
+    *resume = MIN(MAX(state->resume, PCAP_GLOBAL_HEADER_SZ), header.offset);
+    g_hash_table_insert(follower->resume, GUINT_TO_POINTER(state->ssrc), resume);
+    first = MIN(first, *resume);
+  }
+  follower->resumeEnd = header.offset;
+  pcap_reader_seek(&follower->reader, first);
+
+  log_info("Resuming %s from its checkpoint [offset: %" G_GUINT64_FORMAT ", streams: %" G_GUINT64_FORMAT ", read again from: %"
+    G_GUINT64_FORMAT "]", follower->path, header.offset, header.streams, first);
+  g_free(states);
+  return TRUE;
+}
+
+/**
+ *
+ * This function opens the capture and resumes from its checkpoint, when
+ * there is one. The results go to the output of `options`, appended to
+ * the previous ones when resuming.
+ *
+ */
+guint
+follow_open (Follower * follower, const gchar * path, const NativeOptions * options)
+{
+  memset(follower, 0, sizeof(Follower));
+  follower->path = g_strdup(path);
+  follower->checkpointPath = follow_checkpoint_path(path);
+  follower->output = *options->output;
+  follower->options = *options;
+  follower->options.output = &follower->output;
+  follower->resume = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  follower->watch = -1;
+  follower->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (follower->inotify < 0) {
+    log_info("inotify is not available (%s), polling %s", g_strerror(errno), path);
+  }
+
+  if (follow_open_file(follower) != FOLLOW_OK) {
+    follow_close(follower);
+    return FOLLOW_ERROR_OPEN;
+  }
+  native_worker_init(&follower->worker, 0, &follower->options);
+  follow_checkpoint_load(follower);
+  follower->lastCheckpoint = g_get_monotonic_time();
+  return FOLLOW_OK;
+}
+
+/* After a restart, the packets before the checkpoint that were already inspected */
+static gboolean
+follow_skip (Follower * follower, guint32 ssrc, guint64 offset)
+{
+  const guint64 * resume = g_hash_table_lookup(follower->resume, GUINT_TO_POINTER(ssrc));
+  return !resume || offset < *resume;
+}
+
+/* Once per NATIVE_STATS_INTERVAL_MS of capture time, it removes the streams without packets for NATIVE_STREAM_TIMEOUT_MS */
+static void
+follow_expire (Follower * follower)
+{
+  if (follower->captureTime - follower->lastExpire < NATIVE_STATS_INTERVAL_MS * 1000) {
+    return;
+  }
+  follower->lastExpire = follower->captureTime;
+  native_worker_expire(&follower->worker, follower->captureTime);
+}
+
+/**
+ *
+ * This function inspects the packets appended to the capture since the
+ * last read and writes a checkpoint every FOLLOW_CHECKPOINT_INTERVAL_MS
+ * (checked every FOLLOW_READ_BATCH packets, while it catches up with a
+ * big capture). It returns the number of packets read.
+ *
+ */
+guint
+follow_read (Follower * follower)
+{
+  PcapReader * reader = &follower->reader;
+  guint64 checkpointed = follower->packets;
+  PcapPacket packet;
+  RtpPacket rtp;
+  struct stat st;
+  guint count = 0;
+
+  if (!follower->opened && follow_open_file(follower) != FOLLOW_OK) {
+    return 0;
+  }
+  if (fstat(reader->fd, &st) == 0 && (gsize) st.st_size < reader->size) {
+    /* truncated, the end of the mapping is gone (SIGBUS), see follow_check_file() */
+    return 0;
+  }
+  if ((gsize) st.st_size > reader->size) {
+    /* the frames being assembled point to the mapped capture, which is about to change */
+    native_worker_detach(&follower->worker);
+    pcap_reader_refresh(reader);
+  }
+
+  for (;;) {
+    guint batch = 0;
+    while (batch < FOLLOW_READ_BATCH && pcap_reader_next(reader, &packet)) {
+      batch++;
+      if (!rtp_packet_parse(packet.payload, packet.payloadLen, &rtp) || !native_options_accept(&follower->options, rtp.payloadType)) {
+        continue;
+      }
+      if (packet.offset < follower->resumeEnd && follow_skip(follower, rtp.ssrc, packet.offset)) {
+        follower->skipped++;
+        continue;
+      }
+      rtp.arrival = packet.timestamp;
+      rtp.offset = packet.offset;
+      NativeStream * stream = native_worker_push(&follower->worker, &rtp);
+      stream->lastActivity = (gint64) (packet.timestamp / 1000);
+      follower->captureTime = MAX(follower->captureTime, stream->lastActivity);
+      follower->packets++;
+    }
+    count += batch;
+    follow_expire(follower);
+
+    if (follower->resumeEnd && reader->offset >= follower->resumeEnd) {
+      g_hash_table_remove_all(follower->resume);
+      follower->resumeEnd = 0;
+    }
+    if (follower->packets != checkpointed && g_get_monotonic_time() - follower->lastCheckpoint >= FOLLOW_CHECKPOINT_INTERVAL_MS * 1000) {
+      follow_checkpoint(follower);
+      checkpointed = follower->packets;
+    }
+    if (batch < FOLLOW_READ_BATCH) {
+      return count;
+    }
+  }
+}
+
+/* The capture file was truncated in place (copytruncate), or the path is now another file (rotated) */
+static guint
+follow_changed (Follower * follower)
+{
+  struct stat st;
+
+  if (!follower->opened) {
+    return FOLLOW_FILE_SAME;
+  }
+  if (fstat(follower->reader.fd, &st) == 0 && (gsize) st.st_size < follower->reader.size) {
+    return FOLLOW_FILE_TRUNCATED;
+  }
+  if (stat(follower->path, &st) < 0) {
+    return FOLLOW_FILE_SAME;
+  }
+  return (guint64) st.st_dev != follower->device || (guint64) st.st_ino != follower->inode ? FOLLOW_FILE_REPLACED : FOLLOW_FILE_SAME;
+}
+
+/**
+ *
+ * This function starts reading the new file of the path, with the same
+ * streams. The pending packets of the streams are in the previous file,
+ * so after a restart they would be read again from the start of the new
+ * one: a frame split between both files is lost when the inspector is
+ * restarted before it is completed.
+ *
+ * When the capture was truncated, the packets of the frames being
+ * assembled are past the end of the file, so those frames are dropped.
+ *
+ */
+static void
+follow_reopen (Follower * follower, gboolean truncated)
+{
+  SsrcTable * streams = &follower->worker.streams;
+  guint i, j;
+
+  if (truncated) {
+    native_worker_drop_frames(&follower->worker);
+  } else {
+    native_worker_detach(&follower->worker);
+  }
+  for (i = 0; i < streams->capacity; i++) {
+    NativeStream * stream = streams->slots[i].value;
+    if (!stream) {
+      continue;
+    }
+    stream->depay.frame.offset = PCAP_GLOBAL_HEADER_SZ;
+    for (j = 0; stream->reorder.slots && j < stream->reorder.window; j++) {
+      stream->reorder.slots[j].rtp.offset = PCAP_GLOBAL_HEADER_SZ;
+    }
+  }
+  g_hash_table_remove_all(follower->resume);
+  follower->resumeEnd = 0;
+
+  pcap_reader_close(&follower->reader);
+  follower->opened = FALSE;
+  follower->reopens++;
+  log_info("%s was %s, following the new file", follower->path, truncated ? "truncated" : "replaced");
+}
+
+/**
+ *
+ * This function reopens the capture when it was replaced or truncated,
+ * after reading what was written to a replaced file before. It returns
+ * TRUE when it did.
+ *
+ */
+gboolean
+follow_check_file (Follower * follower)
+{
+  guint change = follow_changed(follower);
+
+  if (change == FOLLOW_FILE_SAME) {
+    return FALSE;
+  }
+  if (change == FOLLOW_FILE_REPLACED) {
+    follow_read(follower);
+  }
+  follow_reopen(follower, change == FOLLOW_FILE_TRUNCATED);
+  return TRUE;
+}
+
+/* It waits for the capture to change, up to timeoutMs */
+void
+follow_wait (Follower * follower, guint timeoutMs)
+{
+  struct pollfd pfd = { follower->inotify, POLLIN, 0 };
+  guint8 events[4096];
+
+  if (follower->inotify < 0 || follower->watch < 0) {
+    g_usleep((gulong) timeoutMs * 1000);
+    return;
+  }
+  if (poll(&pfd, 1, (int) timeoutMs) > 0) {
+    /* the events only wake us up, the file is checked anyway */
+    while (read(follower->inotify, events, sizeof(events)) > 0);
+  }
+}
+
+/**
+ *
+ * This function writes the checkpoint, once the results of the frames
+ * inspected so far are flushed: the read offset and, for each stream, its
+ * state and where its pending packets start (see follow.h). It is written
+ * to <file>.vp8ckpt.tmp and renamed, so a checkpoint is always complete.
+ *
+ */
+guint
+follow_checkpoint (Follower * follower)
+{
+  SsrcTable * streams = &follower->worker.streams;
+  GArray * states = g_array_new(FALSE, TRUE, sizeof(FollowStreamState));
+  FollowCheckpointHeader header;
+  gchar * tmpPath;
+  FILE * fd;
+  guint res = FOLLOW_OK;
+  guint i, j;
+
+  if (!follower->opened) {
+    g_array_free(states, TRUE);
+    return FOLLOW_ERROR_OPEN;
+  }
+  if (follower->output.writer) {
+    output_writer_sync(follower->output.writer);
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FOLLOW_CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = FOLLOW_CHECKPOINT_VERSION;
+  header.payloadType = follower->options.payloadType;
+  header.device = follower->device;
+  header.inode = follower->inode;
+  header.offset = MAX(follower->reader.offset, follower->resumeEnd);
+
+  for (i = 0; i < streams->capacity; i++) {
+    NativeStream * stream = streams->slots[i].value;
+    FollowStreamState state;
+    const guint64 * resume;
+    if (!stream) {
+      continue;
+    }
+    memset(&state, 0, sizeof(state));
+    state.ssrc = stream->streamInspector->ssrcId;
+    state.frameNumber = stream->streamInspector->frameNumber;
+    state.width = stream->streamInspector->lastResolution.width;
+    state.widthScale = stream->streamInspector->lastResolution.widthScale;
+    state.height = stream->streamInspector->lastResolution.height;
+    state.heightScale = stream->streamInspector->lastResolution.heightScale;
+    state.firstTimestamp = stream->firstTimestamp;
+    state.lastTimestamp = stream->lastTimestamp;
+    state.firstArrival = stream->firstArrival;
+    state.lastActivity = stream->lastActivity == G_MAXINT64 ? 0 : (guint64) stream->lastActivity;
+
+    state.resume = follower->reader.offset;
+    if (stream->depay.started) {
+      state.resume = MIN(state.resume, stream->depay.frame.offset);
+    }
+    for (j = 0; stream->reorder.slots && j < stream->reorder.window; j++) {
+      if (stream->reorder.slots[j].buffer) {
+        state.resume = MIN(state.resume, stream->reorder.slots[j].rtp.offset);
+      }
+    }
+    /* still before the checkpoint of a restart, not pushed yet */
+    resume = g_hash_table_lookup(follower->resume, GUINT_TO_POINTER(state.ssrc));
+    if (follower->resumeEnd && resume) {
+      state.resume = MAX(state.resume, *resume);
+    }
+    g_array_append_val(states, state);
+  }
+  header.streams = states->len;
+
+  tmpPath = g_strconcat(follower->checkpointPath, ".tmp", NULL);
+  fd = fopen(tmpPath, "w");
+  if (!fd || fwrite(&header, sizeof(header), 1, fd) != 1 ||
+      fwrite(states->data, sizeof(FollowStreamState), states->len, fd) != states->len) {
+    res = FOLLOW_ERROR_CHECKPOINT;
+  }
+  if (fd && fclose(fd) != 0) {
+    res = FOLLOW_ERROR_CHECKPOINT;
+  }
+  if (res == FOLLOW_OK && rename(tmpPath, follower->checkpointPath) < 0) {
+    res = FOLLOW_ERROR_CHECKPOINT;
+  }
+  if (res != FOLLOW_OK) {
+    log_info("Failed to write the checkpoint %s", follower->checkpointPath);
+    unlink(tmpPath);
+  }
+
+  follower->checkpoints += res == FOLLOW_OK;
+  follower->lastCheckpoint = g_get_monotonic_time();
+  g_free(tmpPath);
+  g_array_free(states, TRUE);
+  return res;
+}
+
+/**
+ *
+ * This function follows the capture until `closing` is set (SIGINT or
+ * SIGTERM) and writes the last checkpoint.
+ *
+ */
+void
+follow_run (Follower * follower, volatile sig_atomic_t * closing)
+{
+  while (!*closing) {
+    follow_read(follower);
+    if (follow_check_file(follower)) {
+      continue;
+    }
+    follow_wait(follower, FOLLOW_POLL_INTERVAL_MS);
+  }
+  follow_checkpoint(follower);
+}
+
+/**
+ *
+ * This function releases the follower. The packets held by the reorder
+ * windows are dropped instead of being inspected: they are read again
+ * when the follower resumes from its checkpoint.
+ *
+ */
+void
+follow_close (Follower * follower)
+{
+  SsrcTable * streams = &follower->worker.streams;
+  guint i;
+
+  if (follower->worker.touched) {
+    for (i = 0; i < streams->capacity; i++) {
+      NativeStream * stream = streams->slots[i].value;
+      if (stream) {
+        rtp_reorder_reset(&stream->reorder);
+      }
+    }
+    native_worker_clear(&follower->worker);
+  }
+  if (follower->opened) {
+    pcap_reader_close(&follower->reader);
+    follower->opened = FALSE;
+  }
+  if (follower->inotify >= 0) {
+    close(follower->inotify);
+    follower->inotify = -1;
+  }
+  g_hash_table_destroy(follower->resume);
+  g_free(follower->path);
+  g_free(follower->checkpointPath);
+  follower->path = NULL;
+  follower->checkpointPath = NULL;
+}
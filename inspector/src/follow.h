@@ -0,0 +1,128 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <signal.h>
+#include <glib.h>
+
+#include "native_worker.h"
+#include "pcap_reader.h"
+
+/**
+ *
+ * Follow mode for captures that are still being written (--follow).
+ *
+ * The native engine reads the capture to its end and then waits (inotify,
+ * or polling when it is not available) for the packets appended to it,
+ * with the same worker, so the per-SSRC state (frame number, PTS base,
+ * last resolution, the frame being assembled) is kept across reads. The
+ * frames waiting for more packets at the end of the file are completed by
+ * the next reads instead of being flushed.
+ *
+ * Every FOLLOW_CHECKPOINT_INTERVAL_MS and at exit, once the results written
+ * so far are flushed, a checkpoint (<file>.vp8ckpt) gets the read offset
+ * and the state of every stream. Each stream also gets the offset where
+ * its pending packets start (the frame being assembled, the packets held
+ * by the reorder window). A restart resumes from the checkpoint: the
+ * streams are restored, the capture is read again from the lowest pending
+ * offset and the packets that were already inspected are skipped, so
+ * every frame is inspected once and the results are appended to the
+ * outputs.
+ *
+ * Like in realtime, the streams without packets for NATIVE_STREAM_TIMEOUT_MS
+ * are removed (their files are closed), by the capture times: a capture
+ * that is not written to does not expire its streams. The removed streams
+ * are not in the next checkpoints.
+ *
+ * When the capture is replaced (rotated, or truncated) the new file is
+ * read from its start, with the same streams. A truncated capture loses
+ * the frames that were being assembled, their packets are gone.
+ *
+ */
+
+#define FOLLOW_CHECKPOINT_MAGIC "VP8FOLLW"
+#define FOLLOW_CHECKPOINT_SUFFIX ".vp8ckpt"
+
+enum
+{
+  FOLLOW_CHECKPOINT_VERSION = 1,
+  FOLLOW_CHECKPOINT_INTERVAL_MS = 1000,
+  FOLLOW_POLL_INTERVAL_MS = 1000,      /* the file is checked at least this often, also with inotify */
+  FOLLOW_READ_BATCH = 4096             /* packets read between two checks of the checkpoint interval */
+};
+
+enum
+{
+  FOLLOW_OK = 0,
+  FOLLOW_ERROR_OPEN = 1,
+  FOLLOW_ERROR_CHECKPOINT = 2
+};
+
+enum
+{
+  FOLLOW_FILE_SAME = 0,
+  FOLLOW_FILE_REPLACED = 1,   /* the path is another file */
+  FOLLOW_FILE_TRUNCATED = 2   /* the file is smaller than its mapping */
+};
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 payloadType;
+  guint64 device;         /* the capture file, a replaced capture is not resumed */
+  guint64 inode;
+  guint64 offset;         /* read offset, the packets after it were never read */
+  guint64 streams;
+} FollowCheckpointHeader;
+
+typedef struct
+{
+  guint32 ssrc;
+  guint32 frameNumber;
+  guint64 resume;         /* offset of its first pending packet, or the read offset */
+  guint64 firstTimestamp; /* the PTS base, see native_stream_push() */
+  guint64 lastTimestamp;
+  guint64 firstArrival;
+  guint64 lastActivity;   /* capture time (microseconds) of its last packet, 0 in the older checkpoints */
+  guint16 width;
+  guint16 widthScale;
+  guint16 height;
+  guint16 heightScale;
+} FollowStreamState;
+
+typedef struct
+{
+  gchar * path;
+  gchar * checkpointPath;
+  OutputSettings output;      /* appends to the outputs when resuming */
+  NativeOptions options;
+  NativeWorker worker;
+  PcapReader reader;
+  gboolean opened;
+  guint64 device;
+  guint64 inode;
+  int inotify;                /* -1 without inotify, the file is polled */
+  int watch;
+  GHashTable * resume;        /* SSRC -> offset of its first packet not inspected before the restart */
+  guint64 resumeEnd;          /* the read offset of the checkpoint */
+  gint64 lastCheckpoint;
+  gint64 captureTime;         /* of the last packet read (microseconds), the clock of the stream expiry */
+  gint64 lastExpire;
+
+  guint64 packets;
+  guint64 skipped;            /* read again after a restart, already inspected */
+  guint64 checkpoints;
+  guint reopens;
+} Follower;
+
+gchar * follow_checkpoint_path(const gchar * pcapPath);
+
+guint follow_open(Follower * follower, const gchar * path, const NativeOptions * options);
+guint follow_read(Follower * follower);
+gboolean follow_check_file(Follower * follower);
+void follow_wait(Follower * follower, guint timeoutMs);
+guint follow_checkpoint(Follower * follower);
+void follow_run(Follower * follower, volatile sig_atomic_t * closing);
+void follow_close(Follower * follower);
+
+#endif
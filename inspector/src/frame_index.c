@@ -0,0 +1,510 @@
+/**
+ *
+ * Frame index of a capture (see frame_index.h).
+ *
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame_index.h"
+#include "pcap_reader.h"
+#include "rtp_parser.h"
+#include "vp8_depay.h"
+
+G_STATIC_ASSERT(sizeof(FrameIndexHeader) == 56);
+G_STATIC_ASSERT(sizeof(FrameIndexEntry) == 48);
+
+gchar *
+frame_index_path (const gchar * pcapPath)
+{
+  return g_strconcat(pcapPath, FRAME_INDEX_SUFFIX, NULL);
+}
+
+static gboolean
+frame_index_stat (const gchar * pcapPath, guint64 * size, gint64 * mtime)
+{
+  struct stat st;
+
+  if (stat(pcapPath, &st) < 0) {
+    return FALSE;
+  }
+  *size = st.st_size;
+  *mtime = (gint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return TRUE;
+}
+
+/**
+ *
+ * This function starts the index of a capture. The entries go to
+ * <file>.vp8idx.tmp, which replaces the index when it is committed.
+ *
+ */
+guint
+frame_index_writer_open (FrameIndexWriter * writer, const gchar * pcapPath, guint payloadType)
+{
+  memset(writer, 0, sizeof(FrameIndexWriter));
+  memcpy(writer->header.magic, FRAME_INDEX_MAGIC, sizeof(writer->header.magic));
+  writer->header.version = FRAME_INDEX_VERSION;
+  writer->header.entrySize = sizeof(FrameIndexEntry);
+  writer->header.payloadType = payloadType;
+  if (!frame_index_stat(pcapPath, &writer->header.pcapSize, &writer->header.pcapMtime)) {
+    return FRAME_INDEX_ERROR_OPEN;
+  }
+
+  writer->path = frame_index_path(pcapPath);
+  writer->tmpPath = g_strconcat(writer->path, ".tmp", NULL);
+  writer->fd = fopen(writer->tmpPath, "w");
+  if (!writer->fd || fwrite(&writer->header, sizeof(FrameIndexHeader), 1, writer->fd) != 1) {
+    frame_index_writer_close(writer, FALSE);
+    return FRAME_INDEX_ERROR_WRITE;
+  }
+  return FRAME_INDEX_OK;
+}
+
+/* `previous` is the resolution of the stream before the frame was inspected */
+void
+frame_index_writer_add (FrameIndexWriter * writer, guint32 ssrc, guint32 rtpTimestamp, guint64 offset, const FrameInfo * info, const FrameResolution * previous)
+{
+  FrameIndexEntry entry;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.offset = offset;
+  entry.arrival = info->arrival;
+  entry.pts = info->pts;
+  entry.ssrc = ssrc;
+  entry.rtpTimestamp = rtpTimestamp;
+  entry.frameNumber = info->frameNumber;
+  entry.size = info->size;
+  entry.width = (info->resolution.widthScale << 14) | (info->resolution.width & 0x3fff);
+  entry.height = (info->resolution.heightScale << 14) | (info->resolution.height & 0x3fff);
+  entry.flags = (info->keyframe ? FRAME_INDEX_KEYFRAME : 0) | (info->showFrame ? FRAME_INDEX_SHOW : 0) | (info->ok ? 0 : FRAME_INDEX_CORRUPT);
+  /* like the resolution changes of the metrics, see inspect_frame_info() */
+  if (info->ok && info->keyframe && previous->width != 0 &&
+      (info->resolution.width != previous->width || info->resolution.height != previous->height)) {
+    entry.flags |= FRAME_INDEX_RESOLUTION_CHANGE;
+  }
+
+  if (info->arrival && (writer->header.firstArrival == 0 || info->arrival < writer->header.firstArrival)) {
+    writer->header.firstArrival = info->arrival;
+  }
+  writer->header.entries++;
+  fwrite(&entry, sizeof(entry), 1, writer->fd);
+}
+
+/**
+ *
+ * This function finishes the index. Committed, the header gets the number
+ * of entries and the index replaces the previous one, otherwise it is
+ * removed.
+ *
+ */
+guint
+frame_index_writer_close (FrameIndexWriter * writer, gboolean commit)
+{
+  guint res = FRAME_INDEX_OK;
+
+  if (writer->fd) {
+    if (commit && (fseek(writer->fd, 0, SEEK_SET) != 0 || fwrite(&writer->header, sizeof(FrameIndexHeader), 1, writer->fd) != 1)) {
+      res = FRAME_INDEX_ERROR_WRITE;
+    }
+    if (fclose(writer->fd) != 0) {
+      res = FRAME_INDEX_ERROR_WRITE;
+    }
+    writer->fd = NULL;
+  } else {
+    res = FRAME_INDEX_ERROR_WRITE;
+  }
+
+  if (commit && res == FRAME_INDEX_OK && rename(writer->tmpPath, writer->path) < 0) {
+    res = FRAME_INDEX_ERROR_WRITE;
+  }
+  if (!commit || res != FRAME_INDEX_OK) {
+    unlink(writer->tmpPath);
+  }
+
+  g_free(writer->path);
+  g_free(writer->tmpPath);
+  writer->path = NULL;
+  writer->tmpPath = NULL;
+  return res;
+}
+
+/**
+ *
+ * This function maps the index of a capture. It fails with
+ * FRAME_INDEX_ERROR_STALE when the capture changed since the index was
+ * written or when it was written for another payload type.
+ *
+ */
+guint
+frame_index_load (FrameIndex * index, const gchar * pcapPath, guint payloadType)
+{
+  gchar * path = frame_index_path(pcapPath);
+  const FrameIndexHeader * header;
+  struct stat st;
+  guint64 pcapSize;
+  gint64 pcapMtime;
+  void * data;
+
+  memset(index, 0, sizeof(FrameIndex));
+  index->fd = open(path, O_RDONLY);
+  g_free(path);
+  if (index->fd < 0) {
+    return FRAME_INDEX_ERROR_OPEN;
+  }
+  if (fstat(index->fd, &st) < 0 || st.st_size < (off_t) sizeof(FrameIndexHeader)) {
+    frame_index_free(index);
+    return FRAME_INDEX_ERROR_FORMAT;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, index->fd, 0);
+  if (data == MAP_FAILED) {
+    frame_index_free(index);
+    return FRAME_INDEX_ERROR_OPEN;
+  }
+  index->data = data;
+  index->size = st.st_size;
+  header = (const FrameIndexHeader *) index->data;
+
+  if (memcmp(header->magic, FRAME_INDEX_MAGIC, sizeof(header->magic)) != 0 || header->version != FRAME_INDEX_VERSION ||
+      header->entrySize != sizeof(FrameIndexEntry) || header->entries != (index->size - sizeof(FrameIndexHeader)) / sizeof(FrameIndexEntry) ||
+      (index->size - sizeof(FrameIndexHeader)) % sizeof(FrameIndexEntry) != 0) {
+    frame_index_free(index);
+    return FRAME_INDEX_ERROR_FORMAT;
+  }
+  if (!frame_index_stat(pcapPath, &pcapSize, &pcapMtime) || header->pcapSize != pcapSize || header->pcapMtime != pcapMtime ||
+      header->payloadType != payloadType) {
+    frame_index_free(index);
+    return FRAME_INDEX_ERROR_STALE;
+  }
+
+  index->header = header;
+  index->entries = (const FrameIndexEntry *) (index->data + sizeof(FrameIndexHeader));
+  return FRAME_INDEX_OK;
+}
+
+void
+frame_index_free (FrameIndex * index)
+{
+  if (index->data) {
+    munmap((void *) index->data, index->size);
+    index->data = NULL;
+  }
+  if (index->fd >= 0) {
+    close(index->fd);
+    index->fd = -1;
+  }
+  index->header = NULL;
+  index->entries = NULL;
+}
+
+/* +seconds, HH:MM[:SS] or seconds since the epoch */
+static gboolean
+frame_index_time_parse (const gchar * text, FrameIndexTime * time)
+{
+  gchar * end;
+
+  if (text[0] == '+') {
+    text++;
+    time->kind = FRAME_INDEX_TIME_RELATIVE;
+    time->seconds = g_ascii_strtod(text, &end);
+  } else if (strchr(text, ':')) {
+    guint hours, minutes;
+    gdouble seconds = 0;
+    gint len = 0;
+    if (sscanf(text, "%u:%u%n:%lf%n", &hours, &minutes, &len, &seconds, &len) < 2 || hours > 23 || minutes > 59 || seconds >= 60) {
+      return FALSE;
+    }
+    time->kind = FRAME_INDEX_TIME_OF_DAY;
+    time->seconds = hours * 3600 + minutes * 60 + seconds;
+    end = (gchar *) text + len;
+  } else {
+    time->kind = FRAME_INDEX_TIME_EPOCH;
+    time->seconds = g_ascii_strtod(text, &end);
+  }
+  return end != text && *end == '\0' && time->seconds >= 0;
+}
+
+/**
+ *
+ * This function parses a query: terms separated by commas, all of them
+ * must match.
+ *
+ *   ssrc=<ssrc>           the frames of a stream
+ *   keyframes             only keyframes
+ *   changes               only resolution changes
+ *   corrupt               only frames that failed to parse
+ *   frames=<n>[-[<m>]]    frame numbers (of each stream)
+ *   from=<time>           capture time, +seconds from the first frame,
+ *   to=<time>             HH:MM[:SS] (UTC) or seconds since the epoch
+ *
+ */
+gboolean
+frame_index_query_parse (const gchar * text, FrameIndexQuery * query)
+{
+  gchar ** terms = g_strsplit(text ? text : "", ",", -1);
+  gboolean ok = TRUE;
+  guint i;
+
+  memset(query, 0, sizeof(FrameIndexQuery));
+  query->lastFrame = G_MAXUINT;
+  query->toArrival = G_MAXUINT64;
+
+  for (i = 0; ok && terms[i]; i++) {
+    gchar * term = g_strstrip(terms[i]);
+    gchar * value = strchr(term, '=');
+    gchar * end;
+
+    if (value) {
+      *value++ = '\0';
+    }
+    if (*term == '\0' && !value) {
+      continue;
+    } else if (!value && g_strcmp0(term, "keyframes") == 0) {
+      query->flags |= FRAME_INDEX_KEYFRAME;
+    } else if (!value && g_strcmp0(term, "changes") == 0) {
+      query->flags |= FRAME_INDEX_RESOLUTION_CHANGE;
+    } else if (!value && g_strcmp0(term, "corrupt") == 0) {
+      query->flags |= FRAME_INDEX_CORRUPT;
+    } else if (value && g_strcmp0(term, "ssrc") == 0) {
+      guint64 ssrc = g_ascii_strtoull(value, &end, 0);
+      ok = end != value && *end == '\0' && ssrc <= G_MAXUINT32;
+      query->hasSsrc = TRUE;
+      query->ssrc = (guint32) ssrc;
+    } else if (value && g_strcmp0(term, "frames") == 0) {
+      query->firstFrame = (guint) g_ascii_strtoull(value, &end, 10);
+      ok = end != value;
+      if (ok && *end == '-') {
+        gchar * last = end + 1;
+        if (*last != '\0') {
+          query->lastFrame = (guint) g_ascii_strtoull(last, &end, 10);
+          ok = end != last;
+        } else {
+          end = last;
+        }
+      } else {
+        query->lastFrame = query->firstFrame;
+      }
+      ok = ok && *end == '\0' && query->firstFrame <= query->lastFrame;
+    } else if (value && g_strcmp0(term, "from") == 0) {
+      ok = frame_index_time_parse(value, &query->from);
+    } else if (value && g_strcmp0(term, "to") == 0) {
+      ok = frame_index_time_parse(value, &query->to);
+    } else {
+      ok = FALSE;
+    }
+  }
+
+  g_strfreev(terms);
+  return ok;
+}
+
+static guint64
+frame_index_time_resolve (const FrameIndex * index, const FrameIndexTime * time, guint64 none)
+{
+  guint64 start = index->header->firstArrival;
+  gdouble day, at;
+
+  switch (time->kind) {
+    case FRAME_INDEX_TIME_EPOCH:
+      return (guint64) (time->seconds * 1e9);
+    case FRAME_INDEX_TIME_RELATIVE:
+      return start + (guint64) (time->seconds * 1e9);
+    case FRAME_INDEX_TIME_OF_DAY:
+      /* on the day the capture started, or the next one when that is more than 12 hours before the start */
+      day = (start / 1000000000 / 86400) * 86400.0;
+      at = day + time->seconds;
+      if (at + 43200 < start / 1e9) {
+        at += 86400;
+      }
+      return (guint64) (at * 1e9);
+    default:
+      return none;
+  }
+}
+
+/* The times of the query are converted to capture times with the start of the capture */
+void
+frame_index_query_resolve (const FrameIndex * index, FrameIndexQuery * query)
+{
+  query->fromArrival = frame_index_time_resolve(index, &query->from, 0);
+  query->toArrival = frame_index_time_resolve(index, &query->to, G_MAXUINT64);
+}
+
+gboolean
+frame_index_query_match (const FrameIndexQuery * query, const FrameIndexEntry * entry)
+{
+  return (!query->hasSsrc || entry->ssrc == query->ssrc) &&
+    (entry->flags & query->flags) == query->flags &&
+    entry->frameNumber >= query->firstFrame && entry->frameNumber <= query->lastFrame &&
+    entry->arrival >= query->fromArrival && entry->arrival <= query->toArrival;
+}
+
+static gint
+frame_index_compare_seq (gconstpointer a, gconstpointer b, gpointer data)
+{
+  guint16 first = *(guint16 *) data;
+
+  return (gint) (guint16) (((const RtpPacket *) a)->seq - first) - (gint) (guint16) (((const RtpPacket *) b)->seq - first);
+}
+
+/* Whether a packet with this sequence number was already read (a duplicated packet is read once) */
+static gboolean
+frame_index_has_seq (const GArray * packets, guint16 seq)
+{
+  guint i;
+
+  for (i = 0; i < packets->len; i++) {
+    if (g_array_index(packets, RtpPacket, i).seq == seq) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/**
+ *
+ * This function reads the packets of a frame from its offset: the packets
+ * of its SSRC with its RTP timestamp, until they go from the start of the
+ * frame to the marker without gaps. They are sorted by sequence number,
+ * the duplicates are skipped.
+ *
+ */
+static gboolean
+frame_index_read_frame (PcapReader * reader, guint payloadType, const FrameIndexEntry * entry, GArray * packets, guint64 * read)
+{
+  PcapPacket packet;
+  RtpPacket rtp;
+  Vp8PayloadDescriptor descriptor;
+  gboolean haveFirst = FALSE, haveMarker = FALSE;
+  guint16 firstSeq = 0, markerSeq = 0;
+  guint i;
+
+  g_array_set_size(packets, 0);
+  if (!pcap_reader_seek(reader, entry->offset)) {
+    return FALSE;
+  }
+
+  for (i = 0; i < FRAME_INDEX_SCAN_PACKETS && pcap_reader_next(reader, &packet); i++) {
+    (*read)++;
+    if (!rtp_packet_parse(packet.payload, packet.payloadLen, &rtp) || rtp.payloadType != payloadType ||
+        rtp.ssrc != entry->ssrc || rtp.timestamp != entry->rtpTimestamp || frame_index_has_seq(packets, rtp.seq)) {
+      continue;
+    }
+    rtp.arrival = packet.timestamp;
+    g_array_append_val(packets, rtp);
+
+    if (vp8_payload_descriptor_parse(rtp.payload, rtp.payloadLen, &descriptor) && descriptor.startOfPartition && descriptor.partitionIndex == 0) {
+      haveFirst = TRUE;
+      firstSeq = rtp.seq;
+    }
+    if (rtp.marker) {
+      haveMarker = TRUE;
+      markerSeq = rtp.seq;
+    }
+    if (haveFirst && haveMarker && packets->len == (guint) (guint16) (markerSeq - firstSeq) + 1) {
+      g_array_sort_with_data(packets, frame_index_compare_seq, &firstSeq);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* Like the native engine (see native_stream_push()), with the frame number and resolution of the index */
+static void
+frame_index_inspect (StreamInspector * streamInspector, const FrameIndexEntry * entry, const Vp8Frame * frame, guint parseDepth)
+{
+  guint8 prefix[FRAME_HEADER_FULL_PREFIX_SZ];
+  guint available = vp8_frame_copy(frame, prefix, vp8_header_prefix_size(parseDepth));
+  guint8 table[PARTITION_TABLE_SZ];
+  guint tableAvailable = vp8_frame_copy_at(frame, vp8_partition_table_offset(prefix, available), table, sizeof(table));
+
+  streamInspector->frameNumber = entry->frameNumber;
+  streamInspector->lastResolution.width = entry->width & 0x3fff;
+  streamInspector->lastResolution.widthScale = entry->width >> 14;
+  streamInspector->lastResolution.height = entry->height & 0x3fff;
+  streamInspector->lastResolution.heightScale = entry->height >> 14;
+  inspect_frame_info(streamInspector, prefix, available, table, tableAvailable, frame->size, entry->pts, frame->arrival);
+}
+
+static void
+frame_index_destroy_inspector (gpointer key, gpointer value, gpointer data)
+{
+  stream_inspector_destroy((StreamInspector *) value);
+}
+
+/**
+ *
+ * This function inspects again the frames of the index that match the
+ * query, reading only their packets. The results are the same lines of
+ * the whole inspection, in the same order.
+ *
+ */
+guint
+frame_index_query_run (const FrameIndex * index, const gchar * pcapPath, const FrameIndexQuery * query, guint parseDepth, const OutputSettings * output, FrameIndexQueryStats * stats)
+{
+  FrameIndexQuery resolved = *query;
+  GHashTable * inspectors;
+  GArray * packets;
+  PcapReader reader;
+  Vp8Depay depay;
+  guint64 i;
+  guint j;
+
+  memset(stats, 0, sizeof(FrameIndexQueryStats));
+  stats->entries = index->header->entries;
+  frame_index_query_resolve(index, &resolved);
+
+  if (pcap_reader_open(&reader, pcapPath) != PCAP_OK) {
+    return FRAME_INDEX_ERROR_OPEN;
+  }
+  /* the reads jump from frame to frame */
+  madvise((void *) reader.data, reader.size, MADV_RANDOM);
+
+  inspectors = g_hash_table_new(g_direct_hash, g_direct_equal);
+  packets = g_array_new(FALSE, FALSE, sizeof(RtpPacket));
+  vp8_depay_init_sized(&depay, vp8_header_prefix_size(parseDepth));
+
+  for (i = 0; i < index->header->entries; i++) {
+    const FrameIndexEntry * entry = &index->entries[i];
+    StreamInspector * streamInspector;
+    gboolean complete = FALSE;
+
+    if (!frame_index_query_match(&resolved, entry)) {
+      continue;
+    }
+    stats->matched++;
+    if (!frame_index_read_frame(&reader, index->header->payloadType, entry, packets, &stats->packets)) {
+      continue;
+    }
+
+    vp8_depay_reset(&depay);
+    for (j = 0; j < packets->len; j++) {
+      complete = vp8_depay_push(&depay, &g_array_index(packets, RtpPacket, j));
+    }
+    if (!complete) {
+      continue;
+    }
+
+    streamInspector = g_hash_table_lookup(inspectors, GUINT_TO_POINTER(entry->ssrc));
+    if (!streamInspector) {
+      gchar padName[64];
+      g_snprintf(padName, sizeof(padName), "recv_rtp_src_0_%u_%u", entry->ssrc, index->header->payloadType);
+      streamInspector = stream_inspector_initialize(padName, parseDepth, output);
+      g_hash_table_insert(inspectors, GUINT_TO_POINTER(entry->ssrc), streamInspector);
+    }
+    frame_index_inspect(streamInspector, entry, &depay.frame, parseDepth);
+    stats->inspected++;
+  }
+
+  g_hash_table_foreach(inspectors, frame_index_destroy_inspector, NULL);
+  g_hash_table_destroy(inspectors);
+  g_array_free(packets, TRUE);
+  vp8_depay_clear(&depay);
+  pcap_reader_close(&reader);
+  return FRAME_INDEX_OK;
+}
@@ -0,0 +1,151 @@
+#ifndef FRAME_INDEX_H
+#define FRAME_INDEX_H
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "stream_inspector.h"
+#include "vp8_parser.h"
+
+/**
+ *
+ * Frame index of a capture (--index, --query).
+ *
+ * The native engine can write, while it inspects a PCAP file, a sidecar
+ * <file>.vp8idx with an entry per inspected frame: SSRC, frame number,
+ * PTS, capture time, RTP timestamp, the offset of the first pcap record of
+ * the frame, its size, resolution and some markers (keyframe, resolution
+ * change, corrupt). A query reads the index, seeks to the frames that
+ * match and only parses those.
+ *
+ * The index is valid while the capture has the same size and mtime, and
+ * for the payload type it was built for. The file is a header and the
+ * entries in the order they were inspected, both in the byte order of the
+ * host that wrote it (the version and the entry size read differently in
+ * the other byte order, so a foreign index is rebuilt).
+ *
+ */
+
+#define FRAME_INDEX_MAGIC "VP8INDEX"
+#define FRAME_INDEX_SUFFIX ".vp8idx"
+
+enum
+{
+  FRAME_INDEX_VERSION = 1,
+  FRAME_INDEX_SCAN_PACKETS = 4096   /* records read from the offset of a frame looking for its packets */
+};
+
+enum
+{
+  FRAME_INDEX_OK = 0,
+  FRAME_INDEX_ERROR_OPEN = 1,
+  FRAME_INDEX_ERROR_FORMAT = 2,
+  FRAME_INDEX_ERROR_STALE = 3,     /* the capture changed, or another payload type */
+  FRAME_INDEX_ERROR_WRITE = 4,
+  FRAME_INDEX_ERROR_QUERY = 5
+};
+
+typedef enum
+{
+  FRAME_INDEX_KEYFRAME = 1 << 0,
+  FRAME_INDEX_RESOLUTION_CHANGE = 1 << 1,
+  FRAME_INDEX_SHOW = 1 << 2,
+  FRAME_INDEX_CORRUPT = 1 << 3
+} FrameIndexFlags;
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 entrySize;
+  guint64 pcapSize;
+  gint64 pcapMtime;       /* nanoseconds */
+  guint64 entries;
+  guint64 firstArrival;   /* capture time of the first frame, nanoseconds since the epoch */
+  guint32 payloadType;
+  guint32 reserved;
+} FrameIndexHeader;
+
+typedef struct
+{
+  guint64 offset;         /* pcap record of the first packet of the frame (the lowest offset) */
+  guint64 arrival;        /* capture time of the first packet, nanoseconds since the epoch */
+  guint64 pts;            /* like in the results, nanoseconds */
+  guint32 ssrc;
+  guint32 rtpTimestamp;
+  guint32 frameNumber;
+  guint32 size;
+  guint16 width;          /* scale << 14 | width, like in the keyframe header */
+  guint16 height;
+  guint32 flags;          /* FrameIndexFlags */
+} FrameIndexEntry;
+
+typedef struct
+{
+  FILE * fd;
+  gchar * path;
+  gchar * tmpPath;
+  FrameIndexHeader header;
+} FrameIndexWriter;
+
+typedef struct
+{
+  int fd;
+  const guint8 * data;
+  gsize size;
+  const FrameIndexHeader * header;
+  const FrameIndexEntry * entries;
+} FrameIndex;
+
+typedef enum
+{
+  FRAME_INDEX_TIME_NONE = 0,
+  FRAME_INDEX_TIME_EPOCH = 1,       /* seconds since the epoch */
+  FRAME_INDEX_TIME_RELATIVE = 2,    /* +seconds from the first frame of the capture */
+  FRAME_INDEX_TIME_OF_DAY = 3       /* HH:MM[:SS] UTC, the first one after the start of the capture */
+} FrameIndexTimeKind;
+
+typedef struct
+{
+  FrameIndexTimeKind kind;
+  gdouble seconds;
+} FrameIndexTime;
+
+/* The frames that match all the terms of a query */
+typedef struct
+{
+  gboolean hasSsrc;
+  guint32 ssrc;
+  guint flags;            /* FrameIndexFlags that the frames must have */
+  guint firstFrame;
+  guint lastFrame;
+  FrameIndexTime from;
+  FrameIndexTime to;
+  guint64 fromArrival;    /* from and to in capture time, see frame_index_query_resolve() */
+  guint64 toArrival;
+} FrameIndexQuery;
+
+typedef struct
+{
+  guint64 entries;
+  guint64 matched;
+  guint64 inspected;      /* matched frames found again in the capture */
+  guint64 packets;        /* UDP packets read from the capture */
+} FrameIndexQueryStats;
+
+
+gchar * frame_index_path(const gchar * pcapPath);
+
+guint frame_index_writer_open(FrameIndexWriter * writer, const gchar * pcapPath, guint payloadType);
+void frame_index_writer_add(FrameIndexWriter * writer, guint32 ssrc, guint32 rtpTimestamp, guint64 offset, const FrameInfo * info, const FrameResolution * previous);
+guint frame_index_writer_close(FrameIndexWriter * writer, gboolean commit);
+
+guint frame_index_load(FrameIndex * index, const gchar * pcapPath, guint payloadType);
+void frame_index_free(FrameIndex * index);
+
+gboolean frame_index_query_parse(const gchar * text, FrameIndexQuery * query);
+void frame_index_query_resolve(const FrameIndex * index, FrameIndexQuery * query);
+gboolean frame_index_query_match(const FrameIndexQuery * query, const FrameIndexEntry * entry);
+guint frame_index_query_run(const FrameIndex * index, const gchar * pcapPath, const FrameIndexQuery * query, guint parseDepth, const OutputSettings * output, FrameIndexQueryStats * stats);
+
+#endif
@@ -0,0 +1,315 @@
+/**
+ *
+ * Binary frame records, see frame_record.h for the layout.
+ *
+ * Writing a record is a few stores, no formatting at all. The reader maps
+ * the whole file, so the records can be scanned in place (see
+ * frame_record_reader_get()) or decoded one by one into a FrameInfo.
+ *
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame_record.h"
+
+static inline void
+write_le16 (guint8 * p, guint16 value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static inline void
+write_le32 (guint8 * p, guint32 value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+static inline void
+write_le64 (guint8 * p, guint64 value)
+{
+  write_le32(p, (guint32) value);
+  write_le32(p + 4, (guint32) (value >> 32));
+}
+
+static inline guint16
+read_le16 (const guint8 * p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline guint32
+read_le32 (const guint8 * p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+}
+
+static inline guint64
+read_le64 (const guint8 * p)
+{
+  return read_le32(p) | ((guint64) read_le32(p + 4) << 32);
+}
+
+void
+frame_record_write_header (guint8 * out)
+{
+  memset(out, 0, FRAME_RECORD_HEADER_SZ);
+  memcpy(out, FRAME_RECORD_MAGIC, 4);
+  write_le16(out + 4, FRAME_RECORD_VERSION);
+  write_le16(out + 6, FRAME_RECORD_SZ);
+}
+
+void
+frame_record_encode (guint8 * out, guint32 ssrc, const FrameInfo * ctx)
+{
+  guint8 flags = (ctx->ok ? FRAME_RECORD_FLAG_OK : 0)
+    | (ctx->keyframe ? FRAME_RECORD_FLAG_KEYFRAME : 0)
+    | (ctx->isExperimental ? FRAME_RECORD_FLAG_EXPERIMENTAL : 0)
+    | (ctx->showFrame ? FRAME_RECORD_FLAG_SHOW_FRAME : 0)
+    | (ctx->refreshGoldenFrame ? FRAME_RECORD_FLAG_REFRESH_GOLDEN : 0)
+    | (ctx->refreshAltrefFrame ? FRAME_RECORD_FLAG_REFRESH_ALTREF : 0);
+
+  write_le32(out, ssrc);
+  write_le32(out + 4, ctx->frameNumber);
+  write_le64(out + 8, ctx->pts);
+  write_le64(out + 16, ctx->arrival);
+  write_le32(out + 24, ctx->size);
+  write_le32(out + 28, ctx->partSize);
+  write_le16(out + 32, ctx->resolution.width);
+  write_le16(out + 34, ctx->resolution.height);
+  out[36] = ctx->resolution.widthScale;
+  out[37] = ctx->resolution.heightScale;
+  out[38] = ctx->version;
+  out[39] = flags;
+
+  out[40] = ctx->parseDepth;
+  out[41] = ctx->partitions;
+  out[42] = (ctx->colorSpace ? FRAME_RECORD_HEADER_COLOR_SPACE : 0)
+    | (ctx->clampingType ? FRAME_RECORD_HEADER_CLAMPING_TYPE : 0)
+    | (ctx->refreshEntropyProbs ? FRAME_RECORD_HEADER_REFRESH_ENTROPY_PROBS : 0)
+    | (ctx->refreshLast ? FRAME_RECORD_HEADER_REFRESH_LAST : 0)
+    | (ctx->signBiasGolden ? FRAME_RECORD_HEADER_SIGN_BIAS_GOLDEN : 0)
+    | (ctx->signBiasAltref ? FRAME_RECORD_HEADER_SIGN_BIAS_ALTREF : 0);
+  out[43] = (ctx->copyBufferToGolden & 0x3) | ((ctx->copyBufferToAltref & 0x3) << 2);
+
+  out[44] = ctx->quantizer.yAcQi;
+  out[45] = ctx->quantizer.y1DcDelta;
+  out[46] = ctx->quantizer.y2DcDelta;
+  out[47] = ctx->quantizer.y2AcDelta;
+  out[48] = ctx->quantizer.uvDcDelta;
+  out[49] = ctx->quantizer.uvAcDelta;
+
+  out[50] = ctx->loopFilter.filterType;
+  out[51] = ctx->loopFilter.level;
+  out[52] = ctx->loopFilter.sharpness;
+  out[53] = (ctx->loopFilter.deltaEnabled ? FRAME_RECORD_LF_DELTA_ENABLED : 0)
+    | (ctx->loopFilter.deltaUpdate ? FRAME_RECORD_LF_DELTA_UPDATE : 0);
+  memcpy(out + 54, ctx->loopFilter.refFrameDelta, BLOCK_CONTEXTS);
+  memcpy(out + 58, ctx->loopFilter.modeDelta, BLOCK_CONTEXTS);
+
+  out[62] = (ctx->segmentation.enabled ? FRAME_RECORD_SEGMENTATION_ENABLED : 0)
+    | (ctx->segmentation.updateMap ? FRAME_RECORD_SEGMENTATION_UPDATE_MAP : 0)
+    | (ctx->segmentation.updateData ? FRAME_RECORD_SEGMENTATION_UPDATE_DATA : 0)
+    | (ctx->segmentation.absoluteDelta ? FRAME_RECORD_SEGMENTATION_ABSOLUTE_DELTA : 0);
+  memcpy(out + 63, ctx->segmentation.quantizer, MAX_MB_SEGMENTS);
+  memcpy(out + 67, ctx->segmentation.loopFilterLevel, MAX_MB_SEGMENTS);
+  memcpy(out + 71, ctx->segmentation.treeProbs, MB_FEATURE_TREE_PROBS);
+
+  out[74] = (ctx->probs.mbNoCoeffSkip ? FRAME_RECORD_PROBS_MB_NO_COEFF_SKIP : 0)
+    | (ctx->probs.intra16x16Update ? FRAME_RECORD_PROBS_INTRA_16X16_UPDATE : 0)
+    | (ctx->probs.intraChromaUpdate ? FRAME_RECORD_PROBS_INTRA_CHROMA_UPDATE : 0);
+  out[75] = ctx->probs.probSkipFalse;
+  write_le16(out + 76, ctx->probs.coeffUpdates);
+  out[78] = ctx->probs.probIntra;
+  out[79] = ctx->probs.probLast;
+  out[80] = ctx->probs.probGolden;
+  memcpy(out + 81, ctx->probs.intra16x16Probs, INTRA_16X16_PROBS);
+  memcpy(out + 85, ctx->probs.intraChromaProbs, INTRA_CHROMA_PROBS);
+  out[88] = ctx->probs.mvUpdates;
+  out[89] = ctx->error;
+  memset(out + 90, 0, FRAME_RECORD_SZ - 90);
+}
+
+void
+frame_record_decode (const guint8 * data, guint recordSize, guint32 * ssrc, FrameInfo * ctx)
+{
+  guint8 flags = data[39];
+  guint8 header, lf, segmentation, probs;
+
+  memset(ctx, 0, sizeof(FrameInfo));
+  *ssrc = read_le32(data);
+  ctx->frameNumber = read_le32(data + 4);
+  ctx->pts = read_le64(data + 8);
+  ctx->arrival = read_le64(data + 16);
+  ctx->size = read_le32(data + 24);
+  ctx->partSize = read_le32(data + 28);
+  ctx->resolution.width = read_le16(data + 32);
+  ctx->resolution.height = read_le16(data + 34);
+  ctx->resolution.widthScale = data[36];
+  ctx->resolution.heightScale = data[37];
+  ctx->version = data[38];
+  ctx->ok = !!(flags & FRAME_RECORD_FLAG_OK);
+  ctx->keyframe = !!(flags & FRAME_RECORD_FLAG_KEYFRAME);
+  ctx->isExperimental = !!(flags & FRAME_RECORD_FLAG_EXPERIMENTAL);
+  ctx->showFrame = !!(flags & FRAME_RECORD_FLAG_SHOW_FRAME);
+  ctx->refreshGoldenFrame = !!(flags & FRAME_RECORD_FLAG_REFRESH_GOLDEN);
+  ctx->refreshAltrefFrame = !!(flags & FRAME_RECORD_FLAG_REFRESH_ALTREF);
+
+  /* version 1 records end here */
+  if (recordSize < FRAME_RECORD_SZ) {
+    return;
+  }
+
+  header = data[42];
+  ctx->parseDepth = data[40];
+  ctx->partitions = data[41];
+  ctx->colorSpace = !!(header & FRAME_RECORD_HEADER_COLOR_SPACE);
+  ctx->clampingType = !!(header & FRAME_RECORD_HEADER_CLAMPING_TYPE);
+  ctx->refreshEntropyProbs = !!(header & FRAME_RECORD_HEADER_REFRESH_ENTROPY_PROBS);
+  ctx->refreshLast = !!(header & FRAME_RECORD_HEADER_REFRESH_LAST);
+  ctx->signBiasGolden = !!(header & FRAME_RECORD_HEADER_SIGN_BIAS_GOLDEN);
+  ctx->signBiasAltref = !!(header & FRAME_RECORD_HEADER_SIGN_BIAS_ALTREF);
+  ctx->copyBufferToGolden = data[43] & 0x3;
+  ctx->copyBufferToAltref = (data[43] >> 2) & 0x3;
+
+  ctx->quantizer.yAcQi = data[44];
+  ctx->quantizer.y1DcDelta = (gint8) data[45];
+  ctx->quantizer.y2DcDelta = (gint8) data[46];
+  ctx->quantizer.y2AcDelta = (gint8) data[47];
+  ctx->quantizer.uvDcDelta = (gint8) data[48];
+  ctx->quantizer.uvAcDelta = (gint8) data[49];
+
+  lf = data[53];
+  ctx->loopFilter.filterType = data[50];
+  ctx->loopFilter.level = data[51];
+  ctx->loopFilter.sharpness = data[52];
+  ctx->loopFilter.deltaEnabled = !!(lf & FRAME_RECORD_LF_DELTA_ENABLED);
+  ctx->loopFilter.deltaUpdate = !!(lf & FRAME_RECORD_LF_DELTA_UPDATE);
+  memcpy(ctx->loopFilter.refFrameDelta, data + 54, BLOCK_CONTEXTS);
+  memcpy(ctx->loopFilter.modeDelta, data + 58, BLOCK_CONTEXTS);
+
+  segmentation = data[62];
+  ctx->segmentation.enabled = !!(segmentation & FRAME_RECORD_SEGMENTATION_ENABLED);
+  ctx->segmentation.updateMap = !!(segmentation & FRAME_RECORD_SEGMENTATION_UPDATE_MAP);
+  ctx->segmentation.updateData = !!(segmentation & FRAME_RECORD_SEGMENTATION_UPDATE_DATA);
+  ctx->segmentation.absoluteDelta = !!(segmentation & FRAME_RECORD_SEGMENTATION_ABSOLUTE_DELTA);
+  memcpy(ctx->segmentation.quantizer, data + 63, MAX_MB_SEGMENTS);
+  memcpy(ctx->segmentation.loopFilterLevel, data + 67, MAX_MB_SEGMENTS);
+  memcpy(ctx->segmentation.treeProbs, data + 71, MB_FEATURE_TREE_PROBS);
+
+  probs = data[74];
+  ctx->probs.mbNoCoeffSkip = !!(probs & FRAME_RECORD_PROBS_MB_NO_COEFF_SKIP);
+  ctx->probs.intra16x16Update = !!(probs & FRAME_RECORD_PROBS_INTRA_16X16_UPDATE);
+  ctx->probs.intraChromaUpdate = !!(probs & FRAME_RECORD_PROBS_INTRA_CHROMA_UPDATE);
+  ctx->probs.probSkipFalse = data[75];
+  ctx->probs.coeffUpdates = read_le16(data + 76);
+  ctx->probs.probIntra = data[78];
+  ctx->probs.probLast = data[79];
+  ctx->probs.probGolden = data[80];
+  memcpy(ctx->probs.intra16x16Probs, data + 81, INTRA_16X16_PROBS);
+  memcpy(ctx->probs.intraChromaProbs, data + 85, INTRA_CHROMA_PROBS);
+  ctx->probs.mvUpdates = data[88];
+  ctx->error = data[89];
+}
+
+/**
+ *
+ * This function maps a record file in memory and validates its header.
+ * An empty file (a stream without frames) is not valid, it has at least the header.
+ *
+ */
+guint
+frame_record_reader_open (FrameRecordReader * reader, const gchar * path)
+{
+  struct stat st;
+  void * data;
+
+  memset(reader, 0, sizeof(FrameRecordReader));
+  reader->fd = open(path, O_RDONLY);
+  if (reader->fd < 0) {
+    return FRAME_RECORD_ERROR_OPEN;
+  }
+
+  if (fstat(reader->fd, &st) < 0 || st.st_size < FRAME_RECORD_HEADER_SZ) {
+    close(reader->fd);
+    return FRAME_RECORD_ERROR_FORMAT;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+  if (data == MAP_FAILED) {
+    close(reader->fd);
+    return FRAME_RECORD_ERROR_OPEN;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  reader->data = data;
+  reader->size = st.st_size;
+  reader->offset = FRAME_RECORD_HEADER_SZ;
+
+  if (memcmp(reader->data, FRAME_RECORD_MAGIC, 4) != 0) {
+    frame_record_reader_close(reader);
+    return FRAME_RECORD_ERROR_FORMAT;
+  }
+
+  reader->version = read_le16(reader->data + 4);
+  reader->recordSize = read_le16(reader->data + 6);
+  if (reader->version < 1 || reader->recordSize < FRAME_RECORD_V1_SZ) {
+    frame_record_reader_close(reader);
+    return FRAME_RECORD_ERROR_VERSION;
+  }
+
+  return FRAME_RECORD_OK;
+}
+
+void
+frame_record_reader_close (FrameRecordReader * reader)
+{
+  if (reader->data) {
+    munmap((void *) reader->data, reader->size);
+    reader->data = NULL;
+  }
+  if (reader->fd >= 0) {
+    close(reader->fd);
+    reader->fd = -1;
+  }
+}
+
+/* A truncated last record (the writer was killed) is ignored */
+guint64
+frame_record_reader_count (const FrameRecordReader * reader)
+{
+  return (reader->size - FRAME_RECORD_HEADER_SZ) / reader->recordSize;
+}
+
+/**
+ *
+ * This function returns the raw record at `index`, pointing into the mapped file.
+ *
+ */
+const guint8 *
+frame_record_reader_get (const FrameRecordReader * reader, guint64 index)
+{
+  if (index >= frame_record_reader_count(reader)) {
+    return NULL;
+  }
+  return reader->data + FRAME_RECORD_HEADER_SZ + index * reader->recordSize;
+}
+
+gboolean
+frame_record_reader_next (FrameRecordReader * reader, guint32 * ssrc, FrameInfo * ctx)
+{
+  if (reader->offset + reader->recordSize > reader->size) {
+    return FALSE;
+  }
+
+  frame_record_decode(reader->data + reader->offset, reader->recordSize, ssrc, ctx);
+  reader->offset += reader->recordSize;
+  return TRUE;
+}
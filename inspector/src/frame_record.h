@@ -0,0 +1,149 @@
+#ifndef FRAME_RECORD_H
+#define FRAME_RECORD_H
+
+#include <glib.h>
+
+#include "vp8_parser.h"
+
+/**
+ *
+ * Binary frame record files (--format=binary).
+ *
+ * A file starts with a FRAME_RECORD_HEADER_SZ header followed by
+ * fixed-size records. Every field is little-endian.
+ *
+ * Header:
+ *   0  magic "VP8R"
+ *   4  u16 version
+ *   6  u16 record size
+ *   8  u32 reserved
+ *   12 u32 reserved
+ *
+ * Record (version 1):
+ *   0  u32 ssrc
+ *   4  u32 frame number
+ *   8  u64 pts (nanoseconds)
+ *   16 u64 arrival (nanoseconds since the epoch, 0 when unknown)
+ *   24 u32 frame size
+ *   28 u32 first partition size
+ *   32 u16 width
+ *   34 u16 height
+ *   36 u8  width scale
+ *   37 u8  height scale
+ *   38 u8  version
+ *   39 u8  flags (FRAME_RECORD_FLAG_*)
+ *
+ * Appended in version 2, the rest of the frame header (zero when it was
+ * not parsed, see the parse depth):
+ *   40 u8  parse depth (VP8_PARSE_DEPTH_*)
+ *   41 u8  DCT partitions
+ *   42 u8  header flags (FRAME_RECORD_HEADER_*)
+ *   43 u8  copy buffer to golden (bits 0-1), copy buffer to altref (bits 2-3)
+ *   44 u8  y ac quantizer index
+ *   45 i8  y1 dc, y2 dc, y2 ac, uv dc, uv ac quantizer deltas (5 bytes)
+ *   50 u8  loop filter type
+ *   51 u8  loop filter level
+ *   52 u8  loop filter sharpness
+ *   53 u8  loop filter flags (FRAME_RECORD_LF_*)
+ *   54 i8  loop filter ref frame deltas (4 bytes)
+ *   58 i8  loop filter mode deltas (4 bytes)
+ *   62 u8  segmentation flags (FRAME_RECORD_SEGMENTATION_*)
+ *   63 i8  segment quantizers (4 bytes)
+ *   67 i8  segment loop filter levels (4 bytes)
+ *   71 u8  segment tree probabilities (3 bytes)
+ *   74 u8  probability flags (FRAME_RECORD_PROBS_*)
+ *   75 u8  prob skip false
+ *   76 u16 updated token probabilities
+ *   78 u8  prob intra, prob last, prob golden (3 bytes)
+ *   81 u8  intra 16x16 probabilities (4 bytes)
+ *   85 u8  intra chroma probabilities (3 bytes)
+ *   88 u8  updated motion vector probabilities
+ *   89 u8  parser error (VP8_CODEC_*)
+ *   90 reserved (6 bytes)
+ *
+ * Readers must use the record size of the header to walk the file,
+ * so new fields can be appended to the records.
+ *
+ */
+
+#define FRAME_RECORD_MAGIC "VP8R"
+
+enum
+{
+  FRAME_RECORD_VERSION = 2,
+  FRAME_RECORD_HEADER_SZ = 16,
+  FRAME_RECORD_V1_SZ = 40,
+  FRAME_RECORD_SZ = 96
+};
+
+enum
+{
+  FRAME_RECORD_OK = 0,
+  FRAME_RECORD_ERROR_OPEN = 1,
+  FRAME_RECORD_ERROR_FORMAT = 2,
+  FRAME_RECORD_ERROR_VERSION = 3
+};
+
+enum
+{
+  FRAME_RECORD_FLAG_OK = 1 << 0,
+  FRAME_RECORD_FLAG_KEYFRAME = 1 << 1,
+  FRAME_RECORD_FLAG_EXPERIMENTAL = 1 << 2,
+  FRAME_RECORD_FLAG_SHOW_FRAME = 1 << 3,
+  FRAME_RECORD_FLAG_REFRESH_GOLDEN = 1 << 4,
+  FRAME_RECORD_FLAG_REFRESH_ALTREF = 1 << 5
+};
+
+enum
+{
+  FRAME_RECORD_HEADER_COLOR_SPACE = 1 << 0,
+  FRAME_RECORD_HEADER_CLAMPING_TYPE = 1 << 1,
+  FRAME_RECORD_HEADER_REFRESH_ENTROPY_PROBS = 1 << 2,
+  FRAME_RECORD_HEADER_REFRESH_LAST = 1 << 3,
+  FRAME_RECORD_HEADER_SIGN_BIAS_GOLDEN = 1 << 4,
+  FRAME_RECORD_HEADER_SIGN_BIAS_ALTREF = 1 << 5
+};
+
+enum
+{
+  FRAME_RECORD_LF_DELTA_ENABLED = 1 << 0,
+  FRAME_RECORD_LF_DELTA_UPDATE = 1 << 1
+};
+
+enum
+{
+  FRAME_RECORD_SEGMENTATION_ENABLED = 1 << 0,
+  FRAME_RECORD_SEGMENTATION_UPDATE_MAP = 1 << 1,
+  FRAME_RECORD_SEGMENTATION_UPDATE_DATA = 1 << 2,
+  FRAME_RECORD_SEGMENTATION_ABSOLUTE_DELTA = 1 << 3
+};
+
+enum
+{
+  FRAME_RECORD_PROBS_MB_NO_COEFF_SKIP = 1 << 0,
+  FRAME_RECORD_PROBS_INTRA_16X16_UPDATE = 1 << 1,
+  FRAME_RECORD_PROBS_INTRA_CHROMA_UPDATE = 1 << 2
+};
+
+typedef struct
+{
+  int fd;
+  const guint8 * data;
+  gsize size;
+  gsize offset;
+  guint version;
+  guint recordSize;
+} FrameRecordReader;
+
+
+void frame_record_write_header(guint8 * out);
+void frame_record_encode(guint8 * out, guint32 ssrc, const FrameInfo * ctx);
+void frame_record_decode(const guint8 * data, guint recordSize, guint32 * ssrc, FrameInfo * ctx);
+
+guint frame_record_reader_open(FrameRecordReader * reader, const gchar * path);
+void frame_record_reader_close(FrameRecordReader * reader);
+guint64 frame_record_reader_count(const FrameRecordReader * reader);
+const guint8 * frame_record_reader_get(const FrameRecordReader * reader, guint64 index);
+gboolean frame_record_reader_next(FrameRecordReader * reader, guint32 * ssrc, FrameInfo * ctx);
+
+#endif
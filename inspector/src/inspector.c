@@ -14,37 +14,57 @@
  * How it works?
  * 
  * The main pipeline contains a rtpbin module that detects new SSRC. 
- * So for each SSRC detected with the specified payload type, we create a new
- * bin containing the rtpvp8depay part. After we got the frames we process 
- * them to extract the desided data.
+ * The packets of every SSRC with the specified payload type leave its
+ * jitterbuffer into a single shared demux stage, where they are demuxed by
+ * SSRC and depayloaded like in the native engine. After we got the frames
+ * we process them to extract the desided data.
+ * 
+ * There is also a native engine (--native) that skips GStreamer completely.
+ * For PCAP files the capture is memory-mapped (or decompressed by another
+ * thread, pcap_stream.c) and the Ethernet/IP/UDP headers are decoded by
+ * pcap_reader.c. For realtime inspection the packets are read
+ * in batches by udp_receiver.c. In both cases the RTP headers are decoded by
+ * rtp_parser.c, the packets are demuxed by SSRC and the VP8 frames are
+ * assembled by vp8_depay.c before being inspected by the same
+ * inspect_frame_info() function.
+ * 
+ * The results are written by a single writer thread (output_writer.c), the
+ * inspection threads only queue them in a lock-free ring.
  * 
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <glib-unix.h>
 #include <gst/gst.h>
 
-#include "bool_decoder.h"
-#include "vp8_parser.h"
+#include "batch.h"
+#include "daemon.h"
+#include "follow.h"
+#include "frame_index.h"
+#include "latency_histogram.h"
+#include "log.h"
+#include "metrics.h"
+#include "native_worker.h"
+#include "pcap_reader.h"
+#include "stream_inspector.h"
 
 enum {
   OK = 0,
   ERROR_PARSE_ARGS = 1,
   ERROR_INVALID_ARGS = 2,
-  ERROR_PIPELINE_LINK = 3
+  ERROR_PIPELINE_LINK = 3,
+  ERROR_SOCKET = 4
 };
 
-typedef struct 
-{
-  gchar * ssrc;
-  GstElement *bin;
-  GstClockTime ptsOffset;
-  guint frameNumber;
-  FrameResolution lastResolution;
-  FILE *fdout;
-} StreamInspector;
+/* the default latency of the jitterbuffer of rtpbin */
+enum {
+  NATIVE_FILE_LATENCY_MS = 200
+};
 
 typedef struct
 {
@@ -52,9 +72,12 @@ typedef struct
   GstElement *pipeline;
   GstElement *rtpsrc;
   GstElement *rtpbin;
+  GstElement *funnel;         /* the shared demux stage, every SSRC pad of rtpbin is linked to it */
   gboolean closing;
   gboolean ready;
-  GHashTable *streams;
+  GMutex demuxMutex;          /* the streams are removed from the rtpbin threads */
+  NativeOptions demuxOptions;
+  NativeWorker demux;         /* the SSRC table, depayloader and StreamInspector of each SSRC */
 } Inspector;
 
 
@@ -63,128 +86,70 @@ static gint payloadType = 0;
 static gchar * outputPath = NULL;
 static gchar * inputFile = NULL;
 static gboolean useStdout = FALSE;
+static gboolean useNative = FALSE;
+static gint batchSize = UDP_RECEIVER_DEFAULT_BATCH_SZ;
+static gboolean kernelTimestamps = FALSE;
+static gint workers = 1;
+static gint flushInterval = OUTPUT_WRITER_DEFAULT_FLUSH_INTERVAL_MS;
+static gint flushBytes = OUTPUT_WRITER_DEFAULT_FLUSH_BYTES;
+static gint ringSize = OUTPUT_WRITER_DEFAULT_RING_SZ;
+static gchar * daemonSocket = NULL;
+static gint latencyMs = -1;
+static gint reorderWindow = -1;
+static gint statsInterval = -1;
+static gboolean perfCounters = FALSE;
+static gchar * metricsAddress = NULL;
+static gchar * batchPattern = NULL;
+static gint jobs = 0;
+static gint chunkSize = BATCH_DEFAULT_CHUNK_MB;
+static gboolean buildIndex = FALSE;
+static gchar * queryText = NULL;
+static gboolean followFile = FALSE;
+static gint aggregateInterval = 0;
+
+static gchar * outputFormat = NULL;
+static gchar * parseDepthName = NULL;
+static guint parseDepth = VP8_PARSE_DEPTH_REFERENCE;
+
+static OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+static MetricsServer metricsServer = { NULL, -1 };
+
+static volatile sig_atomic_t nativeClosing = 0;
+
+static gint inspectedFrames = 0;
 
 static GOptionEntry entries[] =
 {
   { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Port to receive rtp stream", "50000" },
   { "payloadType", 't', 0, G_OPTION_ARG_INT, &payloadType, "Expected VP8 Payload Type [96-127]", "96" },
-  { "file", 'f', 0, G_OPTION_ARG_STRING, &inputFile, "PCAP file as source", "./sample.pcap" },
+  { "file", 'f', 0, G_OPTION_ARG_STRING, &inputFile, "PCAP file as source, also .pcap.gz and .pcap.zst with --native", "./sample.pcap" },
   { "outputPath", 'o', 0, G_OPTION_ARG_STRING, &outputPath, "Path to inspector logs", "./inspector-logs" },
   { "stdout", 0, 0, G_OPTION_ARG_NONE, &useStdout, "Send the inspector results to stdout", NULL },
+  { "format", 0, 0, G_OPTION_ARG_STRING, &outputFormat, "Results format: text or binary (fixed-size records)", "text" },
+  { "parseDepth", 0, 0, G_OPTION_ARG_STRING, &parseDepthName, "How far the frame headers are parsed: tag, reference or full", "reference" },
+  { "native", 'n', 0, G_OPTION_ARG_NONE, &useNative, "Use the native PCAP reader and UDP receiver instead of GStreamer", NULL },
+  { "batchSize", 0, 0, G_OPTION_ARG_INT, &batchSize, "Max packets read per syscall by the native UDP receiver", "64" },
+  { "kernelTimestamps", 0, 0, G_OPTION_ARG_NONE, &kernelTimestamps, "Use the kernel receive time as frame PTS in native realtime mode", NULL },
+  { "workers", 'w', 0, G_OPTION_ARG_INT, &workers, "Worker threads for native realtime mode, SSRCs are sharded between them", "1" },
+  { "flushInterval", 0, 0, G_OPTION_ARG_INT, &flushInterval, "Max milliseconds the results wait in the output buffers before being flushed", "100" },
+  { "flushBytes", 0, 0, G_OPTION_ARG_INT, &flushBytes, "Flush the output buffers when this many bytes are pending", "65536" },
+  { "ringSize", 0, 0, G_OPTION_ARG_INT, &ringSize, "Max results queued for the output writer thread", "65536" },
+  { "daemon", 0, 0, G_OPTION_ARG_STRING, &daemonSocket, "Run the native engine as a daemon controlled through this Unix socket", "/tmp/inspector.sock" },
+  { "latencyMs", 0, 0, G_OPTION_ARG_INT, &latencyMs, "Jitter buffer latency, 0 to push the packets as they arrive (default: 200 for rtpbin and --native --file, 50 for --reorderWindow)", "200" },
+  { "reorderWindow", 0, 0, G_OPTION_ARG_INT, &reorderWindow, "Native engine: hold up to N packets after a gap, waiting for the missing ones (default: 256 with --file, else 0, no reordering)", "0" },
+  { "metrics", 0, 0, G_OPTION_ARG_STRING, &metricsAddress, "Serve the per-SSRC counters (Prometheus format) on a local TCP [address:]port or a Unix socket path", "9464" },
+  { "statsInterval", 0, 0, G_OPTION_ARG_INT, &statsInterval, "Log the per-SSRC stage latency every N seconds, 0 for only on SIGUSR1 and at exit (default: off)", "10" },
+  { "perfCounters", 0, 0, G_OPTION_ARG_NONE, &perfCounters, "Add the cycles, instructions, branch and cache misses per frame of the parse and output stages to the stage stats", NULL },
+  { "batch", 0, 0, G_OPTION_ARG_STRING, &batchPattern, "Native engine: inspect the PCAP files of a directory or a glob in parallel", "./captures" },
+  { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Threads for --batch (default: one per CPU)", "8" },
+  { "chunkSize", 0, 0, G_OPTION_ARG_INT, &chunkSize, "With --batch, split the files bigger than this many MB in per-SSRC chunks, 0 to never split them", "256" },
+  { "index", 0, 0, G_OPTION_ARG_NONE, &buildIndex, "Native engine: write the frame index of --file (<file>.vp8idx) while it is inspected, unless it is up to date", NULL },
+  { "query", 0, 0, G_OPTION_ARG_STRING, &queryText, "Only inspect the frames of --file that match, found with its index (built first when needed)", "ssrc=1234,keyframes" },
+  { "follow", 0, 0, G_OPTION_ARG_NONE, &followFile, "Native engine: keep inspecting the packets appended to --file until SIGINT, resuming from its checkpoint (<file>.vp8ckpt)", NULL },
+  { "aggregate", 0, 0, G_OPTION_ARG_INT, &aggregateInterval, "Write a line per stream every N seconds (fps, bitrate, keyframes...) instead of a line per frame, plus the keyframes and corrupt frames", "1" },
   { NULL }
 };
 
-void
-log_info (gchar *str, ...)
-{
-  gchar *info = g_strdup_printf("%s\n", str);
-  va_list arg;
-  va_start(arg, str);
-  vfprintf(stderr, info, arg);
-  va_end(arg);
-  g_free(info);
-}
-
-/**
- * 
- * This function is called to dump the frame info.
- * It can dump to an output file (--outputPath option)
- * and/or stdout (--stdout option)
- * 
- * */
-void
-dump_frame_info (StreamInspector * streamInspector , FrameInfo * ctx)
-{
-  gchar * result = g_strdup_printf(
-    "ssrc: %s, frame: %u, pts: %" G_GUINT64_FORMAT ", ok: %u, keyframe: %u, show: %u, width: %u, height: %u, refreshGoldenFrame: %u, refreshAltrefFrame: %u \n",
-    streamInspector->ssrc, ctx->frameNumber, GST_TIME_AS_MSECONDS(ctx->pts), ctx->ok, ctx->keyframe, ctx->showFrame,  
-    ctx->resolution.width, ctx->resolution.height, ctx->refreshGoldenFrame, ctx->refreshAltrefFrame);
-
-  if (useStdout) {
-    fprintf(stdout, "%s", result);
-    fflush(stdout);
-  }
-
-  if (outputPath) {
-    fprintf(streamInspector->fdout, "%s", result);
-    fflush(streamInspector->fdout);
-  }
-
-  g_free(result);
-}
-
-/**
- * 
- * This function is called when we got a VP8 frame.
- * We read the frame header according https://datatracker.ietf.org/doc/html/draft-bankoski-vp8-bitstream-06 
- * and https://github.com/webmproject/bitstream-guide to find all desired info.
- * 
- **/
-void
-inspect_frame_info(StreamInspector * streamInspector, unsigned char * data, unsigned int size, GstClockTime timestamp)
-{
-  struct bool_decoder bool;
-  FrameInfo * ctx = calloc(1, 1 * sizeof(FrameInfo));
-
-  ctx->ok = FALSE;
-  ctx->pts = timestamp;
-  ctx->frameNumber = streamInspector->frameNumber++;
-
-  ctx->ok = !vp8_parse_header(data, size, ctx);
-
-  if (ctx->keyframe) {
-    streamInspector->lastResolution.width = ctx->resolution.width;
-    streamInspector->lastResolution.widthScale = ctx->resolution.widthScale;
-    streamInspector->lastResolution.height = ctx->resolution.height;
-    streamInspector->lastResolution.heightScale = ctx->resolution.heightScale;
-  } else {      
-    ctx->resolution.width = streamInspector->lastResolution.width;
-    ctx->resolution.widthScale = streamInspector->lastResolution.widthScale;
-    ctx->resolution.height = streamInspector->lastResolution.height;
-    ctx->resolution.heightScale = streamInspector->lastResolution.heightScale;
-  }
-
-  dump_frame_info(streamInspector, ctx);
-  free(ctx);
-}
-
-
-/**
- *
- * This function is called to initialize a StreamInspector struct
- *  
- **/
-StreamInspector *
-stream_inspector_initialize (gchar * padName) {
-  log_info("stream_inspector_initialize [padName: %s]", padName);
-
-  StreamInspector * streamInspector = (StreamInspector *) malloc(1 * sizeof(StreamInspector));
-  gchar **split = g_strsplit(padName, "_", 0);
-  gchar *ssrc = split[4];
-
-  streamInspector->bin = gst_bin_new(NULL);
-  streamInspector->ssrc = g_strdup_printf("%s", ssrc);
-  streamInspector->ptsOffset = 0;
-  streamInspector->frameNumber = 0;
-  streamInspector->lastResolution.width = 0;
-  streamInspector->lastResolution.widthScale = 0;
-  streamInspector->lastResolution.height = 0;
-  streamInspector->lastResolution.heightScale = 0;
-  streamInspector->fdout = NULL;
-
-  g_object_set(streamInspector->bin, "message-forward", TRUE, NULL);
-
-
-  if (outputPath) {
-    gchar * filename = g_strdup_printf("%s/%s.log", outputPath, ssrc);
-    streamInspector->fdout = fopen(filename, "w");
-    g_free(filename);
-  }
-
-  g_strfreev(split);
-  return streamInspector;
-}
-
 /**
  * 
  * This function is called to handle with SIGINT
@@ -202,6 +167,23 @@ signal_handler (gpointer data)
   return TRUE;
 }
 
+/**
+ *
+ * This function tells the parent process that the inspector is ready, with a
+ * "ready" line on stdout. When the results are binary records that can go to
+ * stdout (--stdout, or a daemon `output <ssrc> stdout`), the line would come
+ * before their VP8R header, so it goes to stderr instead.
+ *
+ */
+static void
+print_ready (void)
+{
+  FILE * out = output.format == OUTPUT_FORMAT_BINARY && (output.useStdout || daemonSocket) ? stderr : stdout;
+
+  fprintf(out, "ready\n");
+  fflush(out);
+}
+
 /**
  *
  * This function is called to lead with some pipeline messages.
@@ -214,34 +196,13 @@ bus_handler (GstBus * bus, GstMessage * message, gpointer data)
   Inspector * inspector = (Inspector *)data;
   switch (GST_MESSAGE_TYPE(message)) {
     case GST_MESSAGE_EOS : {
-      if (inspector->closing) {
-        log_info("bus_handler: received EOS when pipeline was closing, stopping pipeline now");
+      /* with --file, the demux stage gets EOS once every SSRC has flushed its jitterbuffer */
+      if (inspector->closing || inputFile) {
+        log_info("bus_handler: received EOS, stopping pipeline now");
         g_main_loop_quit(inspector->loop);
       }
       break;
     }
-    case GST_MESSAGE_ELEMENT : {
-      if (!inspector->closing) {
-        const GstStructure * messageStructure = gst_message_get_structure (message);
-        if (gst_structure_has_name (messageStructure, "GstBinForwarded")){
-          GstMessage *forwardMessage = NULL;
-          gst_structure_get (messageStructure, "message", GST_TYPE_MESSAGE, &forwardMessage, NULL);
-          if (GST_MESSAGE_TYPE (forwardMessage) == GST_MESSAGE_EOS) {
-            log_info("bus_handler: received EOS from bin %s, removing bin now", GST_MESSAGE_SRC_NAME(message));
-            GstElement * bin = GST_ELEMENT(GST_MESSAGE_SRC(message));            
-            gst_element_set_state(bin, GST_STATE_NULL);
-            gst_bin_remove(GST_BIN(inspector->pipeline), bin); 
-
-            // TODO: remove this workaround in future
-            if (inputFile) {
-              g_main_loop_quit(inspector->loop);
-            }
-          }
-          gst_message_unref (forwardMessage);
-        }
-      }
-      break;
-    }
     case GST_MESSAGE_STATE_CHANGED : {
       // we only care about pipeline state change messages
       if (GST_MESSAGE_SRC (message) == GST_OBJECT_CAST (inspector->pipeline)) {
@@ -249,8 +210,7 @@ bus_handler (GstBus * bus, GstMessage * message, gpointer data)
         gst_message_parse_state_changed (message, &old, &new, &pending);
         if (new == GST_STATE_PLAYING && inspector->ready == FALSE) {
           log_info("VP8 Frame Inspector is ready!");
-          fprintf(stdout, "ready\n");
-          fflush(stdout);
+          print_ready();
           inspector->ready = TRUE;
         }
       }
@@ -264,39 +224,72 @@ bus_handler (GstBus * bus, GstMessage * message, gpointer data)
 }
 
 /**
+ *
+ * This function returns when a packet arrived, in nanoseconds since the epoch
+ * (realtime mode). The buffer timestamp of the packets leaving the jitterbuffer
+ * is the running time of their arrival at udpsrc, corrected by the jitterbuffer,
+ * so the arrival to result latency includes their wait there.
+ *
+ */
+static guint64
+packet_arrival (GstElement * element, GstClockTime bufferTimestamp)
+{
+  GstClock * clock = gst_element_get_clock(element);
+  guint64 now = (guint64) g_get_real_time() * 1000;
+
+  if (!clock) {
+    return now;
+  }
+  GstClockTime runningTime = gst_clock_get_time(clock) - gst_element_get_base_time(element);
+  gst_object_unref(clock);
+  if (!GST_CLOCK_TIME_IS_VALID(bufferTimestamp) || runningTime <= bufferTimestamp) {
+    return now;
+  }
+  return now - MIN(runningTime - bufferTimestamp, now);
+}
+
+/**
+ * 
+ * This function is called with every RTP packet leaving the shared queue,
+ * so always from the same thread. The packets are demuxed by SSRC
+ * (an integer-keyed SsrcTable) and depayloaded by the native depayloader,
+ * whose frames are inspected by inspect_frame_info().
  * 
- * This function is called when we have a VP8 Frame available.
- * Here we use the GstBuffer PTS as the frame presentation time (minus the start offset).
- * The Frame buffer should be processed by the inspect_frame_info() function.
+ * NOTE: the frame being assembled points at the buffer memory, so only its
+ * header prefix is kept (detached) once the buffer is unmapped.
  *
  */
 static GstPadProbeReturn
-buffer_probe(GstPad * pad, GstPadProbeInfo * info, gpointer data)
+demux_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 { 
-  GstMapInfo map;
+  Inspector * inspector = (Inspector*) data;
   GstBuffer * buffer = gst_pad_probe_info_get_buffer(info);
-  StreamInspector * streamInspector = (StreamInspector*) data;
+  GstMapInfo map;
+  RtpPacket rtp;
 
-  GstClockTime bufferTimestamp = GST_BUFFER_DTS_OR_PTS(buffer);
-  // NOTE: The buffer clock time is relative to pipeline start time, so we are marking the offset
-  if (streamInspector->ptsOffset == 0) {
-    streamInspector->ptsOffset = bufferTimestamp;
+  if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    return GST_PAD_PROBE_DROP;
   }
-
-  GstClockTime timestamp = bufferTimestamp - streamInspector->ptsOffset;
-  int res = gst_buffer_map(buffer, &map, GST_MAP_READ);
-  if (res) {
-    inspect_frame_info(streamInspector, map.data, map.size, timestamp);
+  if (rtp_packet_parse(map.data, map.size, &rtp) && native_options_accept(&inspector->demuxOptions, rtp.payloadType)) {
+    GstClockTime bufferTimestamp = GST_BUFFER_DTS_OR_PTS(buffer);
+    rtp.arrival = inputFile ? 0 : packet_arrival(inspector->funnel, bufferTimestamp);
+    /* the frame PTS, like the buffers of rtpvp8depay */
+    rtp.pts = GST_CLOCK_TIME_IS_VALID(bufferTimestamp) ? bufferTimestamp : 0;
+    g_mutex_lock(&inspector->demuxMutex);
+    NativeStream * stream = native_worker_push(&inspector->demux, &rtp);
+    vp8_depay_detach(&stream->depay);
+    g_mutex_unlock(&inspector->demuxMutex);
   }
+  gst_buffer_unmap(buffer, &map);
 
-  return GST_PAD_PROBE_HANDLED;
+  return GST_PAD_PROBE_DROP;
 }
 
 /**
  * 
  * This function is called when some SSRC becomes inactive,
- * so we send an EOS event to flush all buffered data and 
- * remove it from our HashTable.
+ * so we release its funnel pad and remove its stream
+ * (its StreamInspector and output file are closed).
  * 
  */
 static void
@@ -305,80 +298,61 @@ on_pad_removed (GstElement * rtpbin, GstPad * pad, Inspector * inspector)
   gchar *padName = gst_pad_get_name (pad);
   log_info("on_pad_removed: %s", padName);
   if (g_str_has_prefix(padName, "recv_rtp_src_")) {
-    StreamInspector * streamInspector = g_hash_table_lookup(inspector->streams, padName);
-    if (streamInspector) {
-      gst_element_send_event(streamInspector->bin, gst_event_new_eos());
-      g_hash_table_remove(inspector->streams, padName);
-      g_free(streamInspector->ssrc);
-      if (outputPath) {
-        fclose(streamInspector->fdout);
-      }
-      free(streamInspector);
+    /* recv_rtp_src_<session>_<ssrc>_<payloadType> */
+    gchar **split = g_strsplit(padName, "_", 0);
+    guint32 ssrc = (guint32) g_ascii_strtoull(split[4], NULL, 10);
+    g_strfreev(split);
+
+    g_mutex_lock(&inspector->demuxMutex);
+    native_worker_remove(&inspector->demux, ssrc);
+    g_mutex_unlock(&inspector->demuxMutex);
+
+    /* the pad was unlinked before the signal, its funnel pad was kept by on_pad_added() */
+    GstPad * funnelPad = g_object_get_data(G_OBJECT(pad), "funnel-pad");
+    if (funnelPad) {
+      gst_element_release_request_pad(inspector->funnel, funnelPad);
+      gst_object_unref(funnelPad);
     }
   }
+  g_free(padName);
 }
 
 /**
  * 
  * This function is called when rtpbin detects a new SSRC.
- * We are using the padName as key of our HashTable.
  * 
- * For each new SSRC we basically build a new bin with
- * a queue and a rtpvp8depay element to receive
- * and lead with the RTP data.
- * 
- * To get the VP8 frames, we put a PROBE at "src" (or output)
- * pad from rtpvp8depay module. The VP8 frames are collected
- * in buffer_probe() function.
+ * Each new SSRC pad is linked to a new sink pad of the shared
+ * funnel, which feeds a single queue (and thread), whose packets are
+ * collected in demux_probe(). The stream of the SSRC is created there,
+ * on its first packet. rtpbin itself still has a jitterbuffer (and its
+ * thread) per SSRC, so the GStreamer pipeline does not scale to
+ * thousands of SSRCs, only --native does.
  * 
  * So basically we are using rtpbin to lead with the
  * RTP scenarios (packet loss, misordering, jitter) and
- * rtpvp8depay to put all packets to that frame together!
+ * the native depayloader to put all packets to that frame together!
  * 
  * */
 static void
 on_pad_added (GstElement * rtpbin, GstPad * new_pad, gpointer data)
 {
-  GstPadLinkReturn ret;
   Inspector * inspector = (Inspector*) data;
   
   gchar *padName = gst_pad_get_name (new_pad);
   log_info("on_pad_added: %s", padName);
   if (!g_str_has_prefix(padName, "recv_rtp_src_")) {
+    g_free(padName);
     return; 
   }
 
-  StreamInspector * streamInspector = stream_inspector_initialize(padName);
-
-  GstElement * queue = gst_element_factory_make("queue", NULL);
-  GstElement * depay = gst_element_factory_make("rtpvp8depay", NULL);
-  
-  GstPad * pad = gst_element_get_static_pad(depay, "src");
-  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, buffer_probe, streamInspector, NULL); 
-  gst_object_unref (pad);
-
-  gst_bin_add_many(GST_BIN(streamInspector->bin), queue, depay, NULL);
-  gst_element_link_many(queue, depay, NULL);
-
-  GstPad *queuePad = gst_element_get_static_pad (queue, "sink");
-  GstPad *ghostPad = gst_ghost_pad_new ("sink", queuePad);
-  gst_pad_set_active (ghostPad, TRUE);
-  gst_element_add_pad (streamInspector->bin, ghostPad);
-  gst_object_unref (queuePad);
-
-  gst_bin_add(GST_BIN(inspector->pipeline), streamInspector->bin);
-
-  GstPad *binSink = gst_element_get_static_pad (streamInspector->bin, "sink");
-  ret = gst_pad_link (new_pad, binSink);
-  if (GST_PAD_LINK_FAILED (ret)) {
+  GstPad * funnelPad = gst_element_request_pad(inspector->funnel, gst_element_get_pad_template(inspector->funnel, "sink_%u"), NULL, NULL);
+  if (GST_PAD_LINK_FAILED (gst_pad_link (new_pad, funnelPad))) {
     log_info("Type is '%s' but link failed.", padName);
     exit(ERROR_PIPELINE_LINK);
-  } else {
-    log_info("Link succeeded (type '%s').", padName);
-    gst_element_sync_state_with_parent(streamInspector->bin);
   }
-  gst_object_unref (binSink);  
-  g_hash_table_insert(inspector->streams, padName, streamInspector);
+  log_info("Link succeeded (type '%s').", padName);
+  g_object_set_data(G_OBJECT(new_pad), "funnel-pad", funnelPad);
+  g_free(padName);
 }
 
 /** 
@@ -443,9 +417,11 @@ get_rtp_source ()
  * (--port) => (udpsrc ! rtpbin)
  * (--file) => (filesrc ! pcapparse ! rtpbin)
  * 
- * It's important to remember that the others gst elements should be created 
- * dinamically when rtpbin detect a new SSRC. Pay attention at the on_pad_added() 
- * function!
+ * and the shared demux stage: (funnel ! queue ! fakesink)
+ * 
+ * It's important to remember that the SSRC pads of rtpbin are linked to the
+ * funnel dinamically when rtpbin detect a new SSRC. Pay attention at the
+ * on_pad_added() function!
  * 
  * */
 Inspector* 
@@ -460,6 +436,18 @@ create_pipeline ()
 
   /* Setting "autoremove" option to clean our pipeline when some SSRC was inactived */
   g_object_set(inspector->rtpbin, "autoremove", TRUE, NULL);
+
+  /*
+   * --latencyMs: the jitterbuffer holds the packets for latencyMs at most, later packets
+   * are dropped and the missing ones are reported (GstRTPPacketLost) instead of waited for.
+   * With 0 there is no buffering at all, the packets are pushed as they arrive.
+   */
+  if (latencyMs >= 0) {
+    g_object_set(inspector->rtpbin, "latency", (guint) latencyMs, "drop-on-latency", TRUE, "do-lost", TRUE, NULL);
+  }
+  if (latencyMs == 0) {
+    g_object_set(inspector->rtpbin, "buffer-mode", 0 /* RTP_JITTER_BUFFER_MODE_NONE */, NULL);
+  }
   g_signal_connect(inspector->rtpbin, "request-pt-map", G_CALLBACK (on_request_pt_map), inspector);
   g_signal_connect(inspector->rtpbin, "pad-added", G_CALLBACK (on_pad_added), inspector);
   g_signal_connect(inspector->rtpbin, "pad-removed", G_CALLBACK (on_pad_removed), inspector);
@@ -470,15 +458,412 @@ create_pipeline ()
     exit(ERROR_PIPELINE_LINK);
   }
 
-  /* This HashTable is resposible by the SSRC/GstBin references */
-  inspector->streams = g_hash_table_new(g_str_hash, g_str_equal);
+  /*
+   * The demux stage is shared by all SSRCs: a single queue (and thread) after the
+   * jitterbuffers of rtpbin (one per SSRC), only bounded by its size in bytes. The packets are dropped by
+   * demux_probe() once inspected, the fakesink only gets the events (EOS).
+   */
+  inspector->funnel = gst_element_factory_make("funnel", NULL);
+  GstElement * queue = gst_element_factory_make("queue", NULL);
+  GstElement * sink = gst_element_factory_make("fakesink", NULL);
+  g_object_set(queue, "max-size-buffers", 0, "max-size-time", (guint64) 0, NULL);
+  g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add_many(GST_BIN(inspector->pipeline), inspector->funnel, queue, sink, NULL);
+  if (!gst_element_link_many(inspector->funnel, queue, sink, NULL)) {
+    log_info("Error at the demux stage link");
+    exit(ERROR_PIPELINE_LINK);
+  }
+  GstPad * pad = gst_element_get_static_pad(queue, "src");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, demux_probe, inspector, NULL);
+  gst_object_unref(pad);
+
+  /* rtpbin already reorders the packets, the demux has no reorder window */
+  inspector->demuxOptions.payloadType = payloadType;
+  inspector->demuxOptions.parseDepth = parseDepth;
+  inspector->demuxOptions.output = &output;
+  inspector->demuxOptions.closing = &nativeClosing;
+  inspector->demuxOptions.jitterBuffered = TRUE;
+  native_worker_init(&inspector->demux, 0, &inspector->demuxOptions);
+  inspector->demux.measureLatency = !inputFile;
+  g_mutex_init(&inspector->demuxMutex);
   return inspector;
 }
 
+/**
+ *
+ * This function runs the native offline engine over the --file capture.
+ * 
+ * (--native --file) => (mmap ! pcap_reader ! rtp_parser ! vp8_depay)
+ * (--native --file x.pcap.gz) => (pcap_stream) => (pcap_reader ! rtp_parser ! vp8_depay)
+ * 
+ */
+static int
+run_native_file (const NativeOptions * options)
+{
+  NativeOptions indexed = *options;
+  FrameIndexWriter indexWriter;
+  FrameIndex index;
+  PcapReader reader;
+  PcapPacket packet;
+  RtpPacket rtp;
+  NativeWorker worker;
+
+  if (pcap_reader_open(&reader, inputFile) != PCAP_OK) {
+    log_info("Failed to open the PCAP file %s", inputFile);
+    return ERROR_INVALID_ARGS;
+  }
+
+  if (buildIndex) {
+    if (frame_index_load(&index, inputFile, payloadType) == FRAME_INDEX_OK) {
+      log_info("The index of %s is up to date", inputFile);
+      frame_index_free(&index);
+    } else if (frame_index_writer_open(&indexWriter, inputFile, payloadType) == FRAME_INDEX_OK) {
+      indexed.index = &indexWriter;
+    } else {
+      log_info("Failed to write the index of %s", inputFile);
+    }
+  }
+
+  native_worker_init(&worker, 0, &indexed);
+  reader.release = (PcapReleaseFunc) native_worker_detach;
+  reader.releaseData = &worker;
+
+  log_info("VP8 Frame Inspector is ready!");
+  while (pcap_reader_next(&reader, &packet)) {
+    if (!rtp_packet_parse(packet.payload, packet.payloadLen, &rtp) || rtp.payloadType != payloadType) {
+      continue;
+    }
+    rtp.arrival = packet.timestamp;
+    rtp.offset = packet.offset;
+    native_worker_push(&worker, &rtp);
+  }
+  native_worker_flush(&worker);
+
+  inspectedFrames = worker.frames;
+  native_worker_clear(&worker);
+  if (reader.stream) {
+    PcapStream * stream = reader.stream;
+    log_info("Decompression [format: %s, compressed: %" G_GUINT64_FORMAT ", bytes: %" G_GUINT64_FORMAT ", reader waits: %" G_GUINT64_FORMAT ", decoder waits: %" G_GUINT64_FORMAT "%s]",
+      pcap_compression_name(stream->compression), stream->compressedBytes, stream->bytes, stream->readerWaits, stream->decoderWaits,
+      stream->failed ? ", failed" : "");
+  }
+  pcap_reader_close(&reader);
+
+  if (indexed.index) {
+    guint64 entries = indexWriter.header.entries;
+    if (frame_index_writer_close(&indexWriter, TRUE) != FRAME_INDEX_OK) {
+      log_info("Failed to write the index of %s", inputFile);
+      return ERROR_INVALID_ARGS;
+    }
+    log_info("Index [file: %s%s, frames: %" G_GUINT64_FORMAT "]", inputFile, FRAME_INDEX_SUFFIX, entries);
+  }
+  return OK;
+}
+
+/**
+ *
+ * This function inspects only the frames of --file that match --query,
+ * using its frame index (see frame_index.h). A missing or stale index is
+ * built first, with a whole inspection of the file without results.
+ *
+ */
+static int
+run_query (const NativeOptions * options, const FrameIndexQuery * query)
+{
+  FrameIndexQueryStats stats;
+  FrameIndex index;
+  gint64 start;
+  guint res = frame_index_load(&index, inputFile, payloadType);
+
+  if (res != FRAME_INDEX_OK) {
+    OutputSettings none = { NULL, FALSE, output.format, NULL };
+    NativeOptions building = *options;
+    building.output = &none;
+    log_info(res == FRAME_INDEX_ERROR_OPEN ? "Building the index of %s" : "The index of %s is stale, rebuilding it", inputFile);
+    buildIndex = TRUE;
+    if (run_native_file(&building) != OK || frame_index_load(&index, inputFile, payloadType) != FRAME_INDEX_OK) {
+      log_info("Failed to build the index of %s", inputFile);
+      return ERROR_INVALID_ARGS;
+    }
+  }
+
+  start = g_get_monotonic_time();
+  res = frame_index_query_run(&index, inputFile, query, parseDepth, &output, &stats);
+  inspectedFrames = stats.inspected;
+  log_info("Query [entries: %" G_GUINT64_FORMAT ", matched: %" G_GUINT64_FORMAT ", inspected: %" G_GUINT64_FORMAT ", packets read: %" G_GUINT64_FORMAT ", seconds: %.3f]",
+    stats.entries, stats.matched, stats.inspected, stats.packets, (g_get_monotonic_time() - start) / (gdouble) G_USEC_PER_SEC);
+
+  frame_index_free(&index);
+  return res == FRAME_INDEX_OK ? OK : ERROR_INVALID_ARGS;
+}
+
+static void
+native_signal_handler (int signal)
+{
+  nativeClosing = 1;
+}
+
+/**
+ *
+ * This function follows --file while it is being written (--follow), see
+ * follow.h. It stops on SIGINT or SIGTERM, after writing the checkpoint.
+ *
+ * (--native --file --follow) => (pcap_reader ! rtp_parser ! vp8_depay), and inotify
+ *
+ */
+static int
+run_follow (const NativeOptions * options)
+{
+  Follower follower;
+  struct sigaction action;
+
+  if (follow_open(&follower, inputFile, options) != FOLLOW_OK) {
+    log_info("Failed to open the PCAP file %s", inputFile);
+    return ERROR_INVALID_ARGS;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = native_signal_handler;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  log_info("VP8 Frame Inspector is ready! [following: %s]", inputFile);
+  follow_run(&follower, &nativeClosing);
+  inspectedFrames = follower.worker.frames;
+
+  log_info("Follow [packets: %" G_GUINT64_FORMAT ", skipped: %" G_GUINT64_FORMAT ", frames: %" G_GUINT64_FORMAT
+    ", checkpoints: %" G_GUINT64_FORMAT ", reopens: %u, offset: %" G_GSIZE_FORMAT "]",
+    follower.packets, follower.skipped, follower.worker.frames, follower.checkpoints, follower.reopens, follower.reader.offset);
+  follow_close(&follower);
+  return OK;
+}
+
+#ifndef INSPECTOR_NO_STATS
+/* SIGUSR1: a snapshot of the stage stats */
+static void
+stats_signal_handler (int signal)
+{
+  output_writer_request_stats(output.writer);
+}
+#endif
+
+/**
+ *
+ * This function runs the native realtime engine listening to --port.
+ *
+ * (--native --port) => (recvmmsg ! rtp_parser ! vp8_depay) x workers
+ *
+ * With more than one worker, each one has its own SO_REUSEPORT socket and
+ * the kernel steers the packets by SSRC to them, so a SSRC is always
+ * inspected by the same worker. Worker N is pinned to CPU N.
+ * 
+ */
+static int
+run_native_port (const NativeOptions * options)
+{
+  NativeWorker * nativeWorkers = g_new0(NativeWorker, workers);
+  struct sigaction action;
+  guint numCpus = g_get_num_processors();
+  gint i;
+
+  for (i = 0; i < workers; i++) {
+    NativeWorker * worker = &nativeWorkers[i];
+    native_worker_init(worker, i, options);
+    worker->cpu = workers > 1 ? (gint) (i % numCpus) : -1;
+
+    guint res = udp_receiver_open(&worker->receiver, port, batchSize, kernelTimestamps, workers > 1);
+    if (res != UDP_RECEIVER_OK) {
+      log_info("Failed to listen to port %i (error %u)", port, res);
+      /* the workers opened so far, and this one (its receiver fd is -1) */
+      for (; i >= 0; i--) {
+        native_worker_clear(&nativeWorkers[i]);
+      }
+      g_free(nativeWorkers);
+      return ERROR_SOCKET;
+    }
+  }
+
+  if (workers > 1 && udp_receiver_steer_by_ssrc(&nativeWorkers[0].receiver, workers) != UDP_RECEIVER_OK) {
+    log_info("Failed to steer SSRCs to workers, using the kernel flow hash");
+  }
+
+  /* No SA_RESTART, so SIGINT interrupts recvmmsg() */
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = native_signal_handler;
+  sigaction(SIGINT, &action, NULL);
+
+  for (i = 0; i < workers; i++) {
+    nativeWorkers[i].thread = g_thread_new("native-worker", native_worker_run, &nativeWorkers[i]);
+  }
+
+  log_info("VP8 Frame Inspector is ready!");
+  print_ready();
+
+  for (i = 0; i < workers; i++) {
+    g_thread_join(nativeWorkers[i].thread);
+    inspectedFrames += nativeWorkers[i].frames;
+    native_worker_clear(&nativeWorkers[i]);
+  }
+
+  g_free(nativeWorkers);
+  return OK;
+}
+
+/**
+ *
+ * This function inspects many PCAP files in parallel (--batch), see batch.h.
+ * The results of each file go to <outputPath>/<file name>/<ssrc>.log, or
+ * all of them to stdout with --stdout.
+ *
+ */
+static int
+run_batch (const NativeOptions * options)
+{
+  GPtrArray * paths = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray * tasks;
+  BatchPool pool = { options, &output, flushInterval, flushBytes, ringSize, &nativeClosing };
+  BatchSummary summary;
+  struct sigaction action;
+  guint numJobs = jobs > 0 ? (guint) jobs : g_get_num_processors();
+
+  if (batch_collect(batchPattern, paths) != BATCH_OK) {
+    log_info("No PCAP files found in %s", batchPattern);
+    g_ptr_array_free(paths, TRUE);
+    return ERROR_INVALID_ARGS;
+  }
+  /* more chunks than threads would only read the file more times */
+  tasks = batch_plan(paths, outputPath, (guint64) chunkSize << 20, numJobs);
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = native_signal_handler;
+  sigaction(SIGINT, &action, NULL);
+
+  log_info("VP8 Frame Inspector is ready! [files: %u, tasks: %u, jobs: %u]", paths->len, tasks->len, numJobs);
+  batch_run(&pool, tasks, numJobs, &summary);
+  inspectedFrames = summary.frames;
+
+  log_info("Batch [files: %u, tasks: %u, jobs: %u, failed: %u, frames: %" G_GUINT64_FORMAT ", packets: %" G_GUINT64_FORMAT
+    ", bytes: %" G_GUINT64_FORMAT ", seconds: %.3f, frames/s: %.0f, GB/s: %.3f, steals: %" G_GUINT64_FORMAT "]",
+    summary.files, summary.tasks, pool.numWorkers, summary.failed,
+    summary.frames, summary.packets, summary.bytes, summary.seconds,
+    summary.seconds > 0 ? summary.frames / summary.seconds : 0, summary.seconds > 0 ? summary.bytes / summary.seconds / 1e9 : 0,
+    summary.steals);
+
+  g_ptr_array_free(tasks, TRUE);
+  g_ptr_array_free(paths, TRUE);
+  return summary.failed > 0 ? ERROR_INVALID_ARGS : OK;
+}
+
+/**
+ *
+ * This function runs the native engine as a daemon (--daemon): the ports and
+ * payload types come from the control socket (see daemon.c), plus --port and
+ * --payloadType when they are given.
+ *
+ */
+static int
+run_daemon (void)
+{
+  struct sigaction action;
+  Daemon daemon;
+  int res = OK;
+
+  daemon_init(&daemon, parseDepth, batchSize, &output, &nativeClosing);
+  daemon.reorderWindow = reorderWindow;
+  daemon.reorderLatencyMs = latencyMs >= 0 ? latencyMs : RTP_REORDER_DEFAULT_LATENCY_MS;
+  if (daemon_listen(&daemon, daemonSocket) != DAEMON_OK) {
+    log_info("Failed to listen to the control socket %s", daemonSocket);
+    daemon_clear(&daemon);
+    return ERROR_SOCKET;
+  }
+
+  if (port > 0) {
+    GString * reply = g_string_new(NULL);
+    gchar * command = g_strdup_printf("add-port %i %i", port, payloadType);
+    if (!daemon_command(&daemon, command, reply)) {
+      log_info("Failed to listen to port %i: %s", port, reply->str);
+      res = ERROR_SOCKET;
+    }
+    g_free(command);
+    g_string_free(reply, TRUE);
+  }
+
+  if (res == OK) {
+    /* No SA_RESTART, so SIGINT interrupts poll() */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = native_signal_handler;
+    sigaction(SIGINT, &action, NULL);
+
+    log_info("VP8 Frame Inspector is ready! [control socket: %s]", daemonSocket);
+    print_ready();
+    daemon_run(&daemon);
+  }
+
+  daemon_clear(&daemon);
+  return res;
+}
+
+/**
+ *
+ * Each SSRC has its own output file, so with thousands of SSRCs the default
+ * soft limit of open files (usually 1024) is not enough. It is raised to the
+ * hard limit.
+ *
+ */
+static void
+raise_open_files_limit (void)
+{
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur == limit.rlim_max) {
+    return;
+  }
+  limit.rlim_cur = limit.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+    log_info("Failed to raise the open files limit");
+  }
+}
+
+/**
+ *
+ * This function logs how fast the inspector was, so we can compare
+ * the GStreamer pipeline against the native engine (see `make bench-pcap`).
+ *
+ */
+static void
+log_run_summary (gint64 startTime)
+{
+  struct stat st;
+  gdouble seconds = (g_get_monotonic_time() - startTime) / (gdouble) G_USEC_PER_SEC;
+  guint frames = g_atomic_int_get(&inspectedFrames);
+
+  if (!inputFile || stat(inputFile, &st) < 0 || seconds <= 0) {
+    return;
+  }
+
+  log_info("Summary [engine: %s, frames: %u, bytes: %" G_GINT64_FORMAT ", seconds: %.3f, frames/s: %.0f, GB/s: %.3f]",
+    useNative ? "native" : "gstreamer", frames, (gint64) st.st_size, seconds,
+    frames / seconds, st.st_size / seconds / 1e9);
+}
+
+/* It writes the pending results and stops serving the metrics */
+static void
+stop_outputs (void)
+{
+  if (output.writer) {
+    output_writer_stop(output.writer);
+  }
+  if (metricsAddress) {
+    log_info("Metrics [scrapes: %" G_GUINT64_FORMAT "]", metricsServer.scrapes);
+    metrics_server_stop(&metricsServer);
+  }
+}
+
 int 
 main (int argc, char *argv[])
 {
   GError * error = NULL;
+  FrameIndexQuery query;
   GOptionContext * context = g_option_context_new("- VP8 Frame Inspector");
   g_option_context_add_main_entries(context, entries, NULL);
   if (!g_option_context_parse(context, &argc, &argv, &error)) {
@@ -486,17 +871,198 @@ main (int argc, char *argv[])
     exit(ERROR_PARSE_ARGS);
   }
 
-  if (inputFile == NULL && port <= 0) {
+  if (inputFile == NULL && port <= 0 && daemonSocket == NULL && batchPattern == NULL) {
     log_info("Invalid port: %i", port);
     exit(ERROR_INVALID_ARGS);
   }
 
-  /* The payload type should be in the dynamic range */
-  if (payloadType < 96 || payloadType > 127) {
+  if (daemonSocket && inputFile) {
+    log_info("The daemon mode is realtime only, --file can not be used with --daemon");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (batchPattern && (!useNative || inputFile || daemonSocket)) {
+    log_info("The batch mode is native and offline only, --batch needs --native and can not be used with --file or --daemon");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  /* Each thread of the batch has its own output writer */
+  if (batchPattern && (statsInterval >= 0 || perfCounters)) {
+    log_info("The stage stats are per output writer, --statsInterval and --perfCounters can not be used with --batch");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if ((buildIndex || queryText) && (!useNative || !inputFile)) {
+    log_info("The frame index is only for PCAP files with the native engine, --index and --query need --native and --file");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (followFile && (!useNative || !inputFile || buildIndex || queryText)) {
+    log_info("The follow mode is for PCAP files with the native engine, --follow needs --native and --file and can not be used with --index or --query");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  /* The index and the follow mode seek in the capture, the GStreamer pipeline reads it with pcapparse */
+  if (inputFile && pcap_file_compression(inputFile) != PCAP_COMPRESSION_NONE && (!useNative || buildIndex || queryText || followFile)) {
+    log_info("A compressed capture is read by the native engine only, %s needs --native and can not be used with --index, --query or --follow", inputFile);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (queryText && !frame_index_query_parse(queryText, &query)) {
+    log_info("Invalid query %s [ssrc=<ssrc>, keyframes, changes, corrupt, frames=<n>[-[<m>]], from=<time>, to=<time>]", queryText);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (jobs < 0 || jobs > BATCH_MAX_JOBS || chunkSize < 0) {
+    log_info("Invalid batch settings [jobs: %i [0-%i], chunkSize: %i]", jobs, BATCH_MAX_JOBS, chunkSize);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  /* The payload type should be in the dynamic range (the daemon gets them later) */
+  if ((payloadType < 96 || payloadType > 127) && !(daemonSocket && port <= 0)) {
     log_info("PayloadType out of range %i [96-127]", payloadType);
     exit(ERROR_INVALID_ARGS);
   }
 
+  if (workers < 1 || workers > NATIVE_MAX_WORKERS) {
+    log_info("Workers out of range %i [1-%i]", workers, NATIVE_MAX_WORKERS);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (!parse_output_format(outputFormat, &output.format)) {
+    log_info("Invalid format %s [text, binary]", outputFormat);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (!vp8_parse_depth_from_string(parseDepthName, &parseDepth)) {
+    log_info("Invalid parseDepth %s [tag, reference, full]", parseDepthName);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (latencyMs < -1) {
+    log_info("Invalid latencyMs %i", latencyMs);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  /* a capture is reordered like by the jitterbuffer of rtpbin, so both engines give the same results */
+  if (reorderWindow == -1) {
+    gboolean capture = useNative && inputFile && !followFile && latencyMs != 0;
+    reorderWindow = capture ? RTP_REORDER_MAX_WINDOW : 0;
+    latencyMs = capture && latencyMs < 0 ? NATIVE_FILE_LATENCY_MS : latencyMs;
+  }
+
+  if (reorderWindow < 0 || reorderWindow > RTP_REORDER_MAX_WINDOW) {
+    log_info("reorderWindow out of range %i [0-%i]", reorderWindow, RTP_REORDER_MAX_WINDOW);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  /* rtpbin has its own jitterbuffer, sized by --latencyMs */
+  if (reorderWindow > 0 && !useNative && !daemonSocket) {
+    log_info("The reorder window is only used by the native engine (--native or --daemon)");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (reorderWindow > 0 && latencyMs == 0) {
+    log_info("A reorder window needs a latency, --latencyMs can not be 0 with --reorderWindow");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (statsInterval < -1) {
+    log_info("Invalid statsInterval %i", statsInterval);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+#ifdef INSPECTOR_NO_STATS
+  if (statsInterval >= 0 || perfCounters) {
+    log_info("The stage stats are compiled out of this build (make STATS=0), --statsInterval and --perfCounters can not be used");
+    exit(ERROR_INVALID_ARGS);
+  }
+#else
+  if (perfCounters) {
+    if (perf_counters_enable() != PERF_COUNTERS_OK) {
+      log_info("Failed to open the performance counters, check kernel.perf_event_paranoid (or the VM has no PMU)");
+      exit(ERROR_INVALID_ARGS);
+    }
+    /* they are only reported in the stats dump, on SIGUSR1 and at exit at least */
+    statsInterval = MAX(statsInterval, 0);
+  }
+#endif
+
+  if (aggregateInterval < 0) {
+    log_info("Invalid aggregate %i", aggregateInterval);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  /* The windows are text lines, and a query only inspects some frames */
+  if (aggregateInterval > 0 && (output.format == OUTPUT_FORMAT_BINARY || queryText)) {
+    log_info("The aggregated results are text lines of all the frames, --aggregate can not be used with --format=binary or --query");
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  if (flushInterval < 0 || flushBytes < 0 || ringSize < 1) {
+    log_info("Invalid output writer settings [flushInterval: %i, flushBytes: %i, ringSize: %i]", flushInterval, flushBytes, ringSize);
+    exit(ERROR_INVALID_ARGS);
+  }
+
+  gint64 startTime = g_get_monotonic_time();
+
+  if (outputPath) {
+    raise_open_files_limit();
+  }
+
+  /* Offline runs wait for the writer when the ring is full, realtime runs drop the results instead */
+  output.outputPath = outputPath;
+  output.aggregateInterval = aggregateInterval;
+  /* the query results go to stdout unless they have an outputPath */
+  output.useStdout = useStdout || (queryText && !outputPath);
+  output.writer = batchPattern ? NULL : output_writer_new(ringSize, flushInterval, flushBytes, inputFile != NULL);
+#ifndef INSPECTOR_NO_STATS
+  if (statsInterval >= 0) {
+    struct sigaction action;
+    output_writer_enable_stats(output.writer, (guint) statsInterval * 1000);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stats_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+  }
+#endif
+
+  if (metricsAddress) {
+    guint res = metrics_server_start(&metricsServer, metricsAddress);
+    if (res != METRICS_OK) {
+      log_info("Failed to serve the metrics on %s (error %u)", metricsAddress, res);
+      exit(res == METRICS_ERROR_ADDRESS ? ERROR_INVALID_ARGS : ERROR_SOCKET);
+    }
+    log_info("Serving the metrics on %s", metricsAddress);
+  }
+
+  if (daemonSocket) {
+    int res = run_daemon();
+    stop_outputs();
+    return res;
+  }
+
+  if (useNative) {
+    NativeOptions options = { payloadType, parseDepth, &output, kernelTimestamps, &nativeClosing };
+    options.reorderWindow = reorderWindow;
+    options.reorderLatencyMs = latencyMs >= 0 ? latencyMs : RTP_REORDER_DEFAULT_LATENCY_MS;
+    int res;
+    if (queryText) {
+      res = run_query(&options, &query);
+      stop_outputs();
+      return res;
+    }
+    if (followFile) {
+      res = run_follow(&options);
+      stop_outputs();
+      return res;
+    }
+    res = batchPattern ? run_batch(&options) : inputFile ? run_native_file(&options) : run_native_port(&options);
+    stop_outputs();
+    log_run_summary(startTime);
+    return res;
+  }
+
   /* Initialize GStreamer */
   gst_init (&argc, &argv);
   log_info("Initializing VP8 Frame Inspector");
@@ -527,5 +1093,14 @@ main (int argc, char *argv[])
   g_source_remove(bus_watch_id);
   g_main_loop_unref(inspector->loop);
 
+  /* the streams flush their last results before the writer stops */
+  inspectedFrames = inspector->demux.frames;
+  if (inspector->demux.latency.total > 0) {
+    latency_histogram_log(&inspector->demux.latency, "Arrival to result latency");
+  }
+  native_worker_clear(&inspector->demux);
+  stop_outputs();
+  log_run_summary(startTime);
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+/**
+ *
+ * Latency histograms (see latency_histogram.h).
+ *
+ * Values below SUB_BUCKETS have their own bucket, the others keep their
+ * highest SUB_BITS + 1 bits:
+ *
+ *   index = (msb - SUB_BITS + 1) * SUB_BUCKETS + (the SUB_BITS bits after the msb)
+ *
+ */
+
+#include <string.h>
+
+#include "latency_histogram.h"
+#include "log.h"
+
+static inline guint
+histogram_index (guint64 value, guint subBits)
+{
+  guint64 subBuckets = 1 << subBits;
+  guint msb, shift;
+
+  if (value < subBuckets) {
+    return (guint) value;
+  }
+  msb = 63 - __builtin_clzll(value);
+  shift = msb - subBits;
+  return (shift + 1) * subBuckets + (guint) ((value >> shift) & (subBuckets - 1));
+}
+
+/* The highest value counted in a bucket */
+static guint64
+histogram_value (guint index, guint subBits)
+{
+  guint subBuckets = 1 << subBits;
+  guint shift, sub;
+
+  if (index < subBuckets) {
+    return index;
+  }
+  shift = index / subBuckets - 1;
+  sub = index % subBuckets;
+  return (((guint64) (subBuckets + sub + 1)) << shift) - 1;
+}
+
+static guint64
+histogram_percentile (const guint32 * counts, guint buckets, guint subBits, guint64 total, guint64 max, gdouble percentile)
+{
+  guint64 rank, seen = 0;
+  guint i;
+
+  if (total == 0) {
+    return 0;
+  }
+  rank = (guint64) (percentile / 100.0 * total + 0.5);
+  rank = CLAMP(rank, 1, total);
+  for (i = 0; i < buckets; i++) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return MIN(histogram_value(i, subBits), max);
+    }
+  }
+  return max;
+}
+
+void
+latency_histogram_reset (LatencyHistogram * histogram)
+{
+  memset(histogram, 0, sizeof(LatencyHistogram));
+}
+
+void
+latency_histogram_record (LatencyHistogram * histogram, guint64 value)
+{
+  value = MIN(value, LATENCY_HISTOGRAM_MAX_VALUE);
+  histogram->counts[histogram_index(value, LATENCY_HISTOGRAM_SUB_BITS)]++;
+  histogram->total++;
+  histogram->max = MAX(histogram->max, value);
+}
+
+void
+latency_histogram_merge (LatencyHistogram * histogram, const LatencyHistogram * other)
+{
+  guint i;
+
+  for (i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    histogram->counts[i] += other->counts[i];
+  }
+  histogram->total += other->total;
+  histogram->max = MAX(histogram->max, other->max);
+}
+
+/**
+ *
+ * This function returns the value below or at which `percentile` (0 to 100)
+ * of the recorded values are, like HdrHistogram it is the highest value of
+ * its bucket (but never above the max). It returns 0 when it is empty.
+ *
+ */
+guint64
+latency_histogram_percentile (const LatencyHistogram * histogram, gdouble percentile)
+{
+  return histogram_percentile(histogram->counts, LATENCY_HISTOGRAM_BUCKETS, LATENCY_HISTOGRAM_SUB_BITS,
+    histogram->total, histogram->max, percentile);
+}
+
+void
+latency_histogram_log (const LatencyHistogram * histogram, const gchar * name)
+{
+  log_info("%s [frames: %" G_GUINT64_FORMAT ", p50: %.3f ms, p90: %.3f ms, p99: %.3f ms, p99.9: %.3f ms, max: %.3f ms]",
+    name, histogram->total,
+    latency_histogram_percentile(histogram, 50) / 1e6, latency_histogram_percentile(histogram, 90) / 1e6,
+    latency_histogram_percentile(histogram, 99) / 1e6, latency_histogram_percentile(histogram, 99.9) / 1e6,
+    histogram->max / 1e6);
+}
+
+void
+stage_histogram_record (StageHistogram * histogram, guint64 value)
+{
+  value = MIN(value, STAGE_HISTOGRAM_MAX_VALUE);
+  histogram->counts[histogram_index(value, STAGE_HISTOGRAM_SUB_BITS)]++;
+  histogram->total++;
+  histogram->max = MAX(histogram->max, value);
+}
+
+guint64
+stage_histogram_percentile (const StageHistogram * histogram, gdouble percentile)
+{
+  return histogram_percentile(histogram->counts, STAGE_HISTOGRAM_BUCKETS, STAGE_HISTOGRAM_SUB_BITS,
+    histogram->total, histogram->max, percentile);
+}
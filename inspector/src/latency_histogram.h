@@ -0,0 +1,71 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <glib.h>
+
+/**
+ *
+ * A fixed-size latency histogram in the HdrHistogram style: each power of
+ * two range is split in LATENCY_HISTOGRAM_SUB_BUCKETS linear buckets, so
+ * any value is known within 1/LATENCY_HISTOGRAM_SUB_BUCKETS (about 3%).
+ * Values are nanoseconds, up to LATENCY_HISTOGRAM_MAX_VALUE (18 minutes).
+ *
+ * Recording is O(1) and does no allocation. It is not thread safe, each
+ * thread records into its own histogram and they are merged to be read.
+ *
+ */
+
+enum
+{
+  LATENCY_HISTOGRAM_SUB_BITS = 5,
+  LATENCY_HISTOGRAM_SUB_BUCKETS = 1 << LATENCY_HISTOGRAM_SUB_BITS,
+  LATENCY_HISTOGRAM_MAX_BITS = 40,
+  LATENCY_HISTOGRAM_BUCKETS = (LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS
+};
+
+#define LATENCY_HISTOGRAM_MAX_VALUE ((G_GUINT64_CONSTANT(1) << LATENCY_HISTOGRAM_MAX_BITS) - 1)
+
+typedef struct
+{
+  guint32 counts[LATENCY_HISTOGRAM_BUCKETS];
+  guint64 total;
+  guint64 max;
+} LatencyHistogram;
+
+
+/**
+ *
+ * The same histogram with STAGE_HISTOGRAM_SUB_BITS (about 12%
+ * precision) and up to 17 seconds, 1KB instead of 4.5KB: the stage stats
+ * keep several of them per SSRC.
+ *
+ */
+
+enum
+{
+  STAGE_HISTOGRAM_SUB_BITS = 3,
+  STAGE_HISTOGRAM_SUB_BUCKETS = 1 << STAGE_HISTOGRAM_SUB_BITS,
+  STAGE_HISTOGRAM_MAX_BITS = 34,
+  STAGE_HISTOGRAM_BUCKETS = (STAGE_HISTOGRAM_MAX_BITS - STAGE_HISTOGRAM_SUB_BITS + 1) * STAGE_HISTOGRAM_SUB_BUCKETS
+};
+
+#define STAGE_HISTOGRAM_MAX_VALUE ((G_GUINT64_CONSTANT(1) << STAGE_HISTOGRAM_MAX_BITS) - 1)
+
+typedef struct
+{
+  guint32 counts[STAGE_HISTOGRAM_BUCKETS];
+  guint64 total;
+  guint64 max;
+} StageHistogram;
+
+
+void latency_histogram_reset(LatencyHistogram * histogram);
+void latency_histogram_record(LatencyHistogram * histogram, guint64 value);
+void latency_histogram_merge(LatencyHistogram * histogram, const LatencyHistogram * other);
+guint64 latency_histogram_percentile(const LatencyHistogram * histogram, gdouble percentile);
+void latency_histogram_log(const LatencyHistogram * histogram, const gchar * name);
+
+void stage_histogram_record(StageHistogram * histogram, guint64 value);
+guint64 stage_histogram_percentile(const StageHistogram * histogram, gdouble percentile);
+
+#endif
@@ -0,0 +1,595 @@
+/**
+ *
+ * Load generator (inspector-loadgen).
+ *
+ * It sends VP8 RTP to the live path of the inspector (--port), either
+ * replaying the UDP payloads of a PCAP file with their capture timing
+ * (--file, at --speed times real time, 0 for as fast as possible) or
+ * synthesizing --ssrcs streams with a bitrate, a frame rate, packet loss
+ * and reordering. It prints the sent packets/s and frames/s once a second
+ * and a summary of each run, one JSON object per line.
+ *
+ * With --metrics (the address of the inspector --metrics endpoint), the
+ * summary has the frames the inspector counted during the run, and
+ * --ramp=<factor> multiplies the speed by the factor after each run
+ * until the inspector loses more than --maxLoss percent of the frames,
+ * then reports the last sustainable rate.
+ *
+ * $ ./out/inspector --native --port=5000 --payloadType=96 --metrics=9464 &
+ * $ ./out/inspector-loadgen --port=5000 --ssrcs=1000 --metrics=9464 --ramp=1.5
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+#include "pcap_reader.h"
+
+enum
+{
+  LOADGEN_BATCH_SZ = 64,
+  LOADGEN_MAX_PAYLOAD_SZ = 1200,
+  LOADGEN_PACKET_SZ = BENCH_RTP_HEADER_SZ + LOADGEN_MAX_PAYLOAD_SZ,
+  LOADGEN_MAX_FRAME_PACKETS = 256,
+  LOADGEN_KEYFRAME_SCALE = 4,   /* keyframes are this times bigger than the interframes */
+  LOADGEN_MAX_THREADS = 64,
+  LOADGEN_REPORT_MS = 1000,
+  LOADGEN_SETTLE_MS = 1000,     /* the wait for the inspector to output the last frames of a run */
+  LOADGEN_SCRAPE_TIMEOUT_MS = 2000
+};
+
+/* A run slower than its speed by more than this ratio is limited by the generator */
+#define LOADGEN_LIMITED_RATIO 1.1
+
+static gchar * host = "127.0.0.1";
+static gint port = 0;
+static gchar * pcapPath = NULL;
+static gdouble speed = 1.0;
+static gint loops = 1;
+static gint ssrcs = 100;
+static gint bitrate = 500;
+static gint fps = 30;
+static gint gop = 60;
+static gdouble loss = 0;
+static gdouble reorder = 0;
+static gint seconds = 10;
+static gint threads = 1;
+static gint payloadType = 96;
+static gchar * metricsAddress = NULL;
+static gdouble ramp = 0;
+static gdouble maxLoss = 0.1;
+
+static GOptionEntry entries[] =
+{
+  { "host", 0, 0, G_OPTION_ARG_STRING, &host, "IPv4 address of the inspector", "127.0.0.1" },
+  { "port", 'p', 0, G_OPTION_ARG_INT, &port, "UDP port of the inspector (--port)", "5000" },
+  { "file", 'f', 0, G_OPTION_ARG_FILENAME, &pcapPath, "Replay the UDP payloads of a PCAP file instead of synthesizing streams", "capture.pcap" },
+  { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed, "Times real time, 0 to send as fast as possible", "1" },
+  { "loops", 0, 0, G_OPTION_ARG_INT, &loops, "Replays of the PCAP file in each run", "1" },
+  { "ssrcs", 0, 0, G_OPTION_ARG_INT, &ssrcs, "Synthetic streams", "100" },
+  { "bitrate", 0, 0, G_OPTION_ARG_INT, &bitrate, "Bitrate of each synthetic stream in kbps", "500" },
+  { "fps", 0, 0, G_OPTION_ARG_INT, &fps, "Frame rate of the synthetic streams", "30" },
+  { "gop", 0, 0, G_OPTION_ARG_INT, &gop, "A keyframe every N frames", "60" },
+  { "loss", 0, 0, G_OPTION_ARG_DOUBLE, &loss, "Synthetic packets dropped, in percent", "0" },
+  { "reorder", 0, 0, G_OPTION_ARG_DOUBLE, &reorder, "Synthetic packets swapped with the next packet of the frame, in percent", "0" },
+  { "seconds", 'd', 0, G_OPTION_ARG_INT, &seconds, "Duration of each synthetic run", "10" },
+  { "threads", 't', 0, G_OPTION_ARG_INT, &threads, "Sender threads, the synthetic streams are split between them", "1" },
+  { "payloadType", 0, 0, G_OPTION_ARG_INT, &payloadType, "RTP payload type of the synthetic streams (and of the PCAP frames counted)", "96" },
+  { "metrics", 'm', 0, G_OPTION_ARG_STRING, &metricsAddress, "Address of the inspector --metrics endpoint, to count the inspected frames", "9464" },
+  { "ramp", 0, 0, G_OPTION_ARG_DOUBLE, &ramp, "Multiply the speed by this factor after each run until frames are lost (needs --metrics)", "1.5" },
+  { "maxLoss", 0, 0, G_OPTION_ARG_DOUBLE, &maxLoss, "Lost frames (in percent) a sustainable run may have", "0.1" },
+  { NULL }
+};
+
+typedef struct
+{
+  guint32 ssrc;
+  guint16 seq;
+  guint32 timestamp;
+  guint64 frames;
+} LoadStream;
+
+/* The counters are only written by the sender thread, the main thread reads them for the reports */
+typedef struct
+{
+  guint64 packets;
+  guint64 frames;
+  guint64 completeFrames;  /* frames with every packet sent, the frames the inspector should output */
+  guint64 dropped;         /* packets dropped by --loss */
+  guint64 reordered;
+  guint64 errors;
+  guint64 captureTime;     /* nanoseconds of capture replayed */
+} LoadCounters;
+
+typedef struct
+{
+  gdouble packetsPerSecond;
+  gdouble framesPerSecond;
+  gdouble lost;            /* percent of the complete frames the inspector did not output, -1 when unknown */
+  gboolean limited;        /* the generator could not send at the speed of the run */
+} LoadRun;
+
+typedef struct
+{
+  guint id;
+  int fd;
+  struct sockaddr_in address;
+  LoadStream * streams;
+  guint numStreams;
+  guint seed;
+  gdouble speed;
+  volatile gint * closing;
+  volatile gint done;
+  GThread * thread;
+  LoadCounters counters;
+
+  guint8 (*buffers)[LOADGEN_PACKET_SZ];
+  struct mmsghdr messages[LOADGEN_BATCH_SZ];
+  struct iovec iovecs[LOADGEN_BATCH_SZ];
+  guint batched;
+} LoadSender;
+
+static void
+loadgen_flush (LoadSender * sender)
+{
+  guint sent = 0;
+
+  while (sent < sender->batched) {
+    int res = sendmmsg(sender->fd, sender->messages + sent, sender->batched - sent, 0);
+    if (res <= 0) {
+      /* nobody listening (ECONNREFUSED) or no buffer, the message is skipped */
+      sender->counters.errors++;
+      sent++;
+      continue;
+    }
+    sender->counters.packets += res;
+    sent += res;
+  }
+  sender->batched = 0;
+}
+
+/* The next message of the batch, the batch is sent when full */
+static struct iovec *
+loadgen_next_message (LoadSender * sender)
+{
+  if (sender->batched == LOADGEN_BATCH_SZ) {
+    loadgen_flush(sender);
+  }
+  return &sender->iovecs[sender->batched++];
+}
+
+static inline gboolean
+loadgen_chance (LoadSender * sender, gdouble percent)
+{
+  return percent > 0 && rand_r(&sender->seed) < percent / 100 * RAND_MAX;
+}
+
+/**
+ *
+ * This function sends the next frame of a synthetic stream: bitrate / fps
+ * bytes (LOADGEN_KEYFRAME_SCALE times more for keyframes) split in
+ * packets of LOADGEN_MAX_PAYLOAD_SZ, some of them dropped (--loss) or
+ * swapped with the next one (--reorder).
+ *
+ */
+static void
+loadgen_synth_frame (LoadSender * sender, LoadStream * stream)
+{
+  gboolean keyframe = stream->frames % gop == 0;
+  guint frameSize = MAX(32, (guint) ((guint64) bitrate * 1000 / 8 / fps));
+  guint order[LOADGEN_MAX_FRAME_PACKETS];
+  guint count, i, tmp;
+  gboolean complete = TRUE;
+
+  if (keyframe) {
+    frameSize *= LOADGEN_KEYFRAME_SCALE;
+  }
+  count = MIN((frameSize + LOADGEN_MAX_PAYLOAD_SZ - 1) / LOADGEN_MAX_PAYLOAD_SZ, LOADGEN_MAX_FRAME_PACKETS);
+  for (i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  for (i = 0; i + 1 < count; i++) {
+    if (loadgen_chance(sender, reorder)) {
+      tmp = order[i];
+      order[i] = order[i + 1];
+      order[i + 1] = tmp;
+      sender->counters.reordered++;
+      i++;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    guint index = order[i];
+    if (loadgen_chance(sender, loss)) {
+      sender->counters.dropped++;
+      complete = FALSE;
+      continue;
+    }
+    struct iovec * iovec = loadgen_next_message(sender);
+    guint8 * p = sender->buffers[iovec - sender->iovecs];
+    guint payloadSize = index + 1 < count ? LOADGEN_MAX_PAYLOAD_SZ : frameSize - index * LOADGEN_MAX_PAYLOAD_SZ;
+    bench_write_vp8_packet(p, payloadType, stream->ssrc, stream->seq + index, stream->timestamp, index == 0, index + 1 == count, keyframe);
+    iovec->iov_base = p;
+    iovec->iov_len = BENCH_RTP_HEADER_SZ + MIN(payloadSize, LOADGEN_MAX_PAYLOAD_SZ);
+  }
+
+  stream->seq += count;
+  stream->timestamp += 90000 / fps;
+  stream->frames++;
+  sender->counters.frames++;
+  sender->counters.completeFrames += complete;
+}
+
+/**
+ *
+ * The frames of the streams of a sender are sent round robin and evenly
+ * spaced: frame n of the sender is due at n / (streams * fps * speed)
+ * seconds from the start.
+ *
+ */
+static gpointer
+loadgen_synth_run (gpointer data)
+{
+  LoadSender * sender = (LoadSender *) data;
+  gdouble rate = sender->numStreams * fps * sender->speed;
+  gint64 start = g_get_monotonic_time();
+  guint64 next = 0, due;
+
+  while (!g_atomic_int_get(sender->closing)) {
+    gint64 elapsed = g_get_monotonic_time() - start;
+    due = rate > 0 ? (guint64) MIN(elapsed * rate / G_USEC_PER_SEC, next + LOADGEN_BATCH_SZ) + 1 : next + LOADGEN_BATCH_SZ;
+    if (next >= due) {
+      gint64 wait = (gint64) (next / rate * G_USEC_PER_SEC) - elapsed;
+      loadgen_flush(sender);
+      g_usleep(CLAMP(wait, 1, 10000));
+      continue;
+    }
+    while (next < due && !g_atomic_int_get(sender->closing)) {
+      loadgen_synth_frame(sender, &sender->streams[next % sender->numStreams]);
+      next++;
+    }
+    loadgen_flush(sender);
+  }
+  loadgen_flush(sender);
+  g_atomic_int_set(&sender->done, 1);
+  return NULL;
+}
+
+/* It replays the UDP payloads of the file --loops times, paced by the capture times */
+static gpointer
+loadgen_replay_run (gpointer data)
+{
+  LoadSender * sender = (LoadSender *) data;
+  PcapReader reader;
+  PcapPacket packet;
+  gint loop;
+
+  for (loop = 0; loop < loops && !g_atomic_int_get(sender->closing); loop++) {
+    gint64 start = g_get_monotonic_time();
+    guint64 first = 0, last = 0;
+    gboolean started = FALSE;
+
+    if (pcap_reader_open(&reader, pcapPath) != PCAP_OK) {
+      sender->counters.errors++;
+      break;
+    }
+    while (!g_atomic_int_get(sender->closing) && pcap_reader_next(&reader, &packet)) {
+      if (!started) {
+        first = packet.timestamp;
+        started = TRUE;
+      }
+      last = packet.timestamp;
+      if (sender->speed > 0) {
+        gint64 due = start + (gint64) ((packet.timestamp - first) / 1000 / sender->speed);
+        gint64 now = g_get_monotonic_time();
+        if (due > now) {
+          loadgen_flush(sender);
+          g_usleep(due - now);
+        }
+      }
+
+      struct iovec * iovec = loadgen_next_message(sender);
+      iovec->iov_base = (void *) packet.payload;
+      iovec->iov_len = packet.payloadLen;
+      if (packet.payloadLen >= 2 && (packet.payload[1] & 0x7f) == payloadType && (packet.payload[1] & 0x80)) {
+        sender->counters.frames++;
+        sender->counters.completeFrames++;
+      }
+    }
+    /* the messages point into the mapped file */
+    loadgen_flush(sender);
+    sender->counters.captureTime += last - first;
+    pcap_reader_close(&reader);
+  }
+  g_atomic_int_set(&sender->done, 1);
+  return NULL;
+}
+
+static int
+loadgen_connect (const gchar * address)
+{
+  const gchar * colon = strrchr(address, ':');
+  int fd;
+
+  if (strchr(address, '/')) {
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    if (strlen(address) >= sizeof(un.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      return -1;
+    }
+    strcpy(un.sun_path, address);
+    if (connect(fd, (struct sockaddr *) &un, sizeof(un)) < 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  struct sockaddr_in in;
+  gchar * name = colon ? g_strndup(address, colon - address) : g_strdup("127.0.0.1");
+  memset(&in, 0, sizeof(in));
+  in.sin_family = AF_INET;
+  in.sin_port = htons(atoi(colon ? colon + 1 : address));
+  if (strcmp(name, "localhost") == 0) {
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  } else if (inet_pton(AF_INET, name, &in.sin_addr) != 1) {
+    g_free(name);
+    return -1;
+  }
+  g_free(name);
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *) &in, sizeof(in)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* It reads vp8_inspector_frames_total from the inspector metrics endpoint */
+static gboolean
+loadgen_scrape_frames (guint64 * frames)
+{
+  struct timeval timeout = { LOADGEN_SCRAPE_TIMEOUT_MS / 1000, (LOADGEN_SCRAPE_TIMEOUT_MS % 1000) * 1000 };
+  const gchar * request = "GET /metrics HTTP/1.0\r\n\r\n";
+  const gchar * name = "\nvp8_inspector_frames_total ";
+  GString * response = g_string_sized_new(4096);
+  gchar buffer[4096];
+  gchar * line;
+  gboolean ok = FALSE;
+  ssize_t res;
+  int fd = loadgen_connect(metricsAddress);
+
+  if (fd < 0) {
+    g_string_free(response, TRUE);
+    return FALSE;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (write(fd, request, strlen(request)) == (ssize_t) strlen(request)) {
+    while ((res = read(fd, buffer, sizeof(buffer))) > 0) {
+      g_string_append_len(response, buffer, res);
+    }
+    line = strstr(response->str, name);
+    if (line) {
+      *frames = g_ascii_strtoull(line + strlen(name), NULL, 10);
+      ok = TRUE;
+    }
+  }
+  close(fd);
+  g_string_free(response, TRUE);
+  return ok;
+}
+
+static void
+loadgen_sum (LoadSender * senders, guint count, LoadCounters * total)
+{
+  guint i;
+
+  memset(total, 0, sizeof(LoadCounters));
+  for (i = 0; i < count; i++) {
+    total->packets += senders[i].counters.packets;
+    total->frames += senders[i].counters.frames;
+    total->completeFrames += senders[i].counters.completeFrames;
+    total->dropped += senders[i].counters.dropped;
+    total->reordered += senders[i].counters.reordered;
+    total->errors += senders[i].counters.errors;
+    total->captureTime += senders[i].counters.captureTime;
+  }
+}
+
+/**
+ *
+ * This function runs the senders at `runSpeed` for --seconds (or until the
+ * replay ends), reporting the rates once a second, and prints the summary of the
+ * run. The lost frames are in percent, -1 without --metrics (or when it
+ * could not be scraped).
+ *
+ */
+static void
+loadgen_run (LoadSender * senders, guint count, guint step, gdouble runSpeed, LoadRun * run)
+{
+  volatile gint closing = 0;
+  LoadCounters before, last, now;
+  guint64 inspectedBefore = 0, inspectedAfter = 0;
+  gboolean scraped = metricsAddress && loadgen_scrape_frames(&inspectedBefore);
+  gint64 start, reportAt, end;
+  gdouble elapsed;
+  guint i, running;
+
+  loadgen_sum(senders, count, &before);
+  last = before;
+  start = g_get_monotonic_time();
+  reportAt = start;
+  for (i = 0; i < count; i++) {
+    senders[i].speed = runSpeed;
+    senders[i].closing = &closing;
+    senders[i].done = 0;
+    senders[i].thread = g_thread_new("loadgen", pcapPath ? loadgen_replay_run : loadgen_synth_run, &senders[i]);
+  }
+
+  do {
+    g_usleep(10000);
+    for (i = 0, running = 0; i < count; i++) {
+      running += !g_atomic_int_get(&senders[i].done);
+    }
+    end = g_get_monotonic_time();
+    if (!pcapPath && end - start >= (gint64) seconds * G_USEC_PER_SEC) {
+      g_atomic_int_set(&closing, 1);
+    }
+    if (end - reportAt >= LOADGEN_REPORT_MS * 1000 || !running) {
+      loadgen_sum(senders, count, &now);
+      elapsed = (end - reportAt) / (gdouble) G_USEC_PER_SEC;
+      printf("{ \"step\": %u, \"elapsed\": %.1f, \"packets/s\": %.0f, \"frames/s\": %.0f }\n", step,
+        (end - start) / (gdouble) G_USEC_PER_SEC, (now.packets - last.packets) / elapsed, (now.frames - last.frames) / elapsed);
+      fflush(stdout);
+      last = now;
+      reportAt = end;
+    }
+  } while (running);
+
+  for (i = 0; i < count; i++) {
+    g_thread_join(senders[i].thread);
+  }
+  loadgen_sum(senders, count, &now);
+  elapsed = (end - start) / (gdouble) G_USEC_PER_SEC;
+  guint64 expected = now.completeFrames - before.completeFrames;
+  run->packetsPerSecond = (now.packets - before.packets) / elapsed;
+  run->framesPerSecond = (now.frames - before.frames) / elapsed;
+  run->lost = -1;
+  if (pcapPath) {
+    run->limited = elapsed > (now.captureTime - before.captureTime) / 1e9 / runSpeed * LOADGEN_LIMITED_RATIO + 0.1;
+  } else {
+    run->limited = run->framesPerSecond * LOADGEN_LIMITED_RATIO < ssrcs * fps * runSpeed;
+  }
+
+  printf("{ \"step\": %u, \"speed\": %.2f, \"seconds\": %.1f, \"packets\": %" G_GUINT64_FORMAT ", \"frames\": %" G_GUINT64_FORMAT
+    ", \"packets/s\": %.0f, \"frames/s\": %.0f, \"dropped\": %" G_GUINT64_FORMAT ", \"reordered\": %" G_GUINT64_FORMAT ", \"sendErrors\": %" G_GUINT64_FORMAT,
+    step, runSpeed, elapsed, now.packets - before.packets, now.frames - before.frames, run->packetsPerSecond,
+    run->framesPerSecond, now.dropped - before.dropped, now.reordered - before.reordered, now.errors - before.errors);
+  if (runSpeed > 0) {
+    printf(", \"generatorLimited\": %s", run->limited ? "true" : "false");
+  }
+  if (scraped) {
+    g_usleep(LOADGEN_SETTLE_MS * 1000);
+    scraped = loadgen_scrape_frames(&inspectedAfter);
+  }
+  if (scraped) {
+    guint64 inspected = inspectedAfter - inspectedBefore;
+    run->lost = expected > inspected ? (expected - inspected) * 100.0 / expected : 0;
+    printf(", \"inspectedFrames\": %" G_GUINT64_FORMAT ", \"lostFrames\": %" G_GUINT64_FORMAT ", \"lost\": %.3f",
+      inspected, expected > inspected ? expected - inspected : 0, run->lost);
+  }
+  printf(" }\n");
+  fflush(stdout);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  GOptionContext * context = g_option_context_new("- VP8 Frame Inspector load generator");
+  LoadSender * senders;
+  PcapReader reader;
+  guint count, i, j, step;
+  gdouble runSpeed, sustainable = 0;
+  LoadRun run, last;
+
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "Failed to parse the arguments\n");
+    exit(1);
+  }
+  if (port <= 0 || port > 65535 || speed < 0 || loops < 1 || ssrcs < 1 || bitrate < 1 || fps < 1 || gop < 1 || seconds < 1
+      || threads < 1 || threads > LOADGEN_MAX_THREADS || payloadType < 0 || payloadType > 127
+      || loss < 0 || loss > 100 || reorder < 0 || reorder > 100 || maxLoss < 0) {
+    fprintf(stderr, "Invalid arguments, see --help\n");
+    exit(1);
+  }
+  if (ramp != 0 && (ramp <= 1 || !metricsAddress || speed == 0)) {
+    fprintf(stderr, "--ramp needs a factor above 1, --metrics and a --speed above 0\n");
+    exit(1);
+  }
+  if (pcapPath) {
+    if (pcap_reader_open(&reader, pcapPath) != PCAP_OK) {
+      fprintf(stderr, "Failed to read %s\n", pcapPath);
+      exit(1);
+    }
+    pcap_reader_close(&reader);
+    /* the packets of a capture must keep their order */
+    threads = 1;
+  }
+
+  count = pcapPath ? 1 : (guint) MIN(threads, ssrcs);
+  senders = g_new0(LoadSender, count);
+  for (i = 0; i < count; i++) {
+    LoadSender * sender = &senders[i];
+    sender->id = i;
+    sender->seed = i + 1;
+    sender->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sender->address.sin_family = AF_INET;
+    sender->address.sin_port = htons(port);
+    if (sender->fd < 0 || inet_pton(AF_INET, host, &sender->address.sin_addr) != 1) {
+      fprintf(stderr, "Invalid host %s\n", host);
+      exit(1);
+    }
+    sender->buffers = g_malloc0(LOADGEN_BATCH_SZ * LOADGEN_PACKET_SZ);
+    for (j = 0; j < LOADGEN_BATCH_SZ; j++) {
+      sender->messages[j].msg_hdr.msg_iov = &sender->iovecs[j];
+      sender->messages[j].msg_hdr.msg_iovlen = 1;
+      sender->messages[j].msg_hdr.msg_name = &sender->address;
+      sender->messages[j].msg_hdr.msg_namelen = sizeof(sender->address);
+    }
+    if (!pcapPath) {
+      /* the first ssrcs % threads senders take one stream more */
+      sender->numStreams = ssrcs / count + (i < ssrcs % count);
+      sender->streams = g_new0(LoadStream, sender->numStreams);
+      for (j = 0; j < sender->numStreams; j++) {
+        sender->streams[j].ssrc = 0x20000000 + i * (ssrcs / count + 1) + j;
+        sender->streams[j].seq = rand_r(&sender->seed);
+        sender->streams[j].timestamp = rand_r(&sender->seed);
+      }
+    }
+  }
+
+  runSpeed = speed;
+  for (step = 1; ; step++) {
+    loadgen_run(senders, count, step, runSpeed, &run);
+    if (ramp == 0 || run.lost < 0 || run.lost > maxLoss) {
+      break;
+    }
+    sustainable = runSpeed;
+    last = run;
+    if (run.limited) {
+      /* the inspector kept up with all the generator could send, more --threads may go further */
+      break;
+    }
+    runSpeed *= ramp;
+  }
+
+  if (ramp != 0) {
+    if (sustainable > 0) {
+      printf("{ \"sustainable\": { \"speed\": %.2f, \"packets/s\": %.0f, \"frames/s\": %.0f, \"generatorLimited\": %s } }\n",
+        sustainable, last.packetsPerSecond, last.framesPerSecond, last.limited ? "true" : "false");
+    } else {
+      printf("{ \"sustainable\": null }\n");
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    close(senders[i].fd);
+    g_free(senders[i].streams);
+    g_free(senders[i].buffers);
+  }
+  g_free(senders);
+  return 0;
+}
@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "log.h"
+
+/* No heap allocation, and the line is written at once (stderr is locked) */
+void
+log_info (gchar *str, ...)
+{
+  va_list arg;
+  va_start(arg, str);
+  flockfile(stderr);
+  vfprintf(stderr, str, arg);
+  fputc_unlocked('\n', stderr);
+  funlockfile(stderr);
+  va_end(arg);
+}
@@ -0,0 +1,8 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <glib.h>
+
+void log_info(gchar *str, ...);
+
+#endif
@@ -0,0 +1,369 @@
+/**
+ *
+ * The metrics endpoint (--metrics): per-SSRC counters in the Prometheus
+ * text exposition format, served over HTTP on a local TCP port or a Unix
+ * socket (curl --unix-socket <path> http://localhost/metrics).
+ *
+ * The inspection threads only increment the counters of their own streams
+ * (StreamInspector.counters), the frame path takes no lock. The live
+ * streams are linked in a registry whose mutex is only taken when a stream
+ * is created or removed and when the endpoint is scraped: the counters are
+ * aggregated then, by SSRC. The counters of the removed streams are kept
+ * in the totals, so the totals never go backwards.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "stream_inspector.h"
+
+typedef struct
+{
+  guint32 ssrc;
+  StreamCounters counters;
+} MetricsSample;
+
+typedef struct
+{
+  const gchar * name;
+  const gchar * help;
+  gsize offset;
+} MetricsCounter;
+
+static const MetricsCounter counters[] = {
+  { "frames", "Frames inspected", G_STRUCT_OFFSET(StreamCounters, frames) },
+  { "corrupt_frames", "Frames that failed to parse (ok: 0)", G_STRUCT_OFFSET(StreamCounters, corruptFrames) },
+  { "keyframes", "Keyframes", G_STRUCT_OFFSET(StreamCounters, keyframes) },
+  { "hidden_frames", "Frames not shown (show_frame: 0)", G_STRUCT_OFFSET(StreamCounters, hiddenFrames) },
+  { "golden_refreshes", "Frames refreshing the golden frame", G_STRUCT_OFFSET(StreamCounters, goldenRefreshes) },
+  { "altref_refreshes", "Frames refreshing the altref frame", G_STRUCT_OFFSET(StreamCounters, altrefRefreshes) },
+  { "bytes", "Bytes of the inspected frames", G_STRUCT_OFFSET(StreamCounters, bytes) },
+  { "resolution_changes", "Keyframes changing the resolution", G_STRUCT_OFFSET(StreamCounters, resolutionChanges) }
+};
+
+static GMutex registryMutex;
+static StreamInspector * registry = NULL;
+static StreamCounters removedCounters;
+static guint64 streamsCreated = 0;
+static guint64 streamsRemoved = 0;
+
+/* The counters of a live stream are incremented by its thread meanwhile (see stream_counters_count()) */
+static inline guint64
+stream_counters_get (const StreamCounters * values, guint i)
+{
+  return __atomic_load_n((const guint64 *) ((const guint8 *) values + counters[i].offset), __ATOMIC_RELAXED);
+}
+
+static void
+stream_counters_load (StreamCounters * values, const StreamCounters * live)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(counters); i++) {
+    *(guint64 *) ((guint8 *) values + counters[i].offset) = stream_counters_get(live, i);
+  }
+}
+
+static void
+stream_counters_add (StreamCounters * values, const StreamCounters * other)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(counters); i++) {
+    *(guint64 *) ((guint8 *) values + counters[i].offset) += stream_counters_get(other, i);
+  }
+}
+
+void
+metrics_register (StreamInspector * streamInspector)
+{
+  memset(&streamInspector->counters, 0, sizeof(StreamCounters));
+
+  g_mutex_lock(&registryMutex);
+  streamInspector->metricsPrev = NULL;
+  streamInspector->metricsNext = registry;
+  if (registry) {
+    registry->metricsPrev = streamInspector;
+  }
+  registry = streamInspector;
+  streamsCreated++;
+  g_mutex_unlock(&registryMutex);
+}
+
+void
+metrics_unregister (StreamInspector * streamInspector)
+{
+  g_mutex_lock(&registryMutex);
+  if (streamInspector->metricsPrev) {
+    streamInspector->metricsPrev->metricsNext = streamInspector->metricsNext;
+  } else {
+    registry = streamInspector->metricsNext;
+  }
+  if (streamInspector->metricsNext) {
+    streamInspector->metricsNext->metricsPrev = streamInspector->metricsPrev;
+  }
+  stream_counters_add(&removedCounters, &streamInspector->counters);
+  streamsRemoved++;
+  g_mutex_unlock(&registryMutex);
+}
+
+static gint
+metrics_sample_compare (gconstpointer a, gconstpointer b)
+{
+  guint32 ssrcA = ((const MetricsSample *) a)->ssrc;
+  guint32 ssrcB = ((const MetricsSample *) b)->ssrc;
+
+  return ssrcA < ssrcB ? -1 : ssrcA > ssrcB;
+}
+
+/**
+ *
+ * This function appends the metrics in the Prometheus text format: for
+ * each counter, the total of every stream since the start and the value
+ * of each live SSRC (the streams of a SSRC on several ports are added up).
+ *
+ */
+void
+metrics_format (GString * out)
+{
+  GArray * samples = g_array_new(FALSE, FALSE, sizeof(MetricsSample));
+  StreamCounters totals;
+  guint64 created, removed;
+  StreamInspector * streamInspector;
+  guint i, j, live = 0;
+
+  g_mutex_lock(&registryMutex);
+  totals = removedCounters;
+  created = streamsCreated;
+  removed = streamsRemoved;
+  for (streamInspector = registry; streamInspector; streamInspector = streamInspector->metricsNext) {
+    MetricsSample sample;
+    sample.ssrc = streamInspector->ssrcId;
+    stream_counters_load(&sample.counters, &streamInspector->counters);
+    stream_counters_add(&totals, &sample.counters);
+    g_array_append_val(samples, sample);
+  }
+  g_mutex_unlock(&registryMutex);
+
+  /* sorted by SSRC, the streams of the same SSRC are merged */
+  g_array_sort(samples, metrics_sample_compare);
+  for (i = 0; i < samples->len; i++) {
+    MetricsSample * sample = &g_array_index(samples, MetricsSample, i);
+    if (live > 0 && g_array_index(samples, MetricsSample, live - 1).ssrc == sample->ssrc) {
+      stream_counters_add(&g_array_index(samples, MetricsSample, live - 1).counters, &sample->counters);
+      continue;
+    }
+    g_array_index(samples, MetricsSample, live++) = *sample;
+  }
+
+  g_string_append_printf(out, "# HELP vp8_inspector_streams_created_total Streams created\n"
+    "# TYPE vp8_inspector_streams_created_total counter\nvp8_inspector_streams_created_total %" G_GUINT64_FORMAT "\n", created);
+  g_string_append_printf(out, "# HELP vp8_inspector_streams_removed_total Streams removed\n"
+    "# TYPE vp8_inspector_streams_removed_total counter\nvp8_inspector_streams_removed_total %" G_GUINT64_FORMAT "\n", removed);
+  g_string_append_printf(out, "# HELP vp8_inspector_streams Live SSRCs\n"
+    "# TYPE vp8_inspector_streams gauge\nvp8_inspector_streams %u\n", live);
+
+  for (i = 0; i < G_N_ELEMENTS(counters); i++) {
+    g_string_append_printf(out, "# HELP vp8_inspector_%s_total %s, all streams\n# TYPE vp8_inspector_%s_total counter\n"
+      "vp8_inspector_%s_total %" G_GUINT64_FORMAT "\n",
+      counters[i].name, counters[i].help, counters[i].name, counters[i].name, stream_counters_get(&totals, i));
+    g_string_append_printf(out, "# HELP vp8_inspector_stream_%s_total %s, per live SSRC\n# TYPE vp8_inspector_stream_%s_total counter\n",
+      counters[i].name, counters[i].help, counters[i].name);
+    for (j = 0; j < live; j++) {
+      MetricsSample * sample = &g_array_index(samples, MetricsSample, j);
+      g_string_append_printf(out, "vp8_inspector_stream_%s_total{ssrc=\"%u\"} %" G_GUINT64_FORMAT "\n",
+        counters[i].name, sample->ssrc, stream_counters_get(&sample->counters, i));
+    }
+  }
+
+  g_array_free(samples, TRUE);
+}
+
+/* It reads the request line, a GET of anything else than / or /metrics is a 404 */
+static void
+metrics_server_reply (MetricsServer * server, int fd)
+{
+  gchar request[METRICS_REQUEST_SZ];
+  struct timeval timeout = { METRICS_TIMEOUT_MS / 1000, (METRICS_TIMEOUT_MS % 1000) * 1000 };
+  gssize len;
+  GString * response;
+  gchar ** words;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  len = recv(fd, request, sizeof(request) - 1, 0);
+  if (len <= 0) {
+    return;
+  }
+  request[len] = '\0';
+
+  words = g_strsplit_set(request, " \r\n", 3);
+  response = g_string_new(NULL);
+  if (g_strv_length(words) >= 2 && g_strcmp0(words[0], "GET") == 0 &&
+      (g_strcmp0(words[1], "/metrics") == 0 || g_strcmp0(words[1], "/") == 0)) {
+    GString * body = g_string_new(NULL);
+    metrics_format(body);
+    g_string_append_printf(response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %"
+      G_GSIZE_FORMAT "\r\n\r\n%s", body->len, body->str);
+    g_string_free(body, TRUE);
+    server->scrapes++;
+  } else {
+    g_string_append(response, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+  }
+
+  gsize sent = 0;
+  while (sent < response->len) {
+    gssize res = send(fd, response->str + sent, response->len - sent, MSG_NOSIGNAL);
+    if (res <= 0) {
+      break;
+    }
+    sent += res;
+  }
+
+  g_string_free(response, TRUE);
+  g_strfreev(words);
+}
+
+static gpointer
+metrics_server_run (gpointer data)
+{
+  MetricsServer * server = (MetricsServer *) data;
+  struct pollfd fds;
+
+  while (!g_atomic_int_get(&server->stopping)) {
+    fds.fd = server->fd;
+    fds.events = POLLIN;
+    if (poll(&fds, 1, METRICS_POLL_MS) <= 0) {
+      continue;
+    }
+    int fd = accept4(server->fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    metrics_server_reply(server, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+static int
+metrics_server_bind_unix (const gchar * socketPath)
+{
+  struct sockaddr_un address;
+  int fd;
+
+  if (strlen(socketPath) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  g_strlcpy(address.sun_path, socketPath, sizeof(address.sun_path));
+  unlink(socketPath);
+  if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int
+metrics_server_bind_tcp (const gchar * host, guint16 port)
+{
+  struct sockaddr_in address;
+  int fd, reuse = 1;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, g_strcmp0(host, "localhost") == 0 ? "127.0.0.1" : host, &address.sin_addr) != 1) {
+    return -1;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ *
+ * This function starts serving the metrics on `address`: a Unix socket path
+ * (anything with a '/'), or a TCP "port" or "address:port" (IPv4, 127.0.0.1
+ * when only the port is given).
+ *
+ */
+guint
+metrics_server_start (MetricsServer * server, const gchar * address)
+{
+  const gchar * colon = strrchr(address, ':');
+  gchar * host = colon ? g_strndup(address, colon - address) : g_strdup("127.0.0.1");
+  const gchar * portString = colon ? colon + 1 : address;
+  gchar * end = NULL;
+  guint64 port;
+
+  memset(server, 0, sizeof(MetricsServer));
+  server->fd = -1;
+
+  if (strchr(address, '/')) {
+    server->fd = metrics_server_bind_unix(address);
+    server->socketPath = g_strdup(address);
+  } else {
+    port = g_ascii_strtoull(portString, &end, 10);
+    if (!g_ascii_isdigit(portString[0]) || *end != '\0' || port == 0 || port > 65535) {
+      g_free(host);
+      return METRICS_ERROR_ADDRESS;
+    }
+    server->fd = metrics_server_bind_tcp(host, (guint16) port);
+  }
+  g_free(host);
+
+  if (server->fd < 0) {
+    return METRICS_ERROR_BIND;
+  }
+  if (listen(server->fd, SOMAXCONN) < 0) {
+    metrics_server_stop(server);
+    return METRICS_ERROR_SOCKET;
+  }
+
+  server->thread = g_thread_new("metrics", metrics_server_run, server);
+  return METRICS_OK;
+}
+
+void
+metrics_server_stop (MetricsServer * server)
+{
+  g_atomic_int_set(&server->stopping, 1);
+  if (server->thread) {
+    g_thread_join(server->thread);
+    server->thread = NULL;
+  }
+  if (server->fd >= 0) {
+    close(server->fd);
+    server->fd = -1;
+  }
+  if (server->socketPath) {
+    unlink(server->socketPath);
+    g_free(server->socketPath);
+    server->socketPath = NULL;
+  }
+}
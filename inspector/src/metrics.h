@@ -0,0 +1,78 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+#include "vp8_parser.h"
+
+enum
+{
+  METRICS_OK = 0,
+  METRICS_ERROR_SOCKET = 1,
+  METRICS_ERROR_BIND = 2,
+  METRICS_ERROR_ADDRESS = 3
+};
+
+enum
+{
+  METRICS_REQUEST_SZ = 2048,
+  METRICS_POLL_MS = 500,
+  METRICS_TIMEOUT_MS = 1000
+};
+
+/**
+ *
+ * The counters of a stream, the flags are counted as they are in the
+ * results (a frame with ok: 0 may still have a valid frame tag). They are
+ * only written by the thread that inspects the stream and read by the
+ * metrics server when it is scraped, both with relaxed atomics (no lock,
+ * no ordering): a read may miss the frame being inspected.
+ *
+ */
+typedef struct
+{
+  guint64 frames;
+  guint64 corruptFrames;       /* ok == 0 */
+  guint64 keyframes;
+  guint64 hiddenFrames;        /* show_frame == 0 */
+  guint64 goldenRefreshes;
+  guint64 altrefRefreshes;
+  guint64 bytes;
+  guint64 resolutionChanges;   /* keyframes with another resolution than the previous one */
+} StreamCounters;
+
+/* A Unix socket (outputPath-like, with a '/') or a TCP [address:]port, localhost by default */
+typedef struct
+{
+  gchar * socketPath;
+  int fd;
+  GThread * thread;
+  volatile gint stopping;
+  guint64 scrapes;
+} MetricsServer;
+
+#define STREAM_COUNTERS_ADD(counter, value) __atomic_fetch_add(&(counter), (guint64) (value), __ATOMIC_RELAXED)
+
+static inline void
+stream_counters_count (StreamCounters * counters, const FrameInfo * ctx, gboolean resolutionChanged)
+{
+  STREAM_COUNTERS_ADD(counters->frames, 1);
+  STREAM_COUNTERS_ADD(counters->bytes, ctx->size);
+  STREAM_COUNTERS_ADD(counters->corruptFrames, !ctx->ok);
+  STREAM_COUNTERS_ADD(counters->keyframes, ctx->keyframe);
+  STREAM_COUNTERS_ADD(counters->hiddenFrames, !ctx->showFrame);
+  STREAM_COUNTERS_ADD(counters->goldenRefreshes, ctx->refreshGoldenFrame);
+  STREAM_COUNTERS_ADD(counters->altrefRefreshes, ctx->refreshAltrefFrame);
+  STREAM_COUNTERS_ADD(counters->resolutionChanges, resolutionChanged);
+}
+
+struct _StreamInspector;
+
+void metrics_register(struct _StreamInspector * streamInspector);
+void metrics_unregister(struct _StreamInspector * streamInspector);
+void metrics_format(GString * out);
+
+guint metrics_server_start(MetricsServer * server, const gchar * address);
+void metrics_server_stop(MetricsServer * server);
+
+#endif
@@ -0,0 +1,485 @@
+/**
+ *
+ * The native engine worker: SSRC demux, VP8 depayloading and inspection.
+ *
+ * The native PCAP engine uses one worker and pushes the packets itself.
+ * In realtime mode each worker runs in its own thread (pinned to a CPU)
+ * reading from its own SO_REUSEPORT socket, and the kernel steers each
+ * SSRC to one socket (see udp_receiver_steer_by_ssrc()). So each worker
+ * has its own StreamInspector table and output files and the hot path
+ * has no shared state between workers.
+ *
+ * With a reorder window (--reorderWindow), the packets of a stream go through
+ * its RtpReorder first. The packets that had to wait are copied, so the
+ * frame is detached after pushing each of them.
+ *
+ * Once the streams are created (and the reorder pool has the buffers of the
+ * most packets held at once), pushing packets does no heap allocation.
+ * Removed streams (and their depayloader buffers) are kept in a per-worker
+ * pool for the next streams.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "native_worker.h"
+
+typedef struct
+{
+  NativeWorker * worker;
+  NativeStream * stream;
+} NativeEmit;
+
+static void native_stream_emit(const RtpPacket * rtp, gboolean held, gpointer data);
+
+static void
+native_stream_free (NativeWorker * worker, NativeStream * stream)
+{
+  NativeEmit emit = { worker, stream };
+
+  /* the frames waiting for a lost packet are inspected now */
+  rtp_reorder_flush(&stream->reorder, native_stream_emit, &emit);
+  if (stream->holding) {
+    g_ptr_array_remove_fast(worker->holding, stream);
+  }
+
+  log_info("native_stream_free: ssrc %s, dropped frames: %u, lost pictures: %u, lost packets: %u, reordered packets: %"
+    G_GUINT64_FORMAT ", late packets: %" G_GUINT64_FORMAT, stream->streamInspector->ssrc, stream->depay.droppedFrames,
+    stream->depay.lostPictures, stream->depay.lostPackets, stream->reorder.reordered, stream->reorder.late);
+  stream_inspector_destroy(stream->streamInspector);
+
+  if (worker->poolSize < NATIVE_STREAM_POOL_SZ) {
+    stream->next = worker->pool;
+    worker->pool = stream;
+    worker->poolSize++;
+    return;
+  }
+  vp8_depay_clear(&stream->depay);
+  rtp_reorder_clear(&stream->reorder);
+  free(stream);
+}
+
+void
+native_worker_init (NativeWorker * worker, guint id, const NativeOptions * options)
+{
+  memset(worker, 0, sizeof(NativeWorker));
+  worker->id = id;
+  worker->cpu = -1;
+  worker->options = options;
+  ssrc_table_init(&worker->streams);
+  worker->touched = g_ptr_array_new();
+  worker->holding = g_ptr_array_new();
+  rtp_reorder_pool_init(&worker->reorderPool);
+  worker->receiver.fd = -1;
+}
+
+void
+native_worker_clear (NativeWorker * worker)
+{
+  guint i;
+
+  for (i = 0; i < worker->streams.capacity; i++) {
+    if (worker->streams.slots[i].value) {
+      native_stream_free(worker, worker->streams.slots[i].value);
+    }
+  }
+  ssrc_table_clear(&worker->streams);
+  g_ptr_array_free(worker->touched, TRUE);
+  g_ptr_array_free(worker->holding, TRUE);
+  while (worker->pool) {
+    NativeStream * stream = worker->pool;
+    worker->pool = stream->next;
+    vp8_depay_clear(&stream->depay);
+    rtp_reorder_clear(&stream->reorder);
+    free(stream);
+  }
+  worker->poolSize = 0;
+  rtp_reorder_pool_clear(&worker->reorderPool);
+  if (worker->receiver.fd >= 0) {
+    udp_receiver_close(&worker->receiver);
+  }
+}
+
+/**
+ *
+ * This function returns the stream of a SSRC, creating its StreamInspector
+ * (using the same pad name that rtpbin would give us) for new SSRCs.
+ *
+ */
+NativeStream *
+native_worker_stream (NativeWorker * worker, guint32 ssrc, guint payloadType)
+{
+  NativeStream * stream = ssrc_table_lookup(&worker->streams, ssrc);
+  if (!stream) {
+    gchar padName[64];
+    g_snprintf(padName, sizeof(padName), "recv_rtp_src_0_%u_%u", ssrc, payloadType);
+    log_info("native_worker_stream: worker %u, new stream %s", worker->id, padName);
+    stream = worker->pool;
+    if (stream) {
+      Vp8Depay depay = stream->depay;
+      RtpReorder reorder = stream->reorder;
+      worker->pool = stream->next;
+      worker->poolSize--;
+      memset(stream, 0, sizeof(NativeStream));
+      stream->depay = depay;
+      stream->reorder = reorder;
+      vp8_depay_reset(&stream->depay);
+      rtp_reorder_reset(&stream->reorder);
+    } else {
+      stream = calloc(1, sizeof(NativeStream));
+      /* the detached frames only need the header prefix of the parse depth */
+      vp8_depay_init_sized(&stream->depay, vp8_header_prefix_size(worker->options->parseDepth));
+      rtp_reorder_init(&stream->reorder, worker->options->reorderWindow, (guint64) worker->options->reorderLatencyMs * 1000000, &worker->reorderPool);
+    }
+    stream->streamInspector = stream_inspector_initialize(padName, worker->options->parseDepth, worker->options->output);
+    ssrc_table_insert(&worker->streams, ssrc, stream);
+  }
+  return stream;
+}
+
+/**
+ *
+ * This function removes the stream of a SSRC (like on_pad_removed()).
+ * It returns FALSE when there is no such stream.
+ *
+ */
+gboolean
+native_worker_remove (NativeWorker * worker, guint32 ssrc)
+{
+  NativeStream * stream = ssrc_table_remove(&worker->streams, ssrc);
+  if (!stream) {
+    return FALSE;
+  }
+  native_stream_free(worker, stream);
+  return TRUE;
+}
+
+/**
+ *
+ * This function is called for each RTP packet of the stream, in order.
+ * It inspects each frame completed by the depayloader.
+ * The frame PTS comes from the RTP timestamp (or from the kernel receive time
+ * with --kernelTimestamps), relative to the first frame of the stream. The
+ * GStreamer pipeline pushes the packets leaving its jitterbuffer here too
+ * (see demux_probe()): like rtpvp8depay, its frame PTS is the buffer PTS
+ * of the packet that completed the frame.
+ *
+ * For the stage stats, a packet that was not `held` left the reorder window
+ * when it arrived, so only the frames completed by a held packet spend time
+ * there. The packets of the GStreamer pipeline left its jitterbuffer when
+ * they are pushed.
+ *
+ */
+static void
+native_stream_push (NativeWorker * worker, NativeStream * stream, const RtpPacket * rtp, gboolean held)
+{
+  if (!vp8_depay_push(&stream->depay, rtp)) {
+    return;
+  }
+
+#ifndef INSPECTOR_NO_STATS
+  if (stageStatsEnabled) {
+    guint64 now = stage_clock_now();
+    STAGE_STATS_SET(STAGE_RECEIVE, worker->measureLatency ? rtp->arrival : 0);
+    STAGE_STATS_SET(STAGE_JITTER, worker->measureLatency ? (held || worker->options->jitterBuffered ? now : rtp->arrival) : 0);
+    STAGE_STATS_SET(STAGE_DEPAY, now);
+  }
+#endif
+
+  guint8 prefix[FRAME_HEADER_FULL_PREFIX_SZ];
+  const Vp8Frame * frame = &stream->depay.frame;
+  guint available = vp8_frame_copy(frame, prefix, vp8_header_prefix_size(worker->options->parseDepth));
+  guint8 table[PARTITION_TABLE_SZ];
+  guint tableAvailable = vp8_frame_copy_at(frame, vp8_partition_table_offset(prefix, available), table, sizeof(table));
+
+  stream->lastTimestamp = rtp_timestamp_extend(stream->lastTimestamp, frame->timestamp);
+  if (stream->firstTimestamp == 0) {
+    stream->firstTimestamp = stream->lastTimestamp;
+  }
+
+  guint64 timestamp = (stream->lastTimestamp - stream->firstTimestamp) * 100000 / 9;
+  if (worker->options->kernelTimestamps && frame->arrival) {
+    if (stream->firstArrival == 0) {
+      stream->firstArrival = frame->arrival;
+    }
+    timestamp = frame->arrival - stream->firstArrival;
+  }
+  if (worker->options->jitterBuffered) {
+    if (stream->firstPts == 0) {
+      stream->firstPts = rtp->pts;
+    }
+    timestamp = rtp->pts > stream->firstPts ? rtp->pts - stream->firstPts : 0;
+  }
+
+  FrameIndexWriter * index = worker->options->index;
+  FrameResolution previous = stream->streamInspector->lastResolution;  /* for the resolution changes of the index */
+
+  const FrameInfo * info = inspect_frame_info(stream->streamInspector, prefix, available, table, tableAvailable, frame->size, timestamp, frame->arrival);
+  worker->frames++;
+  if (index) {
+    frame_index_writer_add(index, stream->streamInspector->ssrcId, frame->timestamp, frame->offset, info, &previous);
+  }
+
+  /* from the arrival of the packet that completed the frame, including its wait in the reorder window */
+  if (worker->measureLatency && rtp->arrival) {
+    guint64 now = (guint64) g_get_real_time() * 1000;
+    latency_histogram_record(&worker->latency, now > rtp->arrival ? now - rtp->arrival : 0);
+  }
+}
+
+static void
+native_stream_emit (const RtpPacket * rtp, gboolean held, gpointer data)
+{
+  NativeEmit * emit = (NativeEmit *) data;
+
+  native_stream_push(emit->worker, emit->stream, rtp, held);
+  /* a held packet lives in its reorder slot, which is reused by the next packets */
+  if (held) {
+    vp8_depay_detach(&emit->stream->depay);
+  }
+}
+
+/**
+ *
+ * This function is called for each RTP packet with the expected payload type.
+ * Without a reorder window the packet goes straight to the depayloader.
+ *
+ */
+NativeStream *
+native_worker_push (NativeWorker * worker, const RtpPacket * rtp)
+{
+  NativeStream * stream = native_worker_stream(worker, rtp->ssrc, rtp->payloadType);
+
+  worker->packets++;
+  if (worker->options->reorderWindow == 0) {
+    native_stream_push(worker, stream, rtp, FALSE);
+    return stream;
+  }
+
+  NativeEmit emit = { worker, stream };
+  rtp_reorder_push(&stream->reorder, rtp, native_stream_emit, &emit);
+  if (stream->reorder.held > 0 && !stream->holding) {
+    stream->holding = TRUE;
+    g_ptr_array_add(worker->holding, stream);
+  }
+  return stream;
+}
+
+/**
+ *
+ * This function emits the held packets whose wait is over at `now`
+ * (nanoseconds since the epoch, like the arrival times).
+ *
+ */
+static void
+native_worker_release (NativeWorker * worker, guint64 now)
+{
+  guint i = 0;
+
+  while (i < worker->holding->len) {
+    NativeStream * stream = g_ptr_array_index(worker->holding, i);
+    NativeEmit emit = { worker, stream };
+    rtp_reorder_expire(&stream->reorder, now, native_stream_emit, &emit);
+    if (stream->reorder.held == 0) {
+      stream->holding = FALSE;
+      g_ptr_array_remove_index_fast(worker->holding, i);
+      continue;
+    }
+    i++;
+  }
+}
+
+/* When the first held packet of the worker must be emitted (like the arrival times), G_MAXUINT64 when none is held */
+guint64
+native_worker_next_deadline (NativeWorker * worker)
+{
+  guint64 deadline = G_MAXUINT64;
+  guint i;
+
+  for (i = 0; i < worker->holding->len; i++) {
+    NativeStream * stream = g_ptr_array_index(worker->holding, i);
+    deadline = MIN(deadline, stream->reorder.deadline);
+  }
+  return deadline;
+}
+
+/* The frames being assembled point to the packets, whose memory is about to be reused (see vp8_depay_detach()) */
+void
+native_worker_detach (NativeWorker * worker)
+{
+  guint i;
+
+  for (i = 0; i < worker->streams.capacity; i++) {
+    NativeStream * stream = worker->streams.slots[i].value;
+    if (stream) {
+      vp8_depay_detach(&stream->depay);
+    }
+  }
+}
+
+/* The memory of the packets of the frames being assembled is gone (a truncated capture), so they can not be detached */
+void
+native_worker_drop_frames (NativeWorker * worker)
+{
+  guint i;
+
+  for (i = 0; i < worker->streams.capacity; i++) {
+    NativeStream * stream = worker->streams.slots[i].value;
+    if (stream) {
+      vp8_depay_drop_frame(&stream->depay);
+    }
+  }
+}
+
+/* It emits every held packet, at the end of a PCAP file */
+void
+native_worker_flush (NativeWorker * worker)
+{
+  native_worker_release(worker, G_MAXUINT64);
+}
+
+/**
+ *
+ * This function pushes a batch of UDP packets read by the receiver.
+ *
+ * The packets live in the receiver packet pool, which is reused by the next
+ * batch. So, before returning, we detach the frames that are still being
+ * assembled by the streams touched in this batch.
+ *
+ */
+void
+native_worker_push_batch (NativeWorker * worker, const UdpPacket * packets, guint count, gint64 now)
+{
+  RtpPacket rtp;
+  guint64 receiveTime = 0;
+  guint i;
+
+  for (i = 0; i < count; i++) {
+    if (!rtp_packet_parse(packets[i].data, packets[i].len, &rtp) || !native_options_accept(worker->options, rtp.payloadType)) {
+      continue;
+    }
+    /* without kernel timestamps, all packets of the batch get the same arrival time */
+    rtp.arrival = packets[i].timestamp;
+    if (rtp.arrival == 0) {
+      if (receiveTime == 0) {
+        receiveTime = (guint64) g_get_real_time() * 1000;
+      }
+      rtp.arrival = receiveTime;
+    }
+
+    NativeStream * stream = native_worker_push(worker, &rtp);
+    stream->lastActivity = now;
+    if (!stream->touched) {
+      stream->touched = TRUE;
+      g_ptr_array_add(worker->touched, stream);
+    }
+  }
+
+  /* also when the receiver timed out (no packets), so a gap is not waited for longer than the latency */
+  if (worker->holding->len > 0) {
+    native_worker_release(worker, receiveTime ? receiveTime : (guint64) g_get_real_time() * 1000);
+  }
+
+  for (i = 0; i < worker->touched->len; i++) {
+    NativeStream * stream = g_ptr_array_index(worker->touched, i);
+    vp8_depay_detach(&stream->depay);
+    stream->touched = FALSE;
+  }
+  g_ptr_array_set_size(worker->touched, 0);
+}
+
+/**
+ *
+ * This function removes the streams without packets for NATIVE_STREAM_TIMEOUT_MS,
+ * closing their files like on_pad_removed() does when rtpbin removes a SSRC.
+ *
+ */
+void
+native_worker_expire (NativeWorker * worker, gint64 now)
+{
+  SsrcTable * streams = &worker->streams;
+  guint i = 0;
+
+  worker->expireTime = now;
+  while (i < streams->capacity) {
+    NativeStream * stream = streams->slots[i].value;
+    if (!stream || now - stream->lastActivity <= NATIVE_STREAM_TIMEOUT_MS * 1000) {
+      i++;
+      continue;
+    }
+    /* the slot is checked again, another stream may have moved into it */
+    ssrc_table_remove_slot(streams, i);
+    native_stream_free(worker, stream);
+  }
+}
+
+static void
+native_worker_pin (NativeWorker * worker)
+{
+  cpu_set_t cpus;
+
+  if (worker->cpu < 0) {
+    return;
+  }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(worker->cpu, &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    log_info("native_worker_pin: failed to pin worker %u to cpu %i", worker->id, worker->cpu);
+  }
+}
+
+/**
+ *
+ * The realtime worker thread: read a batch, push it, and once per
+ * NATIVE_STATS_INTERVAL_MS report kernel drops and remove inactive streams.
+ *
+ */
+gpointer
+native_worker_run (gpointer data)
+{
+  NativeWorker * worker = (NativeWorker *) data;
+  UdpReceiver * receiver = &worker->receiver;
+  guint32 reportedDrops = 0;
+  gint64 lastHousekeeping = g_get_monotonic_time();
+
+  native_worker_pin(worker);
+  worker->measureLatency = TRUE;
+
+  while (!*worker->options->closing) {
+    gint count = udp_receiver_receive(receiver);
+    if (count < 0) {
+      log_info("native_worker_run: worker %u failed to receive packets", worker->id);
+      break;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    native_worker_push_batch(worker, receiver->packets, count, now);
+
+    if (now - lastHousekeeping >= NATIVE_STATS_INTERVAL_MS * 1000) {
+      lastHousekeeping = now;
+      if (receiver->kernelDrops != reportedDrops) {
+        log_info("native_worker_run: worker %u, the kernel dropped %u packets (%u in total), we are falling behind",
+          worker->id, receiver->kernelDrops - reportedDrops, receiver->kernelDrops);
+        reportedDrops = receiver->kernelDrops;
+      }
+      native_worker_expire(worker, now);
+    }
+  }
+
+  log_info("Worker %u [cpu: %i, packets: %" G_GUINT64_FORMAT ", frames: %" G_GUINT64_FORMAT ", batches: %" G_GUINT64_FORMAT
+    ", packets/batch: %.1f, truncated: %" G_GUINT64_FORMAT ", kernel drops: %u]",
+    worker->id, worker->cpu, receiver->receivedPackets, worker->frames, receiver->receivedBatches,
+    receiver->receivedBatches ? receiver->receivedPackets / (gdouble) receiver->receivedBatches : 0.0,
+    receiver->truncatedPackets, receiver->kernelDrops);
+  if (worker->latency.total > 0) {
+    gchar name[64];
+    g_snprintf(name, sizeof(name), "Worker %u arrival to result latency", worker->id);
+    latency_histogram_log(&worker->latency, name);
+  }
+  return NULL;
+}
@@ -0,0 +1,98 @@
+#ifndef NATIVE_WORKER_H
+#define NATIVE_WORKER_H
+
+#include <signal.h>
+#include <glib.h>
+
+#include "frame_index.h"
+#include "latency_histogram.h"
+#include "rtp_parser.h"
+#include "rtp_reorder.h"
+#include "ssrc_table.h"
+#include "stream_inspector.h"
+#include "udp_receiver.h"
+#include "vp8_depay.h"
+
+enum
+{
+  NATIVE_STREAM_TIMEOUT_MS = 30000,
+  NATIVE_STATS_INTERVAL_MS = 1000,
+  NATIVE_MAX_WORKERS = 64,
+  NATIVE_STREAM_POOL_SZ = 1024 /* removed streams kept by each worker for the next streams */
+};
+
+typedef struct
+{
+  guint payloadType;
+  guint parseDepth;
+  const OutputSettings * output;
+  gboolean kernelTimestamps;
+  volatile sig_atomic_t * closing;
+  guint64 payloadTypes[2];  /* accepted payload types (bit N for payload type N), only payloadType when empty */
+  guint reorderWindow;      /* packets, 0 to push the packets as they arrive */
+  guint reorderLatencyMs;   /* the longest a packet waits in the reorder window */
+  FrameIndexWriter * index; /* PCAP files: the inspected frames are added to this index, NULL for none */
+  gboolean jitterBuffered;  /* the packets are pushed as they leave the rtpbin jitterbuffer, the frame PTS is their buffer PTS */
+} NativeOptions;
+
+static inline gboolean
+native_options_accept (const NativeOptions * options, guint payloadType)
+{
+  if (options->payloadTypes[0] == 0 && options->payloadTypes[1] == 0) {
+    return payloadType == options->payloadType;
+  }
+  return payloadType < 128 && ((options->payloadTypes[payloadType >> 6] >> (payloadType & 63)) & 1);
+}
+
+typedef struct _NativeStream
+{
+  StreamInspector *streamInspector;
+  Vp8Depay depay;
+  RtpReorder reorder;
+  guint64 firstTimestamp;
+  guint64 lastTimestamp;
+  guint64 firstArrival;
+  guint64 firstPts;
+  gint64 lastActivity;
+  gboolean touched;
+  gboolean holding;            /* the reorder window has packets */
+  struct _NativeStream * next; /* in the pool */
+} NativeStream;
+
+/* A worker owns its streams and output files, nothing is shared with other workers */
+typedef struct
+{
+  guint id;
+  gint cpu;
+  const NativeOptions * options;
+  SsrcTable streams;
+  GPtrArray * touched;
+  GPtrArray * holding;
+  NativeStream * pool;
+  guint poolSize;
+  RtpReorderPool reorderPool;  /* the payloads held by the reorder windows of the streams */
+  gint64 expireTime;
+  UdpReceiver receiver;
+  GThread * thread;
+
+  guint64 packets;
+  guint64 frames;
+  gboolean measureLatency;     /* realtime: the arrival to result latency of each frame */
+  LatencyHistogram latency;
+} NativeWorker;
+
+
+void native_worker_init(NativeWorker * worker, guint id, const NativeOptions * options);
+void native_worker_clear(NativeWorker * worker);
+NativeStream * native_worker_stream(NativeWorker * worker, guint32 ssrc, guint payloadType);
+gboolean native_worker_remove(NativeWorker * worker, guint32 ssrc);
+NativeStream * native_worker_push(NativeWorker * worker, const RtpPacket * rtp);
+void native_worker_push_batch(NativeWorker * worker, const UdpPacket * packets, guint count, gint64 now);
+void native_worker_expire(NativeWorker * worker, gint64 now);
+guint64 native_worker_next_deadline(NativeWorker * worker);
+void native_worker_detach(NativeWorker * worker);
+void native_worker_drop_frames(NativeWorker * worker);
+void native_worker_flush(NativeWorker * worker);
+gpointer native_worker_run(gpointer data);
+
+#endif
@@ -0,0 +1,618 @@
+/**
+ *
+ * Asynchronous batched output writer.
+ *
+ * The inspection threads (GStreamer streaming threads or native workers) do
+ * not format nor write anything: they copy a fixed-size record (the binary
+ * frame record of frame_record.h) into a lock-free ring and go back to the
+ * packets. A single writer thread drains
+ * the ring, formats the records and writes them to the stdio buffers of
+ * each stream. The buffers are flushed when --flushInterval milliseconds
+ * have passed or when --flushBytes bytes are pending, instead of after
+ * every single frame.
+ *
+ * With --format=binary the writer stores fixed-size records (frame_record.h)
+ * instead of text lines. With --aggregate most records are the windows of
+ * frames of the streams (aggregate.h) instead of the frames.
+ *
+ * With --statsInterval the writer also keeps the per-stage latency
+ * histograms of every SSRC (stage_stats.h): the records carry the stage
+ * times and the writer adds the output one. The performance counters of
+ * the frames (--perfCounters) are too big for every slot, they go to a
+ * ring of the same size that is only allocated when they are enabled.
+ *
+ * In realtime mode a full ring drops the record (and counts it), the packet
+ * path never blocks on the disk. In offline mode the producers wait, so no
+ * result is lost.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_record.h"
+#include "log.h"
+#include "output_writer.h"
+
+/* The binary header is written once, before the first record sent to stdout */
+static volatile gint stdoutHeaderWritten = 0;
+
+/**
+ *
+ * This function formats a frame info as the text line of the inspector logs.
+ * Frames parsed with --parseDepth=full also get the main fields of the rest of the header.
+ * It returns the length of the line.
+ *
+ */
+guint
+format_frame_info (gchar * buffer, gsize size, const gchar * ssrc, const FrameInfo * ctx)
+{
+  gint len = g_snprintf(buffer, size,
+    "ssrc: %s, frame: %u, pts: %" G_GUINT64_FORMAT ", ok: %u, keyframe: %u, show: %u, width: %u, height: %u, refreshGoldenFrame: %u, refreshAltrefFrame: %u",
+    ssrc, ctx->frameNumber, ctx->pts / FRAME_PTS_MSECOND, ctx->ok, ctx->keyframe, ctx->showFrame,
+    ctx->resolution.width, ctx->resolution.height, ctx->refreshGoldenFrame, ctx->refreshAltrefFrame);
+
+  if (ctx->parseDepth == VP8_PARSE_DEPTH_FULL && (gsize) len < size) {
+    len += g_snprintf(buffer + len, size - len,
+      ", partitions: %u, qIndex: %u, loopFilterLevel: %u, sharpness: %u, segmentation: %u, refreshEntropyProbs: %u, refreshLast: %u, "
+      "copyToGolden: %u, copyToAltref: %u, signBiasGolden: %u, signBiasAltref: %u, coeffUpdates: %u, mvUpdates: %u",
+      ctx->partitions, ctx->quantizer.yAcQi, ctx->loopFilter.level, ctx->loopFilter.sharpness, ctx->segmentation.enabled,
+      ctx->refreshEntropyProbs, ctx->refreshLast, ctx->copyBufferToGolden, ctx->copyBufferToAltref,
+      ctx->signBiasGolden, ctx->signBiasAltref, ctx->probs.coeffUpdates, ctx->probs.mvUpdates);
+  }
+
+  if ((gsize) len < size) {
+    len += g_snprintf(buffer + len, size - len, " \n");
+  }
+  return MIN((guint) len, size - 1);
+}
+
+gboolean
+parse_output_format (const gchar * name, guint * format)
+{
+  if (name == NULL || g_strcmp0(name, "text") == 0) {
+    *format = OUTPUT_FORMAT_TEXT;
+    return TRUE;
+  }
+  if (g_strcmp0(name, "binary") == 0) {
+    *format = OUTPUT_FORMAT_BINARY;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* The sequence number of the slot of `pos`, see OutputWriter */
+static inline guint
+output_slot_sequence (OutputWriter * writer, guint pos)
+{
+  return (guint) g_atomic_int_get(&writer->slots[pos & writer->mask].sequence) + (pos & writer->mask);
+}
+
+static inline void
+output_slot_set_sequence (OutputWriter * writer, guint pos, guint sequence)
+{
+  g_atomic_int_set(&writer->slots[pos & writer->mask].sequence, (gint) (sequence - (pos & writer->mask)));
+}
+
+static gboolean
+output_writer_try_push (OutputWriter * writer, const OutputRecord * record)
+{
+  guint pos = g_atomic_int_get(&writer->tail);
+  OutputSlot * slot;
+  gint occupancy;
+
+  for (;;) {
+    slot = &writer->slots[pos & writer->mask];
+    gint diff = (gint) (output_slot_sequence(writer, pos) - pos);
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange(&writer->tail, (gint) pos, (gint) (pos + 1))) {
+        break;
+      }
+    } else if (diff < 0) {
+      return FALSE;
+    }
+    pos = g_atomic_int_get(&writer->tail);
+  }
+
+  slot->record = *record;
+#ifndef INSPECTOR_NO_STATS
+  /* the counters of the frame measured by the calling thread */
+  if (writer->perf && record->type == OUTPUT_RECORD_FRAME) {
+    PERF_COUNTERS_TAKE(writer->perf[pos & writer->mask]);
+  }
+#endif
+  output_slot_set_sequence(writer, pos, pos + 1);
+
+  occupancy = (gint) (pos + 1 - (guint) g_atomic_int_get(&writer->head));
+  for (;;) {
+    gint highWater = g_atomic_int_get(&writer->highWater);
+    if (occupancy <= highWater || g_atomic_int_compare_and_exchange(&writer->highWater, highWater, occupancy)) {
+      break;
+    }
+  }
+
+  /* only wake the writer when it is really sleeping, the mutex is not taken otherwise */
+  if (g_atomic_int_get(&writer->waiting)) {
+    g_mutex_lock(&writer->mutex);
+    g_cond_signal(&writer->cond);
+    g_mutex_unlock(&writer->mutex);
+  }
+  return TRUE;
+}
+
+static gboolean
+output_writer_pop (OutputWriter * writer, OutputRecord * record, PerfFrame * perf)
+{
+  guint pos = g_atomic_int_get(&writer->head);
+  OutputSlot * slot = &writer->slots[pos & writer->mask];
+
+  if (output_slot_sequence(writer, pos) != pos + 1) {
+    return FALSE;
+  }
+
+  *record = slot->record;
+#ifndef INSPECTOR_NO_STATS
+  if (writer->perf) {
+    *perf = writer->perf[pos & writer->mask];
+  }
+#endif
+  output_slot_set_sequence(writer, pos, pos + writer->mask + 1);
+  g_atomic_int_set(&writer->head, (gint) (pos + 1));
+  return TRUE;
+}
+
+static gboolean
+output_writer_is_empty (OutputWriter * writer)
+{
+  guint pos = g_atomic_int_get(&writer->head);
+  return output_slot_sequence(writer, pos) != pos + 1;
+}
+
+static void
+output_writer_flush (OutputWriter * writer)
+{
+  guint i;
+
+  for (i = 0; i < writer->dirty->len; i++) {
+    OutputTarget * target = g_ptr_array_index(writer->dirty, i);
+    fflush(target->fdout);
+    target->dirty = FALSE;
+  }
+  g_ptr_array_set_size(writer->dirty, 0);
+
+  if (writer->stdoutDirty) {
+    fflush(stdout);
+    writer->stdoutDirty = FALSE;
+  }
+
+  if (writer->pendingBytes) {
+    writer->flushes++;
+  }
+  writer->pendingBytes = 0;
+}
+
+static void
+output_writer_write (OutputWriter * writer, const OutputRecord * record, const PerfFrame * recordPerf)
+{
+  OutputTarget * target = record->target;
+
+  if (record->type == OUTPUT_RECORD_SYNC) {
+    output_writer_flush(writer);
+    g_atomic_int_inc(&writer->synced);
+    return;
+  }
+
+  if (record->type == OUTPUT_RECORD_CLOSE) {
+#ifndef INSPECTOR_NO_STATS
+    if (writer->statsIntervalMs >= 0) {
+      stage_stats_close(&writer->stages, target->ssrcId);
+    }
+#endif
+    if (target->dirty) {
+      g_ptr_array_remove_fast(writer->dirty, target);
+    }
+    output_target_close(target);
+    return;
+  }
+
+  writer->records++;
+  if (record->type == OUTPUT_RECORD_WINDOW) {
+    writer->pendingBytes += output_target_write_window(target, &record->window);
+    writer->stdoutDirty |= target->useStdout;
+    if (target->fdout && !target->dirty) {
+      target->dirty = TRUE;
+      g_ptr_array_add(writer->dirty, target);
+    }
+    return;
+  }
+
+  PERF_COUNTERS_START();
+  writer->pendingBytes += output_target_write_record(target, record->frame);
+  PERF_COUNTERS_MARK(PERF_STAGE_OUTPUT);
+#ifndef INSPECTOR_NO_STATS
+  if (writer->statsIntervalMs >= 0) {
+    StageTimes stages = record->stages;
+    stages.at[STAGE_OUTPUT] = stage_clock_now();
+    stage_stats_record(&writer->stages, target->ssrcId, &stages);
+  }
+  if (writer->perf) {
+    PerfFrame perf = *recordPerf;
+    perf.stages[PERF_STAGE_OUTPUT] = perfThread.frame.stages[PERF_STAGE_OUTPUT];
+    perf.measured |= perfThread.frame.measured;
+    stage_stats_record_perf(&writer->stages, target->ssrcId, &perf);
+  }
+#endif
+  writer->stdoutDirty |= target->useStdout;
+  if (target->fdout && !target->dirty) {
+    target->dirty = TRUE;
+    g_ptr_array_add(writer->dirty, target);
+  }
+}
+
+#ifndef INSPECTOR_NO_STATS
+/* It dumps the stage stats when they were requested (SIGUSR1) or every statsIntervalMs */
+static void
+output_writer_check_stats (OutputWriter * writer, gint64 now, gint64 * lastStats)
+{
+  gint intervalMs = writer->statsIntervalMs;
+
+  if (intervalMs < 0) {
+    return;
+  }
+  if (g_atomic_int_compare_and_exchange(&writer->statsRequested, 1, 0)) {
+    stage_stats_dump(&writer->stages, "request");
+  } else if (intervalMs > 0 && now - *lastStats >= (gint64) intervalMs * 1000) {
+    stage_stats_dump(&writer->stages, "interval");
+  } else {
+    return;
+  }
+  *lastStats = now;
+}
+#endif
+
+static gpointer
+output_writer_run (gpointer data)
+{
+  OutputWriter * writer = (OutputWriter *) data;
+  gint64 interval = (gint64) writer->flushIntervalMs * 1000;
+  gint64 lastFlush = g_get_monotonic_time();
+#ifndef INSPECTOR_NO_STATS
+  gint64 lastStats = lastFlush;
+#endif
+
+  for (;;) {
+    OutputRecord record;
+    PerfFrame perf;
+    guint count = 0;
+    gint64 now;
+
+    while (count < OUTPUT_WRITER_BATCH_SZ && output_writer_pop(writer, &record, &perf)) {
+      output_writer_write(writer, &record, &perf);
+      count++;
+    }
+
+    now = g_get_monotonic_time();
+    if (writer->pendingBytes >= writer->flushBytes || (writer->pendingBytes && now - lastFlush >= interval)) {
+      output_writer_flush(writer);
+      lastFlush = now;
+    }
+#ifndef INSPECTOR_NO_STATS
+    output_writer_check_stats(writer, now, &lastStats);
+#endif
+
+    if (count) {
+      continue;
+    }
+
+    /* the producers are gone when stopping is set, so an empty ring means everything was written */
+    if (g_atomic_int_get(&writer->stopping) && output_writer_is_empty(writer)) {
+      break;
+    }
+
+    g_mutex_lock(&writer->mutex);
+    g_atomic_int_set(&writer->waiting, 1);
+    if (output_writer_is_empty(writer) && !g_atomic_int_get(&writer->stopping)) {
+      gint64 deadline = writer->pendingBytes ? lastFlush + interval : now + G_USEC_PER_SEC;
+      g_cond_wait_until(&writer->cond, &writer->mutex, deadline);
+    }
+    g_atomic_int_set(&writer->waiting, 0);
+    g_mutex_unlock(&writer->mutex);
+  }
+
+  output_writer_flush(writer);
+#ifndef INSPECTOR_NO_STATS
+  if (writer->statsIntervalMs >= 0) {
+    stage_stats_dump(&writer->stages, "exit");
+  }
+#endif
+  return NULL;
+}
+
+/**
+ *
+ * This function creates the ring and starts the writer thread.
+ * The ring size is rounded up to a power of two.
+ *
+ */
+OutputWriter *
+output_writer_new (guint ringSize, guint flushIntervalMs, guint flushBytes, gboolean blockWhenFull)
+{
+  OutputWriter * writer = g_new0(OutputWriter, 1);
+  guint size = 2;
+
+  while (size < ringSize && size < (1u << 30)) {
+    size <<= 1;
+  }
+
+  /* zeroed, so ready without touching the slots (see OutputWriter) */
+  writer->slots = g_new0(OutputSlot, size);
+  writer->mask = size - 1;
+
+  writer->flushIntervalMs = flushIntervalMs;
+  writer->flushBytes = MAX(flushBytes, 1);
+  writer->blockWhenFull = blockWhenFull;
+  writer->dirty = g_ptr_array_new();
+  g_mutex_init(&writer->mutex);
+  g_cond_init(&writer->cond);
+#ifndef INSPECTOR_NO_STATS
+  stage_stats_init(&writer->stages);
+  writer->statsIntervalMs = -1;
+  if (g_atomic_int_get(&perfCountersEnabled)) {
+    writer->perf = g_new0(PerfFrame, size);
+  }
+#endif
+
+  writer->thread = g_thread_new("output-writer", output_writer_run, writer);
+  return writer;
+}
+
+/**
+ *
+ * This function drains the ring, flushes every output and stops the writer
+ * thread. All the producers must be stopped before (on EOS or SIGINT), so
+ * the records that are already in the ring are always written.
+ *
+ */
+void
+output_writer_stop (OutputWriter * writer)
+{
+  g_atomic_int_set(&writer->stopping, 1);
+  g_mutex_lock(&writer->mutex);
+  g_cond_signal(&writer->cond);
+  g_mutex_unlock(&writer->mutex);
+  g_thread_join(writer->thread);
+
+  log_info("Output writer [records: %" G_GUINT64_FORMAT ", flushes: %" G_GUINT64_FORMAT ", ring high-water: %i/%u, dropped: %i]",
+    writer->records, writer->flushes, g_atomic_int_get(&writer->highWater), writer->mask + 1, g_atomic_int_get(&writer->dropped));
+
+  g_ptr_array_free(writer->dirty, TRUE);
+#ifndef INSPECTOR_NO_STATS
+  stage_stats_clear(&writer->stages);
+  g_free(writer->perf);
+#endif
+  g_mutex_clear(&writer->mutex);
+  g_cond_clear(&writer->cond);
+  g_free(writer->slots);
+  g_free(writer);
+}
+
+/**
+ *
+ * This function queues a record for the writer thread. When the ring is full,
+ * it waits for room if the writer blocks when full (offline mode), otherwise
+ * the record is dropped. Only the FRAME records are dropped.
+ *
+ */
+gboolean
+output_writer_push (OutputWriter * writer, const OutputRecord * record)
+{
+  while (!output_writer_try_push(writer, record)) {
+    if (!writer->blockWhenFull && record->type == OUTPUT_RECORD_FRAME) {
+      g_atomic_int_inc(&writer->dropped);
+      return FALSE;
+    }
+    g_usleep(100);
+  }
+  return TRUE;
+}
+
+/**
+ *
+ * This function opens the outputs of a stream (<outputPath>/<ssrc>.log or
+ * <outputPath>/<ssrc>.bin, and/or stdout). The file gets a large stdio
+ * buffer, it is only flushed by output_target_flush() or by the writer thread.
+ * With `append`, the results go after the ones already in the file.
+ *
+ */
+OutputTarget *
+output_target_open (const gchar * ssrc, const gchar * outputPath, gboolean useStdout, guint format, gboolean append)
+{
+  OutputTarget * target = g_new0(OutputTarget, 1);
+
+  g_strlcpy(target->ssrc, ssrc, sizeof(target->ssrc));
+  target->ssrcId = (guint32) g_ascii_strtoull(ssrc, NULL, 10);
+  target->format = format;
+  target->useStdout = useStdout;
+
+  if (outputPath) {
+    gchar * filename = g_strdup_printf("%s/%s.%s", outputPath, ssrc, format == OUTPUT_FORMAT_BINARY ? "bin" : "log");
+    target->fdout = fopen(filename, append ? "a" : "w");
+    if (target->fdout) {
+      setvbuf(target->fdout, NULL, _IOFBF, OUTPUT_WRITER_FILE_BUFFER_SZ);
+    }
+    g_free(filename);
+  }
+
+  /* an appended binary file already has its header */
+  if (target->fdout && format == OUTPUT_FORMAT_BINARY && (!append || (fseek(target->fdout, 0, SEEK_END) == 0 && ftell(target->fdout) == 0))) {
+    guint8 header[FRAME_RECORD_HEADER_SZ];
+    frame_record_write_header(header);
+    fwrite(header, 1, sizeof(header), target->fdout);
+  }
+
+  return target;
+}
+
+/* A line (or a binary record) to the outputs of the target */
+static guint
+output_target_write_line (OutputTarget * target, const gchar * line, guint len)
+{
+  guint written = 0;
+
+  if (target->useStdout) {
+    if (target->format == OUTPUT_FORMAT_BINARY && g_atomic_int_compare_and_exchange(&stdoutHeaderWritten, 0, 1)) {
+      guint8 header[FRAME_RECORD_HEADER_SZ];
+      frame_record_write_header(header);
+      fwrite(header, 1, sizeof(header), stdout);
+    }
+    fwrite(line, 1, len, stdout);
+    written += len;
+  }
+
+  if (target->fdout) {
+    fwrite(line, 1, len, target->fdout);
+    written += len;
+  }
+
+  return written;
+}
+
+/**
+ *
+ * This function writes a frame info to the outputs of the target (without flushing).
+ * It returns the number of bytes written.
+ *
+ */
+guint
+output_target_write (OutputTarget * target, const FrameInfo * ctx)
+{
+  gchar line[OUTPUT_WRITER_LINE_SZ];
+  guint len;
+
+  if (target->format == OUTPUT_FORMAT_BINARY) {
+    frame_record_encode((guint8 *) line, target->ssrcId, ctx);
+    len = FRAME_RECORD_SZ;
+  } else {
+    len = format_frame_info(line, sizeof(line), target->ssrc, ctx);
+  }
+  return output_target_write_line(target, line, len);
+}
+
+/* The same for a frame record (OutputRecord.frame), written as it is in binary */
+guint
+output_target_write_record (OutputTarget * target, const guint8 * record)
+{
+  gchar line[OUTPUT_WRITER_LINE_SZ];
+  FrameInfo ctx;
+  guint32 ssrc;
+
+  if (target->format == OUTPUT_FORMAT_BINARY) {
+    return output_target_write_line(target, (const gchar *) record, FRAME_RECORD_SZ);
+  }
+  frame_record_decode(record, FRAME_RECORD_SZ, &ssrc, &ctx);
+  return output_target_write_line(target, line, format_frame_info(line, sizeof(line), target->ssrc, &ctx));
+}
+
+/* The line of a window of frames (--aggregate), the windows are text only */
+guint
+output_target_write_window (OutputTarget * target, const AggregateWindow * window)
+{
+  gchar line[OUTPUT_WRITER_LINE_SZ];
+  guint len = format_aggregate_window(line, sizeof(line), target->ssrc, window), written = 0;
+
+  if (target->useStdout) {
+    fwrite(line, 1, len, stdout);
+    written += len;
+  }
+  if (target->fdout) {
+    fwrite(line, 1, len, target->fdout);
+    written += len;
+  }
+  return written;
+}
+
+void
+output_target_flush (OutputTarget * target)
+{
+  if (target->useStdout) {
+    fflush(stdout);
+  }
+  if (target->fdout) {
+    fflush(target->fdout);
+  }
+}
+
+void
+output_target_close (OutputTarget * target)
+{
+  if (target->fdout) {
+    fclose(target->fdout);
+  }
+  g_free(target);
+}
+
+/**
+ *
+ * This function hands the target over to the writer thread, which closes
+ * the file and releases the target after the pending records are written.
+ *
+ */
+void
+output_writer_close_target (OutputWriter * writer, OutputTarget * target)
+{
+  OutputRecord record;
+
+  memset(&record, 0, sizeof(record));
+  record.type = OUTPUT_RECORD_CLOSE;
+  record.target = target;
+  output_writer_push(writer, &record);
+}
+
+/**
+ *
+ * This function waits until the records pushed before are written and
+ * flushed (before a checkpoint, see follow.c). The SYNC records are
+ * counted, so only one producer can wait at a time.
+ *
+ */
+void
+output_writer_sync (OutputWriter * writer)
+{
+  OutputRecord record;
+  gint synced = g_atomic_int_get(&writer->synced);
+
+  memset(&record, 0, sizeof(record));
+  record.type = OUTPUT_RECORD_SYNC;
+  output_writer_push(writer, &record);
+  while (g_atomic_int_get(&writer->synced) == synced) {
+    g_usleep(100);
+  }
+}
+
+#ifndef INSPECTOR_NO_STATS
+/**
+ *
+ * This function enables the stage stats, dumped every `intervalMs` (0 to
+ * only dump them on request and when the writer stops). It must be called
+ * before the producers start.
+ *
+ */
+void
+output_writer_enable_stats (OutputWriter * writer, guint intervalMs)
+{
+  g_atomic_int_set(&writer->statsIntervalMs, (gint) MIN(intervalMs, G_MAXINT));
+  stage_stats_enable();
+}
+
+/**
+ *
+ * This function asks the writer thread for a dump of the stage stats.
+ * It is async-signal-safe (SIGUSR1), the dump comes within a second.
+ *
+ */
+void
+output_writer_request_stats (OutputWriter * writer)
+{
+  g_atomic_int_set(&writer->statsRequested, 1);
+}
+#endif
@@ -0,0 +1,141 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "aggregate.h"
+#include "frame_record.h"
+#include "stage_stats.h"
+#include "vp8_parser.h"
+
+enum
+{
+  OUTPUT_WRITER_DEFAULT_RING_SZ = 65536,
+  OUTPUT_WRITER_DEFAULT_FLUSH_INTERVAL_MS = 100,
+  OUTPUT_WRITER_DEFAULT_FLUSH_BYTES = 65536,
+  OUTPUT_WRITER_BATCH_SZ = 1024,
+  OUTPUT_WRITER_FILE_BUFFER_SZ = 65536,
+  OUTPUT_WRITER_SSRC_SZ = 16,
+  OUTPUT_WRITER_LINE_SZ = 512
+};
+
+enum
+{
+  OUTPUT_FORMAT_TEXT = 0,
+  OUTPUT_FORMAT_BINARY = 1
+};
+
+typedef enum
+{
+  OUTPUT_RECORD_FRAME = 0,
+  OUTPUT_RECORD_CLOSE = 1,
+  OUTPUT_RECORD_SYNC = 2,   /* flush everything written so far, see output_writer_sync() */
+  OUTPUT_RECORD_WINDOW = 3  /* the results of a window of frames (--aggregate) */
+} OutputRecordType;
+
+/**
+ *
+ * An OutputTarget is where the records of one stream go. With an output
+ * writer, it is created by the producer but only the writer thread touches
+ * it and it is released by the writer when the CLOSE record arrives.
+ *
+ */
+typedef struct
+{
+  gchar ssrc[OUTPUT_WRITER_SSRC_SZ];
+  guint32 ssrcId;
+  guint format;
+  FILE * fdout;
+  gboolean useStdout;
+  gboolean dirty;
+} OutputTarget;
+
+typedef struct
+{
+  OutputRecordType type;
+  OutputTarget * target;
+  union {
+    guint8 frame[FRAME_RECORD_SZ];  /* the frame info as a binary record (frame_record.h), a third of a FrameInfo */
+    AggregateWindow window;
+  };
+#ifndef INSPECTOR_NO_STATS
+  StageTimes stages;
+#endif
+} OutputRecord;
+
+typedef struct
+{
+  volatile gint sequence;
+  OutputRecord record;
+} OutputSlot;
+
+/**
+ *
+ * Bounded multi-producer single-consumer ring (Vyukov style: every slot has
+ * its own sequence number, so producers only contend on the tail CAS).
+ *
+ * The slots keep their sequence number minus their index, so a zeroed ring
+ * is ready to use: its pages are only touched (and take memory) once the
+ * ring is filled that far.
+ *
+ */
+typedef struct
+{
+  OutputSlot * slots;
+  guint mask;
+  volatile gint head;
+  volatile gint tail;
+
+  guint flushIntervalMs;
+  guint flushBytes;
+  gboolean blockWhenFull;
+
+  GThread * thread;
+  GMutex mutex;
+  GCond cond;
+  volatile gint waiting;
+  volatile gint stopping;
+  volatile gint synced;           /* SYNC records done */
+
+  GPtrArray * dirty;
+  gboolean stdoutDirty;
+  gsize pendingBytes;
+
+  /* stats */
+  volatile gint highWater;
+  volatile gint dropped;
+  guint64 records;
+  guint64 flushes;
+
+#ifndef INSPECTOR_NO_STATS
+  /* per-stage latency, see stage_stats.h */
+  StageStats stages;
+  volatile gint statsIntervalMs;  /* -1 when disabled, 0 to dump on request only */
+  volatile gint statsRequested;
+  PerfFrame * perf;               /* --perfCounters, the counters of the FRAME record of each slot, NULL when disabled */
+#endif
+} OutputWriter;
+
+
+OutputWriter * output_writer_new(guint ringSize, guint flushIntervalMs, guint flushBytes, gboolean blockWhenFull);
+void output_writer_stop(OutputWriter * writer);
+gboolean output_writer_push(OutputWriter * writer, const OutputRecord * record);
+void output_writer_close_target(OutputWriter * writer, OutputTarget * target);
+void output_writer_sync(OutputWriter * writer);
+#ifndef INSPECTOR_NO_STATS
+void output_writer_enable_stats(OutputWriter * writer, guint intervalMs);
+void output_writer_request_stats(OutputWriter * writer);
+#endif
+
+OutputTarget * output_target_open(const gchar * ssrc, const gchar * outputPath, gboolean useStdout, guint format, gboolean append);
+guint output_target_write(OutputTarget * target, const FrameInfo * ctx);
+guint output_target_write_record(OutputTarget * target, const guint8 * record);
+guint output_target_write_window(OutputTarget * target, const AggregateWindow * window);
+void output_target_flush(OutputTarget * target);
+void output_target_close(OutputTarget * target);
+
+gboolean parse_output_format(const gchar * name, guint * format);
+guint format_frame_info(gchar * buffer, gsize size, const gchar * ssrc, const FrameInfo * ctx);
+
+#endif
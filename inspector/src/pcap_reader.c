@@ -0,0 +1,431 @@
+/**
+ *
+ * A tiny PCAP reader used by the native offline engine.
+ *
+ * The whole capture is memory-mapped and we walk the record headers
+ * directly, decoding only Ethernet/SLL, IPv4/IPv6 and UDP. Every packet
+ * that is not a (non-fragmented) UDP datagram is skipped, which is the same
+ * filtering that pcapparse does for us in the GStreamer pipeline.
+ *
+ * The compressed captures (gzip, zstd) are decompressed by another thread
+ * instead, and walked one block at a time (see pcap_stream.h).
+ *
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcap_reader.h"
+
+enum
+{
+  LINKTYPE_NULL = 0,
+  LINKTYPE_ETHERNET = 1,
+  LINKTYPE_RAW = 101,
+  LINKTYPE_LINUX_SLL = 113,
+  LINKTYPE_IPV4 = 228,
+  LINKTYPE_IPV6 = 229,
+  LINKTYPE_LINUX_SLL2 = 276
+};
+
+enum
+{
+  ETHERTYPE_IPV4 = 0x0800,
+  ETHERTYPE_IPV6 = 0x86dd,
+  ETHERTYPE_VLAN = 0x8100,
+  ETHERTYPE_QINQ = 0x88a8
+};
+
+enum
+{
+  IP_PROTO_HOPOPTS = 0,
+  IP_PROTO_UDP = 17,
+  IP_PROTO_ROUTING = 43,
+  IP_PROTO_FRAGMENT = 44,
+  IP_PROTO_DSTOPTS = 60
+};
+
+static inline guint16
+read_be16 (const guint8 * p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static inline guint32
+pcap_read32 (const PcapReader * reader, const guint8 * p)
+{
+  guint32 value = p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+  return reader->swapped ? GUINT32_SWAP_LE_BE(value) : value;
+}
+
+static gboolean
+parse_udp (const guint8 * data, guint len, PcapPacket * packet)
+{
+  guint udpLen;
+
+  if (len < 8) {
+    return FALSE;
+  }
+
+  udpLen = read_be16(data + 4);
+  if (udpLen < 8 || udpLen > len) {
+    return FALSE;
+  }
+
+  packet->srcPort = read_be16(data);
+  packet->dstPort = read_be16(data + 2);
+  packet->payload = data + 8;
+  packet->payloadLen = udpLen - 8;
+  return TRUE;
+}
+
+static gboolean
+parse_ipv4 (const guint8 * data, guint len, PcapPacket * packet)
+{
+  guint headerLen, totalLen;
+
+  if (len < 20 || (data[0] >> 4) != 4) {
+    return FALSE;
+  }
+
+  headerLen = (data[0] & 0x0f) * 4;
+  totalLen = read_be16(data + 2);
+  if (headerLen < 20 || totalLen < headerLen || totalLen > len) {
+    return FALSE;
+  }
+
+  /* NOTE: fragmented datagrams are ignored, RTP over UDP should never be fragmented */
+  if (read_be16(data + 6) & 0x3fff) {
+    return FALSE;
+  }
+
+  if (data[9] != IP_PROTO_UDP) {
+    return FALSE;
+  }
+
+  return parse_udp(data + headerLen, totalLen - headerLen, packet);
+}
+
+static gboolean
+parse_ipv6 (const guint8 * data, guint len, PcapPacket * packet)
+{
+  guint nextHeader, payloadLen;
+
+  if (len < 40 || (data[0] >> 4) != 6) {
+    return FALSE;
+  }
+
+  payloadLen = read_be16(data + 4);
+  nextHeader = data[6];
+  data += 40;
+  len -= 40;
+  if (payloadLen > len) {
+    return FALSE;
+  }
+  len = payloadLen;
+
+  while (nextHeader == IP_PROTO_HOPOPTS || nextHeader == IP_PROTO_ROUTING || nextHeader == IP_PROTO_DSTOPTS) {
+    guint extLen;
+    if (len < 8) {
+      return FALSE;
+    }
+    extLen = (data[1] + 1) * 8;
+    if (extLen > len) {
+      return FALSE;
+    }
+    nextHeader = data[0];
+    data += extLen;
+    len -= extLen;
+  }
+
+  if (nextHeader != IP_PROTO_UDP) {
+    return FALSE;
+  }
+
+  return parse_udp(data, len, packet);
+}
+
+static gboolean
+parse_ip (const guint8 * data, guint len, PcapPacket * packet)
+{
+  if (len < 1) {
+    return FALSE;
+  }
+  return (data[0] >> 4) == 6 ? parse_ipv6(data, len, packet) : parse_ipv4(data, len, packet);
+}
+
+static gboolean
+parse_ethertype (guint16 etherType, const guint8 * data, guint len, PcapPacket * packet)
+{
+  switch (etherType) {
+    case ETHERTYPE_IPV4:
+      return parse_ipv4(data, len, packet);
+    case ETHERTYPE_IPV6:
+      return parse_ipv6(data, len, packet);
+    default:
+      return FALSE;
+  }
+}
+
+static gboolean
+parse_link_layer (const PcapReader * reader, const guint8 * data, guint len, PcapPacket * packet)
+{
+  guint16 etherType;
+  guint32 family;
+
+  switch (reader->linkType) {
+    case LINKTYPE_ETHERNET:
+      if (len < 14) {
+        return FALSE;
+      }
+      etherType = read_be16(data + 12);
+      data += 14;
+      len -= 14;
+      while ((etherType == ETHERTYPE_VLAN || etherType == ETHERTYPE_QINQ) && len >= 4) {
+        etherType = read_be16(data + 2);
+        data += 4;
+        len -= 4;
+      }
+      return parse_ethertype(etherType, data, len, packet);
+
+    case LINKTYPE_LINUX_SLL:
+      if (len < 16) {
+        return FALSE;
+      }
+      return parse_ethertype(read_be16(data + 14), data + 16, len - 16, packet);
+
+    case LINKTYPE_LINUX_SLL2:
+      if (len < 20) {
+        return FALSE;
+      }
+      return parse_ethertype(read_be16(data), data + 20, len - 20, packet);
+
+    case LINKTYPE_NULL:
+      if (len < 4) {
+        return FALSE;
+      }
+      /* The loopback family is written in the capturing host byte order */
+      family = pcap_read32(reader, data);
+      if (family > 0xffff) {
+        family = GUINT32_SWAP_LE_BE(family);
+      }
+      return family == 2 ? parse_ipv4(data + 4, len - 4, packet) : parse_ipv6(data + 4, len - 4, packet);
+
+    case LINKTYPE_RAW:
+      return parse_ip(data, len, packet);
+
+    case LINKTYPE_IPV4:
+      return parse_ipv4(data, len, packet);
+
+    case LINKTYPE_IPV6:
+      return parse_ipv6(data, len, packet);
+
+    default:
+      return FALSE;
+  }
+}
+
+/* The compression of the capture at `path`, PCAP_COMPRESSION_NONE when it can not be read */
+guint
+pcap_file_compression (const gchar * path)
+{
+  guint compression = PCAP_COMPRESSION_NONE;
+  int fd = open(path, O_RDONLY);
+
+  if (fd >= 0) {
+    compression = pcap_stream_compression(fd);
+    close(fd);
+  }
+  return compression;
+}
+
+/**
+ *
+ * This function maps the PCAP file in memory and validates its global header.
+ * A compressed capture is decompressed by another thread instead, which
+ * is started here.
+ *
+ */
+guint
+pcap_reader_open (PcapReader * reader, const gchar * path)
+{
+  struct stat st;
+  guint32 magic, compression;
+  void * data;
+
+  memset(reader, 0, sizeof(PcapReader));
+  reader->fd = open(path, O_RDONLY);
+  if (reader->fd < 0) {
+    return PCAP_ERROR_OPEN;
+  }
+
+  if (fstat(reader->fd, &st) < 0 || st.st_size < PCAP_GLOBAL_HEADER_SZ) {
+    close(reader->fd);
+    return PCAP_ERROR_FORMAT;
+  }
+
+  compression = pcap_stream_compression(reader->fd);
+  if (compression != PCAP_COMPRESSION_NONE) {
+    const PcapBlock * block;
+
+    reader->stream = pcap_stream_new(reader->fd, compression);
+    block = reader->stream ? pcap_stream_next(reader->stream) : NULL;
+    if (!block || block->len < PCAP_GLOBAL_HEADER_SZ) {
+      pcap_reader_close(reader);
+      return PCAP_ERROR_FORMAT;
+    }
+    reader->data = block->data;
+    reader->size = block->len;
+  } else {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (data == MAP_FAILED) {
+      close(reader->fd);
+      return PCAP_ERROR_OPEN;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    reader->data = data;
+    reader->size = st.st_size;
+  }
+  reader->offset = PCAP_GLOBAL_HEADER_SZ;
+
+  magic = pcap_read32(reader, reader->data);
+  if (magic == GUINT32_SWAP_LE_BE(PCAP_MAGIC_USEC) || magic == GUINT32_SWAP_LE_BE(PCAP_MAGIC_NSEC)) {
+    reader->swapped = TRUE;
+    magic = GUINT32_SWAP_LE_BE(magic);
+  }
+
+  if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+    pcap_reader_close(reader);
+    return PCAP_ERROR_FORMAT;
+  }
+
+  reader->nanoseconds = magic == PCAP_MAGIC_NSEC;
+  reader->linkType = pcap_read32(reader, reader->data + 20) & 0x0fffffff;
+  return PCAP_OK;
+}
+
+void
+pcap_reader_close (PcapReader * reader)
+{
+  if (reader->stream) {
+    pcap_stream_free(reader->stream);
+    reader->stream = NULL;
+    reader->data = NULL;
+  }
+  if (reader->data) {
+    munmap((void *) reader->data, reader->size);
+    reader->data = NULL;
+  }
+  if (reader->fd >= 0) {
+    close(reader->fd);
+    reader->fd = -1;
+  }
+}
+
+/* A compressed capture: it moves to the next decompressed block */
+static gboolean
+pcap_reader_next_block (PcapReader * reader)
+{
+  const PcapBlock * block;
+
+  if (reader->release) {
+    reader->release(reader->releaseData);
+  }
+  pcap_stream_release(reader->stream);
+  block = pcap_stream_next(reader->stream);
+  if (!block) {
+    reader->data = NULL;
+    reader->size = 0;
+    reader->offset = 0;
+    return FALSE;
+  }
+  reader->data = block->data;
+  reader->size = block->len;
+  reader->offset = 0;
+  reader->base = block->base;
+  return TRUE;
+}
+
+/**
+ *
+ * This function returns the next UDP datagram of the capture.
+ * The packet payload points directly into the mapped file, so it is
+ * valid until pcap_reader_close() or pcap_reader_refresh() is called.
+ * A truncated last record is handled like the end of the file, and read
+ * again once the file grew (see pcap_reader_refresh()).
+ *
+ * For a compressed capture the payload points into the current block, which
+ * is reused once the reader moves to the next one: reader->release is
+ * called before it, so the packets kept by the caller can be copied.
+ *
+ */
+gboolean
+pcap_reader_next (PcapReader * reader, PcapPacket * packet)
+{
+  do {
+    while (reader->offset + PCAP_RECORD_HEADER_SZ <= reader->size) {
+      const guint8 * record = reader->data + reader->offset;
+      guint32 seconds = pcap_read32(reader, record);
+      guint32 fraction = pcap_read32(reader, record + 4);
+      guint32 capturedLen = pcap_read32(reader, record + 8);
+
+      if (capturedLen > reader->size - reader->offset - PCAP_RECORD_HEADER_SZ) {
+        return FALSE;
+      }
+
+      packet->offset = reader->base + reader->offset;
+      packet->timestamp = (guint64) seconds * 1000000000 + (reader->nanoseconds ? fraction : (guint64) fraction * 1000);
+      reader->offset += PCAP_RECORD_HEADER_SZ + capturedLen;
+
+      if (parse_link_layer(reader, record + PCAP_RECORD_HEADER_SZ, capturedLen, packet)) {
+        return TRUE;
+      }
+    }
+  } while (reader->stream && pcap_reader_next_block(reader));
+
+  return FALSE;
+}
+
+/**
+ *
+ * This function maps the file again when it grew since it was mapped (a
+ * capture that is still being written, see follow.h). The packets read
+ * before point to the previous mapping, which is released. It returns TRUE
+ * when there is new data, never for a compressed capture.
+ *
+ */
+gboolean
+pcap_reader_refresh (PcapReader * reader)
+{
+  struct stat st;
+  void * data;
+
+  if (reader->stream || fstat(reader->fd, &st) < 0 || (gsize) st.st_size <= reader->size) {
+    return FALSE;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+  if (data == MAP_FAILED) {
+    return FALSE;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  munmap((void *) reader->data, reader->size);
+  reader->data = data;
+  reader->size = st.st_size;
+  return TRUE;
+}
+
+/* The next packet is the one of the record at `offset` (a PcapPacket.offset), or the next one appended at the end */
+gboolean
+pcap_reader_seek (PcapReader * reader, gsize offset)
+{
+  if (reader->stream || offset < PCAP_GLOBAL_HEADER_SZ || offset > reader->size) {
+    return FALSE;
+  }
+  reader->offset = offset;
+  return TRUE;
+}
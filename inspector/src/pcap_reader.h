@@ -0,0 +1,60 @@
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <glib.h>
+
+#include "pcap_stream.h"
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+
+enum
+{
+  PCAP_OK = 0,
+  PCAP_ERROR_OPEN = 1,
+  PCAP_ERROR_FORMAT = 2
+};
+
+enum
+{
+  PCAP_GLOBAL_HEADER_SZ = 24,
+  PCAP_RECORD_HEADER_SZ = 16
+};
+
+/* Called before the packets returned so far are overwritten (compressed captures) */
+typedef void (*PcapReleaseFunc) (gpointer data);
+
+typedef struct
+{
+  int fd;
+  const guint8 * data;
+  gsize size;
+  gsize offset;
+  gboolean swapped;
+  gboolean nanoseconds;
+  guint32 linkType;
+  PcapStream * stream;        /* compressed captures: data is the current block */
+  guint64 base;               /* the offset of data[0] in the (decompressed) capture */
+  PcapReleaseFunc release;
+  gpointer releaseData;
+} PcapReader;
+
+typedef struct
+{
+  guint64 timestamp;      /* capture time in nanoseconds */
+  gsize offset;           /* file offset of the pcap record header (decompressed) */
+  const guint8 * payload; /* UDP payload, points into the mapped file or the current block */
+  guint payloadLen;
+  guint16 srcPort;
+  guint16 dstPort;
+} PcapPacket;
+
+
+guint pcap_file_compression(const gchar * path);
+guint pcap_reader_open(PcapReader * reader, const gchar * path);
+void pcap_reader_close(PcapReader * reader);
+gboolean pcap_reader_next(PcapReader * reader, PcapPacket * packet);
+gboolean pcap_reader_seek(PcapReader * reader, gsize offset);
+gboolean pcap_reader_refresh(PcapReader * reader);
+
+#endif
@@ -0,0 +1,353 @@
+/**
+ *
+ * The decompression thread of the compressed captures (see pcap_stream.h).
+ *
+ * The thread fills the block after the last decompressed one: the partial
+ * record left by the previous block first, then the decompressed bytes up
+ * to PCAP_STREAM_BLOCK_SZ. The record headers are walked to find the end of
+ * the last whole record, and what follows it is kept for the next block.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef INSPECTOR_ZSTD
+#include <zstd.h>
+#endif
+
+#include "log.h"
+#include "pcap_reader.h"
+#include "pcap_stream.h"
+
+enum
+{
+  PCAP_STREAM_DECODE_OK = 0,
+  PCAP_STREAM_DECODE_END = 1,   /* the end of a gzip member */
+  PCAP_STREAM_DECODE_ERROR = 2
+};
+
+static const guint8 gzipMagic[] = { 0x1f, 0x8b };
+static const guint8 zstdMagic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+/* The compression of a capture, from its first bytes */
+guint
+pcap_stream_compression (int fd)
+{
+  guint8 magic[4];
+
+  if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+    return PCAP_COMPRESSION_NONE;
+  }
+  if (memcmp(magic, gzipMagic, sizeof(gzipMagic)) == 0) {
+    return PCAP_COMPRESSION_GZIP;
+  }
+  if (memcmp(magic, zstdMagic, sizeof(zstdMagic)) == 0) {
+    return PCAP_COMPRESSION_ZSTD;
+  }
+  return PCAP_COMPRESSION_NONE;
+}
+
+const gchar *
+pcap_compression_name (guint compression)
+{
+  switch (compression) {
+    case PCAP_COMPRESSION_GZIP:
+      return "gzip";
+    case PCAP_COMPRESSION_ZSTD:
+      return "zstd";
+    default:
+      return "none";
+  }
+}
+
+/* It decompresses the input buffer into `out`, `produced` gets the decompressed bytes */
+static guint
+pcap_stream_decode (PcapStream * stream, guint8 * out, gsize len, gsize * produced)
+{
+  if (stream->compression == PCAP_COMPRESSION_GZIP) {
+    z_stream * z = stream->decoder;
+    int ret;
+
+    z->next_in = stream->input + stream->inputPos;
+    z->avail_in = stream->inputLen - stream->inputPos;
+    z->next_out = out;
+    z->avail_out = len;
+    ret = inflate(z, Z_NO_FLUSH);
+    stream->inputPos = stream->inputLen - z->avail_in;
+    *produced = len - z->avail_out;
+    if (ret == Z_STREAM_END) {
+      return PCAP_STREAM_DECODE_END;
+    }
+    return ret == Z_OK || ret == Z_BUF_ERROR ? PCAP_STREAM_DECODE_OK : PCAP_STREAM_DECODE_ERROR;
+  }
+
+#ifdef INSPECTOR_ZSTD
+  ZSTD_inBuffer input = { stream->input, stream->inputLen, stream->inputPos };
+  ZSTD_outBuffer output = { out, len, 0 };
+  /* the frames of a file are decompressed one after the other */
+  size_t ret = ZSTD_decompressStream(stream->decoder, &output, &input);
+
+  stream->inputPos = input.pos;
+  *produced = output.pos;
+  return ZSTD_isError(ret) ? PCAP_STREAM_DECODE_ERROR : PCAP_STREAM_DECODE_OK;
+#else
+  *produced = 0;
+  return PCAP_STREAM_DECODE_ERROR;
+#endif
+}
+
+/**
+ *
+ * This function decompresses up to `len` bytes into `out`. It returns less
+ * only at the end of the file, or after an error (stream->failed). A
+ * truncated file ends at its last decompressed byte.
+ *
+ */
+static gsize
+pcap_stream_fill (PcapStream * stream, guint8 * out, gsize len)
+{
+  gsize filled = 0;
+  gboolean memberEnd = FALSE;
+
+  while (filled < len && !stream->failed) {
+    gsize produced;
+    guint ret;
+
+    if (stream->inputPos == stream->inputLen) {
+      gssize count;
+
+      if (stream->inputEnd) {
+        break;
+      }
+      count = read(stream->fd, stream->input, PCAP_STREAM_INPUT_SZ);
+      if (count < 0) {
+        log_info("Failed to read the compressed capture");
+        stream->failed = TRUE;
+        break;
+      }
+      stream->inputEnd = count == 0;
+      stream->inputLen = count;
+      stream->inputPos = 0;
+      stream->compressedBytes += count;
+      continue;
+    }
+
+    /* gzip: a file can be several members, like the output of cat a.gz b.gz */
+    if (memberEnd) {
+      inflateReset(stream->decoder);
+      memberEnd = FALSE;
+    }
+
+    ret = pcap_stream_decode(stream, out + filled, len - filled, &produced);
+    filled += produced;
+    if (ret == PCAP_STREAM_DECODE_END) {
+      memberEnd = TRUE;
+    } else if (ret == PCAP_STREAM_DECODE_ERROR) {
+      log_info("Failed to decompress the capture (%s) after %" G_GUINT64_FORMAT " bytes",
+        pcap_compression_name(stream->compression), stream->bytes + filled);
+      stream->failed = TRUE;
+    }
+  }
+
+  return filled;
+}
+
+static guint32
+pcap_stream_read32 (const guint8 * p, gboolean swapped)
+{
+  guint32 value = p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+  return swapped ? GUINT32_SWAP_LE_BE(value) : value;
+}
+
+static gpointer
+pcap_stream_run (gpointer data)
+{
+  PcapStream * stream = (PcapStream *) data;
+  guint8 * carry = g_malloc(PCAP_STREAM_BLOCK_SZ);
+  gsize carryLen = 0;
+  guint64 base = 0;
+  gboolean swapped = FALSE;
+  gboolean end = FALSE;
+
+  while (!end) {
+    PcapBlock * block;
+    gsize len, start, offset;
+
+    g_mutex_lock(&stream->mutex);
+    while (stream->full == PCAP_STREAM_BLOCKS && !stream->stopping) {
+      stream->decoderWaits++;
+      g_cond_wait(&stream->cond, &stream->mutex);
+    }
+    if (stream->stopping) {
+      g_mutex_unlock(&stream->mutex);
+      break;
+    }
+    block = &stream->blocks[(stream->head + stream->full) % PCAP_STREAM_BLOCKS];
+    g_mutex_unlock(&stream->mutex);
+
+    memcpy(block->data, carry, carryLen);
+    len = carryLen + pcap_stream_fill(stream, block->data + carryLen, PCAP_STREAM_BLOCK_SZ - carryLen);
+    end = len < PCAP_STREAM_BLOCK_SZ;
+
+    start = 0;
+    if (base == 0 && len >= PCAP_GLOBAL_HEADER_SZ) {
+      /* the global header, the reader validates it */
+      guint32 magic = pcap_stream_read32(block->data, FALSE);
+      swapped = magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC;
+      start = PCAP_GLOBAL_HEADER_SZ;
+    }
+    offset = start;
+    while (offset + PCAP_RECORD_HEADER_SZ <= len) {
+      guint32 capturedLen = pcap_stream_read32(block->data + offset + 8, swapped);
+      if (capturedLen > len - offset - PCAP_RECORD_HEADER_SZ) {
+        break;
+      }
+      offset += PCAP_RECORD_HEADER_SZ + capturedLen;
+    }
+
+    if (offset == start && !end) {
+      log_info("The capture has a record bigger than %u bytes at %" G_GUINT64_FORMAT, PCAP_STREAM_BLOCK_SZ, base);
+      stream->failed = TRUE;
+      end = TRUE;
+    }
+
+    /* at the end, the partial record is dropped like the reader drops a truncated record */
+    carryLen = len - offset;
+    memcpy(carry, block->data + offset, carryLen);
+    block->len = offset;
+    block->base = base;
+    base += offset;
+
+    g_mutex_lock(&stream->mutex);
+    stream->full++;
+    stream->bytes = base;
+    stream->done = end;
+    g_cond_broadcast(&stream->cond);
+    g_mutex_unlock(&stream->mutex);
+  }
+
+  g_mutex_lock(&stream->mutex);
+  stream->done = TRUE;
+  g_cond_broadcast(&stream->cond);
+  g_mutex_unlock(&stream->mutex);
+  g_free(carry);
+  return NULL;
+}
+
+/**
+ *
+ * This function starts the decompression of the file `fd` (from its
+ * current position), it returns NULL when the compression is not supported.
+ * The file stays open after pcap_stream_free().
+ *
+ */
+PcapStream *
+pcap_stream_new (int fd, guint compression)
+{
+  PcapStream * stream;
+  guint i;
+
+  if (compression == PCAP_COMPRESSION_ZSTD) {
+#ifndef INSPECTOR_ZSTD
+    log_info("Built without zstd, the .pcap.zst captures are not supported");
+    return NULL;
+#endif
+  } else if (compression != PCAP_COMPRESSION_GZIP) {
+    return NULL;
+  }
+
+  stream = g_new0(PcapStream, 1);
+  stream->fd = fd;
+  stream->compression = compression;
+  stream->input = g_malloc(PCAP_STREAM_INPUT_SZ);
+
+  if (compression == PCAP_COMPRESSION_GZIP) {
+    z_stream * z = g_new0(z_stream, 1);
+    /* 15 + 32: the largest window, with the gzip or zlib header */
+    inflateInit2(z, 15 + 32);
+    stream->decoder = z;
+  }
+#ifdef INSPECTOR_ZSTD
+  if (compression == PCAP_COMPRESSION_ZSTD) {
+    stream->decoder = ZSTD_createDStream();
+    ZSTD_initDStream(stream->decoder);
+  }
+#endif
+
+  for (i = 0; i < PCAP_STREAM_BLOCKS; i++) {
+    stream->blocks[i].data = g_malloc(PCAP_STREAM_BLOCK_SZ);
+  }
+  g_mutex_init(&stream->mutex);
+  g_cond_init(&stream->cond);
+  stream->thread = g_thread_new("pcap-stream", pcap_stream_run, stream);
+  return stream;
+}
+
+/**
+ *
+ * This function returns the next decompressed block, waiting for it, or NULL
+ * at the end of the capture. The block stays valid until pcap_stream_release().
+ *
+ */
+const PcapBlock *
+pcap_stream_next (PcapStream * stream)
+{
+  const PcapBlock * block = NULL;
+
+  g_mutex_lock(&stream->mutex);
+  if (stream->full == 0 && !stream->done) {
+    stream->readerWaits++;
+  }
+  while (stream->full == 0 && !stream->done) {
+    g_cond_wait(&stream->cond, &stream->mutex);
+  }
+  if (stream->full > 0) {
+    block = &stream->blocks[stream->head];
+  }
+  g_mutex_unlock(&stream->mutex);
+  return block;
+}
+
+/* The block returned by pcap_stream_next() is reused by the decompression */
+void
+pcap_stream_release (PcapStream * stream)
+{
+  g_mutex_lock(&stream->mutex);
+  if (stream->full > 0) {
+    stream->head = (stream->head + 1) % PCAP_STREAM_BLOCKS;
+    stream->full--;
+    g_cond_broadcast(&stream->cond);
+  }
+  g_mutex_unlock(&stream->mutex);
+}
+
+void
+pcap_stream_free (PcapStream * stream)
+{
+  guint i;
+
+  g_mutex_lock(&stream->mutex);
+  stream->stopping = TRUE;
+  g_cond_broadcast(&stream->cond);
+  g_mutex_unlock(&stream->mutex);
+  g_thread_join(stream->thread);
+
+  if (stream->compression == PCAP_COMPRESSION_GZIP) {
+    inflateEnd(stream->decoder);
+    g_free(stream->decoder);
+  }
+#ifdef INSPECTOR_ZSTD
+  if (stream->compression == PCAP_COMPRESSION_ZSTD) {
+    ZSTD_freeDStream(stream->decoder);
+  }
+#endif
+
+  for (i = 0; i < PCAP_STREAM_BLOCKS; i++) {
+    g_free(stream->blocks[i].data);
+  }
+  g_mutex_clear(&stream->mutex);
+  g_cond_clear(&stream->cond);
+  g_free(stream->input);
+  g_free(stream);
+}
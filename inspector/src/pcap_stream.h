@@ -0,0 +1,78 @@
+#ifndef PCAP_STREAM_H
+#define PCAP_STREAM_H
+
+#include <glib.h>
+
+/**
+ *
+ * Streaming decompression of compressed captures (.pcap.gz, .pcap.zst).
+ *
+ * A thread reads the compressed file and decompresses it into a ring of
+ * PCAP_STREAM_BLOCKS blocks, while the reader parses the previous ones.
+ * Each block ends at a pcap record boundary (the partial record at the end
+ * is moved to the next block), so the reader walks a block like it walks
+ * a mapped capture. The memory used is the ring, a block for the partial
+ * record and the input buffer, whatever the size of the capture.
+ *
+ * The format is found by the magic bytes, not by the file name. zstd is
+ * only available when built with libzstd (INSPECTOR_ZSTD).
+ *
+ */
+
+enum
+{
+  PCAP_COMPRESSION_NONE = 0,
+  PCAP_COMPRESSION_GZIP = 1,
+  PCAP_COMPRESSION_ZSTD = 2
+};
+
+enum
+{
+  PCAP_STREAM_BLOCKS = 4,
+  PCAP_STREAM_BLOCK_SZ = 1 << 20,   /* bigger than any record (snaplen is 256KB at most) */
+  PCAP_STREAM_INPUT_SZ = 1 << 18
+};
+
+typedef struct
+{
+  guint8 * data;
+  gsize len;
+  guint64 base;           /* offset of data[0] in the decompressed capture */
+} PcapBlock;
+
+typedef struct
+{
+  int fd;
+  guint compression;
+  gpointer decoder;       /* z_stream or ZSTD_DStream */
+  guint8 * input;
+  gsize inputLen;
+  gsize inputPos;
+  gboolean inputEnd;
+
+  GThread * thread;
+  GMutex mutex;
+  GCond cond;
+  PcapBlock blocks[PCAP_STREAM_BLOCKS];
+  guint head;             /* the block being read */
+  guint full;             /* decompressed blocks, including the one being read */
+  gboolean done;          /* no more blocks, at the end of the file or after an error */
+  gboolean stopping;
+  gboolean failed;
+
+  /* stats */
+  guint64 compressedBytes;
+  guint64 bytes;
+  guint64 readerWaits;    /* the reader waited for a block: the decompression is the bottleneck */
+  guint64 decoderWaits;   /* the decompression waited for a free block: the inspection is */
+} PcapStream;
+
+guint pcap_stream_compression(int fd);
+const gchar * pcap_compression_name(guint compression);
+
+PcapStream * pcap_stream_new(int fd, guint compression);
+const PcapBlock * pcap_stream_next(PcapStream * stream);
+void pcap_stream_release(PcapStream * stream);
+void pcap_stream_free(PcapStream * stream);
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ *
+ * Hardware performance counters (see perf_counters.h).
+ *
+ */
+
+#ifndef INSPECTOR_NO_STATS
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "log.h"
+#include "perf_counters.h"
+
+enum
+{
+  PERF_COUNTERS_CALIBRATION_READS = 32
+};
+
+static void perf_counters_close(gpointer data);
+
+volatile gint perfCountersEnabled = 0;
+__thread PerfThread perfThread = { -1 };
+
+/* Set to the PerfThread of each thread that opened its counters, they are closed when the thread exits */
+static GPrivate perfThreadKey = G_PRIVATE_INIT(perf_counters_close);
+
+static const guint64 counterConfigs[PERF_COUNTER_COUNT] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_BRANCH_MISSES,
+  PERF_COUNT_HW_CACHE_MISSES
+};
+
+static const gchar * counterNames[PERF_COUNTER_COUNT] = {
+  "cycles", "instructions", "branch-misses", "cache-misses"
+};
+
+static const gchar * stageNames[PERF_STAGE_COUNT] = {
+  "tag", "header", "output"
+};
+
+const gchar *
+perf_stage_name (PerfStage stage)
+{
+  return stage < PERF_STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+const gchar *
+perf_counter_name (PerfCounter counter)
+{
+  return counter < PERF_COUNTER_COUNT ? counterNames[counter] : "unknown";
+}
+
+static int
+perf_counters_open_event (guint64 config, int group)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  /* this thread, on any CPU */
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+static gboolean
+perf_counters_read_group (PerfThread * thread, PerfSample * sample)
+{
+  guint64 values[1 + PERF_COUNTER_COUNT];
+  guint i;
+
+  if (read(thread->fd, values, sizeof(guint64) * (1 + thread->members)) != (ssize_t) (sizeof(guint64) * (1 + thread->members))) {
+    return FALSE;
+  }
+  for (i = 0; i < PERF_COUNTER_COUNT; i++) {
+    sample->value[i] = thread->index[i] >= 0 ? values[1 + thread->index[i]] : 0;
+  }
+  return TRUE;
+}
+
+/* It closes the counters of a thread, the members first */
+static void
+perf_counters_close (gpointer data)
+{
+  PerfThread * thread = (PerfThread *) data;
+  gint i;
+
+  for (i = PERF_COUNTER_COUNT - 1; i >= 0; i--) {
+    if (thread->fds[i] >= 0) {
+      close(thread->fds[i]);
+      thread->fds[i] = -1;
+    }
+  }
+  thread->fd = -1;
+}
+
+/**
+ *
+ * This function opens the counters of the calling thread. Only the cycles
+ * are required, the other counters are left at 0 when the PMU does not
+ * have them. The overhead is the smallest delta of back to back reads.
+ *
+ */
+static gboolean
+perf_counters_open (PerfThread * thread)
+{
+  PerfSample a, b;
+  guint i, j;
+
+  thread->fd = perf_counters_open_event(counterConfigs[PERF_COUNTER_CYCLES], -1);
+  if (thread->fd < 0) {
+    thread->failed = TRUE;
+    return FALSE;
+  }
+  thread->fds[PERF_COUNTER_CYCLES] = thread->fd;
+  thread->index[PERF_COUNTER_CYCLES] = 0;
+  thread->members = 1;
+  for (i = 1; i < PERF_COUNTER_COUNT; i++) {
+    thread->fds[i] = perf_counters_open_event(counterConfigs[i], thread->fd);
+    thread->index[i] = thread->fds[i] >= 0 ? (gint) thread->members++ : -1;
+  }
+
+  memset(&thread->overhead, 0xff, sizeof(PerfSample));
+  for (i = 0; i < PERF_COUNTERS_CALIBRATION_READS; i++) {
+    if (!perf_counters_read_group(thread, &a) || !perf_counters_read_group(thread, &b)) {
+      perf_counters_close(thread);
+      thread->failed = TRUE;
+      return FALSE;
+    }
+    for (j = 0; j < PERF_COUNTER_COUNT; j++) {
+      thread->overhead.value[j] = MIN(thread->overhead.value[j], b.value[j] - a.value[j]);
+    }
+  }
+
+  g_private_set(&perfThreadKey, thread);
+  return TRUE;
+}
+
+/**
+ *
+ * This function reads the counters of the calling thread, opening them on
+ * its first call. It returns FALSE when they can not be opened.
+ *
+ */
+gboolean
+perf_counters_read (PerfSample * sample)
+{
+  PerfThread * thread = &perfThread;
+
+  if (thread->fd < 0 && (thread->failed || !perf_counters_open(thread))) {
+    return FALSE;
+  }
+  return perf_counters_read_group(thread, sample);
+}
+
+/* A new frame, the stages are measured from now */
+void
+perf_counters_start (void)
+{
+  memset(&perfThread.frame, 0, sizeof(PerfFrame));
+  perfThread.started = perf_counters_read(&perfThread.last);
+}
+
+void
+perf_counters_mark (PerfStage stage)
+{
+  PerfThread * thread = &perfThread;
+  PerfSample now;
+  guint i;
+
+  if (!perf_counters_read_group(thread, &now)) {
+    return;
+  }
+  for (i = 0; i < PERF_COUNTER_COUNT; i++) {
+    guint64 delta = now.value[i] - thread->last.value[i];
+    thread->frame.stages[stage].value[i] += delta > thread->overhead.value[i] ? delta - thread->overhead.value[i] : 0;
+  }
+  thread->frame.measured |= 1 << stage;
+  thread->last = now;
+}
+
+void
+perf_sample_add (PerfSample * total, const PerfSample * sample)
+{
+  guint i;
+
+  for (i = 0; i < PERF_COUNTER_COUNT; i++) {
+    total->value[i] += sample->value[i];
+  }
+}
+
+/**
+ *
+ * This function checks that the counters can be opened (in the calling
+ * thread) and makes the threads read them for each frame from now on. It
+ * must be called before the output writers are created (they only make
+ * room for the counters when they are enabled) and the producers start.
+ *
+ */
+guint
+perf_counters_enable (void)
+{
+  PerfSample sample;
+
+  if (!perf_counters_read(&sample)) {
+    log_info("perf_event_open failed: %s", g_strerror(errno));
+    return PERF_COUNTERS_ERROR_OPEN;
+  }
+  g_atomic_int_set(&perfCountersEnabled, 1);
+  return PERF_COUNTERS_OK;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <string.h>
+#include <glib.h>
+
+/**
+ *
+ * Hardware performance counters of the parse path (--perfCounters).
+ *
+ * Each thread opens a group of counters for itself (cycles, instructions,
+ * branch misses and cache misses, user space only, see perf_event_open(2))
+ * the first time it reads them and closes them when it exits. The
+ * inspection threads read them around the stages of each frame: the frame
+ * tag (vp8_parse_frame_header()), the bool-decoded header (the rest of the
+ * header and the partition table) and the output writer thread around the
+ * output of the record. The deltas travel with the record, like the stage
+ * times, and the writer adds them up per SSRC for the stats dump (see
+ * stage_stats.h).
+ *
+ * Each read is a read() syscall, it is a profiling mode: the cost of a
+ * read is measured when the counters are opened and taken off each delta.
+ * It is compiled out with the stage stats (-DINSPECTOR_NO_STATS).
+ *
+ */
+
+enum
+{
+  PERF_COUNTERS_OK = 0,
+  PERF_COUNTERS_ERROR_OPEN = 1  /* no PMU (some VMs) or not allowed (kernel.perf_event_paranoid) */
+};
+
+typedef enum
+{
+  PERF_COUNTER_CYCLES = 0,
+  PERF_COUNTER_INSTRUCTIONS = 1,
+  PERF_COUNTER_BRANCH_MISSES = 2,
+  PERF_COUNTER_CACHE_MISSES = 3,
+  PERF_COUNTER_COUNT = 4
+} PerfCounter;
+
+typedef enum
+{
+  PERF_STAGE_TAG = 0,     /* frame tag and keyframe header */
+  PERF_STAGE_HEADER = 1,  /* bool-decoded header and partition table */
+  PERF_STAGE_OUTPUT = 2,  /* format and write of the result (output writer thread) */
+  PERF_STAGE_COUNT = 3
+} PerfStage;
+
+typedef struct
+{
+  guint64 value[PERF_COUNTER_COUNT];
+} PerfSample;
+
+/* The counters spent by a frame in each stage */
+typedef struct
+{
+  PerfSample stages[PERF_STAGE_COUNT];
+  guint measured;  /* 1 << stage for each stage measured */
+} PerfFrame;
+
+typedef struct
+{
+  int fd;                           /* group leader (cycles), -1 until opened */
+  gboolean failed;
+  int fds[PERF_COUNTER_COUNT];      /* the leader and the members, -1 when the counter is not supported */
+  gint index[PERF_COUNTER_COUNT];   /* position in the group read, -1 when the counter is not supported */
+  guint members;
+  PerfSample overhead;              /* the cost of a read */
+  PerfSample last;
+  gboolean started;                 /* a frame is being measured */
+  PerfFrame frame;
+} PerfThread;
+
+#ifdef INSPECTOR_NO_STATS
+
+#define PERF_COUNTERS_START() do { } while (0)
+#define PERF_COUNTERS_MARK(stage) do { } while (0)
+#define PERF_COUNTERS_TAKE(taken) do { } while (0)
+
+#else
+
+extern volatile gint perfCountersEnabled;
+extern __thread PerfThread perfThread;
+
+#define PERF_COUNTERS_START() do { \
+    if (perfCountersEnabled) { perf_counters_start(); } \
+  } while (0)
+
+/* It adds the counters since the previous read to `stage` of the current frame */
+#define PERF_COUNTERS_MARK(stage) do { \
+    if (perfCountersEnabled && perfThread.started) { perf_counters_mark(stage); } \
+  } while (0)
+
+/* It moves the counters of the current frame to `taken`, the next frame starts without them */
+#define PERF_COUNTERS_TAKE(taken) do { \
+    if (perfCountersEnabled) { \
+      (taken) = perfThread.frame; \
+      memset(&perfThread.frame, 0, sizeof(PerfFrame)); \
+      perfThread.started = FALSE; \
+    } \
+  } while (0)
+
+#endif
+
+guint perf_counters_enable(void);
+gboolean perf_counters_read(PerfSample * sample);
+void perf_counters_start(void);
+void perf_counters_mark(PerfStage stage);
+void perf_sample_add(PerfSample * total, const PerfSample * sample);
+const gchar * perf_stage_name(PerfStage stage);
+const gchar * perf_counter_name(PerfCounter counter);
+
+#endif
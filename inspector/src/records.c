@@ -0,0 +1,72 @@
+/**
+ *
+ * Binary frame records reader (--format=binary).
+ *
+ * It maps each record file and prints the records in the text format
+ * of the inspector logs, so the binary results can be used by the same tools.
+ *
+ * $ ./out/inspector-records ./inspector-results/*.bin
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_record.h"
+#include "output_writer.h"
+
+static gboolean countOnly = FALSE;
+
+static GOptionEntry entries[] =
+{
+  { "count", 'c', 0, G_OPTION_ARG_NONE, &countOnly, "Only print the number of records of each file", NULL },
+  { NULL }
+};
+
+static gboolean
+print_records (const gchar * path)
+{
+  FrameRecordReader reader;
+  FrameInfo frame;
+  guint32 ssrc;
+  gchar ssrcName[OUTPUT_WRITER_SSRC_SZ];
+  gchar line[OUTPUT_WRITER_LINE_SZ];
+  guint res = frame_record_reader_open(&reader, path);
+
+  if (res != FRAME_RECORD_OK) {
+    fprintf(stderr, "Failed to read %s (error %u)\n", path, res);
+    return FALSE;
+  }
+
+  if (countOnly) {
+    printf("%s: %" G_GUINT64_FORMAT "\n", path, frame_record_reader_count(&reader));
+    frame_record_reader_close(&reader);
+    return TRUE;
+  }
+
+  while (frame_record_reader_next(&reader, &ssrc, &frame)) {
+    g_snprintf(ssrcName, sizeof(ssrcName), "%u", ssrc);
+    fwrite(line, 1, format_frame_info(line, sizeof(line), ssrcName, &frame), stdout);
+  }
+
+  frame_record_reader_close(&reader);
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError * error = NULL;
+  gboolean ok = TRUE;
+  GOptionContext * context = g_option_context_new("FILE... - VP8 Frame Inspector binary records reader");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error) || argc < 2) {
+    fprintf(stderr, "Usage: %s [--count] FILE...\n", argv[0]);
+    exit(1);
+  }
+
+  for (gint i = 1; i < argc; i++) {
+    ok &= print_records(argv[i]);
+  }
+  return ok ? 0 : 1;
+}
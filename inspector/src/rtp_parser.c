@@ -0,0 +1,82 @@
+#include "rtp_parser.h"
+
+/**
+ *
+ * This function parses the fixed RTP header (https://datatracker.ietf.org/doc/html/rfc3550#section-5.1),
+ * skipping CSRCs, header extensions and padding. RTCP packets that share the
+ * same port (rtcp-mux) are rejected looking at the packet type range.
+ *
+ */
+gboolean
+rtp_packet_parse (const guint8 * data, guint len, RtpPacket * rtp)
+{
+  guint headerLen, padding = 0;
+
+  if (len < RTP_HEADER_SZ || (data[0] >> 6) != RTP_VERSION) {
+    return FALSE;
+  }
+
+  /* RTCP SR/RR/SDES/BYE/APP (200-204) look like RTP payload types 72-76 with marker */
+  if (data[1] >= 200 && data[1] <= 204) {
+    return FALSE;
+  }
+
+  headerLen = RTP_HEADER_SZ + (data[0] & 0x0f) * 4;
+  if (len < headerLen) {
+    return FALSE;
+  }
+
+  if (data[0] & 0x10) {
+    if (len < headerLen + 4) {
+      return FALSE;
+    }
+    headerLen += 4 + ((data[headerLen + 2] << 8) | data[headerLen + 3]) * 4;
+    if (len < headerLen) {
+      return FALSE;
+    }
+  }
+
+  if (data[0] & 0x20) {
+    padding = data[len - 1];
+    if (padding == 0 || headerLen + padding > len) {
+      return FALSE;
+    }
+  }
+
+  rtp->marker = data[1] >> 7;
+  rtp->payloadType = data[1] & 0x7f;
+  rtp->seq = (data[2] << 8) | data[3];
+  rtp->timestamp = ((guint32) data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+  rtp->ssrc = ((guint32) data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+  rtp->payload = data + headerLen;
+  rtp->payloadLen = len - headerLen - padding;
+  rtp->arrival = 0;
+  rtp->offset = 0;
+  return TRUE;
+}
+
+/**
+ *
+ * This function extends a 32 bits RTP timestamp to 64 bits based on the last
+ * extended value, handling wraparounds in both directions (late packets).
+ * Use 0 as lastExtended for the first timestamp of the stream.
+ *
+ */
+guint64
+rtp_timestamp_extend (guint64 lastExtended, guint32 timestamp)
+{
+  guint64 extended;
+
+  if (lastExtended == 0) {
+    /* start one cycle ahead, so a late packet before the first one never underflows */
+    return ((guint64) 1 << 32) + timestamp;
+  }
+
+  extended = (lastExtended & ~(guint64) 0xffffffff) | timestamp;
+  if (extended + 0x80000000 < lastExtended) {
+    extended += (guint64) 1 << 32;
+  } else if (extended > lastExtended + 0x80000000) {
+    extended -= (guint64) 1 << 32;
+  }
+  return extended;
+}
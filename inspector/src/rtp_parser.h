@@ -0,0 +1,30 @@
+#ifndef RTP_PARSER_H
+#define RTP_PARSER_H
+
+#include <glib.h>
+
+enum
+{
+  RTP_HEADER_SZ = 12,
+  RTP_VERSION = 2
+};
+
+typedef struct
+{
+  gboolean marker;
+  guint payloadType;
+  guint16 seq;
+  guint32 timestamp;
+  guint32 ssrc;
+  const guint8 * payload;
+  guint payloadLen;
+  guint64 arrival; /* receive time in nanoseconds, set by the caller */
+  guint64 offset;  /* offset of the pcap record in the capture, set by the caller (0 for live packets) */
+  guint64 pts;     /* buffer PTS in nanoseconds, set by the GStreamer pipeline (see NativeOptions.jitterBuffered) */
+} RtpPacket;
+
+
+gboolean rtp_packet_parse(const guint8 * data, guint len, RtpPacket * rtp);
+guint64 rtp_timestamp_extend(guint64 lastExtended, guint32 timestamp);
+
+#endif
@@ -0,0 +1,268 @@
+/**
+ *
+ * The native engine reorder buffer (see rtp_reorder.h).
+ *
+ * rtpbin's jitterbuffer holds every packet for its latency (200ms by
+ * default). Here a packet in order is emitted right away, without any copy,
+ * and only the packets after a gap wait for it, in the slot of their
+ * sequence number (seq % window), with their payload in a buffer of the pool.
+ *
+ */
+
+#include <string.h>
+
+#include "rtp_reorder.h"
+
+void
+rtp_reorder_pool_init (RtpReorderPool * pool)
+{
+  memset(pool, 0, sizeof(RtpReorderPool));
+}
+
+/* The buffers of the held packets must have been given back (rtp_reorder_clear()) */
+void
+rtp_reorder_pool_clear (RtpReorderPool * pool)
+{
+  while (pool->free) {
+    RtpReorderBuffer * buffer = pool->free;
+    pool->free = buffer->next;
+    g_free(buffer);
+  }
+  pool->allocated = 0;
+}
+
+static RtpReorderBuffer *
+rtp_reorder_pool_take (RtpReorderPool * pool)
+{
+  RtpReorderBuffer * buffer = pool->free;
+
+  if (!buffer) {
+    pool->allocated++;
+    return g_new(RtpReorderBuffer, 1);
+  }
+  pool->free = buffer->next;
+  return buffer;
+}
+
+static void
+rtp_reorder_pool_give (RtpReorderPool * pool, RtpReorderBuffer * buffer)
+{
+  buffer->next = pool->free;
+  pool->free = buffer;
+}
+
+void
+rtp_reorder_init (RtpReorder * reorder, guint window, guint64 latency, RtpReorderPool * pool)
+{
+  memset(reorder, 0, sizeof(RtpReorder));
+  reorder->pool = pool;
+  /* a power of two, so the slots of consecutive sequence numbers never collide when they wrap */
+  reorder->window = window > 0 ? 1 : 0;
+  while (reorder->window < MIN(window, RTP_REORDER_MAX_WINDOW)) {
+    reorder->window <<= 1;
+  }
+  reorder->latency = latency;
+  reorder->deadline = G_MAXUINT64;
+}
+
+/* The held packets are dropped, their buffers go back to the pool */
+static void
+rtp_reorder_drop (RtpReorder * reorder)
+{
+  guint i;
+
+  for (i = 0; reorder->slots && i < reorder->window; i++) {
+    if (reorder->slots[i].buffer) {
+      rtp_reorder_pool_give(reorder->pool, reorder->slots[i].buffer);
+      reorder->slots[i].buffer = NULL;
+    }
+  }
+}
+
+void
+rtp_reorder_clear (RtpReorder * reorder)
+{
+  rtp_reorder_drop(reorder);
+  g_free(reorder->slots);
+  reorder->slots = NULL;
+}
+
+/* It forgets the stream state but keeps the slots, so a new stream can reuse the reorder buffer */
+void
+rtp_reorder_reset (RtpReorder * reorder)
+{
+  RtpReorderSlot * slots = reorder->slots;
+
+  rtp_reorder_drop(reorder);
+  rtp_reorder_init(reorder, reorder->window, reorder->latency, reorder->pool);
+  reorder->slots = slots;
+}
+
+static inline RtpReorderSlot *
+rtp_reorder_slot (RtpReorder * reorder, guint16 seq)
+{
+  return &reorder->slots[seq % reorder->window];
+}
+
+static void
+rtp_reorder_update_deadline (RtpReorder * reorder)
+{
+  guint64 oldest = G_MAXUINT64;
+  guint i;
+
+  for (i = 0; reorder->held > 0 && i < reorder->window; i++) {
+    if (reorder->slots[i].buffer) {
+      oldest = MIN(oldest, reorder->slots[i].rtp.arrival);
+    }
+  }
+  reorder->deadline = reorder->held > 0 ? oldest + reorder->latency : G_MAXUINT64;
+}
+
+static void
+rtp_reorder_emit_slot (RtpReorder * reorder, RtpReorderSlot * slot, RtpReorderEmit emit, gpointer userData)
+{
+  RtpReorderBuffer * buffer = slot->buffer;
+
+  slot->buffer = NULL;
+  reorder->held--;
+  reorder->reordered++;
+  emit(&slot->rtp, TRUE, userData);
+  /* after the call: the payload is valid during the emit, and the emit can not hold packets */
+  rtp_reorder_pool_give(reorder->pool, buffer);
+}
+
+/* It emits the held packets from nextSeq on, up to the next gap */
+static void
+rtp_reorder_release (RtpReorder * reorder, RtpReorderEmit emit, gpointer userData)
+{
+  gboolean released = FALSE;
+
+  while (reorder->held > 0) {
+    RtpReorderSlot * slot = rtp_reorder_slot(reorder, reorder->nextSeq);
+    if (!slot->buffer) {
+      break;
+    }
+    reorder->nextSeq++;
+    rtp_reorder_emit_slot(reorder, slot, emit, userData);
+    released = TRUE;
+  }
+  if (released) {
+    rtp_reorder_update_deadline(reorder);
+  }
+}
+
+/* It gives up the packets before `seq`, emitting the held ones */
+static void
+rtp_reorder_skip_to (RtpReorder * reorder, guint16 seq, RtpReorderEmit emit, gpointer userData)
+{
+  while ((gint16) (seq - reorder->nextSeq) > 0) {
+    if (reorder->held == 0) {
+      reorder->nextSeq = seq;
+      break;
+    }
+    RtpReorderSlot * slot = rtp_reorder_slot(reorder, reorder->nextSeq);
+    reorder->nextSeq++;
+    if (slot->buffer) {
+      rtp_reorder_emit_slot(reorder, slot, emit, userData);
+    }
+  }
+  rtp_reorder_release(reorder, emit, userData);
+  rtp_reorder_update_deadline(reorder);
+}
+
+/* It gives up the first gap and emits the held packets after it */
+static void
+rtp_reorder_skip_gap (RtpReorder * reorder, RtpReorderEmit emit, gpointer userData)
+{
+  while (!rtp_reorder_slot(reorder, reorder->nextSeq)->buffer) {
+    reorder->nextSeq++;
+  }
+  rtp_reorder_release(reorder, emit, userData);
+}
+
+/**
+ *
+ * This function pushes a packet of the stream, `emit` is called for it and
+ * for the held packets that can go now, in sequence number order.
+ * Without a window it only calls `emit`.
+ *
+ */
+void
+rtp_reorder_push (RtpReorder * reorder, const RtpPacket * rtp, RtpReorderEmit emit, gpointer userData)
+{
+  gint delta;
+
+  if (reorder->window == 0) {
+    emit(rtp, FALSE, userData);
+    return;
+  }
+
+  if (!reorder->haveSeq) {
+    reorder->haveSeq = TRUE;
+    reorder->nextSeq = rtp->seq;
+  }
+  rtp_reorder_expire(reorder, rtp->arrival, emit, userData);
+
+  delta = (gint16) (rtp->seq - reorder->nextSeq);
+  if (delta < 0) {
+    if (delta >= -RTP_REORDER_MAX_MISORDER) {
+      reorder->late++;
+      return;
+    }
+    rtp_reorder_flush(reorder, emit, userData);
+    reorder->nextSeq = rtp->seq;
+    delta = 0;
+  }
+
+  /* the window is full, or the packet can not be held: the gaps before it are given up */
+  if (delta >= (gint) reorder->window) {
+    rtp_reorder_skip_to(reorder, rtp->seq - reorder->window + 1, emit, userData);
+  } else if (delta > 0 && rtp->payloadLen > RTP_REORDER_PAYLOAD_SZ) {
+    rtp_reorder_skip_to(reorder, rtp->seq, emit, userData);
+  }
+
+  if (rtp->seq == reorder->nextSeq) {
+    reorder->nextSeq++;
+    emit(rtp, FALSE, userData);
+    rtp_reorder_release(reorder, emit, userData);
+    return;
+  }
+
+  if (!reorder->slots) {
+    reorder->slots = g_new0(RtpReorderSlot, reorder->window);
+  }
+  RtpReorderSlot * slot = rtp_reorder_slot(reorder, rtp->seq);
+  if (slot->buffer) {
+    reorder->late++;
+    return;
+  }
+  slot->buffer = rtp_reorder_pool_take(reorder->pool);
+  slot->rtp = *rtp;
+  slot->rtp.payload = slot->buffer->payload;
+  memcpy(slot->buffer->payload, rtp->payload, rtp->payloadLen);
+  reorder->held++;
+  reorder->deadline = MIN(reorder->deadline, rtp->arrival + reorder->latency);
+}
+
+/**
+ *
+ * This function gives up the gaps that made a packet wait for the latency
+ * (`now` is in nanoseconds, like the arrival times).
+ *
+ */
+void
+rtp_reorder_expire (RtpReorder * reorder, guint64 now, RtpReorderEmit emit, gpointer userData)
+{
+  while (reorder->held > 0 && now >= reorder->deadline) {
+    rtp_reorder_skip_gap(reorder, emit, userData);
+  }
+}
+
+/* It emits all the held packets, giving up the gaps between them */
+void
+rtp_reorder_flush (RtpReorder * reorder, RtpReorderEmit emit, gpointer userData)
+{
+  while (reorder->held > 0) {
+    rtp_reorder_skip_gap(reorder, emit, userData);
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef RTP_REORDER_H
+#define RTP_REORDER_H
+
+#include <glib.h>
+
+#include "rtp_parser.h"
+
+enum
+{
+  RTP_REORDER_MAX_WINDOW = 256,
+  RTP_REORDER_PAYLOAD_SZ = 2048,      /* bigger payloads are never held */
+  RTP_REORDER_MAX_MISORDER = 100,     /* a bigger backward jump is a sender restart (RFC 3550 A.1) */
+  RTP_REORDER_DEFAULT_LATENCY_MS = 50
+};
+
+/* `held` is TRUE when the packet was copied to the reorder buffer, its payload is only valid during the call */
+typedef void (*RtpReorderEmit)(const RtpPacket * rtp, gboolean held, gpointer userData);
+
+typedef struct _RtpReorderBuffer
+{
+  struct _RtpReorderBuffer * next;  /* in the pool */
+  guint8 payload[RTP_REORDER_PAYLOAD_SZ];
+} RtpReorderBuffer;
+
+/**
+ *
+ * The payload buffers of the held packets, shared by the reorder windows of
+ * the streams of a worker (one thread). A buffer is taken when a packet is
+ * held and given back when it is emitted, so the pool only grows to the
+ * most packets held at once, whatever the number of streams and their window.
+ *
+ */
+typedef struct
+{
+  RtpReorderBuffer * free;
+  guint allocated;
+} RtpReorderPool;
+
+typedef struct
+{
+  RtpPacket rtp;
+  RtpReorderBuffer * buffer;  /* NULL when the slot is not used */
+} RtpReorderSlot;
+
+/**
+ *
+ * A minimal reorder buffer for the native engine, sized in packets (rounded
+ * up to a power of two).
+ *
+ * Packets are emitted in sequence number order. A packet after a gap is
+ * held until the gap is filled, until the window is full or until the
+ * first held packet waited `latency` nanoseconds (by the arrival times).
+ * Then the missing packets are given up (the depayloader sees the gap
+ * and reports the loss) and the held ones are emitted.
+ *
+ * The slots (a packet header each) are only allocated when a packet has to
+ * be held, and the payloads of the held packets are copied to buffers of
+ * the shared pool.
+ *
+ */
+typedef struct
+{
+  guint window;
+  guint64 latency;
+  RtpReorderPool * pool;
+  RtpReorderSlot * slots;
+  guint held;
+  guint64 deadline;    /* when the oldest held packet must be emitted */
+  gboolean haveSeq;
+  guint16 nextSeq;
+
+  guint64 reordered;   /* emitted after being held */
+  guint64 late;        /* arrived after their gap was given up, or duplicated */
+} RtpReorder;
+
+
+void rtp_reorder_pool_init(RtpReorderPool * pool);
+void rtp_reorder_pool_clear(RtpReorderPool * pool);
+void rtp_reorder_init(RtpReorder * reorder, guint window, guint64 latency, RtpReorderPool * pool);
+void rtp_reorder_clear(RtpReorder * reorder);
+void rtp_reorder_reset(RtpReorder * reorder);
+void rtp_reorder_push(RtpReorder * reorder, const RtpPacket * rtp, RtpReorderEmit emit, gpointer userData);
+void rtp_reorder_expire(RtpReorder * reorder, guint64 now, RtpReorderEmit emit, gpointer userData);
+void rtp_reorder_flush(RtpReorder * reorder, RtpReorderEmit emit, gpointer userData);
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ *
+ * The SSRC table of the native workers.
+ *
+ * With thousands of streams per worker, a lookup per packet must not chase
+ * pointers: the SSRC and the stream pointer are in the same 16 bytes slot
+ * and a lookup usually reads one or two slots of a single array.
+ *
+ * SSRCs are random 32 bits values, but nothing stops a sender from using
+ * consecutive ones, so they are mixed (Fibonacci hashing, the high half of
+ * a 64 bits product) before taking the home slot.
+ *
+ */
+
+#include "ssrc_table.h"
+
+static inline guint
+ssrc_table_home (const SsrcTable * table, guint32 ssrc)
+{
+  return (guint) (((guint64) ssrc * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15)) >> 32) & (table->capacity - 1);
+}
+
+static void
+ssrc_table_resize (SsrcTable * table, guint capacity)
+{
+  SsrcTableSlot * slots = table->slots;
+  guint oldCapacity = table->capacity, i;
+
+  table->slots = g_new0(SsrcTableSlot, capacity);
+  table->capacity = capacity;
+  table->size = 0;
+  for (i = 0; i < oldCapacity; i++) {
+    if (slots[i].value) {
+      ssrc_table_insert(table, slots[i].ssrc, slots[i].value);
+    }
+  }
+  g_free(slots);
+}
+
+void
+ssrc_table_init (SsrcTable * table)
+{
+  table->slots = g_new0(SsrcTableSlot, SSRC_TABLE_MIN_CAPACITY);
+  table->capacity = SSRC_TABLE_MIN_CAPACITY;
+  table->size = 0;
+}
+
+void
+ssrc_table_clear (SsrcTable * table)
+{
+  g_free(table->slots);
+  table->slots = NULL;
+  table->capacity = 0;
+  table->size = 0;
+}
+
+gpointer
+ssrc_table_lookup (const SsrcTable * table, guint32 ssrc)
+{
+  guint mask = table->capacity - 1;
+  guint i = ssrc_table_home(table, ssrc);
+
+  while (table->slots[i].value) {
+    if (table->slots[i].ssrc == ssrc) {
+      return table->slots[i].value;
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+/* The SSRC must not be in the table yet, `value` must not be NULL */
+void
+ssrc_table_insert (SsrcTable * table, guint32 ssrc, gpointer value)
+{
+  guint i;
+
+  if ((table->size + 1) * 2 > table->capacity) {
+    ssrc_table_resize(table, table->capacity * 2);
+  }
+
+  i = ssrc_table_home(table, ssrc);
+  while (table->slots[i].value) {
+    i = (i + 1) & (table->capacity - 1);
+  }
+  table->slots[i].ssrc = ssrc;
+  table->slots[i].value = value;
+  table->size++;
+}
+
+/**
+ *
+ * This function empties a slot and moves back the next slots of the same
+ * run that can get closer to their home slot.
+ *
+ * When walking the slots in order, a slot must be checked again after
+ * being removed (the next entry may have moved into it). An entry may also
+ * move from the beginning to the end of the array and be seen twice, but
+ * none is skipped.
+ *
+ */
+gboolean
+ssrc_table_remove_slot (SsrcTable * table, guint index)
+{
+  guint mask = table->capacity - 1;
+  guint hole = index, i = index;
+
+  if (!table->slots[index].value) {
+    return FALSE;
+  }
+
+  for (;;) {
+    i = (i + 1) & mask;
+    if (!table->slots[i].value) {
+      break;
+    }
+    /* the entry at i can fill the hole unless its home is in (hole, i] */
+    guint home = ssrc_table_home(table, table->slots[i].ssrc);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      table->slots[hole] = table->slots[i];
+      hole = i;
+    }
+  }
+
+  table->slots[hole].value = NULL;
+  table->size--;
+  return TRUE;
+}
+
+gpointer
+ssrc_table_remove (SsrcTable * table, guint32 ssrc)
+{
+  guint mask = table->capacity - 1;
+  guint i = ssrc_table_home(table, ssrc);
+
+  while (table->slots[i].value) {
+    if (table->slots[i].ssrc == ssrc) {
+      gpointer value = table->slots[i].value;
+      ssrc_table_remove_slot(table, i);
+      return value;
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef SSRC_TABLE_H
+#define SSRC_TABLE_H
+
+#include <glib.h>
+
+enum
+{
+  SSRC_TABLE_MIN_CAPACITY = 16
+};
+
+/* A slot is empty when its value is NULL */
+typedef struct
+{
+  guint32 ssrc;
+  gpointer value;
+} SsrcTableSlot;
+
+/**
+ *
+ * A SSRC -> pointer table with open addressing (linear probing, the slots are
+ * in a single array) and backward shift deletion, so there are no tombstones.
+ * The capacity is a power of two and the table is at most half full.
+ *
+ */
+typedef struct
+{
+  SsrcTableSlot * slots;
+  guint capacity;
+  guint size;
+} SsrcTable;
+
+
+void ssrc_table_init(SsrcTable * table);
+void ssrc_table_clear(SsrcTable * table);
+gpointer ssrc_table_lookup(const SsrcTable * table, guint32 ssrc);
+void ssrc_table_insert(SsrcTable * table, guint32 ssrc, gpointer value);
+gpointer ssrc_table_remove(SsrcTable * table, guint32 ssrc);
+gboolean ssrc_table_remove_slot(SsrcTable * table, guint index);
+
+#endif
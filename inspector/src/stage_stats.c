@@ -0,0 +1,193 @@
+/**
+ *
+ * Per-stage latency histograms (see stage_stats.h).
+ *
+ * The stamps cost a clock_gettime() (vDSO) each and only when the stats
+ * are enabled. The histograms live in the output writer thread, so
+ * recording takes no lock and the inspection threads never see them.
+ * A stream is allocated on its first frame and forgotten after the dump
+ * that follows the close of its output.
+ *
+ */
+
+#ifndef INSPECTOR_NO_STATS
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "stage_stats.h"
+
+volatile gint stageStatsEnabled = 0;
+__thread StageTimes stageTimes;
+
+/* The stages at both ends of each interval */
+static const Stage intervalStages[STAGE_INTERVAL_COUNT][2] = {
+  { STAGE_RECEIVE, STAGE_JITTER },
+  { STAGE_JITTER, STAGE_DEPAY },
+  { STAGE_DEPAY, STAGE_PARSE_START },
+  { STAGE_PARSE_START, STAGE_PARSE_END },
+  { STAGE_PARSE_END, STAGE_OUTPUT },
+  { STAGE_RECEIVE, STAGE_OUTPUT }
+};
+
+static const gchar * intervalNames[STAGE_INTERVAL_COUNT] = {
+  "jitterbuffer", "depay", "handoff", "parse", "output", "total"
+};
+
+const gchar *
+stage_interval_name (StageInterval interval)
+{
+  return interval < STAGE_INTERVAL_COUNT ? intervalNames[interval] : "unknown";
+}
+
+/* The producers stamp the frames from now on, it must be called before they start */
+void
+stage_stats_enable (void)
+{
+  g_atomic_int_set(&stageStatsEnabled, 1);
+}
+
+void
+stage_stats_init (StageStats * stats)
+{
+  ssrc_table_init(&stats->streams);
+  stats->dumps = 0;
+}
+
+void
+stage_stats_clear (StageStats * stats)
+{
+  guint i;
+
+  for (i = 0; i < stats->streams.capacity; i++) {
+    g_free(stats->streams.slots[i].value);
+  }
+  ssrc_table_clear(&stats->streams);
+}
+
+StageStream *
+stage_stats_lookup (StageStats * stats, guint32 ssrc)
+{
+  return ssrc_table_lookup(&stats->streams, ssrc);
+}
+
+/**
+ *
+ * This function records the stages of a frame. An interval is only
+ * recorded when both of its stages were stamped (the PCAP engines have no
+ * receive time, the library callback has no output).
+ *
+ */
+static StageStream *
+stage_stats_stream (StageStats * stats, guint32 ssrc)
+{
+  StageStream * stream = ssrc_table_lookup(&stats->streams, ssrc);
+
+  if (!stream) {
+    stream = g_new0(StageStream, 1);
+    stream->ssrc = ssrc;
+    ssrc_table_insert(&stats->streams, ssrc, stream);
+  }
+  stream->closed = FALSE;
+  return stream;
+}
+
+void
+stage_stats_record (StageStats * stats, guint32 ssrc, const StageTimes * times)
+{
+  StageStream * stream = stage_stats_stream(stats, ssrc);
+  guint i;
+
+  for (i = 0; i < STAGE_INTERVAL_COUNT; i++) {
+    guint64 start = times->at[intervalStages[i][0]];
+    guint64 end = times->at[intervalStages[i][1]];
+    if (start && end) {
+      /* the kernel timestamps and our clock may disagree a little */
+      stage_histogram_record(&stream->intervals[i], end > start ? end - start : 0);
+    }
+  }
+}
+
+/* It adds the performance counters of a frame to the stages it was measured in (--perfCounters) */
+void
+stage_stats_record_perf (StageStats * stats, guint32 ssrc, const PerfFrame * perf)
+{
+  StageStream * stream = stage_stats_stream(stats, ssrc);
+  guint i;
+
+  for (i = 0; i < PERF_STAGE_COUNT; i++) {
+    if (perf->measured & (1 << i)) {
+      stream->perfFrames[i]++;
+      perf_sample_add(&stream->perf[i], &perf->stages[i]);
+    }
+  }
+}
+
+void
+stage_stats_close (StageStats * stats, guint32 ssrc)
+{
+  StageStream * stream = ssrc_table_lookup(&stats->streams, ssrc);
+
+  if (stream) {
+    stream->closed = TRUE;
+  }
+}
+
+/**
+ *
+ * This function logs the histograms of every stream, one line per stage
+ * with frames, then the performance counters per frame of each stage
+ * (--perfCounters), and forgets the closed streams.
+ * It returns how many streams were logged.
+ *
+ */
+guint
+stage_stats_dump (StageStats * stats, const gchar * reason)
+{
+  SsrcTable * streams = &stats->streams;
+  guint i, j, count = streams->size;
+
+  stats->dumps++;
+  log_info("Stage stats [reason: %s, dump: %" G_GUINT64_FORMAT ", streams: %u]", reason, stats->dumps, count);
+
+  for (i = 0; i < streams->capacity; i++) {
+    StageStream * stream = streams->slots[i].value;
+    for (j = 0; stream && j < STAGE_INTERVAL_COUNT; j++) {
+      const StageHistogram * histogram = &stream->intervals[j];
+      if (histogram->total == 0) {
+        continue;
+      }
+      log_info("Stage latency [ssrc: %u, stage: %s, frames: %" G_GUINT64_FORMAT ", p50: %.1f us, p99: %.1f us, p99.9: %.1f us, max: %.1f us]",
+        stream->ssrc, intervalNames[j], histogram->total,
+        stage_histogram_percentile(histogram, 50) / 1e3, stage_histogram_percentile(histogram, 99) / 1e3,
+        stage_histogram_percentile(histogram, 99.9) / 1e3, histogram->max / 1e3);
+    }
+    for (j = 0; stream && j < PERF_STAGE_COUNT; j++) {
+      const PerfSample * perf = &stream->perf[j];
+      gdouble frames = stream->perfFrames[j];
+      if (frames == 0) {
+        continue;
+      }
+      log_info("Stage perf [ssrc: %u, stage: %s, frames: %" G_GUINT64_FORMAT ", cycles: %.0f, instructions: %.0f, IPC: %.2f, branch-misses: %.2f, cache-misses: %.2f]",
+        stream->ssrc, perf_stage_name(j), stream->perfFrames[j], perf->value[PERF_COUNTER_CYCLES] / frames,
+        perf->value[PERF_COUNTER_INSTRUCTIONS] / frames,
+        perf->value[PERF_COUNTER_CYCLES] ? perf->value[PERF_COUNTER_INSTRUCTIONS] / (gdouble) perf->value[PERF_COUNTER_CYCLES] : 0,
+        perf->value[PERF_COUNTER_BRANCH_MISSES] / frames, perf->value[PERF_COUNTER_CACHE_MISSES] / frames);
+    }
+  }
+
+  i = 0;
+  while (i < streams->capacity) {
+    StageStream * stream = streams->slots[i].value;
+    if (!stream || !stream->closed) {
+      i++;
+      continue;
+    }
+    /* the slot is checked again, another stream may have moved into it */
+    ssrc_table_remove_slot(streams, i);
+    g_free(stream);
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+
+#include "latency_histogram.h"
+#include "perf_counters.h"
+#include "ssrc_table.h"
+
+/**
+ *
+ * Per-stage latency of each frame (--statsInterval).
+ *
+ * The inspection thread stamps the frame at each stage in a per-thread
+ * StageTimes, dump_frame_info() hands them to the output writer with the
+ * result and the writer thread stamps STAGE_OUTPUT and records the time
+ * between the stages in the histograms of the SSRC.
+ *
+ * Building with -DINSPECTOR_NO_STATS (make STATS=0) compiles all of it out:
+ * the stamps are empty statements and the records do not carry them.
+ *
+ */
+
+typedef enum
+{
+  STAGE_RECEIVE = 0,     /* socket receive of the last packet of the frame */
+  STAGE_JITTER = 1,      /* out of the jitterbuffer (rtpbin) or the reorder window */
+  STAGE_DEPAY = 2,       /* out of the depayloader (buffer_probe()) */
+  STAGE_PARSE_START = 3, /* vp8_parse_header() entry */
+  STAGE_PARSE_END = 4,   /* vp8_parse_header() exit */
+  STAGE_OUTPUT = 5,      /* written by the output writer */
+  STAGE_COUNT = 6
+} Stage;
+
+/* The histograms of each SSRC, the time between two stages */
+typedef enum
+{
+  STAGE_INTERVAL_JITTER = 0,  /* receive to jitterbuffer exit */
+  STAGE_INTERVAL_DEPAY = 1,   /* jitterbuffer exit to depayloader output */
+  STAGE_INTERVAL_HANDOFF = 2, /* depayloader output to parse */
+  STAGE_INTERVAL_PARSE = 3,   /* parse entry to exit */
+  STAGE_INTERVAL_OUTPUT = 4,  /* parse exit to written */
+  STAGE_INTERVAL_TOTAL = 5,   /* receive to written */
+  STAGE_INTERVAL_COUNT = 6
+} StageInterval;
+
+/* Nanoseconds since the epoch, like the packet arrival times, 0 when the stage was not stamped */
+typedef struct
+{
+  guint64 at[STAGE_COUNT];
+} StageTimes;
+
+typedef struct
+{
+  guint32 ssrc;
+  gboolean closed;            /* its output was closed, it is forgotten after the next dump */
+  StageHistogram intervals[STAGE_INTERVAL_COUNT];
+  guint64 perfFrames[PERF_STAGE_COUNT];  /* --perfCounters, the frames measured in each stage */
+  PerfSample perf[PERF_STAGE_COUNT];
+} StageStream;
+
+/* Only touched by the output writer thread */
+typedef struct
+{
+  SsrcTable streams;
+  guint64 dumps;
+} StageStats;
+
+static inline guint64
+stage_clock_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef INSPECTOR_NO_STATS
+
+#define STAGE_STATS_SET(stage, time) do { } while (0)
+#define STAGE_STATS_MARK(stage) do { } while (0)
+#define STAGE_STATS_TAKE(times) do { } while (0)
+
+#else
+
+extern volatile gint stageStatsEnabled;
+extern __thread StageTimes stageTimes;
+
+#define STAGE_STATS_SET(stage, time) do { \
+    if (stageStatsEnabled) { stageTimes.at[(stage)] = (time); } \
+  } while (0)
+
+#define STAGE_STATS_MARK(stage) do { \
+    if (stageStatsEnabled) { stageTimes.at[(stage)] = stage_clock_now(); } \
+  } while (0)
+
+/* It moves the stamps of the current frame to `times`, the next frame starts without stamps */
+#define STAGE_STATS_TAKE(times) do { \
+    if (stageStatsEnabled) { (times) = stageTimes; memset(&stageTimes, 0, sizeof(StageTimes)); } \
+  } while (0)
+
+#endif
+
+void stage_stats_enable(void);
+void stage_stats_init(StageStats * stats);
+void stage_stats_clear(StageStats * stats);
+void stage_stats_record(StageStats * stats, guint32 ssrc, const StageTimes * times);
+void stage_stats_record_perf(StageStats * stats, guint32 ssrc, const PerfFrame * perf);
+void stage_stats_close(StageStats * stats, guint32 ssrc);
+StageStream * stage_stats_lookup(StageStats * stats, guint32 ssrc);
+guint stage_stats_dump(StageStats * stats, const gchar * reason);
+const gchar * stage_interval_name(StageInterval interval);
+
+#endif
@@ -0,0 +1,271 @@
+/**
+ * 
+ * The per-SSRC inspection state, shared by the GStreamer pipeline
+ * and the native engine.
+ * 
+ * Each StreamInspector has its own output file (<outputPath>/<ssrc>.log or .bin),
+ * so different threads can inspect different streams without sharing anything.
+ * 
+ * Inspecting a frame does no heap allocation: the frame info lives in a
+ * per-thread scratch (not in each StreamInspector, there can be thousands
+ * of them) and the results are formatted in the output buffers.
+ * Destroyed StreamInspectors are kept in a pool for the next streams.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "stream_inspector.h"
+
+static GMutex poolMutex;
+static StreamInspector * pool = NULL;
+static guint poolSize = 0;
+static __thread FrameInfo frameInfo;
+
+/**
+ * 
+ * This function is called to dump the frame info.
+ * It can dump to an output file (--outputPath option)
+ * and/or stdout (--stdout option).
+ * With an output writer, the frame info is only queued and the writer
+ * thread formats and flushes it in batches.
+ * With a callback (the library API), the frame info is only handed to it.
+ * 
+ * */
+void
+dump_frame_info (StreamInspector * streamInspector , FrameInfo * ctx)
+{
+  if (streamInspector->callback) {
+    streamInspector->callback(streamInspector->ssrcId, ctx, streamInspector->userData);
+    return;
+  }
+
+  if (streamInspector->writer) {
+    OutputRecord record;
+    record.type = OUTPUT_RECORD_FRAME;
+    record.target = streamInspector->target;
+    frame_record_encode(record.frame, record.target->ssrcId, ctx);
+    STAGE_STATS_TAKE(record.stages);
+    output_writer_push(streamInspector->writer, &record);
+    return;
+  }
+
+  output_target_write(streamInspector->target, ctx);
+  output_target_flush(streamInspector->target);
+}
+
+/**
+ *
+ * This function is called to dump the results of a window of frames
+ * (--aggregate), to the same outputs than the frames.
+ *
+ */
+void
+dump_aggregate_window (StreamInspector * streamInspector, const AggregateWindow * window)
+{
+  if (streamInspector->writer) {
+    OutputRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = OUTPUT_RECORD_WINDOW;
+    record.target = streamInspector->target;
+    record.window = *window;
+    output_writer_push(streamInspector->writer, &record);
+    return;
+  }
+
+  if (streamInspector->target) {
+    output_target_write_window(streamInspector->target, window);
+    output_target_flush(streamInspector->target);
+  }
+}
+
+/**
+ * 
+ * This function is called when we got a VP8 frame.
+ * We read the frame header according https://datatracker.ietf.org/doc/html/draft-bankoski-vp8-bitstream-06 
+ * and https://github.com/webmproject/bitstream-guide to find all desired info.
+ * 
+ * Only the first `available` bytes of the frame are needed (the header prefix,
+ * see vp8_header_prefix_size() for the stream parse depth) and the first
+ * `tableAvailable` bytes of the partition size table (at vp8_partition_table_offset()).
+ * `size` is the size of the whole frame and `arrival` its arrival time
+ * in nanoseconds since the epoch (0 when unknown).
+ * The caller stamps the stages before the parse (see stage_stats.h).
+ * It returns the frame info, valid until the thread inspects another frame.
+ * 
+ **/
+const FrameInfo *
+inspect_frame_info(StreamInspector * streamInspector, const unsigned char * data, unsigned int available, const unsigned char * table, unsigned int tableAvailable, unsigned int size, guint64 timestamp, guint64 arrival)
+{
+  FrameInfo * ctx = &frameInfo;
+
+  memset(ctx, 0, sizeof(FrameInfo));
+  ctx->pts = timestamp;
+  ctx->size = size;
+  ctx->arrival = arrival;
+  ctx->frameNumber = streamInspector->frameNumber++;
+
+  STAGE_STATS_MARK(STAGE_PARSE_START);
+  PERF_COUNTERS_START();
+  ctx->error = vp8_parse_header_prefix(data, available, size, streamInspector->parseDepth, ctx);
+  /* truncated frames are rejected here, before anyone tries to decode them */
+  if (ctx->error == VP8_CODEC_OK && ctx->parseDepth >= VP8_PARSE_DEPTH_REFERENCE) {
+    ctx->error = vp8_parse_partition_table(table, tableAvailable, size, ctx);
+  }
+  if (ctx->parseDepth > VP8_PARSE_DEPTH_TAG) {
+    PERF_COUNTERS_MARK(PERF_STAGE_HEADER);
+  }
+  STAGE_STATS_MARK(STAGE_PARSE_END);
+  ctx->ok = ctx->error == VP8_CODEC_OK;
+
+  gboolean resolutionChanged = ctx->ok && ctx->keyframe && streamInspector->lastResolution.width != 0 &&
+    (ctx->resolution.width != streamInspector->lastResolution.width || ctx->resolution.height != streamInspector->lastResolution.height);
+  stream_counters_count(&streamInspector->counters, ctx, resolutionChanged);
+
+  if (ctx->keyframe) {
+    streamInspector->lastResolution.width = ctx->resolution.width;
+    streamInspector->lastResolution.widthScale = ctx->resolution.widthScale;
+    streamInspector->lastResolution.height = ctx->resolution.height;
+    streamInspector->lastResolution.heightScale = ctx->resolution.heightScale;
+  } else {      
+    ctx->resolution.width = streamInspector->lastResolution.width;
+    ctx->resolution.widthScale = streamInspector->lastResolution.widthScale;
+    ctx->resolution.height = streamInspector->lastResolution.height;
+    ctx->resolution.heightScale = streamInspector->lastResolution.heightScale;
+  }
+
+  /* with --aggregate, only the notable frames are written one by one */
+  if (streamInspector->aggregator.length > 0) {
+    AggregateWindow window;
+    if (aggregator_add(&streamInspector->aggregator, ctx, resolutionChanged, &window)) {
+      dump_aggregate_window(streamInspector, &window);
+    }
+    if (!aggregate_notable(ctx)) {
+      return ctx;
+    }
+  }
+
+  dump_frame_info(streamInspector, ctx);
+  return ctx;
+}
+
+
+static OutputTarget *
+stream_inspector_open_target (const gchar * ssrc, const OutputSettings * output)
+{
+  const gchar * outputPath = output->targets ? g_hash_table_lookup(output->targets, ssrc) : NULL;
+
+  if (!outputPath) {
+    return output_target_open(ssrc, output->outputPath, output->useStdout, output->format, output->append);
+  }
+  if (g_strcmp0(outputPath, OUTPUT_SETTINGS_STDOUT) == 0) {
+    return output_target_open(ssrc, NULL, TRUE, output->format, FALSE);
+  }
+  return output_target_open(ssrc, outputPath, FALSE, output->format, output->append);
+}
+
+/**
+ *
+ * This function is called to initialize a StreamInspector struct
+ *  
+ **/
+StreamInspector *
+stream_inspector_initialize (const gchar * padName, guint parseDepth, const OutputSettings * output) {
+  log_info("stream_inspector_initialize [padName: %s]", padName);
+
+  g_mutex_lock(&poolMutex);
+  StreamInspector * streamInspector = pool;
+  if (streamInspector) {
+    pool = streamInspector->next;
+    poolSize--;
+  }
+  g_mutex_unlock(&poolMutex);
+
+  if (!streamInspector) {
+    streamInspector = (StreamInspector *) malloc(1 * sizeof(StreamInspector));
+  }
+
+  gchar **split = g_strsplit(padName, "_", 0);
+  gchar *ssrc = split[4];
+
+  g_strlcpy(streamInspector->ssrc, ssrc, sizeof(streamInspector->ssrc));
+  streamInspector->ssrcId = (guint32) g_ascii_strtoull(ssrc, NULL, 10);
+  streamInspector->next = NULL;
+  streamInspector->frameNumber = 0;
+  streamInspector->parseDepth = parseDepth;
+  streamInspector->lastResolution.width = 0;
+  streamInspector->lastResolution.widthScale = 0;
+  streamInspector->lastResolution.height = 0;
+  streamInspector->lastResolution.heightScale = 0;
+  streamInspector->callback = output->callback;
+  streamInspector->userData = output->userData;
+  /* the callbacks (the library API) get every frame */
+  aggregator_init(&streamInspector->aggregator, output->callback ? 0 : (guint64) output->aggregateInterval * FRAME_PTS_SECOND);
+  streamInspector->writer = output->callback ? NULL : output->writer;
+  streamInspector->target = output->callback ? NULL : stream_inspector_open_target(ssrc, output);
+
+  metrics_register(streamInspector);
+
+  g_strfreev(split);
+  return streamInspector;
+}
+
+/**
+ *
+ * This function closes the output of a stream and opens it again
+ * (after a change of output->targets). The next frames go to the new output.
+ *
+ **/
+void
+stream_inspector_set_target (StreamInspector * streamInspector, const OutputSettings * output)
+{
+  if (streamInspector->callback) {
+    return;
+  }
+
+  if (streamInspector->writer) {
+    output_writer_close_target(streamInspector->writer, streamInspector->target);
+  } else if (streamInspector->target) {
+    output_target_close(streamInspector->target);
+  }
+  streamInspector->target = stream_inspector_open_target(streamInspector->ssrc, output);
+}
+
+/**
+ *
+ * This function is called to release a StreamInspector struct,
+ * it goes back to the pool (up to STREAM_INSPECTOR_POOL_SZ).
+ * The last window of frames (--aggregate) is written before.
+ *  
+ **/
+void
+stream_inspector_destroy (StreamInspector * streamInspector)
+{
+  AggregateWindow window;
+
+  metrics_unregister(streamInspector);
+
+  if (streamInspector->aggregator.length > 0 && aggregator_finish(&streamInspector->aggregator, &window)) {
+    dump_aggregate_window(streamInspector, &window);
+  }
+
+  if (streamInspector->writer) {
+    output_writer_close_target(streamInspector->writer, streamInspector->target);
+  } else if (streamInspector->target) {
+    output_target_close(streamInspector->target);
+  }
+
+  g_mutex_lock(&poolMutex);
+  if (poolSize < STREAM_INSPECTOR_POOL_SZ) {
+    streamInspector->next = pool;
+    pool = streamInspector;
+    poolSize++;
+    streamInspector = NULL;
+  }
+  g_mutex_unlock(&poolMutex);
+
+  free(streamInspector);
+}
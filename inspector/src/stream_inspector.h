@@ -0,0 +1,73 @@
+#ifndef STREAM_INSPECTOR_H
+#define STREAM_INSPECTOR_H
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "aggregate.h"
+#include "metrics.h"
+#include "output_writer.h"
+#include "vp8_parser.h"
+
+/* Called with every inspected frame instead of writing it, the frame is only valid during the call */
+typedef void (*FrameCallback) (guint32 ssrc, const FrameInfo * ctx, gpointer userData);
+
+/* In OutputSettings.targets, the output path of the streams sent to stdout */
+#define OUTPUT_SETTINGS_STDOUT "-"
+
+/**
+ *
+ * Where the results go. Without a writer, every frame is written and flushed synchronously.
+ * With a callback, nothing is written and the frames are handed to the callback.
+ * The targets table (SSRC string to output path, or OUTPUT_SETTINGS_STDOUT) overrides
+ * outputPath and useStdout for some streams. With append, the output files
+ * are not truncated (--follow, resuming from a checkpoint). With an
+ * aggregateInterval, the results are windows of frames (see aggregate.h).
+ *
+ */
+typedef struct
+{
+  const gchar * outputPath;
+  gboolean useStdout;
+  guint format;
+  OutputWriter * writer;
+  FrameCallback callback;
+  gpointer userData;
+  GHashTable * targets;
+  gboolean append;
+  guint aggregateInterval;  /* seconds of stream time, 0 for a result per frame */
+} OutputSettings;
+
+enum
+{
+  STREAM_INSPECTOR_SSRC_SZ = 16,
+  STREAM_INSPECTOR_POOL_SZ = 1024  /* destroyed stream inspectors kept for the next streams */
+};
+
+typedef struct _StreamInspector
+{
+  gchar ssrc[STREAM_INSPECTOR_SSRC_SZ];
+  guint32 ssrcId;
+  guint frameNumber;
+  guint parseDepth;
+  FrameResolution lastResolution;
+  StreamCounters counters;          /* only written by the inspecting thread, see metrics.c */
+  Aggregator aggregator;            /* --aggregate, length 0 when the frames are not aggregated */
+  OutputWriter * writer;
+  OutputTarget * target;
+  FrameCallback callback;
+  gpointer userData;
+  struct _StreamInspector * next;   /* in the pool */
+  struct _StreamInspector * metricsPrev;
+  struct _StreamInspector * metricsNext;
+} StreamInspector;
+
+
+StreamInspector * stream_inspector_initialize(const gchar * padName, guint parseDepth, const OutputSettings * output);
+void stream_inspector_destroy(StreamInspector * streamInspector);
+void stream_inspector_set_target(StreamInspector * streamInspector, const OutputSettings * output);
+const FrameInfo * inspect_frame_info(StreamInspector * streamInspector, const unsigned char * data, unsigned int available, const unsigned char * table, unsigned int tableAvailable, unsigned int size, guint64 timestamp, guint64 arrival);
+void dump_frame_info(StreamInspector * streamInspector, FrameInfo * ctx);
+void dump_aggregate_window(StreamInspector * streamInspector, const AggregateWindow * window);
+
+#endif
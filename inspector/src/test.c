@@ -1,5 +1,67 @@
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include <gst/gst.h>
 #include "vp8_parser.h"
+#include "pcap_reader.h"
+#include "rtp_parser.h"
+#include "vp8_depay.h"
+#include "output_writer.h"
+#include "frame_record.h"
+#include "native_worker.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "rtp_reorder.h"
+#include "ssrc_table.h"
+#include "stage_stats.h"
+#include "vp8inspect.h"
+#include "stream_inspector.h"
+#include "daemon.h"
+#include "batch.h"
+#include "follow.h"
+#include "frame_index.h"
+#include "bool_decoder_reference.h"
+#include "bool_encoder.h"
+#include "vp8_tables.h"
+
+/*
+ * Allocation counting: malloc(), calloc() and realloc() are replaced by
+ * wrappers around the glibc ones (glib uses them too), which count the
+ * allocations of the threads with countAllocations set.
+ */
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static __thread gboolean countAllocations = FALSE;
+static volatile gint allocations = 0;
+
+void *
+malloc (size_t size)
+{
+  if (countAllocations) g_atomic_int_inc(&allocations);
+  return __libc_malloc(size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+  if (countAllocations) g_atomic_int_inc(&allocations);
+  return __libc_calloc(n, size);
+}
+
+void *
+realloc (void * ptr, size_t size)
+{
+  if (countAllocations) g_atomic_int_inc(&allocations);
+  return __libc_realloc(ptr, size);
+}
 
 void
 test_bool (const char * msg, const int bool) {
@@ -11,6 +73,13 @@ test_bool (const char * msg, const int bool) {
   printf(" - OK!\n");
 }
 
+static guint32
+test_random (guint32 * state)
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 8;
+}
+
 void
 frame_header_test_001 (void) 
 {
@@ -117,7 +186,7 @@ frame_header_test_005 (void)
 {
   // is a keyframe
   FrameInfo frame;
-  unsigned char data[] = { 
+  unsigned char data[16] = { // padded, the bool decoder reads whole words
     0b10010001, // keyframe(1) = false, version(3) = 0, display(1) = true
     0b00011000, 
     0b00000110, // partSize(19) = 12484
@@ -141,6 +210,2242 @@ frame_header_test_005 (void)
   printf("\n");
 }
 
+/* it writes the frame tag (and the keyframe header) of a frame with a first partition of `partSize` bytes */
+static guint
+write_frame_tag (guint8 * out, gboolean keyframe, guint partSize)
+{
+  out[0] = (keyframe ? 0 : 1) | (1 << 4) | ((partSize & 0x7) << 5); // version = 0, display = true
+  out[1] = partSize >> 3;
+  out[2] = partSize >> 11;
+  if (!keyframe) {
+    return FRAME_HEADER_SZ;
+  }
+  guint8 sync[] = { 0x9d, 0x01, 0x2a, 0x80, 0x02, 0xe0, 0x01 }; // 640x480
+  memcpy(out + FRAME_HEADER_SZ, sync, sizeof(sync));
+  return FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ;
+}
+
+void
+frame_header_test_006 (void)
+{
+  // a keyframe with every optional header, encoded with the bool encoder
+  struct bool_encoder e;
+  FrameInfo frame;
+  guint8 data[4096];
+  guint i, j, k, l, updates = 0;
+
+  memset(data, 0, sizeof(data));
+  init_bool_encoder(&e, data + FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ);
+  bool_put_bit(&e, 0); // color_space
+  bool_put_bit(&e, 1); // clamping_type
+  bool_put_bit(&e, 1); // segmentation_enabled
+  bool_put_bit(&e, 1); // update_mb_segmentation_map
+  bool_put_bit(&e, 1); // update_segment_feature_data
+  bool_put_bit(&e, 0); // segment_feature_mode = delta
+  bool_put_maybe_int(&e, 10, 7);
+  bool_put_maybe_int(&e, -5, 7);
+  bool_put_maybe_int(&e, 0, 7);
+  bool_put_maybe_int(&e, 3, 7);
+  bool_put_maybe_int(&e, -12, 6);
+  bool_put_maybe_int(&e, 0, 6);
+  bool_put_maybe_int(&e, 7, 6);
+  bool_put_maybe_int(&e, 0, 6);
+  bool_put_bit(&e, 1); bool_put_uint(&e, 100, 8); // segment_prob_update
+  bool_put_bit(&e, 0);
+  bool_put_bit(&e, 1); bool_put_uint(&e, 20, 8);
+  bool_put_bit(&e, 1); // filter_type
+  bool_put_uint(&e, 32, 6); // loop_filter_level
+  bool_put_uint(&e, 3, 3); // sharpness_level
+  bool_put_bit(&e, 1); // loop_filter_adj_enable
+  bool_put_bit(&e, 1); // mode_ref_lf_delta_update
+  bool_put_maybe_int(&e, 2, 6);
+  bool_put_maybe_int(&e, 0, 6);
+  bool_put_maybe_int(&e, -2, 6);
+  bool_put_maybe_int(&e, -2, 6);
+  bool_put_maybe_int(&e, 4, 6);
+  bool_put_maybe_int(&e, -2, 6);
+  bool_put_maybe_int(&e, 2, 6);
+  bool_put_maybe_int(&e, 4, 6);
+  bool_put_uint(&e, 2, 2); // log2_nbr_of_dct_partitions
+  bool_put_uint(&e, 60, 7); // y_ac_qi
+  bool_put_maybe_int(&e, -3, 4);
+  bool_put_maybe_int(&e, 0, 4);
+  bool_put_maybe_int(&e, 5, 4);
+  bool_put_maybe_int(&e, 0, 4);
+  bool_put_maybe_int(&e, -1, 4);
+  bool_put_bit(&e, 1); // refresh_entropy_probs
+  for (i = 0; i < BLOCK_TYPES; i++)
+    for (j = 0; j < COEF_BANDS; j++)
+      for (k = 0; k < PREV_COEF_CONTEXTS; k++)
+        for (l = 0; l < ENTROPY_NODES; l++) {
+          gboolean update = (i + j + k + l) % 17 == 0;
+          bool_put(&e, coeff_update_probs[i][j][k][l], update);
+          if (update) {
+            bool_put_uint(&e, 128, 8);
+            updates++;
+          }
+        }
+  bool_put_bit(&e, 1); // mb_no_coeff_skip
+  bool_put_uint(&e, 200, 8); // prob_skip_false
+  guint partSize = bool_flush_encoder(&e);
+  write_frame_tag(data, TRUE, partSize);
+  guint len = FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ + partSize + 1000;
+
+  printf("- Full keyframe header \n");
+  memset(&frame, 0, sizeof(frame));
+  test_bool("Should parse the full header", vp8_parse_header_prefix(data, len, len, VP8_PARSE_DEPTH_FULL, &frame) == VP8_CODEC_OK);
+  test_bool("Should reach the full depth", frame.parseDepth == VP8_PARSE_DEPTH_FULL);
+  test_bool("Should get the color space and clamping type", frame.colorSpace == 0 && frame.clampingType == 1);
+  test_bool("Should get the segmentation header", frame.segmentation.enabled && frame.segmentation.updateMap
+    && frame.segmentation.updateData && !frame.segmentation.absoluteDelta
+    && frame.segmentation.quantizer[0] == 10 && frame.segmentation.quantizer[1] == -5 && frame.segmentation.quantizer[3] == 3
+    && frame.segmentation.loopFilterLevel[0] == -12 && frame.segmentation.loopFilterLevel[2] == 7
+    && frame.segmentation.treeProbs[0] == 100 && frame.segmentation.treeProbs[1] == 255 && frame.segmentation.treeProbs[2] == 20);
+  test_bool("Should get the loop filter header", frame.loopFilter.filterType == 1 && frame.loopFilter.level == 32
+    && frame.loopFilter.sharpness == 3 && frame.loopFilter.deltaEnabled && frame.loopFilter.deltaUpdate
+    && frame.loopFilter.refFrameDelta[0] == 2 && frame.loopFilter.refFrameDelta[3] == -2
+    && frame.loopFilter.modeDelta[0] == 4 && frame.loopFilter.modeDelta[1] == -2);
+  test_bool("Should get the DCT partitions", frame.partitions == 4);
+  test_bool("Should get the quantizer indices", frame.quantizer.yAcQi == 60 && frame.quantizer.y1DcDelta == -3
+    && frame.quantizer.y2DcDelta == 0 && frame.quantizer.y2AcDelta == 5 && frame.quantizer.uvAcDelta == -1);
+  test_bool("Should refresh every reference", frame.refreshGoldenFrame && frame.refreshAltrefFrame && frame.refreshLast);
+  test_bool("Should refresh the entropy probs", frame.refreshEntropyProbs);
+  test_bool("Should count the token probability updates", frame.probs.coeffUpdates == updates);
+  test_bool("Should get the skip probability", frame.probs.mbNoCoeffSkip && frame.probs.probSkipFalse == 200);
+
+  memset(&frame, 0, sizeof(frame));
+  test_bool("Should parse up to the reference flags", vp8_parse_header(data, len, &frame) == VP8_CODEC_OK);
+  test_bool("Should stop at the reference depth", frame.parseDepth == VP8_PARSE_DEPTH_REFERENCE
+    && frame.quantizer.yAcQi == 60 && !frame.refreshEntropyProbs && frame.probs.coeffUpdates == 0);
+
+  memset(&frame, 0, sizeof(frame));
+  test_bool("Should parse the frame tag", vp8_parse_header_prefix(data, len, len, VP8_PARSE_DEPTH_TAG, &frame) == VP8_CODEC_OK);
+  test_bool("Should stop at the tag depth", frame.parseDepth == VP8_PARSE_DEPTH_TAG && frame.keyframe
+    && frame.resolution.width == 640 && frame.partitions == 0 && !frame.refreshGoldenFrame);
+
+  memset(&frame, 0, sizeof(frame));
+  test_bool("Should parse a truncated prefix", vp8_parse_header_prefix(data, FRAME_HEADER_PREFIX_SZ, len, VP8_PARSE_DEPTH_FULL, &frame) == VP8_CODEC_OK);
+  test_bool("Should not report the headers after the prefix", frame.parseDepth == VP8_PARSE_DEPTH_REFERENCE
+    && frame.refreshGoldenFrame && !frame.refreshEntropyProbs && frame.probs.coeffUpdates == 0 && !frame.probs.mbNoCoeffSkip);
+  printf("\n");
+}
+
+void
+frame_header_test_007 (void)
+{
+  // an interframe with every optional header, encoded with the bool encoder
+  struct bool_encoder e;
+  FrameInfo frame;
+  guint8 data[4096];
+  guint i, j, k, l;
+
+  memset(data, 0, sizeof(data));
+  init_bool_encoder(&e, data + FRAME_HEADER_SZ);
+  bool_put_bit(&e, 0); // segmentation_enabled
+  bool_put_bit(&e, 0); // filter_type
+  bool_put_uint(&e, 20, 6); // loop_filter_level
+  bool_put_uint(&e, 0, 3); // sharpness_level
+  bool_put_bit(&e, 0); // loop_filter_adj_enable
+  bool_put_uint(&e, 0, 2); // log2_nbr_of_dct_partitions
+  bool_put_uint(&e, 127, 7); // y_ac_qi
+  for (i = 0; i < 5; i++) bool_put_maybe_int(&e, 0, 4);
+  bool_put_bit(&e, 0); // refresh_golden_frame
+  bool_put_bit(&e, 1); // refresh_alternate_frame
+  bool_put_uint(&e, 2, 2); // copy_buffer_to_golden
+  bool_put_bit(&e, 1); // sign_bias_golden
+  bool_put_bit(&e, 0); // sign_bias_alternate
+  bool_put_bit(&e, 0); // refresh_entropy_probs
+  bool_put_bit(&e, 1); // refresh_last
+  for (i = 0; i < BLOCK_TYPES; i++)
+    for (j = 0; j < COEF_BANDS; j++)
+      for (k = 0; k < PREV_COEF_CONTEXTS; k++)
+        for (l = 0; l < ENTROPY_NODES; l++)
+          bool_put(&e, coeff_update_probs[i][j][k][l], 0);
+  bool_put_bit(&e, 0); // mb_no_coeff_skip
+  bool_put_uint(&e, 30, 8); // prob_intra
+  bool_put_uint(&e, 120, 8); // prob_last
+  bool_put_uint(&e, 180, 8); // prob_gf
+  bool_put_bit(&e, 1); // intra_16x16_prob_update_flag
+  for (i = 0; i < INTRA_16X16_PROBS; i++) bool_put_uint(&e, 10 + i, 8);
+  bool_put_bit(&e, 0); // intra_chroma_prob_update_flag
+  for (i = 0; i < MV_COMPONENTS; i++)
+    for (j = 0; j < MV_PROB_COUNT; j++) {
+      bool_put(&e, mv_update_probs[i][j], j == 3);
+      if (j == 3) bool_put_uint(&e, 64, 7);
+    }
+  guint partSize = bool_flush_encoder(&e);
+  write_frame_tag(data, FALSE, partSize);
+  guint len = FRAME_HEADER_SZ + partSize + 1000;
+
+  printf("- Full interframe header \n");
+  memset(&frame, 0, sizeof(frame));
+  test_bool("Should parse the full header", vp8_parse_header_prefix(data, len, len, VP8_PARSE_DEPTH_FULL, &frame) == VP8_CODEC_OK);
+  test_bool("Should reach the full depth", frame.parseDepth == VP8_PARSE_DEPTH_FULL);
+  test_bool("Should get the loop filter and quantizer", !frame.segmentation.enabled && frame.loopFilter.level == 20
+    && frame.partitions == 1 && frame.quantizer.yAcQi == 127);
+  test_bool("Should get the reference flags", !frame.refreshGoldenFrame && frame.refreshAltrefFrame && frame.refreshLast);
+  test_bool("Should get the buffer copies", frame.copyBufferToGolden == 2 && frame.copyBufferToAltref == 0);
+  test_bool("Should get the sign bias", frame.signBiasGolden && !frame.signBiasAltref);
+  test_bool("Should not refresh the entropy probs", !frame.refreshEntropyProbs && frame.probs.coeffUpdates == 0);
+  test_bool("Should get the reference probabilities", frame.probs.probIntra == 30 && frame.probs.probLast == 120 && frame.probs.probGolden == 180);
+  test_bool("Should get the intra mode probabilities", frame.probs.intra16x16Update && frame.probs.intra16x16Probs[0] == 10
+    && frame.probs.intra16x16Probs[3] == 13 && !frame.probs.intraChromaUpdate);
+  test_bool("Should count the motion vector probability updates", frame.probs.mvUpdates == 2);
+  printf("\n");
+}
+
+/* a keyframe with `partitions` DCT partitions of `sizes` bytes, it returns the frame size */
+static guint
+write_partitioned_frame (guint8 * out, guint partitions, const guint * sizes)
+{
+  struct bool_encoder e;
+  guint i, header = FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ;
+
+  init_bool_encoder(&e, out + header);
+  bool_put_uint(&e, 0, 2); // color_space, clamping_type
+  bool_put_bit(&e, 0); // segmentation_enabled
+  bool_put_uint(&e, 0, 10); // filter_type, loop_filter_level, sharpness_level
+  bool_put_bit(&e, 0); // loop_filter_adj_enable
+  bool_put_uint(&e, g_bit_nth_lsf(partitions, -1), 2); // log2_nbr_of_dct_partitions
+  bool_put_uint(&e, 40, 7); // y_ac_qi
+  for (i = 0; i < 5; i++) bool_put_maybe_int(&e, 0, 4);
+  guint partSize = bool_flush_encoder(&e);
+  write_frame_tag(out, TRUE, partSize);
+
+  guint offset = header + partSize;
+  for (i = 0; i + 1 < partitions; i++, offset += PARTITION_SIZE_SZ) {
+    out[offset] = sizes[i];
+    out[offset + 1] = sizes[i] >> 8;
+    out[offset + 2] = sizes[i] >> 16;
+  }
+  for (i = 0; i < partitions; i++) {
+    memset(out + offset, 0x10 + i, sizes[i]);
+    offset += sizes[i];
+  }
+  return offset;
+}
+
+void
+frame_header_test_008 (void)
+{
+  // truncated frames: every length of frames with 1, 2, 4 and 8 partitions
+  guint sizes[MAX_DCT_PARTITIONS] = { 50, 1, 300, 0, 70, 20, 200, 90 };
+  guint8 data[2048];
+  FrameInfo frame;
+  guint partitions, cut, i;
+  gboolean offsets = TRUE, truncated = TRUE, prefix = TRUE;
+
+  printf("- Truncated frames \n");
+  for (partitions = 1; partitions <= MAX_DCT_PARTITIONS; partitions *= 2) {
+    memset(data, 0, sizeof(data));
+    guint len = write_partitioned_frame(data, partitions, sizes);
+    guint tableOffset = vp8_partition_table_offset(data, len);
+
+    memset(&frame, 0, sizeof(frame));
+    test_bool("Should parse the complete frame", vp8_parse_header(data, len, &frame) == VP8_CODEC_OK && frame.partitions == partitions);
+    guint offset = tableOffset + (partitions - 1) * PARTITION_SIZE_SZ;
+    for (i = 0; i < partitions; i++) {
+      offsets = offsets && frame.partitionOffset[i] == offset && frame.partitionSize[i] == sizes[i]
+        && (sizes[i] == 0 || data[offset] == 0x10 + i);
+      offset += sizes[i];
+    }
+    guint lastOffset = frame.partitionOffset[partitions - 1];
+
+    // only the last partition size is implicit, it can be cut (but a frame has some bytes after the first partition)
+    for (cut = 10; cut < len; cut++) {
+      guint expected = cut >= lastOffset && cut > tableOffset ? VP8_CODEC_OK : VP8_CODEC_TRUNCATED_FRAME;
+      memset(&frame, 0, sizeof(frame));
+      truncated = truncated && vp8_parse_header(data, cut, &frame) == expected;
+
+      // the same with the header prefix and the table copied apart, like the inspector does
+      memset(&frame, 0, sizeof(frame));
+      guint res = vp8_parse_header_prefix(data, MIN(cut, FRAME_HEADER_PREFIX_SZ), cut, VP8_PARSE_DEPTH_REFERENCE, &frame);
+      if (res == VP8_CODEC_OK) {
+        res = vp8_parse_partition_table(data + tableOffset, tableOffset < cut ? MIN(cut - tableOffset, PARTITION_TABLE_SZ) : 0, cut, &frame);
+      }
+      prefix = prefix && res == expected;
+    }
+  }
+  test_bool("Should expose every partition offset and size", offsets);
+  test_bool("Should reject every truncated frame", truncated);
+  test_bool("Should reject every truncated frame from the prefix and the table", prefix);
+
+  guint len = write_partitioned_frame(data, 4, sizes);
+  data[vp8_partition_table_offset(data, len) + 2] = 0xff; // first partition size > 16MB
+  memset(&frame, 0, sizeof(frame));
+  test_bool("Should reject a corrupt partition size", vp8_parse_header(data, len, &frame) == VP8_CODEC_TRUNCATED_FRAME);
+  test_bool("Should reject a truncated first partition", vp8_parse_frame_header(data, 12, &frame) == VP8_CODEC_TRUNCATED_FRAME);
+  printf("\n");
+}
+
+static guint
+write_rtp_packet (guint8 * out, guint16 seq, gboolean marker, const guint8 * payload, guint len)
+{
+  guint8 header[] = {
+    0x80, (marker << 7) | 96, // version = 2, payloadType = 96
+    seq >> 8, seq & 0xff,
+    0x00, 0x00, 0x0b, 0xb8, // timestamp = 3000
+    0x0e, 0x53, 0x3e, 0x5a, // ssrc = 240336474
+  };
+  memcpy(out, header, sizeof(header));
+  memcpy(out + sizeof(header), payload, len);
+  return sizeof(header) + len;
+}
+
+static guint
+write_pcap_record (guint8 * out, guint usec, const guint8 * rtp, guint len)
+{
+  guint8 udpLen = 8 + len;
+  guint8 ipLen = 20 + udpLen;
+  guint captured = 14 + ipLen;
+  guint8 record[] = {
+    1 + usec / 1000000, 0x00, 0x00, 0x00, // ts = 1s + usec
+    (usec % 1000000) & 0xff, ((usec % 1000000) >> 8) & 0xff, (usec % 1000000) >> 16, 0x00,
+    captured, 0x00, 0x00, 0x00, captured, 0x00, 0x00, 0x00,
+    0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 2, 0x08, 0x00, // ethernet, ethertype = IPv4
+    0x45, 0x00, 0x00, ipLen, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00, // IPv4, DF, UDP
+    127, 0, 0, 1, 127, 0, 0, 1,
+    0xc3, 0x50, 0xd9, 0x03, 0x00, udpLen, 0x00, 0x00, // 50000 -> 55555
+  };
+  memcpy(out, record, sizeof(record));
+  memcpy(out + sizeof(record), rtp, len);
+  return sizeof(record) + len;
+}
+
+/* The capture fixtures: a 320x240 keyframe in two packets, and an interframe ending like it */
+static const guint8 pcapHeader[] = {
+  0xd4, 0xc3, 0xb2, 0xa1, 0x02, 0x00, 0x04, 0x00, // magic, version 2.4
+  0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0, 0, 0x01, 0, 0, 0, // snaplen, linktype = ethernet
+};
+static const guint8 first[] = {
+  0x10, // VP8 payload descriptor: S = 1, PID = 0
+  0b00010000, 0b00000001, 0b00000000, // keyframe = true, display = true, partSize = 8
+  0x9d, 0x01, 0x2a, // sync code
+  0x40, 0x01, // width = 320
+};
+static const guint8 inter[] = { 0x10, 0b00010001, 0b00000001, 0b00000000 }; // interframe
+static const guint8 second[] = {
+  0x00, // VP8 payload descriptor: S = 0, PID = 0
+  0xf0, 0x00, // height = 240
+  0, 0, 0, 0, 0, 0, 0, 0, 0, // first partition and some DCT data
+};
+
+/* A pcap record with an RTP packet of any SSRC and timestamp */
+static guint
+write_rtp_record (guint8 * out, guint usec, guint32 ssrc, guint16 seq, guint32 timestamp, gboolean marker, const guint8 * payload, guint len)
+{
+  guint8 rtp[128];
+  guint n = write_rtp_packet(rtp, seq, marker, payload, len);
+
+  rtp[8] = ssrc >> 24;
+  rtp[9] = ssrc >> 16;
+  rtp[10] = ssrc >> 8;
+  rtp[11] = ssrc & 0xff;
+  rtp[4] = timestamp >> 24;
+  rtp[5] = timestamp >> 16;
+  rtp[6] = timestamp >> 8;
+  rtp[7] = timestamp & 0xff;
+  return write_pcap_record(out, usec, rtp, n);
+}
+
+/* It collects the inspected frames of an OutputSettings callback, as "ssrc:frameNumber:keyframe:width " */
+static void
+frames_test_callback (guint32 ssrc, const FrameInfo * frame, gpointer userData)
+{
+  GString * frames = (GString *) userData;
+  g_string_append_printf(frames, "%u:%u:%u:%u ", ssrc, frame->frameNumber, frame->keyframe, frame->resolution.width);
+}
+
+void
+pcap_test_001 (void)
+{
+  guint8 file[1024];
+  guint8 rtp[128];
+  guint size = 0;
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  PcapReader reader;
+  PcapPacket packet;
+  RtpPacket rtpPacket;
+  Vp8Depay depay;
+  FrameInfo frame;
+  guint packets = 0, frames = 0;
+
+  memcpy(file, pcapHeader, sizeof(pcapHeader));
+  size += sizeof(pcapHeader);
+  size += write_pcap_record(file + size, 0, rtp, write_rtp_packet(rtp, 65535, FALSE, first, sizeof(first)));
+  size += write_pcap_record(file + size, 10, rtp, write_rtp_packet(rtp, 0, TRUE, second, sizeof(second)));
+  // a frame with a lost packet, it should be dropped
+  size += write_pcap_record(file + size, 20, rtp, write_rtp_packet(rtp, 1, FALSE, first, sizeof(first)));
+  size += write_pcap_record(file + size, 30, rtp, write_rtp_packet(rtp, 3, TRUE, second, sizeof(second)));
+
+  printf("- Native PCAP reader, RTP parser and VP8 depayloader \n");
+  int fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  test_bool("Should open the PCAP file", pcap_reader_open(&reader, path) == PCAP_OK);
+  vp8_depay_init(&depay);
+  while (pcap_reader_next(&reader, &packet)) {
+    packets++;
+    test_bool("Should read the UDP ports", packet.srcPort == 50000 && packet.dstPort == 55555);
+    test_bool("Should parse the RTP packet", rtp_packet_parse(packet.payload, packet.payloadLen, &rtpPacket));
+    test_bool("Should get the RTP header fields", rtpPacket.payloadType == 96 && rtpPacket.ssrc == 240336474 && rtpPacket.timestamp == 3000);
+    if (vp8_depay_push(&depay, &rtpPacket)) {
+      guint8 data[64];
+      guint len = vp8_frame_copy(&depay.frame, data, sizeof(data));
+      frames++;
+      test_bool("Should assemble the frame without the payload descriptors", depay.frame.size == sizeof(first) + sizeof(second) - 2 && len == depay.frame.size);
+      test_bool("Should parse the assembled frame", vp8_parse_header(data, len, &frame) == VP8_CODEC_OK);
+      test_bool("Should get the correct resolution", frame.resolution.width == 320 && frame.resolution.height == 240);
+    }
+  }
+  test_bool("Should read all UDP packets", packets == 4);
+  test_bool("Should drop the frame with a lost packet", frames == 1);
+  vp8_depay_clear(&depay);
+  pcap_reader_close(&reader);
+  unlink(path);
+  printf("\n");
+}
+
+void
+rtp_test_001 (void)
+{
+  printf("- RTP timestamp extension \n");
+  guint64 ts = rtp_timestamp_extend(0, 0xfffff000);
+  test_bool("Should extend across the wraparound", rtp_timestamp_extend(ts, 0x00000100) == ts + 0x1100);
+  test_bool("Should handle late packets before the wraparound", rtp_timestamp_extend(ts + 0x1100, 0xffffff00) == ts + 0xf00);
+  printf("\n");
+}
+
+static void
+push_vp8_packet (Vp8Depay * depay, RtpPacket * rtp, guint8 * buffer, const guint8 * descriptor, guint descriptorLen,
+  const guint8 * data, guint len, gboolean marker)
+{
+  memcpy(buffer, descriptor, descriptorLen);
+  memcpy(buffer + descriptorLen, data, len);
+  rtp->payload = buffer;
+  rtp->payloadLen = descriptorLen + len;
+  rtp->marker = marker;
+}
+
+void
+depay_test_001 (void)
+{
+  Vp8PayloadDescriptor descriptor;
+  guint8 shortId[] = { 0x90, 0xe0, 0x7f, 0x12, 0xa5, 0xff };
+  guint8 longId[] = { 0xb3, 0x90, 0xff, 0xfe, 0x44, 0xff };
+
+  printf("- VP8 payload descriptor \n");
+  test_bool("Should parse the descriptor with a 7 bits PictureID", vp8_payload_descriptor_parse(shortId, sizeof(shortId), &descriptor));
+  test_bool("Should get X, N, S and PID", descriptor.extended && !descriptor.nonReference && descriptor.startOfPartition && descriptor.partitionIndex == 0);
+  test_bool("Should get the PictureID", descriptor.hasPictureId && !descriptor.longPictureId && descriptor.pictureId == 127);
+  test_bool("Should get the TL0PICIDX", descriptor.hasTl0PicIdx && descriptor.tl0PicIdx == 0x12);
+  test_bool("Should get TID, Y and KEYIDX", descriptor.hasTid && !descriptor.hasKeyIdx && descriptor.tid == 2 && descriptor.layerSync && descriptor.keyIdx == 5);
+  test_bool("Should get the descriptor size", descriptor.size == 5);
+  test_bool("Should parse the descriptor with a 15 bits PictureID", vp8_payload_descriptor_parse(longId, sizeof(longId), &descriptor));
+  test_bool("Should get N, S and PID", descriptor.nonReference && descriptor.startOfPartition && descriptor.partitionIndex == 3);
+  test_bool("Should get the long PictureID", descriptor.hasPictureId && descriptor.longPictureId && descriptor.pictureId == 0x7ffe);
+  test_bool("Should get the KEYIDX", descriptor.hasKeyIdx && !descriptor.hasTl0PicIdx && descriptor.keyIdx == 4);
+  test_bool("Should reject a descriptor without payload", !vp8_payload_descriptor_parse(longId, 5, &descriptor));
+  test_bool("Should reject a truncated descriptor", !vp8_payload_descriptor_parse(longId, 3, &descriptor));
+  printf("\n");
+}
+
+void
+depay_test_002 (void)
+{
+  Vp8Depay depay;
+  RtpPacket rtp = { 0 };
+  guint8 packets[10][64];
+  guint8 frame[10 * 32];
+  guint8 copy[10 * 32];
+  guint8 start[] = { 0x90, 0x80, 0x7e };  // S = 1, PictureID = 126
+  guint8 middle[] = { 0x80, 0x80, 0x7e }; // S = 0, PictureID = 126
+  guint i, completed = 0;
+
+  for (i = 0; i < sizeof(frame); i++) {
+    frame[i] = i * 7;
+  }
+
+  printf("- VP8 depayloader with frames split in many packets \n");
+  vp8_depay_init(&depay);
+  for (i = 0; i < 10; i++) {
+    rtp.seq = 65530 + i;
+    push_vp8_packet(&depay, &rtp, packets[i], i == 0 ? start : middle, 3, frame + i * 32, 32, i == 9);
+    completed += vp8_depay_push(&depay, &rtp);
+  }
+  test_bool("Should complete one frame across the seqnum wraparound", completed == 1);
+  test_bool("Should keep one slice per packet", depay.frame.numSlices == 10 && depay.frame.size == sizeof(frame));
+  test_bool("Should point to the packets, not copy them", depay.frame.slices[3].data == packets[3] + 3);
+  test_bool("Should linearize the frame like rtpvp8depay", vp8_frame_copy(&depay.frame, copy, sizeof(copy)) == sizeof(frame) && memcmp(copy, frame, sizeof(frame)) == 0);
+  test_bool("Should linearize only the requested prefix", vp8_frame_copy(&depay.frame, copy, 40) == 40 && memcmp(copy, frame, 40) == 0);
+  test_bool("Should get the PictureID of the frame", depay.frame.descriptor.pictureId == 126);
+
+  // the packets memory is reused in the middle of the frame (realtime receiver pool)
+  completed = 0;
+  for (i = 0; i < 10; i++) {
+    rtp.seq++;
+    push_vp8_packet(&depay, &rtp, packets[i % 2], i == 0 ? start : middle, 3, frame + i * 32, 32, i == 9);
+    completed += vp8_depay_push(&depay, &rtp);
+    vp8_depay_detach(&depay);
+    memset(packets[i % 2], 0xff, sizeof(packets[i % 2]));
+  }
+  test_bool("Should complete the detached frame", completed == 1 && depay.frame.size == sizeof(frame));
+  test_bool("Should keep the frame prefix after the packets are reused", vp8_frame_copy(&depay.frame, copy, 64) == 64 && memcmp(copy, frame, 64) == 0);
+  vp8_depay_clear(&depay);
+  printf("\n");
+}
+
+void
+depay_test_004 (void)
+{
+  Vp8Depay depay;
+  RtpPacket rtp = { 0 };
+  guint8 packets[2][600];
+  guint8 frame[4200];
+  guint8 table[PARTITION_TABLE_SZ];
+  guint8 start[] = { 0x10 }; // S = 1
+  guint8 middle[] = { 0x00 };
+  guint sizes[] = { 100, 200, 300, 400 };
+  guint i, offset, len, completed = 0;
+
+  // a big first partition: the partition size table is after the detached prefix
+  memset(frame, 0x33, sizeof(frame));
+  write_frame_tag(frame, FALSE, 3000);
+  offset = FRAME_HEADER_SZ + 3000;
+  for (i = 0; i < 3; i++) {
+    frame[offset + i * 3] = sizes[i];
+    frame[offset + i * 3 + 1] = sizes[i] >> 8;
+    frame[offset + i * 3 + 2] = 0;
+  }
+  len = offset + 9 + 100 + 200 + 300 + 400;
+
+  printf("- VP8 depayloader keeps the partition size table \n");
+  vp8_depay_init(&depay);
+  for (i = 0; i * 500 < len; i++) {
+    guint n = MIN(500, len - i * 500);
+    rtp.seq = i;
+    push_vp8_packet(&depay, &rtp, packets[i % 2], i == 0 ? start : middle, 1, frame + i * 500, n, (i + 1) * 500 >= len);
+    completed += vp8_depay_push(&depay, &rtp);
+    vp8_depay_detach(&depay);
+    memset(packets[i % 2], 0xff, sizeof(packets[i % 2]));
+  }
+  test_bool("Should complete the detached frame", completed == 1 && depay.frame.size == len);
+  test_bool("Should find the table offset", vp8_partition_table_offset(frame, VP8_DEPAY_DETACHED_SZ) == offset);
+  test_bool("Should keep the partition size table", vp8_frame_copy_at(&depay.frame, offset, table, sizeof(table)) == sizeof(table)
+    && memcmp(table, frame + offset, sizeof(table)) == 0);
+  test_bool("Should not copy the forgotten bytes", vp8_frame_copy_at(&depay.frame, VP8_DEPAY_DETACHED_SZ, table, sizeof(table)) == 0);
+  vp8_depay_clear(&depay);
+  printf("\n");
+}
+
+/* The frames of the RTP packets depayloaded by rtpvp8depay, or NULL without the GStreamer plugins */
+static GPtrArray *
+rtpvp8depay_frames (GPtrArray * packets)
+{
+  GError * error = NULL;
+  GstElement * pipeline = gst_parse_launch("appsrc name=src format=time caps=\"application/x-rtp,media=(string)video,"
+    "encoding-name=(string)VP8,clock-rate=(int)90000,payload=(int)96\" ! rtpvp8depay ! appsink name=sink sync=false", &error);
+  GstFlowReturn ret;
+  GstSample * sample;
+  guint i;
+
+  if (!pipeline || error) {
+    g_clear_error(&error);
+    if (pipeline) {
+      gst_object_unref(pipeline);
+    }
+    return NULL;
+  }
+  GstElement * src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+  GstElement * sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+  GPtrArray * frames = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  for (i = 0; i < packets->len; i++) {
+    GBytes * packet = g_ptr_array_index(packets, i);
+    GstBuffer * buffer = gst_buffer_new_allocate(NULL, g_bytes_get_size(packet), NULL);
+    gst_buffer_fill(buffer, 0, g_bytes_get_data(packet, NULL), g_bytes_get_size(packet));
+    g_signal_emit_by_name(src, "push-buffer", buffer, &ret);
+    gst_buffer_unref(buffer);
+  }
+  g_signal_emit_by_name(src, "end-of-stream", &ret);
+  // pull-sample returns NULL at EOS
+  for (sample = NULL, g_signal_emit_by_name(sink, "pull-sample", &sample); sample; sample = NULL, g_signal_emit_by_name(sink, "pull-sample", &sample)) {
+    GstBuffer * buffer = gst_sample_get_buffer(sample);
+    gsize size = gst_buffer_get_size(buffer);
+    guint8 * data = g_malloc(size);
+    gst_buffer_extract(buffer, 0, data, size);
+    g_ptr_array_add(frames, g_bytes_new_take(data, size));
+    gst_sample_unref(sample);
+  }
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(src);
+  gst_object_unref(sink);
+  gst_object_unref(pipeline);
+  return frames;
+}
+
+void
+depay_test_005 (void)
+{
+  GPtrArray * packets = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+  GPtrArray * frames = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+  GPtrArray * expected;
+  guint8 frame[2000], packet[512], copy[2000];
+  guint32 random = 3;
+  guint16 seq = 65530;
+  Vp8Depay depay;
+  RtpPacket rtp;
+  guint i, f, offset;
+
+  printf("- VP8 depayloader against rtpvp8depay \n");
+  gst_init(NULL, NULL);
+
+  // 12 frames of 200 to 1267 bytes in 300 bytes packets, with 7 and 15 bits PictureIDs, across the seqnum wraparound
+  for (f = 0; f < 12; f++) {
+    guint len = 200 + f * 97;
+    offset = write_frame_tag(frame, f % 6 == 0, 40);
+    for (i = offset; i < len; i++) {
+      frame[i] = test_random(&random);
+    }
+    for (offset = 0; offset < len; offset += 300) {
+      guint n = MIN(300, len - offset);
+      guint8 shortId[] = { 0x90, 0x80, f };                                  // X, S, I, 7 bits PictureID
+      guint8 longId[] = { 0x90, 0xe0, 0x80, f, f, 0x40 };                    // X, S, I, L, T, 15 bits PictureID, TL0PICIDX, TID
+      guint8 * descriptor = f % 2 ? longId : shortId;
+      guint descriptorLen = f % 2 ? sizeof(longId) : sizeof(shortId);
+      if (offset > 0) {
+        descriptor[0] = f == 5 ? 0x91 : 0x80;                                // a second partition starts in the middle of frame 5
+      }
+      guint header = write_rtp_packet(packet, seq++, offset + n == len, descriptor, descriptorLen);
+      packet[4] = (f * 3000) >> 24;
+      packet[5] = (f * 3000) >> 16;
+      packet[6] = (f * 3000) >> 8;
+      packet[7] = (f * 3000) & 0xff;
+      memcpy(packet + header, frame + offset, n);
+      g_ptr_array_add(packets, g_bytes_new(packet, header + n));
+    }
+  }
+
+  vp8_depay_init(&depay);
+  for (i = 0; i < packets->len; i++) {
+    GBytes * bytes = g_ptr_array_index(packets, i);
+    rtp_packet_parse(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes), &rtp);
+    if (vp8_depay_push(&depay, &rtp)) {
+      guint len = vp8_frame_copy(&depay.frame, copy, sizeof(copy));
+      g_ptr_array_add(frames, g_bytes_new(copy, len));
+    }
+  }
+  vp8_depay_clear(&depay);
+  test_bool("Should depayload every frame", frames->len == 12);
+
+  expected = rtpvp8depay_frames(packets);
+  if (!expected) {
+    printf("rtpvp8depay not available, skipped\n\n");
+  } else {
+    gboolean same = expected->len == frames->len;
+    for (i = 0; same && i < frames->len; i++) {
+      same = g_bytes_equal(g_ptr_array_index(frames, i), g_ptr_array_index(expected, i));
+    }
+    test_bool("Should assemble the same frames as rtpvp8depay", same);
+    g_ptr_array_free(expected, TRUE);
+    printf("\n");
+  }
+  g_ptr_array_free(frames, TRUE);
+  g_ptr_array_free(packets, TRUE);
+}
+
+/* it pushes `frames` frames (2 packets each) round robin to 4 SSRCs, in batches like the realtime receiver */
+static void
+push_test_frames (NativeWorker * worker, const guint8 * frame, guint len, guint frames, guint16 * seqs)
+{
+  guint8 packets[32][1024];
+  UdpPacket batch[32];
+  guint i, count = 0;
+
+  for (i = 0; i < frames * 2; i++) {
+    guint ssrc = (i / 2) % 4;
+    gboolean first = i % 2 == 0;
+    guint8 descriptor = first ? 0x10 : 0x00; // S = 1 on the first packet
+    guint half = len / 2;
+    guint8 * out = packets[count];
+
+    guint n = write_rtp_packet(out, seqs[ssrc]++, !first, &descriptor, 1);
+    out[11] = ssrc;
+    memcpy(out + n, first ? frame : frame + half, first ? half : len - half);
+    batch[count].data = out;
+    batch[count].len = n + (first ? half : len - half);
+    batch[count].timestamp = 0;
+    if (++count == G_N_ELEMENTS(batch)) {
+      native_worker_push_batch(worker, batch, count, 0);
+      count = 0;
+    }
+  }
+  native_worker_push_batch(worker, batch, count, 0);
+}
+
+void
+allocation_test_001 (void)
+{
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  guint sizes[] = { 300, 400 };
+  guint8 frame[1024];
+  guint16 seqs[4] = { 100, 200, 300, 400 };
+  volatile sig_atomic_t closing = 0;
+  NativeWorker worker;
+  guint i;
+
+  printf("- Allocation-free hot path \n");
+  test_bool("Should create the temporary directory", mkdtemp(path) != NULL);
+  memset(frame, 0, sizeof(frame));
+  guint len = write_partitioned_frame(frame, 2, sizes);
+
+  // synchronous output: everything happens in this thread
+  OutputSettings output = { path, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_FULL, &output, FALSE, &closing };
+  native_worker_init(&worker, 0, &options);
+  push_test_frames(&worker, frame, len, 1000, seqs);
+  countAllocations = TRUE;
+  push_test_frames(&worker, frame, len, 100000, seqs);
+  countAllocations = FALSE;
+  test_bool("Should inspect every frame", worker.frames == 101000);
+  test_bool("Should not allocate while inspecting 100k frames", g_atomic_int_get(&allocations) == 0);
+  native_worker_clear(&worker);
+
+  // with the output writer thread, the inspecting thread only queues the results
+  output.writer = output_writer_new(1024, 100, 65536, TRUE);
+  output.format = OUTPUT_FORMAT_BINARY;
+  native_worker_init(&worker, 0, &options);
+  push_test_frames(&worker, frame, len, 1000, seqs);
+  countAllocations = TRUE;
+  push_test_frames(&worker, frame, len, 100000, seqs);
+  countAllocations = FALSE;
+  test_bool("Should not allocate while queueing 100k frames", g_atomic_int_get(&allocations) == 0);
+  native_worker_clear(&worker);
+  output_writer_stop(output.writer);
+  output.writer = NULL;
+
+  // removed streams come back from the pools
+  native_worker_init(&worker, 0, &options);
+  push_test_frames(&worker, frame, len, 4, seqs);
+  NativeStream * streams[4];
+  StreamInspector * inspectors[4];
+  for (i = 0; i < 4; i++) {
+    streams[i] = ssrc_table_lookup(&worker.streams, 0x0e533e00 + i);
+    inspectors[i] = streams[i]->streamInspector;
+  }
+  native_worker_expire(&worker, NATIVE_STREAM_TIMEOUT_MS * 1000 + 1);
+  test_bool("Should keep the removed streams", worker.streams.size == 0 && worker.poolSize == 4);
+  push_test_frames(&worker, frame, len, 1, seqs);
+  NativeStream * stream = ssrc_table_lookup(&worker.streams, 0x0e533e00);
+  gboolean reused = FALSE, reusedInspector = FALSE;
+  for (i = 0; i < 4; i++) {
+    reused = reused || stream == streams[i];
+    reusedInspector = reusedInspector || stream->streamInspector == inspectors[i];
+  }
+  test_bool("Should reuse a removed stream", reused && worker.poolSize == 3 && stream->depay.frame.slices != NULL);
+  test_bool("Should reuse a stream inspector", reusedInspector && stream->streamInspector->frameNumber == 1);
+  native_worker_clear(&worker);
+
+  for (i = 0; i < 4; i++) {
+    gchar * filename = g_strdup_printf("%s/%u.log", path, 0x0e533e00 + i);
+    unlink(filename);
+    g_free(filename);
+    filename = g_strdup_printf("%s/%u.bin", path, 0x0e533e00 + i);
+    unlink(filename);
+    g_free(filename);
+  }
+  rmdir(path);
+  printf("\n");
+}
+
+static void
+library_test_callback (guint32 ssrc, const FrameInfo * frame, gpointer userData)
+{
+  guint * frames = (guint *) userData;
+  if (ssrc == 0x0e533e5a && frame->ok && frame->frameNumber == *frames && frame->partitions == 2) {
+    (*frames)++;
+  }
+}
+
+void
+library_test_001 (void)
+{
+  guint sizes[] = { 300, 400 };
+  guint8 frame[1024];
+  guint8 packet[1024];
+  guint8 start = 0x10, middle = 0x00; // S = 1 on the first packet of the frame
+  guint frames = 0, completed = 0, i;
+  guint16 seq = 1000;
+
+  printf("- Library API \n");
+  memset(frame, 0, sizeof(frame));
+  guint len = write_partitioned_frame(frame, 2, sizes);
+  guint half = len / 2;
+
+  // RTP packets in, frames out through the callback
+  Vp8Inspect * ctx = vp8_inspect_new(96, VP8_PARSE_DEPTH_FULL);
+  vp8_inspect_set_callback(ctx, library_test_callback, &frames);
+  for (i = 0; i < 10; i++) {
+    guint n = write_rtp_packet(packet, seq++, FALSE, &start, 1);
+    memcpy(packet + n, frame, half);
+    completed += vp8_inspect_push_packet(ctx, packet, n + half, 0);
+    // the packet buffer is reused, the depayloader must not keep pointers to it
+    memset(packet, 0xff, sizeof(packet));
+    n = write_rtp_packet(packet, seq++, TRUE, &middle, 1);
+    memcpy(packet + n, frame + half, len - half);
+    completed += vp8_inspect_push_packet(ctx, packet, n + len - half, 0);
+  }
+  packet[1] = 97;
+  test_bool("Should ignore other payload types", !vp8_inspect_push_packet(ctx, packet, 100, 0));
+  test_bool("Should complete a frame every two packets", completed == 10);
+  test_bool("Should inspect every frame", frames == 10);
+  test_bool("Should not queue results with a callback", vp8_inspect_next(ctx) == NULL);
+  vp8_inspect_free(ctx);
+
+  // whole frames in, results out through the iterator
+  ctx = vp8_inspect_new(96, VP8_PARSE_DEPTH_REFERENCE);
+  vp8_inspect_push_frame(ctx, 1, frame, len, 0, 0);
+  vp8_inspect_push_frame(ctx, 2, frame, len, 1000, 0);
+  vp8_inspect_push_frame(ctx, 1, frame, len - sizes[1] - 1, 2000, 0);
+  const Vp8InspectResult * first = vp8_inspect_next(ctx);
+  const Vp8InspectResult * second = vp8_inspect_next(ctx);
+  const Vp8InspectResult * third = vp8_inspect_next(ctx);
+  test_bool("Should return the results in order", first && second && third && first->ssrc == 1 && second->ssrc == 2 && third->ssrc == 1);
+  test_bool("Should inspect the frames", first->frame.ok && first->frame.keyframe && second->frame.ok && second->frame.pts == 1000);
+  test_bool("Should number the frames per SSRC", second->frame.frameNumber == 0 && third->frame.frameNumber == 1);
+  test_bool("Should validate the partitions of whole frames", third->frame.error == VP8_CODEC_TRUNCATED_FRAME);
+  test_bool("Should be empty once read", vp8_inspect_next(ctx) == NULL && vp8_inspect_next(ctx) == NULL);
+  test_bool("Should remove a stream", vp8_inspect_remove_stream(ctx, 1) && !vp8_inspect_remove_stream(ctx, 1));
+  vp8_inspect_push_frame(ctx, 1, frame, len, 0, 0);
+  first = vp8_inspect_next(ctx);
+  test_bool("Should start a removed stream again", first && first->frame.frameNumber == 0);
+  vp8_inspect_free(ctx);
+  printf("\n");
+}
+
+static void
+demux_test_callback (guint32 ssrc, const FrameInfo * frame, gpointer userData)
+{
+  GArray * pts = (GArray *) userData;
+  g_array_append_val(pts, frame->pts);
+}
+
+void
+demux_test_001 (void)
+{
+  guint sizes[] = { 300, 400 };
+  guint8 frame[1024];
+  guint8 packet[1024];
+  guint8 start = 0x10; // S = 1
+  guint64 bufferPts[] = { 5 * GST_SECOND, 5 * GST_SECOND + 40 * GST_MSECOND, 5 * GST_SECOND + 70 * GST_MSECOND };
+  GArray * pts = g_array_new(FALSE, FALSE, sizeof(GstClockTime));
+  volatile sig_atomic_t closing = 0;
+  NativeWorker worker;
+  RtpPacket rtp;
+  guint i;
+
+  printf("- GStreamer pipeline demux \n");
+  memset(frame, 0, sizeof(frame));
+  guint len = write_partitioned_frame(frame, 2, sizes);
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL, demux_test_callback, pts };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  options.jitterBuffered = TRUE;
+
+  // single packet frames, all with the same RTP timestamp
+  native_worker_init(&worker, 0, &options);
+  for (i = 0; i < G_N_ELEMENTS(bufferPts); i++) {
+    guint n = write_rtp_packet(packet, 100 + i, TRUE, &start, 1);
+    memcpy(packet + n, frame, len);
+    rtp_packet_parse(packet, n + len, &rtp);
+    rtp.arrival = 0;
+    rtp.pts = bufferPts[i];
+    native_worker_push(&worker, &rtp);
+  }
+  native_worker_clear(&worker);
+  test_bool("Should take the frame PTS from the jitterbuffer", pts->len == 3 && g_array_index(pts, GstClockTime, 0) == 0
+    && g_array_index(pts, GstClockTime, 1) == 40 * GST_MSECOND && g_array_index(pts, GstClockTime, 2) == 70 * GST_MSECOND);
+  g_array_free(pts, TRUE);
+  printf("\n");
+}
+
+static gpointer
+daemon_test_run (Daemon * daemon)
+{
+  daemon_run(daemon);
+  return NULL;
+}
+
+void
+daemon_test_001 (void)
+{
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  guint8 start[] = { 0x10 }, frame[64] = { 0 };
+  guint8 packet[128];
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  GString * reply = g_string_new(NULL);
+  Daemon daemon;
+  UdpPacket udp = { packet, 0, 0 };
+
+  printf("- Daemon control commands \n");
+  test_bool("Should create the temporary directory", mkdtemp(path) != NULL);
+  gchar * streamPath = g_strdup_printf("%s/stream", path);
+  mkdir(streamPath, 0700);
+  output.outputPath = path;
+  daemon_init(&daemon, VP8_PARSE_DEPTH_REFERENCE, 8, &output, &closing);
+
+  test_bool("Should open a port", daemon_command(&daemon, "add-port 46321 97", reply) && g_strcmp0(reply->str, "ok\n") == 0);
+  test_bool("Should not open a port twice", !daemon_command(&daemon, "add-port 46321 96", reply));
+  test_bool("Should reject invalid payload types", !daemon_command(&daemon, "add-pt 46321 128", reply) && !daemon_command(&daemon, "add-pt 46321 x", reply));
+  test_bool("Should reject unknown commands", !daemon_command(&daemon, "restart", reply) && !daemon_command(&daemon, "", reply));
+  test_bool("Should add and remove payload types", daemon_command(&daemon, "add-pt 46321 96", reply) && daemon_command(&daemon, "remove-pt 46321 97", reply));
+  g_string_truncate(reply, 0);
+  daemon_command(&daemon, "ports", reply);
+  test_bool("Should list the ports", g_strcmp0(reply->str, "port 46321 pts 96 streams 0\nok\n") == 0);
+
+  // the packets of the port, as if they were received
+  DaemonPort * port = daemon_find_port(&daemon, 46321);
+  frame[0] = 0x10; frame[3] = 0x9d; frame[4] = 0x01; frame[5] = 0x2a;
+  udp.len = write_rtp_packet(packet, 1, TRUE, start, sizeof(start));
+  memcpy(packet + udp.len, frame, sizeof(frame));
+  udp.len += sizeof(frame);
+  native_worker_push_batch(&port->worker, &udp, 1, 0);
+  packet[1] = 0x80 | 97;
+  native_worker_push_batch(&port->worker, &udp, 1, 0);
+  test_bool("Should only inspect the payload types of the port", port->worker.frames == 1);
+
+  gchar command[128];
+  g_snprintf(command, sizeof(command), "output 240336474 %s", streamPath);
+  test_bool("Should set the output of a stream", daemon_command(&daemon, command, reply));
+  test_bool("Should set the output of a future stream", daemon_command(&daemon, "output 1234 stdout", reply));
+  test_bool("Should reject an invalid SSRC", !daemon_command(&daemon, "output 4294967296 stdout", reply));
+  g_string_truncate(reply, 0);
+  daemon_command(&daemon, "list", reply);
+  test_bool("Should list the streams", g_str_has_prefix(reply->str, "ssrc 240336474 port 46321 frames 1 output ") && g_str_has_suffix(reply->str, "/stream\nok\n"));
+
+  test_bool("Should close a port", daemon_command(&daemon, "remove-port 46321", reply) && daemon_find_port(&daemon, 46321) == NULL);
+  test_bool("Should not close a port twice", !daemon_command(&daemon, "remove-port 46321", reply));
+  daemon_clear(&daemon);
+
+  gchar * filename = g_strdup_printf("%s/240336474.log", path);
+  test_bool("Should write the first frames to the default output", access(filename, F_OK) == 0);
+  unlink(filename);
+  g_free(filename);
+  filename = g_strdup_printf("%s/240336474.log", streamPath);
+  test_bool("Should move the stream to its output", access(filename, F_OK) == 0);
+  unlink(filename);
+  g_free(filename);
+  rmdir(streamPath);
+  rmdir(path);
+  g_free(streamPath);
+
+  // a gap is given up after the latency, even if no packet comes after it
+  GArray * pts = g_array_new(FALSE, FALSE, sizeof(GstClockTime));
+  OutputSettings callbackOutput = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL, demux_test_callback, pts };
+  daemon_init(&daemon, VP8_PARSE_DEPTH_REFERENCE, 8, &callbackOutput, &closing);
+  daemon.reorderWindow = 4;
+  daemon.reorderLatencyMs = 20;
+  daemon_command(&daemon, "add-port 46321 96", reply);
+  port = daemon_find_port(&daemon, 46321);
+  packet[1] = 0x80 | 96;
+  udp.timestamp = (guint64) g_get_real_time() * 1000;
+  native_worker_push_batch(&port->worker, &udp, 1, g_get_monotonic_time());
+  packet[3] = 3;  // seq 2 is lost
+  native_worker_push_batch(&port->worker, &udp, 1, g_get_monotonic_time());
+  test_bool("Should hold the packet after the gap", port->worker.frames == 1 && port->worker.holding->len == 1);
+  GThread * thread = g_thread_new("daemon", (GThreadFunc) daemon_test_run, &daemon);
+  g_usleep(200000);
+  closing = 1;
+  g_thread_join(thread);
+  closing = 0;
+  test_bool("Should release the held packet after the latency", port->worker.frames == 2 && port->worker.holding->len == 0);
+  daemon_clear(&daemon);
+  g_array_free(pts, TRUE);
+
+  output.targets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  daemon_init(&daemon, VP8_PARSE_DEPTH_REFERENCE, 8, &output, &closing);
+  daemon_command(&daemon, "output 1234 stdout", reply);
+  daemon_clear(&daemon);
+  test_bool("Should keep the targets it did not create", output.targets != NULL && g_hash_table_size(output.targets) == 1);
+  g_hash_table_destroy(output.targets);
+  g_string_free(reply, TRUE);
+  printf("\n");
+}
+
+void
+depay_test_003 (void)
+{
+  Vp8Depay depay;
+  RtpPacket rtp = { 0 };
+  guint8 packets[12][16];
+  guint8 data[8] = { 0 };
+  guint8 start[] = { 0x90, 0x80, 0x7f };
+  guint8 middle[] = { 0x80, 0x80, 0x7f };
+  guint completed = 0;
+  guint16 seq = 100;
+
+  printf("- VP8 depayloader with lost packets and PictureID wraparound \n");
+  vp8_depay_init(&depay);
+
+  // PictureID 127: 3 packets, the middle one is lost
+  rtp.seq = seq++;
+  push_vp8_packet(&depay, &rtp, packets[0], start, 3, data, sizeof(data), FALSE);
+  completed += vp8_depay_push(&depay, &rtp);
+  seq++;
+  rtp.seq = seq++;
+  push_vp8_packet(&depay, &rtp, packets[1], middle, 3, data, sizeof(data), TRUE);
+  completed += vp8_depay_push(&depay, &rtp);
+  test_bool("Should drop the frame with a lost middle packet", completed == 0 && depay.droppedFrames == 1);
+
+  // PictureID 0 (wraparound): a complete frame
+  start[2] = middle[2] = 0x00;
+  rtp.seq = seq++;
+  push_vp8_packet(&depay, &rtp, packets[2], start, 3, data, sizeof(data), FALSE);
+  completed += vp8_depay_push(&depay, &rtp);
+  rtp.seq = seq++;
+  push_vp8_packet(&depay, &rtp, packets[3], middle, 3, data, sizeof(data), TRUE);
+  completed += vp8_depay_push(&depay, &rtp);
+  test_bool("Should complete the frame after the PictureID wraparound", completed == 1 && depay.frame.size == 16);
+  test_bool("Should not count the wraparound as loss", depay.lostPictures == 0);
+
+  // PictureID 3: frames 1 and 2 were lost completely
+  start[2] = 0x03;
+  rtp.seq = seq += 4;
+  push_vp8_packet(&depay, &rtp, packets[4], start, 3, data, sizeof(data), TRUE);
+  completed += vp8_depay_push(&depay, &rtp);
+  test_bool("Should complete the single packet frame", completed == 2 && depay.frame.numSlices == 1);
+  test_bool("Should count the lost pictures", depay.lostPictures == 2);
+
+  // A frame without the marker bit followed by a new frame
+  start[2] = 0x04;
+  rtp.seq = ++seq;
+  push_vp8_packet(&depay, &rtp, packets[5], start, 3, data, sizeof(data), FALSE);
+  completed += vp8_depay_push(&depay, &rtp);
+  start[2] = 0x05;
+  rtp.seq = ++seq;
+  push_vp8_packet(&depay, &rtp, packets[6], start, 3, data, sizeof(data), TRUE);
+  completed += vp8_depay_push(&depay, &rtp);
+  test_bool("Should drop the frame without marker and complete the next one", completed == 3 && depay.droppedFrames == 2);
+  test_bool("Should start the new frame from its first packet", depay.frame.slices[0].data == packets[6] + 3);
+
+  // Packets before the first S bit are ignored
+  rtp.seq = seq += 10;
+  push_vp8_packet(&depay, &rtp, packets[7], middle, 3, data, sizeof(data), TRUE);
+  test_bool("Should ignore packets until a frame starts", !vp8_depay_push(&depay, &rtp));
+  vp8_depay_clear(&depay);
+  printf("\n");
+}
+
+typedef struct
+{
+  OutputWriter * writer;
+  OutputTarget * target;
+  guint frames;
+} WriterProducer;
+
+static gpointer
+writer_producer_run (gpointer data)
+{
+  WriterProducer * producer = (WriterProducer *) data;
+  OutputRecord record;
+  FrameInfo frame;
+  guint i;
+
+  memset(&record, 0, sizeof(record));
+  memset(&frame, 0, sizeof(frame));
+  record.type = OUTPUT_RECORD_FRAME;
+  record.target = producer->target;
+  for (i = 0; i < producer->frames; i++) {
+    frame.ok = TRUE;
+    frame.frameNumber = i;
+    frame.pts = (GstClockTime) i * GST_MSECOND;
+    frame_record_encode(record.frame, producer->target->ssrcId, &frame);
+    output_writer_push(producer->writer, &record);
+  }
+  output_writer_close_target(producer->writer, producer->target);
+  return NULL;
+}
+
+static guint
+count_lines (const gchar * filename, gchar * last, gsize size)
+{
+  FILE * f = fopen(filename, "r");
+  gchar line[OUTPUT_WRITER_LINE_SZ];
+  guint lines = 0;
+
+  if (!f) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    g_strlcpy(last, line, size);
+    lines++;
+  }
+  fclose(f);
+  return lines;
+}
+
+void
+output_writer_test_001 (void)
+{
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  gchar last[OUTPUT_WRITER_LINE_SZ];
+  WriterProducer producers[2];
+  GThread * threads[2];
+  gchar expected[OUTPUT_WRITER_LINE_SZ];
+  FrameInfo frame;
+  guint i;
+
+  printf("- Output writer \n");
+  test_bool("Should create the temporary directory", mkdtemp(path) != NULL);
+
+  // a tiny ring, so the producers really wait for the writer
+  OutputWriter * writer = output_writer_new(8, 1000, 1 << 20, TRUE);
+  for (i = 0; i < 2; i++) {
+    gchar ssrc[16];
+    g_snprintf(ssrc, sizeof(ssrc), "%u", 1000 + i);
+    producers[i].writer = writer;
+    producers[i].target = output_target_open(ssrc, path, FALSE, OUTPUT_FORMAT_TEXT, FALSE);
+    producers[i].frames = 5000;
+    threads[i] = g_thread_new("producer", writer_producer_run, &producers[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    g_thread_join(threads[i]);
+  }
+  output_writer_stop(writer);
+
+  memset(&frame, 0, sizeof(frame));
+  frame.ok = TRUE;
+  frame.frameNumber = 4999;
+  frame.pts = (GstClockTime) 4999 * GST_MSECOND;
+  for (i = 0; i < 2; i++) {
+    gchar ssrc[16];
+    g_snprintf(ssrc, sizeof(ssrc), "%u", 1000 + i);
+    gchar * filename = g_strdup_printf("%s/%s.log", path, ssrc);
+    format_frame_info(expected, sizeof(expected), ssrc, &frame);
+    test_bool("Should write every record when the ring is full", count_lines(filename, last, sizeof(last)) == 5000);
+    test_bool("Should write the records in order", strcmp(last, expected) == 0);
+    unlink(filename);
+    g_free(filename);
+  }
+  rmdir(path);
+  printf("\n");
+}
+
+void
+frame_record_test_001 (void)
+{
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  FrameRecordReader reader;
+  FrameInfo frame, decoded;
+  guint32 ssrc;
+  guint i;
+
+  printf("- Binary frame records \n");
+  test_bool("Should create the temporary directory", mkdtemp(path) != NULL);
+
+  memset(&frame, 0, sizeof(frame));
+  frame.ok = TRUE;
+  frame.keyframe = TRUE;
+  frame.showFrame = TRUE;
+  frame.refreshAltrefFrame = TRUE;
+  frame.version = 2;
+  frame.partSize = 12484;
+  frame.resolution.width = 1280;
+  frame.resolution.height = 720;
+  frame.resolution.widthScale = 1;
+  frame.size = 40000;
+  frame.arrival = G_GUINT64_CONSTANT(1700000000123456789);
+  frame.parseDepth = VP8_PARSE_DEPTH_FULL;
+  frame.clampingType = 1;
+  frame.partitions = 8;
+  frame.quantizer.yAcQi = 127;
+  frame.quantizer.uvAcDelta = -15;
+  frame.loopFilter.level = 63;
+  frame.loopFilter.deltaEnabled = TRUE;
+  frame.loopFilter.modeDelta[3] = -63;
+  frame.segmentation.enabled = TRUE;
+  frame.segmentation.absoluteDelta = TRUE;
+  frame.segmentation.quantizer[2] = -127;
+  frame.segmentation.treeProbs[2] = 255;
+  frame.refreshEntropyProbs = TRUE;
+  frame.refreshLast = TRUE;
+  frame.copyBufferToAltref = 2;
+  frame.probs.coeffUpdates = 1056;
+  frame.probs.intraChromaUpdate = TRUE;
+  frame.probs.intraChromaProbs[1] = 77;
+  frame.probs.mvUpdates = 38;
+
+  OutputTarget * target = output_target_open("4294967295", path, FALSE, OUTPUT_FORMAT_BINARY, FALSE);
+  for (i = 0; i < 3; i++) {
+    frame.frameNumber = i;
+    frame.pts = (GstClockTime) i * 33 * GST_MSECOND;
+    output_target_write(target, &frame);
+  }
+  output_target_close(target);
+
+  gchar * filename = g_strdup_printf("%s/4294967295.bin", path);
+  test_bool("Should open the record file", frame_record_reader_open(&reader, filename) == FRAME_RECORD_OK);
+  test_bool("Should read the header", reader.version == FRAME_RECORD_VERSION && reader.recordSize == FRAME_RECORD_SZ);
+  test_bool("Should count the records", frame_record_reader_count(&reader) == 3);
+  for (i = 0; frame_record_reader_next(&reader, &ssrc, &decoded); i++) {
+    frame.frameNumber = i;
+    frame.pts = (GstClockTime) i * 33 * GST_MSECOND;
+    test_bool("Should decode every field", ssrc == 4294967295u && memcmp(&frame, &decoded, sizeof(frame)) == 0);
+  }
+  test_bool("Should read all records", i == 3);
+  frame_record_reader_close(&reader);
+
+  // a record file from a killed writer
+  test_bool("Should truncate the file", truncate(filename, FRAME_RECORD_HEADER_SZ + FRAME_RECORD_SZ + 7) == 0);
+  test_bool("Should open the truncated file", frame_record_reader_open(&reader, filename) == FRAME_RECORD_OK);
+  test_bool("Should ignore the truncated last record", frame_record_reader_count(&reader) == 1 && frame_record_reader_get(&reader, 1) == NULL);
+  frame_record_reader_close(&reader);
+
+  unlink(filename);
+  g_free(filename);
+  rmdir(path);
+  printf("\n");
+}
+
+void
+bool_decoder_test_001 (void)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  guint8 * pages = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  guint32 state = 42;
+  gboolean same = TRUE, inside = TRUE;
+  guint stream, i;
+
+  printf("- Word-at-a-time bool decoder \n");
+  // the input ends right before a protected page, reading past it would crash
+  test_bool("Should protect the page after the input", pages != MAP_FAILED && mprotect(pages + page, page, PROT_NONE) == 0);
+
+  for (stream = 0; stream < 20000 && same; stream++) {
+    guint len = test_random(&state) % (stream < 1000 ? 16 : 256);
+    guint8 * data = pages + page - len;
+    struct bool_decoder fast;
+    struct ref_bool_decoder ref;
+
+    for (i = 0; i < len; i++) {
+      data[i] = test_random(&state);
+    }
+    // some streams with long runs of 0x00 and 0xff
+    if (stream % 7 == 0 && len > 4) {
+      memset(data + len / 2, stream % 14 ? 0xff : 0x00, len / 4);
+    }
+
+    init_bool_decoder(&fast, data, len);
+    ref_init_bool_decoder(&ref, data, len);
+
+    // read past the end of the input, both should shift in zeros
+    for (i = 0; i < len * 8 + 64 && same; i++) {
+      guint op = test_random(&state) % 8;
+      if (op == 0) {
+        guint bits = 1 + test_random(&state) % 8;
+        same = bool_get_uint(&fast, bits) == ref_bool_get_uint(&ref, bits);
+      } else if (op == 1) {
+        guint bits = 1 + test_random(&state) % 7;
+        same = bool_maybe_get_int(&fast, bits) == ref_bool_maybe_get_int(&ref, bits);
+      } else {
+        int probability = test_random(&state) % 256;
+        same = bool_get(&fast, probability) == ref_bool_get(&ref, probability);
+      }
+      inside = inside && fast.input <= data + len;
+    }
+  }
+
+  test_bool("Should decode the same bools as the reference decoder", same);
+  test_bool("Should never read past the input", inside);
+  munmap(pages, 2 * page);
+  printf("\n");
+}
+
+void
+ssrc_table_test_001 (void)
+{
+  SsrcTable table;
+  guint32 state = 7, ssrcs[4096];
+  gboolean found = TRUE, removed = TRUE;
+  guint i, seen = 0;
+
+  printf("- SSRC table \n");
+  ssrc_table_init(&table);
+  // consecutive SSRCs and random ones
+  for (i = 0; i < 4096; i++) {
+    ssrcs[i] = i < 2048 ? 0x0e533e00 + i : test_random(&state) << 8 | i;
+    ssrc_table_insert(&table, ssrcs[i], GUINT_TO_POINTER(i + 1));
+  }
+  for (i = 0; i < 4096; i++) {
+    found = found && ssrc_table_lookup(&table, ssrcs[i]) == GUINT_TO_POINTER(i + 1);
+  }
+  test_bool("Should find every SSRC", found && table.size == 4096 && table.capacity >= 8192);
+  test_bool("Should not find a missing SSRC", ssrc_table_lookup(&table, 0x0e533e00 + 2048) == NULL);
+
+  for (i = 0; i < 4096; i += 2) {
+    removed = removed && ssrc_table_remove(&table, ssrcs[i]) == GUINT_TO_POINTER(i + 1);
+  }
+  found = TRUE;
+  for (i = 0; i < 4096; i++) {
+    found = found && ssrc_table_lookup(&table, ssrcs[i]) == (i % 2 ? GUINT_TO_POINTER(i + 1) : NULL);
+  }
+  test_bool("Should remove half of the SSRCs", removed && table.size == 2048);
+  test_bool("Should still find the other ones", found);
+  test_bool("Should not remove a missing SSRC", ssrc_table_remove(&table, ssrcs[0]) == NULL);
+
+  // removing while walking the slots, like native_worker_expire()
+  i = 0;
+  while (i < table.capacity) {
+    if (table.slots[i].value && GPOINTER_TO_UINT(table.slots[i].value) % 4 == 0) {
+      ssrc_table_remove_slot(&table, i);
+      seen++;
+      continue;
+    }
+    i++;
+  }
+  found = TRUE;
+  for (i = 1; i < 4096; i += 2) {
+    found = found && ssrc_table_lookup(&table, ssrcs[i]) == ((i + 1) % 4 ? GUINT_TO_POINTER(i + 1) : NULL);
+  }
+  test_bool("Should remove the slots while walking them", seen == 1024 && table.size == 1024 && found);
+  ssrc_table_clear(&table);
+  printf("\n");
+}
+
+typedef struct
+{
+  guint16 seqs[32];
+  gboolean held[32];
+  guint count;
+} ReorderTestOutput;
+
+static void
+reorder_test_emit (const RtpPacket * rtp, gboolean held, gpointer userData)
+{
+  ReorderTestOutput * out = (ReorderTestOutput *) userData;
+  if (out->count < G_N_ELEMENTS(out->seqs) && rtp->payloadLen == 1 && rtp->payload[0] == (guint8) rtp->seq) {
+    out->seqs[out->count] = rtp->seq;
+    out->held[out->count++] = held;
+  }
+}
+
+static void
+reorder_test_push (RtpReorder * reorder, guint16 seq, guint64 arrival, ReorderTestOutput * out)
+{
+  guint8 payload = (guint8) seq;
+  RtpPacket rtp = { TRUE, 96, seq, 0, 1, &payload, 1, arrival };
+  rtp_reorder_push(reorder, &rtp, reorder_test_emit, out);
+  // the payload is gone after the push, like the receiver buffers
+  payload = 0xff;
+}
+
+static void
+reorder_test_frames (NativeWorker * worker, const guint8 * frame, guint len, guint frames, guint16 * seq, gint64 age)
+{
+  guint8 packets[3][1024];
+  guint8 start = 0x10, middle = 0x00; // S = 1 on the first packet of the frame
+  guint third = len / 3;
+  UdpPacket batch[3];
+  guint64 arrival = (guint64) (g_get_real_time() - age) * 1000;
+  guint i, n;
+
+  // the last two packets of each frame are swapped, the last one comes in the next batch
+  for (i = 0; i < frames; i++, *seq += 3) {
+    n = write_rtp_packet(packets[0], *seq, FALSE, &start, 1);
+    memcpy(packets[0] + n, frame, third);
+    batch[0] = (UdpPacket) { packets[0], n + third, arrival };
+    n = write_rtp_packet(packets[1], *seq + 2, TRUE, &middle, 1);
+    memcpy(packets[1] + n, frame + 2 * third, len - 2 * third);
+    batch[1] = (UdpPacket) { packets[1], n + len - 2 * third, arrival };
+    native_worker_push_batch(worker, batch, 2, 0);
+
+    memset(packets, 0xff, sizeof(packets));
+    n = write_rtp_packet(packets[0], *seq + 1, FALSE, &middle, 1);
+    memcpy(packets[0] + n, frame + third, third);
+    batch[0] = (UdpPacket) { packets[0], n + third, arrival };
+    native_worker_push_batch(worker, batch, age ? 0 : 1, 0);
+  }
+}
+
+void
+reorder_test_001 (void)
+{
+  ReorderTestOutput out;
+  RtpReorderPool pool;
+  RtpReorder reorder;
+  guint sizes[] = { 300, 400 };
+  guint8 frame[1024];
+  guint frames = 0;
+  guint16 seq = 1000;
+  volatile sig_atomic_t closing = 0;
+  NativeWorker worker;
+  guint i;
+
+  printf("- Reorder window \n");
+  memset(&out, 0, sizeof(out));
+  rtp_reorder_pool_init(&pool);
+  rtp_reorder_init(&reorder, 3, 1000, &pool);
+  test_bool("Should round the window up to a power of two", reorder.window == 4);
+  reorder_test_push(&reorder, 10, 0, &out);
+  reorder_test_push(&reorder, 12, 0, &out);
+  test_bool("Should hold a packet after a gap", out.count == 1 && reorder.held == 1);
+  reorder_test_push(&reorder, 11, 0, &out);
+  test_bool("Should emit the held packet once the gap is filled", out.count == 3 && out.seqs[1] == 11 && out.seqs[2] == 12 && out.held[2] && !out.held[1]);
+
+  reorder_test_push(&reorder, 14, 100, &out);
+  rtp_reorder_expire(&reorder, 1099, reorder_test_emit, &out);
+  test_bool("Should wait for the latency", out.count == 3);
+  rtp_reorder_expire(&reorder, 1100, reorder_test_emit, &out);
+  test_bool("Should give up the gap after the latency", out.count == 4 && out.seqs[3] == 14);
+  reorder_test_push(&reorder, 13, 1200, &out);
+  test_bool("Should drop the packets that come too late", out.count == 4 && reorder.late == 1);
+
+  reorder_test_push(&reorder, 16, 1200, &out);
+  reorder_test_push(&reorder, 21, 1200, &out);
+  test_bool("Should give up the gaps when the window is full", out.count == 5 && out.seqs[4] == 16 && reorder.held == 1);
+  reorder_test_push(&reorder, 21, 1200, &out);
+  test_bool("Should drop the duplicated packets", reorder.late == 2);
+  reorder_test_push(&reorder, 18, 1200, &out);
+  reorder_test_push(&reorder, 20, 1200, &out);
+  reorder_test_push(&reorder, 19, 1200, &out);
+  test_bool("Should emit in order", out.count == 9 && out.seqs[5] == 18 && out.seqs[6] == 19 && out.seqs[7] == 20 && out.seqs[8] == 21);
+  reorder_test_push(&reorder, 23, 1200, &out);
+  rtp_reorder_flush(&reorder, reorder_test_emit, &out);
+  test_bool("Should flush the held packets", out.count == 10 && out.seqs[9] == 23 && reorder.held == 0 && reorder.reordered == 6);
+  reorder_test_push(&reorder, 60000, 1200, &out);
+  test_bool("Should follow a sender restart", out.count == 11 && out.seqs[10] == 60000);
+  test_bool("Should only allocate the payloads of the packets held at once", pool.allocated == 2);
+  rtp_reorder_clear(&reorder);
+  rtp_reorder_pool_clear(&pool);
+
+  memset(frame, 0, sizeof(frame));
+  guint len = write_partitioned_frame(frame, 2, sizes);
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL, library_test_callback, &frames };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_FULL, &output, FALSE, &closing };
+
+  // without a window the swapped packets drop the frames
+  native_worker_init(&worker, 0, &options);
+  reorder_test_frames(&worker, frame, len, 10, &seq, 0);
+  NativeStream * stream = ssrc_table_lookup(&worker.streams, 0x0e533e5a);
+  test_bool("Should drop the reordered frames without a window", worker.frames == 0 && stream->depay.droppedFrames == 10);
+  native_worker_clear(&worker);
+
+  options.reorderWindow = 8;
+  options.reorderLatencyMs = 50;
+  native_worker_init(&worker, 0, &options);
+  reorder_test_frames(&worker, frame, len, 10, &seq, 0);
+  test_bool("Should inspect the reordered frames with a window", worker.frames == 10 && frames == 10);
+
+  // the missing packet is older than the latency at the end of the batch
+  reorder_test_frames(&worker, frame, len, 1, &seq, 100000);
+  stream = ssrc_table_lookup(&worker.streams, 0x0e533e5a);
+  test_bool("Should report the lost packet instead of waiting for it", worker.holding->len == 0 && stream->depay.lostPackets == 1 && worker.frames == 10);
+  for (i = 0; i < 2; i++) {
+    reorder_test_frames(&worker, frame, len, 1, &seq, 0);
+  }
+  test_bool("Should go on after the loss", worker.frames == 12);
+  native_worker_clear(&worker);
+  printf("\n");
+}
+
+void
+latency_histogram_test_001 (void)
+{
+  LatencyHistogram histogram;
+  guint64 value;
+
+  printf("- Latency histogram \n");
+  latency_histogram_reset(&histogram);
+  test_bool("Should be empty", latency_histogram_percentile(&histogram, 50) == 0);
+  for (value = 1; value <= 100000; value++) {
+    latency_histogram_record(&histogram, value * 1000);
+  }
+  value = latency_histogram_percentile(&histogram, 50);
+  test_bool("Should get the median within 1/32", value >= 50000000 && value <= 50000000 + 50000000 / 32);
+  value = latency_histogram_percentile(&histogram, 99.9);
+  test_bool("Should get the p99.9 within 1/32", value >= 99900000 && value <= 99900000 + 99900000 / 32);
+  test_bool("Should keep the max", histogram.max == 100000000 && latency_histogram_percentile(&histogram, 100) == 100000000);
+  latency_histogram_reset(&histogram);
+  latency_histogram_record(&histogram, 7);
+  test_bool("Should count small values exactly", latency_histogram_percentile(&histogram, 50) == 7);
+  latency_histogram_record(&histogram, G_MAXUINT64);
+  test_bool("Should clamp huge values", histogram.max == LATENCY_HISTOGRAM_MAX_VALUE && histogram.total == 2);
+  printf("\n");
+}
+
+static gboolean
+metrics_test_has (const gchar * text, const gchar * line)
+{
+  gchar * needle = g_strdup_printf("\n%s\n", line);
+  gboolean found = strstr(text, needle) != NULL;
+  g_free(needle);
+  return found;
+}
+
+static void
+metrics_test_001 (void)
+{
+  guint sizes[] = { 300, 400 };
+  guint8 frame[1024];
+  gchar path[64], response[65536];
+  struct sockaddr_un address;
+  MetricsServer server;
+  GString * text = g_string_new(NULL);
+  gssize len, received = 0;
+  int fd;
+
+  printf("- Metrics \n");
+  memset(frame, 0, sizeof(frame));
+  guint frameLen = write_partitioned_frame(frame, 2, sizes);
+
+  Vp8Inspect * ctx = vp8_inspect_new(96, VP8_PARSE_DEPTH_REFERENCE);
+  vp8_inspect_push_frame(ctx, 77, frame, frameLen, 0, 0);
+  vp8_inspect_push_frame(ctx, 77, frame, frameLen - sizes[1] - 1, 1000, 0);
+  frame[6] ^= 0x01; // another width
+  vp8_inspect_push_frame(ctx, 77, frame, frameLen, 2000, 0);
+  vp8_inspect_push_frame(ctx, 78, frame, frameLen, 0, 0);
+
+  metrics_format(text);
+  test_bool("Should count the frames per SSRC", metrics_test_has(text->str, "vp8_inspector_stream_frames_total{ssrc=\"77\"} 3") &&
+    metrics_test_has(text->str, "vp8_inspector_stream_frames_total{ssrc=\"78\"} 1"));
+  test_bool("Should count the corrupt frames", metrics_test_has(text->str, "vp8_inspector_stream_corrupt_frames_total{ssrc=\"77\"} 1"));
+  test_bool("Should count the keyframes and refreshes", metrics_test_has(text->str, "vp8_inspector_stream_keyframes_total{ssrc=\"77\"} 3") &&
+    metrics_test_has(text->str, "vp8_inspector_stream_golden_refreshes_total{ssrc=\"77\"} 3"));
+  test_bool("Should count the resolution changes", metrics_test_has(text->str, "vp8_inspector_stream_resolution_changes_total{ssrc=\"77\"} 1") &&
+    metrics_test_has(text->str, "vp8_inspector_stream_resolution_changes_total{ssrc=\"78\"} 0"));
+  g_string_truncate(text, 0);
+
+  vp8_inspect_remove_stream(ctx, 77);
+  metrics_format(text);
+  test_bool("Should forget the removed streams", strstr(text->str, "{ssrc=\"77\"}") == NULL &&
+    metrics_test_has(text->str, "vp8_inspector_stream_frames_total{ssrc=\"78\"} 1"));
+
+  g_snprintf(path, sizeof(path), "/tmp/inspector-metrics-%i.sock", getpid());
+  test_bool("Should reject a bad port", metrics_server_start(&server, "localhost:http") == METRICS_ERROR_ADDRESS);
+  test_bool("Should serve the metrics", metrics_server_start(&server, path) == METRICS_OK);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  g_strlcpy(address.sun_path, path, sizeof(address.sun_path));
+  if (connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0) {
+    const gchar * request = "GET /metrics HTTP/1.0\r\n\r\n";
+    send(fd, request, strlen(request), 0);
+    while ((len = recv(fd, response + received, sizeof(response) - 1 - received, 0)) > 0) {
+      received += len;
+    }
+  }
+  response[received] = '\0';
+  close(fd);
+  test_bool("Should answer over HTTP", g_str_has_prefix(response, "HTTP/1.0 200 OK\r\n") &&
+    metrics_test_has(response, "vp8_inspector_stream_frames_total{ssrc=\"78\"} 1"));
+  metrics_server_stop(&server);
+  test_bool("Should remove the socket", access(path, F_OK) != 0 && server.scrapes == 1);
+
+  vp8_inspect_free(ctx);
+  g_string_free(text, TRUE);
+  printf("\n");
+}
+
+/* A capture with one keyframe of SSRC 240336474 */
+static void
+write_batch_test_file (const gchar * path)
+{
+  guint8 file[512];
+  guint size = sizeof(pcapHeader);
+  FILE * f = fopen(path, "w");
+
+  memcpy(file, pcapHeader, sizeof(pcapHeader));
+  size += write_rtp_record(file + size, 0, 240336474, 0, 3000, FALSE, first, sizeof(first));
+  size += write_rtp_record(file + size, 10, 240336474, 1, 3000, TRUE, second, sizeof(second));
+  if (f) {
+    fwrite(file, 1, size, f);
+    fclose(f);
+  }
+}
+
+void
+batch_test_001 (void)
+{
+  gchar folder[] = "/tmp/vp8-inspector-test-XXXXXX";
+  gchar last[OUTPUT_WRITER_LINE_SZ];
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  BatchPool pool = { &options, &output, 0, 0, 1024, &closing };
+  BatchSummary summary;
+  GPtrArray * paths = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray * compressedPaths = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray * tasks;
+  const gchar * files[] = { "y.pcap", "x.pcap", "sub/x.pcap", "notes.txt" };
+  const gchar * folders[] = { "out/x", "out/x-2", "out/y", "out", "sub", "" };
+  gchar * path;
+  gchar * data;
+  gsize len;
+  gzFile gz;
+  guint i;
+
+  printf("- Batch mode \n");
+  test_bool("Should create the temporary folder", mkdtemp(folder) != NULL);
+  path = g_strdup_printf("%s/sub", folder);
+  mkdir(path, 0755);
+  g_free(path);
+  for (i = 0; i < G_N_ELEMENTS(files); i++) {
+    path = g_strdup_printf("%s/%s", folder, files[i]);
+    write_batch_test_file(path);
+    g_free(path);
+  }
+  test_bool("Should find the PCAP files of the folder", batch_collect(folder, paths) == BATCH_OK && paths->len == 2 &&
+    g_str_has_suffix(g_ptr_array_index(paths, 0), "/x.pcap") && g_str_has_suffix(g_ptr_array_index(paths, 1), "/y.pcap"));
+  path = g_strdup_printf("%s/*/*.pcap", folder);
+  test_bool("Should find the files of a glob", batch_collect(path, paths) == BATCH_OK && paths->len == 3);
+  g_free(path);
+  path = g_strdup_printf("%s/none-*.pcap", folder);
+  test_bool("Should fail without files", batch_collect(path, paths) == BATCH_ERROR_NO_FILES && paths->len == 3);
+  g_free(path);
+
+  tasks = batch_plan(paths, NULL, 16, 4);
+  test_bool("Should split the big files in chunks", tasks->len == 12 && ((BatchTask *) g_ptr_array_index(tasks, 0))->chunks == 4);
+  g_ptr_array_free(tasks, TRUE);
+
+  // each chunk of a compressed file would decompress all of it
+  test_bool("Should read the capture", g_file_get_contents(g_ptr_array_index(paths, 0), &data, &len, NULL));
+  path = g_strdup_printf("%s/z.pcap.gz", folder);
+  gz = gzopen(path, "wb");
+  test_bool("Should compress the capture", gz != NULL && gzwrite(gz, data, len) == (int) len && gzclose(gz) == Z_OK);
+  g_ptr_array_add(compressedPaths, path);
+  tasks = batch_plan(compressedPaths, NULL, 16, 4);
+  test_bool("Should not split the compressed files", tasks->len == 1 && ((BatchTask *) g_ptr_array_index(tasks, 0))->chunks == 1 &&
+    ((BatchTask *) g_ptr_array_index(tasks, 0))->size > 16);
+  batch_run(&pool, tasks, 2, &summary);
+  test_bool("Should inspect the compressed files", summary.files == 1 && summary.failed == 0 && summary.frames == 1);
+  g_ptr_array_free(tasks, TRUE);
+  unlink(path);
+  g_ptr_array_free(compressedPaths, TRUE);
+  g_free(data);
+
+  path = g_strdup_printf("%s/out", folder);
+  tasks = batch_plan(paths, path, 0, 4);
+  g_free(path);
+  test_bool("Should make a task per file", tasks->len == 3);
+  batch_run(&pool, tasks, 2, &summary);
+  test_bool("Should inspect every file", summary.files == 3 && summary.tasks == 3 && summary.failed == 0 && summary.frames == 3);
+
+  path = g_strdup_printf("%s/out/x/240336474.log", folder);
+  test_bool("Should write the results of a file to its folder", count_lines(path, last, sizeof(last)) == 1 && strstr(last, "width: 320, height: 240"));
+  g_free(path);
+  path = g_strdup_printf("%s/out/x-2/240336474.log", folder);
+  test_bool("Should not mix files with the same name", count_lines(path, last, sizeof(last)) == 1);
+  g_free(path);
+  path = g_strdup_printf("%s/out/y/240336474.log", folder);
+  test_bool("Should write the results of every file", count_lines(path, last, sizeof(last)) == 1);
+  g_free(path);
+
+  for (i = 0; i < G_N_ELEMENTS(files); i++) {
+    path = g_strdup_printf("%s/%s", folder, files[i]);
+    unlink(path);
+    g_free(path);
+  }
+  for (i = 0; i < G_N_ELEMENTS(folders); i++) {
+    path = g_strdup_printf("%s/%s/240336474.log", folder, folders[i]);
+    unlink(path);
+    g_free(path);
+    path = g_strdup_printf("%s/%s", folder, folders[i]);
+    rmdir(path);
+    g_free(path);
+  }
+  g_ptr_array_free(tasks, TRUE);
+  g_ptr_array_free(paths, TRUE);
+  printf("\n");
+}
+
+void
+frame_index_test_001 (void)
+{
+  guint8 file[1024];
+  guint8 wider[] = { 0x10, 0b00010000, 0b00000001, 0b00000000, 0x9d, 0x01, 0x2a, 0x80, 0x02 }; // keyframe, 640 wide
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  GString * frames = g_string_new(NULL);
+  FrameIndexWriter writer;
+  FrameIndexQuery query;
+  FrameIndexQueryStats stats;
+  FrameIndex index;
+  NativeWorker worker;
+  PcapReader reader;
+  PcapPacket packet;
+  RtpPacket rtpPacket;
+  guint size = sizeof(pcapHeader);
+  gchar * indexPath;
+
+  printf("- Frame index \n");
+  memcpy(file, pcapHeader, sizeof(pcapHeader));
+  size += write_rtp_record(file + size, 0, 240336474, 0, 3000, FALSE, first, sizeof(first));
+  size += write_rtp_record(file + size, 10, 240336474, 1, 3000, TRUE, second, sizeof(second));
+  // the first packet of the interframe arrives after its second packet, which is duplicated
+  size += write_rtp_record(file + size, 20, 240336474, 3, 6000, TRUE, second, sizeof(second));
+  size += write_rtp_record(file + size, 25, 240336474, 3, 6000, TRUE, second, sizeof(second));
+  size += write_rtp_record(file + size, 30, 240336474, 2, 6000, FALSE, inter, sizeof(inter));
+  size += write_rtp_record(file + size, 40, 240336474, 4, 9000, FALSE, wider, sizeof(wider));
+  size += write_rtp_record(file + size, 50, 240336474, 5, 9000, TRUE, second, sizeof(second));
+  int fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  indexPath = frame_index_path(path);
+
+  test_bool("Should not find an index", frame_index_load(&index, path, 96) == FRAME_INDEX_ERROR_OPEN);
+  test_bool("Should start the index", frame_index_writer_open(&writer, path, 96) == FRAME_INDEX_OK);
+  options.index = &writer;
+  options.reorderWindow = 4;
+  options.reorderLatencyMs = 1000;
+  native_worker_init(&worker, 0, &options);
+  pcap_reader_open(&reader, path);
+  while (pcap_reader_next(&reader, &packet)) {
+    rtp_packet_parse(packet.payload, packet.payloadLen, &rtpPacket);
+    rtpPacket.arrival = packet.timestamp;
+    rtpPacket.offset = packet.offset;
+    native_worker_push(&worker, &rtpPacket);
+  }
+  native_worker_flush(&worker);
+  native_worker_clear(&worker);
+  pcap_reader_close(&reader);
+  test_bool("Should write the index", frame_index_writer_close(&writer, TRUE) == FRAME_INDEX_OK && access(indexPath, F_OK) == 0);
+
+  test_bool("Should load the index", frame_index_load(&index, path, 96) == FRAME_INDEX_OK && index.header->entries == 3);
+  test_bool("Should index the frames", index.entries[0].ssrc == 240336474 && index.entries[0].flags == (FRAME_INDEX_KEYFRAME | FRAME_INDEX_SHOW) &&
+    index.entries[1].frameNumber == 1 && index.entries[1].flags == FRAME_INDEX_SHOW && index.entries[1].width == 320 &&
+    index.entries[2].flags == (FRAME_INDEX_KEYFRAME | FRAME_INDEX_SHOW | FRAME_INDEX_RESOLUTION_CHANGE) && index.entries[2].width == 640);
+  test_bool("Should keep the lowest offset of a frame", index.entries[1].offset < index.entries[2].offset &&
+    index.entries[0].offset == 24 && index.entries[1].offset == 24 + (16 + 42 + 12 + 9) + (16 + 42 + 12 + 12));
+  test_bool("Should keep the capture time", index.header->firstArrival == 1000000000 && index.entries[2].arrival == 1000040000);
+
+  test_bool("Should parse a query", frame_index_query_parse("ssrc=0x0e533e5a, keyframes, frames=1-, from=+0.00002, to=00:00:01.5", &query) &&
+    query.hasSsrc && query.ssrc == 240336474 && query.flags == FRAME_INDEX_KEYFRAME && query.firstFrame == 1 && query.lastFrame == G_MAXUINT &&
+    query.from.kind == FRAME_INDEX_TIME_RELATIVE && query.to.kind == FRAME_INDEX_TIME_OF_DAY);
+  test_bool("Should reject an invalid query", !frame_index_query_parse("frames=2-1", &query) && !frame_index_query_parse("ssrc", &query) &&
+    !frame_index_query_parse("from=25:00", &query) && !frame_index_query_parse("to=+", &query) && !frame_index_query_parse("keyframes=1", &query));
+  frame_index_query_parse("from=1.00001,to=+0.00003", &query);
+  frame_index_query_resolve(&index, &query);
+  test_bool("Should match by capture time", !frame_index_query_match(&query, &index.entries[0]) &&
+    frame_index_query_match(&query, &index.entries[1]) && !frame_index_query_match(&query, &index.entries[2]));
+
+  output.callback = frames_test_callback;
+  output.userData = frames;
+  frame_index_query_parse("frames=1-", &query);
+  test_bool("Should run a query", frame_index_query_run(&index, path, &query, VP8_PARSE_DEPTH_REFERENCE, &output, &stats) == FRAME_INDEX_OK &&
+    stats.entries == 3 && stats.matched == 2 && stats.inspected == 2);
+  test_bool("Should inspect only the frames of the query, like the whole inspection", g_strcmp0(frames->str, "240336474:1:0:320 240336474:2:1:640 ") == 0);
+  g_string_truncate(frames, 0);
+  frame_index_query_parse("changes", &query);
+  frame_index_query_run(&index, path, &query, VP8_PARSE_DEPTH_REFERENCE, &output, &stats);
+  test_bool("Should find the resolution changes", g_strcmp0(frames->str, "240336474:2:1:640 ") == 0 && stats.packets == 2);
+  frame_index_free(&index);
+
+  test_bool("Should be stale for another payload type", frame_index_load(&index, path, 97) == FRAME_INDEX_ERROR_STALE);
+  fd = open(path, O_WRONLY | O_APPEND);
+  test_bool("Should grow the capture", fd >= 0 && write(fd, pcapHeader, 4) == 4);
+  close(fd);
+  test_bool("Should be stale when the capture changes", frame_index_load(&index, path, 96) == FRAME_INDEX_ERROR_STALE);
+
+  unlink(indexPath);
+  unlink(path);
+  g_free(indexPath);
+  g_string_free(frames, TRUE);
+  printf("\n");
+}
+
+static void
+append_follow_test_file (const gchar * path, const guint8 * data, guint len)
+{
+  FILE * f = fopen(path, "a");
+  if (f) {
+    fwrite(data, 1, len, f);
+    fclose(f);
+  }
+}
+
+void
+follow_test_001 (void)
+{
+  guint8 file[1024];
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  volatile sig_atomic_t closing = 0;
+  GString * frames = g_string_new(NULL);
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL, frames_test_callback, frames };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  Follower follower;
+  guint size = sizeof(pcapHeader), start, checkpoint;
+  gchar * checkpointPath;
+
+  printf("- Follow mode \n");
+  memcpy(file, pcapHeader, sizeof(pcapHeader));
+  size += write_rtp_record(file + size, 0, 240336474, 0, 3000, FALSE, first, sizeof(first));
+  size += write_rtp_record(file + size, 10, 240336474, 1, 3000, TRUE, second, sizeof(second));
+  size += write_rtp_record(file + size, 20, 1234, 0, 3000, FALSE, first, sizeof(first));
+  size += write_rtp_record(file + size, 30, 240336474, 2, 6000, FALSE, inter, sizeof(inter));
+  size += write_rtp_record(file + size, 40, 240336474, 3, 6000, TRUE, second, sizeof(second));
+  int fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  checkpointPath = follow_checkpoint_path(path);
+
+  test_bool("Should open the capture", follow_open(&follower, path, &options) == FOLLOW_OK && !follower.output.append);
+  test_bool("Should read the capture", follow_read(&follower) == 5 && g_strcmp0(frames->str, "240336474:0:1:320 240336474:1:0:320 ") == 0);
+  test_bool("Should wait for the appended packets", follow_read(&follower) == 0);
+
+  // the rest of the pending frame of SSRC 1234 and half a record of a third frame of 240336474
+  start = size;
+  size += write_rtp_record(file + size, 50, 1234, 1, 3000, TRUE, second, sizeof(second));
+  checkpoint = size;
+  size += write_rtp_record(file + size, 60, 240336474, 4, 9000, FALSE, inter, sizeof(inter));
+  append_follow_test_file(path, file + start, size - start - 20);
+  g_string_truncate(frames, 0);
+  test_bool("Should keep the state of the streams across reads", follow_read(&follower) == 1 && g_strcmp0(frames->str, "1234:0:1:320 ") == 0);
+  test_bool("Should write a checkpoint", follow_checkpoint(&follower) == FOLLOW_OK && access(checkpointPath, F_OK) == 0);
+  follow_close(&follower);
+
+  append_follow_test_file(path, file + size - 20, 20);
+  start = size;
+  size += write_rtp_record(file + size, 70, 240336474, 5, 9000, TRUE, second, sizeof(second));
+  append_follow_test_file(path, file + start, size - start);
+  g_string_truncate(frames, 0);
+  test_bool("Should resume from the checkpoint", follow_open(&follower, path, &options) == FOLLOW_OK && follower.output.append &&
+    follower.reader.offset == checkpoint);
+  test_bool("Should only inspect the frames after the checkpoint", follow_read(&follower) == 2 && follower.skipped == 0 &&
+    g_strcmp0(frames->str, "240336474:2:0:320 ") == 0);
+  follow_checkpoint(&follower);
+  follow_close(&follower);
+
+  // a checkpoint in the middle of a frame, the packets of the other streams are read again but skipped
+  start = size;
+  size += write_rtp_record(file + size, 80, 240336474, 6, 12000, FALSE, inter, sizeof(inter));
+  size += write_rtp_record(file + size, 90, 1234, 2, 6000, FALSE, inter, sizeof(inter));
+  size += write_rtp_record(file + size, 100, 1234, 3, 6000, TRUE, second, sizeof(second));
+  append_follow_test_file(path, file + start, size - start);
+  g_string_truncate(frames, 0);
+  follow_open(&follower, path, &options);
+  test_bool("Should inspect the frames that were completed", follow_read(&follower) == 3 && g_strcmp0(frames->str, "1234:1:0:320 ") == 0);
+  follow_checkpoint(&follower);
+  follow_close(&follower);
+  start = size;
+  size += write_rtp_record(file + size, 110, 240336474, 7, 12000, TRUE, second, sizeof(second));
+  append_follow_test_file(path, file + start, size - start);
+  g_string_truncate(frames, 0);
+  follow_open(&follower, path, &options);
+  test_bool("Should complete a frame pending at the checkpoint", follow_read(&follower) == 4 && follower.skipped == 2 &&
+    g_strcmp0(frames->str, "240336474:3:0:320 ") == 0);
+  follow_close(&follower);
+
+  options.payloadType = 97;
+  test_bool("Should not resume another payload type", follow_open(&follower, path, &options) == FOLLOW_OK && !follower.output.append &&
+    follower.reader.offset == PCAP_GLOBAL_HEADER_SZ);
+  follow_close(&follower);
+  unlink(checkpointPath);
+  unlink(path);
+  g_free(checkpointPath);
+
+  // truncated in place (copytruncate) while a frame is pending, then written again from the start
+  options.payloadType = 96;
+  size = sizeof(pcapHeader);
+  size += write_rtp_record(file + size, 0, 1234, 0, 3000, FALSE, first, sizeof(first));
+  strcpy(path, "/tmp/vp8-inspector-test-XXXXXX");
+  fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  checkpointPath = follow_checkpoint_path(path);
+  g_string_truncate(frames, 0);
+  follow_open(&follower, path, &options);
+  test_bool("Should keep the frame pending", follow_read(&follower) == 1 && frames->len == 0);
+  test_bool("Should not read a truncated capture", truncate(path, 0) == 0 && follow_read(&follower) == 0);
+  test_bool("Should reopen a truncated capture", follow_check_file(&follower) && follower.reopens == 1 && !follow_check_file(&follower));
+  size = sizeof(pcapHeader);
+  size += write_rtp_record(file + size, 0, 1234, 1, 6000, FALSE, first, sizeof(first));
+  size += write_rtp_record(file + size, 10, 1234, 2, 6000, TRUE, second, sizeof(second));
+  append_follow_test_file(path, file, size);
+  test_bool("Should drop the pending frame and follow the new capture", follow_read(&follower) == 2 &&
+    g_strcmp0(frames->str, "1234:0:1:320 ") == 0);
+  follow_close(&follower);
+  unlink(checkpointPath);
+  unlink(path);
+  g_free(checkpointPath);
+
+  // SSRC 1234 stops sending, 240336474 goes on for longer than the stream timeout
+  FollowCheckpointHeader header = { { 0 } };
+  size = sizeof(pcapHeader);
+  size += write_rtp_record(file + size, 0, 1234, 0, 3000, TRUE, first, sizeof(first));
+  size += write_rtp_record(file + size, 0, 240336474, 0, 3000, TRUE, first, sizeof(first));
+  size += write_rtp_record(file + size, NATIVE_STREAM_TIMEOUT_MS * 1000 + 1000, 240336474, 1, 6000, TRUE, second, sizeof(second));
+  strcpy(path, "/tmp/vp8-inspector-test-XXXXXX");
+  fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  checkpointPath = follow_checkpoint_path(path);
+  follow_open(&follower, path, &options);
+  test_bool("Should expire the idle streams by the capture time", follow_read(&follower) == 3 &&
+    ssrc_table_lookup(&follower.worker.streams, 1234) == NULL && ssrc_table_lookup(&follower.worker.streams, 240336474) != NULL);
+  follow_checkpoint(&follower);
+  follow_close(&follower);
+  FILE * f = fopen(checkpointPath, "r");
+  test_bool("Should leave the expired streams out of the checkpoint", f && fread(&header, sizeof(header), 1, f) == 1 && header.streams == 1);
+  if (f) {
+    fclose(f);
+  }
+  unlink(checkpointPath);
+  unlink(path);
+  g_free(checkpointPath);
+  g_string_free(frames, TRUE);
+  printf("\n");
+}
+
+typedef struct
+{
+  NativeWorker worker;
+  guint64 packets;
+  guint64 checksum;   /* of the packet offsets and sizes */
+  guint releases;
+  GString * frames;
+} PcapStreamTestRun;
+
+static void
+pcap_stream_test_release (gpointer data)
+{
+  PcapStreamTestRun * run = (PcapStreamTestRun *) data;
+  run->releases++;
+  native_worker_detach(&run->worker);
+}
+
+static guint
+pcap_stream_test_read (const gchar * path, PcapStreamTestRun * run)
+{
+  volatile sig_atomic_t closing = 0;
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL, frames_test_callback, run->frames };
+  NativeOptions options = { 96, VP8_PARSE_DEPTH_REFERENCE, &output, FALSE, &closing };
+  PcapReader reader;
+  PcapPacket packet;
+  RtpPacket rtp;
+  guint res = pcap_reader_open(&reader, path);
+
+  if (res != PCAP_OK) {
+    return res;
+  }
+  native_worker_init(&run->worker, 0, &options);
+  reader.release = pcap_stream_test_release;
+  reader.releaseData = run;
+  while (pcap_reader_next(&reader, &packet)) {
+    run->packets++;
+    run->checksum = run->checksum * 31 + packet.offset + packet.payloadLen;
+    if (rtp_packet_parse(packet.payload, packet.payloadLen, &rtp)) {
+      native_worker_push(&run->worker, &rtp);
+    }
+  }
+  native_worker_flush(&run->worker);
+  native_worker_clear(&run->worker);
+  pcap_reader_close(&reader);
+  return PCAP_OK;
+}
+
+void
+pcap_stream_test_001 (void)
+{
+  guint8 longSecond[80] = { 0x00, 0xf0, 0x00 }; // 240 high, and a partition bigger than the records of the other tests
+  guint numFrames = 25000;  // more blocks than the ring, so the blocks are reused
+  guint8 * file = g_malloc(sizeof(pcapHeader) + numFrames * 2 * 256);
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  gchar * gzipPath;
+  PcapStreamTestRun plain = { 0 }, compressed = { 0 }, truncated = { 0 };
+  gzFile gz;
+  guint size = sizeof(pcapHeader), i;
+  struct stat st;
+
+  printf("- Compressed captures \n");
+  memcpy(file, pcapHeader, sizeof(pcapHeader));
+  for (i = 0; i < numFrames; i++) {
+    size += write_rtp_record(file + size, i, 240336474, 2 * i, 3000 * (i + 1), FALSE, first, sizeof(first));
+    size += write_rtp_record(file + size, i, 240336474, 2 * i + 1, 3000 * (i + 1), TRUE, longSecond, sizeof(longSecond));
+  }
+  int fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  gzipPath = g_strconcat(path, ".gz", NULL);
+  gz = gzopen(gzipPath, "wb");
+  test_bool("Should compress the capture", gz != NULL && gzwrite(gz, file, size) == (int) size && gzclose(gz) == Z_OK);
+  test_bool("Should be bigger than the decompressed blocks", size > PCAP_STREAM_BLOCKS * PCAP_STREAM_BLOCK_SZ);
+
+  plain.frames = g_string_new(NULL);
+  compressed.frames = g_string_new(NULL);
+  truncated.frames = g_string_new(NULL);
+  test_bool("Should detect the compression", pcap_file_compression(gzipPath) == PCAP_COMPRESSION_GZIP && pcap_file_compression(path) == PCAP_COMPRESSION_NONE);
+  test_bool("Should read the captures", pcap_stream_test_read(path, &plain) == PCAP_OK && pcap_stream_test_read(gzipPath, &compressed) == PCAP_OK);
+  test_bool("Should read the same packets at the same offsets", plain.packets == 2 * numFrames && compressed.packets == plain.packets && compressed.checksum == plain.checksum);
+  test_bool("Should assemble the frames split between two blocks", compressed.worker.frames == numFrames && g_strcmp0(compressed.frames->str, plain.frames->str) == 0);
+  test_bool("Should release the blocks", plain.releases == 0 && compressed.releases > PCAP_STREAM_BLOCKS);
+
+  // a capture cut in the middle of its compressed data ends at its last whole record
+  stat(gzipPath, &st);
+  test_bool("Should cut the compressed capture", truncate(gzipPath, st.st_size / 2) == 0);
+  test_bool("Should read the truncated capture", pcap_stream_test_read(gzipPath, &truncated) == PCAP_OK);
+  test_bool("Should read its first packets", truncated.packets > 0 && truncated.packets < plain.packets && truncated.worker.frames >= truncated.packets / 2 - 1);
+
+  g_string_free(plain.frames, TRUE);
+  g_string_free(compressed.frames, TRUE);
+  g_string_free(truncated.frames, TRUE);
+  unlink(gzipPath);
+  unlink(path);
+  g_free(gzipPath);
+  g_free(file);
+  printf("\n");
+}
+
+/* It runs ./out/inspector on a capture, with the results in `outputPath` */
+static gboolean
+run_test_inspector (const gchar * path, const gchar * outputPath, gboolean native)
+{
+  gchar * file = g_strdup_printf("--file=%s", path);
+  gchar * output = g_strdup_printf("--outputPath=%s", outputPath);
+  gchar * gstreamer[] = { "./out/inspector", file, "--payloadType=96", output, NULL };
+  gchar * nativeEngine[] = { "./out/inspector", "--native", file, "--payloadType=96", output, NULL };
+  gint status = -1;
+  gboolean spawned = g_spawn_sync(NULL, native ? nativeEngine : gstreamer, NULL, G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+    NULL, NULL, NULL, NULL, &status, NULL);
+
+  g_free(file);
+  g_free(output);
+  return spawned && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void
+engines_test_001 (void)
+{
+  guint8 * file = g_malloc(sizeof(pcapHeader) + 2 * 90 * 2 * 128);
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  gchar folder[] = "/tmp/vp8-inspector-test-XXXXXX";
+  guint32 ssrcs[] = { 240336474, 1234 };
+  guint16 seqs[] = { 65500, 0 };
+  guint32 random = 7;
+  guint size = sizeof(pcapHeader), i, j;
+  gchar * outputs[2];
+
+  printf("- GStreamer and native engines \n");
+  if (!g_file_test("./out/inspector", G_FILE_TEST_IS_EXECUTABLE)) {
+    printf("./out/inspector not built, skipped\n\n");
+    g_free(file);
+    return;
+  }
+
+  // 2 streams of 90 frames at 30 fps, up to 20ms of jitter and a frame in 5 with its packets swapped
+  memcpy(file, pcapHeader, sizeof(pcapHeader));
+  for (i = 0; i < 90; i++) {
+    for (j = 0; j < G_N_ELEMENTS(ssrcs); j++) {
+      guint arrival = i * 33333 + j * 1000 + test_random(&random) % 20000;
+      const guint8 * start = i % 30 == 0 ? first : inter;
+      guint startLen = i % 30 == 0 ? sizeof(first) : sizeof(inter);
+      guint16 seq = seqs[j];
+      seqs[j] += 2;
+      if (i % 5 == 3) {
+        size += write_rtp_record(file + size, arrival, ssrcs[j], seq + 1, 3000 * i, TRUE, second, sizeof(second));
+        size += write_rtp_record(file + size, arrival + 500, ssrcs[j], seq, 3000 * i, FALSE, start, startLen);
+      } else {
+        size += write_rtp_record(file + size, arrival, ssrcs[j], seq, 3000 * i, FALSE, start, startLen);
+        size += write_rtp_record(file + size, arrival + 500, ssrcs[j], seq + 1, 3000 * i, TRUE, second, sizeof(second));
+      }
+    }
+  }
+  int fd = mkstemp(path);
+  test_bool("Should create the temporary file", fd >= 0 && write(fd, file, size) == size);
+  close(fd);
+  test_bool("Should create the temporary folder", mkdtemp(folder) != NULL);
+  outputs[0] = g_strdup_printf("%s/gstreamer", folder);
+  outputs[1] = g_strdup_printf("%s/native", folder);
+  mkdir(outputs[0], 0755);
+  mkdir(outputs[1], 0755);
+
+  test_bool("Should inspect the capture with GStreamer", run_test_inspector(path, outputs[0], FALSE));
+  test_bool("Should inspect the capture with the native engine", run_test_inspector(path, outputs[1], TRUE));
+  for (j = 0; j < G_N_ELEMENTS(ssrcs); j++) {
+    gchar * results[2] = { NULL, NULL };
+    for (i = 0; i < 2; i++) {
+      gchar * filename = g_strdup_printf("%s/%u.log", outputs[i], ssrcs[j]);
+      g_file_get_contents(filename, &results[i], NULL, NULL);
+      unlink(filename);
+      g_free(filename);
+    }
+    test_bool("Should write the same results, PTS included", results[0] && results[1] && g_strcmp0(results[0], results[1]) == 0);
+    test_bool("Should inspect every frame, the reordered ones included", results[1] && strstr(results[1], "frame: 89, pts: 2966,") != NULL);
+    g_free(results[0]);
+    g_free(results[1]);
+  }
+
+  for (i = 0; i < 2; i++) {
+    rmdir(outputs[i]);
+    g_free(outputs[i]);
+  }
+  rmdir(folder);
+  unlink(path);
+  g_free(file);
+  printf("\n");
+}
+
+void
+aggregate_test_001 (void)
+{
+  guint8 keyframe[] = { 0b00010000, 0b00000001, 0b00000000, 0x9d, 0x01, 0x2a, 0x40, 0x01, 0xf0, 0x00 }; // 320x240
+  guint8 interframe[] = { 0b00010001, 0b00000001, 0b00000000, 0, 0, 0, 0, 0, 0, 0 };
+  gchar path[] = "/tmp/vp8-inspector-test-XXXXXX";
+  gchar line[OUTPUT_WRITER_LINE_SZ];
+  OutputSettings output = { NULL, FALSE, OUTPUT_FORMAT_TEXT, NULL };
+  StreamInspector * streamInspector;
+  AggregateWindow window;
+  Aggregator aggregator;
+  FrameInfo frame;
+  gchar * filename, * contents = NULL, ** lines;
+  guint i, ended = 0;
+
+  printf("- Aggregated results \n");
+  aggregator_init(&aggregator, GST_SECOND);
+  memset(&frame, 0, sizeof(frame));
+  frame.ok = TRUE;
+  frame.showFrame = TRUE;
+  frame.size = 1000;
+  frame.resolution.width = 320;
+  frame.resolution.height = 240;
+  // 25 fps, a keyframe every 10 frames, a hidden and a corrupt frame in the first second
+  for (i = 0; i < 50; i++) {
+    frame.pts = (guint64) i * 40 * GST_MSECOND;
+    frame.keyframe = i % 10 == 0;
+    frame.showFrame = i != 3;
+    frame.ok = i != 7;
+    frame.refreshGoldenFrame = frame.keyframe;
+    if (aggregator_add(&aggregator, &frame, FALSE, &window)) {
+      ended++;
+      test_bool("Should end the first window with the first frame after it", i == 25 && window.start == 0 && window.duration == GST_SECOND);
+      test_bool("Should count the frames of the window", window.frames == 25 && window.bytes == 25000 && window.keyframes == 3 &&
+        window.hiddenFrames == 1 && window.corruptFrames == 1 && window.goldenRefreshes == 3);
+      test_bool("Should get the keyframe interval", window.keyframeIntervals == 2 && window.keyframeIntervalSum == 800 * GST_MSECOND);
+      format_aggregate_window(line, sizeof(line), "1234", &window);
+      test_bool("Should format the window", g_str_has_prefix(line, "ssrc: 1234, window: 0, duration: 1000, frames: 25, fps: 25.00, kbps: 200.0, keyframes: 3, keyframeInterval: 400, hidden: 0.040"));
+    }
+  }
+  test_bool("Should keep the window until a frame is after it", ended == 1 && aggregator.window.frames == 25);
+
+  // after a pause of 3 seconds, the next window is still aligned on the first one
+  frame.pts = 4100 * GST_MSECOND;
+  frame.keyframe = FALSE;
+  test_bool("Should skip the windows without frames", aggregator_add(&aggregator, &frame, FALSE, &window) &&
+    window.start == GST_SECOND && aggregator.window.start == 4 * GST_SECOND && aggregator.window.frames == 1);
+  frame.pts = 4140 * GST_MSECOND;
+  aggregator_add(&aggregator, &frame, TRUE, &window);
+  test_bool("Should end the last window at its last frame", aggregator_finish(&aggregator, &window) && window.frames == 2 &&
+    window.duration == 180 * GST_MSECOND && window.resolutionChanges == 1);
+  test_bool("Should not end an empty window", !aggregator_finish(&aggregator, &window));
+
+  // only the keyframes and the corrupt frames still get a line
+  test_bool("Should create the temporary directory", mkdtemp(path) != NULL);
+  output.outputPath = path;
+  output.aggregateInterval = 1;
+  streamInspector = stream_inspector_initialize("recv_rtp_src_0_1234_96", VP8_PARSE_DEPTH_TAG, &output);
+  for (i = 0; i < 50; i++) {
+    gboolean key = i % 25 == 0;
+    inspect_frame_info(streamInspector, key ? keyframe : interframe, key ? sizeof(keyframe) : sizeof(interframe), NULL, 0, 100,
+      (GstClockTime) i * 40 * GST_MSECOND, 0);
+  }
+  stream_inspector_destroy(streamInspector);
+  filename = g_strdup_printf("%s/1234.log", path);
+  g_file_get_contents(filename, &contents, NULL, NULL);
+  lines = g_strsplit(contents ? contents : "", "\n", 0);
+  test_bool("Should write the keyframes and a line per window", g_strv_length(lines) == 5 && g_str_has_prefix(lines[0], "ssrc: 1234, frame: 0,") &&
+    g_str_has_prefix(lines[1], "ssrc: 1234, window: 0, duration: 1000, frames: 25, fps: 25.00, kbps: 20.0, keyframes: 1,") &&
+    g_str_has_prefix(lines[2], "ssrc: 1234, frame: 25,") &&
+    g_str_has_prefix(lines[3], "ssrc: 1234, window: 1000, duration: 1000, frames: 25, fps: 25.00, kbps: 20.0, keyframes: 1, keyframeInterval: 1000,"));
+  g_strfreev(lines);
+  g_free(contents);
+  unlink(filename);
+  rmdir(path);
+  g_free(filename);
+  printf("\n");
+}
+
+#ifndef INSPECTOR_NO_STATS
+static void
+stage_stats_test_001 (void)
+{
+  StageTimes times = { { 1000000, 2000000, 5000000, 6000000, 6500000, 10000000 } };
+  StageTimes offline = { { 0, 0, 5000000, 6000000, 6500000, 10000000 } };
+  StageTimes taken;
+  StageStats stats;
+  StageStream * stream;
+  guint64 value;
+
+  printf("- Stage stats \n");
+  stage_stats_init(&stats);
+  stage_stats_record(&stats, 42, &times);
+  stage_stats_record(&stats, 42, &offline);
+  stream = stage_stats_lookup(&stats, 42);
+  test_bool("Should create the stream on its first frame", stream != NULL && stats.streams.size == 1);
+  test_bool("Should record every stage", stream->intervals[STAGE_INTERVAL_PARSE].total == 2 && stream->intervals[STAGE_INTERVAL_OUTPUT].total == 2);
+  test_bool("Should skip the stages without receive time", stream->intervals[STAGE_INTERVAL_JITTER].total == 1 && stream->intervals[STAGE_INTERVAL_TOTAL].total == 1);
+  value = stage_histogram_percentile(&stream->intervals[STAGE_INTERVAL_DEPAY], 50);
+  test_bool("Should get the stage latency within 1/8", value >= 3000000 && value <= 3000000 + 3000000 / 8);
+  test_bool("Should keep the max", stream->intervals[STAGE_INTERVAL_TOTAL].max == 9000000);
+  test_bool("Should name the stages", g_strcmp0(stage_interval_name(STAGE_INTERVAL_HANDOFF), "handoff") == 0);
+
+  stage_stats_close(&stats, 42);
+  test_bool("Should dump the closed stream once", stage_stats_dump(&stats, "test") == 1 && stage_stats_lookup(&stats, 42) == NULL);
+  test_bool("Should dump nothing after", stage_stats_dump(&stats, "test") == 0);
+  stage_stats_clear(&stats);
+
+  stage_stats_enable();
+  STAGE_STATS_SET(STAGE_RECEIVE, 1);
+  STAGE_STATS_MARK(STAGE_PARSE_END);
+  memset(&taken, 0, sizeof(taken));
+  STAGE_STATS_TAKE(taken);
+  test_bool("Should take the stamps of the frame", taken.at[STAGE_RECEIVE] == 1 && taken.at[STAGE_PARSE_END] > 0);
+  memset(&taken, 0, sizeof(taken));
+  STAGE_STATS_TAKE(taken);
+  test_bool("Should start the next frame without stamps", taken.at[STAGE_RECEIVE] == 0 && taken.at[STAGE_PARSE_END] == 0);
+  printf("\n");
+}
+
+void
+perf_counters_test_001 (void)
+{
+  PerfFrame frame;
+  PerfSample before, after;
+  StageStats stats;
+  StageStream * stream;
+  volatile guint i, sum = 0;
+
+  printf("- Performance counters \n");
+  stage_stats_init(&stats);
+  memset(&frame, 0, sizeof(frame));
+  frame.stages[PERF_STAGE_TAG].value[PERF_COUNTER_CYCLES] = 100;
+  frame.stages[PERF_STAGE_HEADER].value[PERF_COUNTER_INSTRUCTIONS] = 2000;
+  frame.measured = (1 << PERF_STAGE_TAG) | (1 << PERF_STAGE_HEADER);
+  stage_stats_record_perf(&stats, 7, &frame);
+  frame.measured = 1 << PERF_STAGE_TAG;
+  stage_stats_record_perf(&stats, 7, &frame);
+  stream = stage_stats_lookup(&stats, 7);
+  test_bool("Should count the frames measured in each stage", stream != NULL && stream->perfFrames[PERF_STAGE_TAG] == 2
+    && stream->perfFrames[PERF_STAGE_HEADER] == 1 && stream->perfFrames[PERF_STAGE_OUTPUT] == 0);
+  test_bool("Should add up the counters of the stages measured", stream->perf[PERF_STAGE_TAG].value[PERF_COUNTER_CYCLES] == 200
+    && stream->perf[PERF_STAGE_HEADER].value[PERF_COUNTER_INSTRUCTIONS] == 2000);
+  test_bool("Should name the stages and the counters", g_strcmp0(perf_stage_name(PERF_STAGE_HEADER), "header") == 0
+    && g_strcmp0(perf_counter_name(PERF_COUNTER_BRANCH_MISSES), "branch-misses") == 0);
+  stage_stats_clear(&stats);
+
+  /* without a PMU (most VMs and containers) there is nothing else to check */
+  if (!perf_counters_read(&before)) {
+    printf("Performance counters not available, skipped\n\n");
+    return;
+  }
+  for (i = 0; i < 100000; i++) {
+    sum += i;
+  }
+  test_bool("Should count the cycles of this thread", perf_counters_read(&after) && after.value[PERF_COUNTER_CYCLES] > before.value[PERF_COUNTER_CYCLES]);
+  printf("\n");
+}
+#endif
+
 int
 main (int argc, char *argv[]) 
 {
@@ -149,5 +2454,36 @@ main (int argc, char *argv[])
   frame_header_test_003();
   frame_header_test_004();
   frame_header_test_005();
+  frame_header_test_006();
+  frame_header_test_007();
+  frame_header_test_008();
+  bool_decoder_test_001();
+  pcap_test_001();
+  rtp_test_001();
+  depay_test_001();
+  depay_test_002();
+  depay_test_003();
+  depay_test_004();
+  depay_test_005();
+  ssrc_table_test_001();
+  output_writer_test_001();
+  frame_record_test_001();
+  allocation_test_001();
+  library_test_001();
+  demux_test_001();
+  daemon_test_001();
+  reorder_test_001();
+  latency_histogram_test_001();
+  metrics_test_001();
+  batch_test_001();
+  frame_index_test_001();
+  follow_test_001();
+  pcap_stream_test_001();
+  engines_test_001();
+  aggregate_test_001();
+#ifndef INSPECTOR_NO_STATS
+  stage_stats_test_001();
+  perf_counters_test_001();
+#endif
   return 0;
 }
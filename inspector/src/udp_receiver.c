@@ -0,0 +1,207 @@
+/**
+ *
+ * A batched UDP receiver used by the native engine in realtime mode.
+ *
+ * Instead of one syscall and one buffer allocation per packet (udpsrc), we
+ * read up to batchSize packets per recvmmsg() call into a packet pool that is
+ * allocated once and reused by every batch. So the packets returned by
+ * udp_receiver_receive() are only valid until the next call.
+ *
+ * The socket also reports how many packets the kernel dropped because we
+ * were not reading fast enough (SO_RXQ_OVFL) and, optionally, the kernel
+ * receive timestamp of each packet (SO_TIMESTAMPNS).
+ *
+ * To use many cores, many receivers can be bound to the same port with
+ * SO_REUSEPORT, and udp_receiver_steer_by_ssrc() makes the kernel deliver
+ * all packets of a SSRC to the same receiver.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+
+#include "udp_receiver.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+/**
+ *
+ * This function opens and binds the socket of the receiver. On error the
+ * socket is closed and `fd` is -1, like a receiver that was never opened.
+ *
+ */
+guint
+udp_receiver_open (UdpReceiver * receiver, gint port, guint batchSize, gboolean timestamps, gboolean reusePort)
+{
+  struct sockaddr_in address;
+  struct timeval timeout = { 0, UDP_RECEIVER_TIMEOUT_MS * 1000 };
+  int enable = 1;
+  int bufferSize = UDP_RECEIVER_BUFFER_SZ;
+  guint i;
+
+  memset(receiver, 0, sizeof(UdpReceiver));
+  receiver->batchSize = CLAMP(batchSize, 1, UDP_RECEIVER_MAX_BATCH_SZ);
+  receiver->timestamps = timestamps;
+
+  receiver->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (receiver->fd < 0) {
+    return UDP_RECEIVER_ERROR_SOCKET;
+  }
+
+  setsockopt(receiver->fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  if (reusePort && setsockopt(receiver->fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+    close(receiver->fd);
+    receiver->fd = -1;
+    return UDP_RECEIVER_ERROR_SOCKET;
+  }
+  setsockopt(receiver->fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+  setsockopt(receiver->fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+  /* the timeout lets the caller check for SIGINT and do some housekeeping */
+  setsockopt(receiver->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (timestamps) {
+    setsockopt(receiver->fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (bind(receiver->fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    close(receiver->fd);
+    receiver->fd = -1;
+    return UDP_RECEIVER_ERROR_BIND;
+  }
+
+  receiver->controlSize = CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(guint32));
+  receiver->buffers = g_malloc(receiver->batchSize * UDP_RECEIVER_PACKET_SZ);
+  receiver->controls = g_malloc(receiver->batchSize * receiver->controlSize);
+  receiver->messages = g_new0(struct mmsghdr, receiver->batchSize);
+  receiver->iovecs = g_new0(struct iovec, receiver->batchSize);
+  receiver->packets = g_new0(UdpPacket, receiver->batchSize);
+
+  for (i = 0; i < receiver->batchSize; i++) {
+    receiver->iovecs[i].iov_base = receiver->buffers + i * UDP_RECEIVER_PACKET_SZ;
+    receiver->iovecs[i].iov_len = UDP_RECEIVER_PACKET_SZ;
+    receiver->messages[i].msg_hdr.msg_iov = &receiver->iovecs[i];
+    receiver->messages[i].msg_hdr.msg_iovlen = 1;
+    receiver->messages[i].msg_hdr.msg_control = receiver->controls + i * receiver->controlSize;
+  }
+
+  return UDP_RECEIVER_OK;
+}
+
+/**
+ *
+ * This function attaches a classic BPF program to the SO_REUSEPORT group of
+ * the receiver (groupSize sockets, in the order they were bound). The kernel
+ * runs it with the UDP payload as packet data and uses the returned value as
+ * the socket index, so it selects the socket by RTP SSRC (bytes 8-11):
+ *
+ *   socket = ssrc % groupSize
+ *
+ * Packets shorter than a RTP header make the program return 0.
+ *
+ */
+guint
+udp_receiver_steer_by_ssrc (UdpReceiver * receiver, guint groupSize)
+{
+  struct sock_filter code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, 8 },
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, groupSize },
+    { BPF_RET | BPF_A, 0, 0, 0 },
+  };
+  struct sock_fprog program = { G_N_ELEMENTS(code), code };
+
+  if (setsockopt(receiver->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0) {
+    return UDP_RECEIVER_ERROR_STEERING;
+  }
+  return UDP_RECEIVER_OK;
+}
+
+void
+udp_receiver_close (UdpReceiver * receiver)
+{
+  close(receiver->fd);
+  g_free(receiver->buffers);
+  g_free(receiver->controls);
+  g_free(receiver->messages);
+  g_free(receiver->iovecs);
+  g_free(receiver->packets);
+  receiver->fd = -1;
+}
+
+static void
+udp_receiver_parse_control (UdpReceiver * receiver, struct msghdr * header, UdpPacket * packet)
+{
+  struct cmsghdr * cmsg;
+
+  packet->timestamp = 0;
+  for (cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) {
+      continue;
+    }
+    if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+      guint32 drops;
+      memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+      receiver->kernelDrops = drops;
+    } else if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      struct timespec ts;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      packet->timestamp = (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+  }
+}
+
+/**
+ *
+ * This function blocks until at least one packet is available (or the socket
+ * timeout expires) and reads all packets already queued, up to batchSize.
+ * The packets are available at receiver->packets. It returns the number of
+ * packets, 0 on timeout or signal and -1 on error.
+ *
+ */
+gint
+udp_receiver_receive (UdpReceiver * receiver)
+{
+  gint i, count, received = 0;
+
+  for (i = 0; i < (gint) receiver->batchSize; i++) {
+    receiver->messages[i].msg_hdr.msg_controllen = receiver->controlSize;
+    receiver->messages[i].msg_hdr.msg_flags = 0;
+  }
+
+  count = recvmmsg(receiver->fd, receiver->messages, receiver->batchSize, MSG_WAITFORONE, NULL);
+  if (count < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  }
+
+  receiver->receivedBatches++;
+  for (i = 0; i < count; i++) {
+    struct msghdr * header = &receiver->messages[i].msg_hdr;
+    UdpPacket * packet = &receiver->packets[received];
+
+    udp_receiver_parse_control(receiver, header, packet);
+    if (header->msg_flags & MSG_TRUNC) {
+      receiver->truncatedPackets++;
+      continue;
+    }
+
+    packet->data = receiver->iovecs[i].iov_base;
+    packet->len = receiver->messages[i].msg_len;
+    received++;
+  }
+
+  receiver->receivedPackets += received;
+  return received;
+}
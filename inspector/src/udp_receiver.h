@@ -0,0 +1,54 @@
+#ifndef UDP_RECEIVER_H
+#define UDP_RECEIVER_H
+
+#include <glib.h>
+
+enum
+{
+  UDP_RECEIVER_OK = 0,
+  UDP_RECEIVER_ERROR_SOCKET = 1,
+  UDP_RECEIVER_ERROR_BIND = 2,
+  UDP_RECEIVER_ERROR_STEERING = 3
+};
+
+enum
+{
+  UDP_RECEIVER_DEFAULT_BATCH_SZ = 64,
+  UDP_RECEIVER_MAX_BATCH_SZ = 1024,
+  UDP_RECEIVER_PACKET_SZ = 2048,
+  UDP_RECEIVER_BUFFER_SZ = 4 * 1024 * 1024,
+  UDP_RECEIVER_TIMEOUT_MS = 200
+};
+
+typedef struct
+{
+  const guint8 * data;
+  guint len;
+  guint64 timestamp; /* kernel receive time in nanoseconds (CLOCK_REALTIME), 0 when disabled */
+} UdpPacket;
+
+typedef struct
+{
+  int fd;
+  guint batchSize;
+  gboolean timestamps;
+  guint8 * buffers;  /* batchSize packets of UDP_RECEIVER_PACKET_SZ, reused by every batch */
+  guint8 * controls; /* ancillary data for each packet */
+  gsize controlSize;
+  struct mmsghdr * messages;
+  struct iovec * iovecs;
+  UdpPacket * packets;
+
+  guint64 receivedPackets;
+  guint64 receivedBatches;
+  guint64 truncatedPackets;
+  guint32 kernelDrops; /* SO_RXQ_OVFL, packets dropped by the kernel since the socket was created */
+} UdpReceiver;
+
+
+guint udp_receiver_open(UdpReceiver * receiver, gint port, guint batchSize, gboolean timestamps, gboolean reusePort);
+guint udp_receiver_steer_by_ssrc(UdpReceiver * receiver, guint groupSize);
+void udp_receiver_close(UdpReceiver * receiver);
+gint udp_receiver_receive(UdpReceiver * receiver);
+
+#endif
@@ -0,0 +1,365 @@
+/**
+ *
+ * A zero-copy VP8 RTP depayloader (https://datatracker.ietf.org/doc/html/rfc7741)
+ * used by the native engine and the demux stage of the GStreamer pipeline.
+ *
+ * It follows the same rules that GStreamer's rtpvp8depay uses:
+ * a frame starts at a packet with the S bit set and partition index 0, ends at
+ * the packet with the RTP marker bit and any sequence gap drops the frame
+ * that was being assembled.
+ *
+ * Differently from rtpvp8depay, the frame is never copied: it is a list of
+ * slices pointing to the RTP payloads, so the packets memory must be valid
+ * until the frame is completed (the PCAP file is mapped for the whole run).
+ * Who needs contiguous bytes (the header parser) uses vp8_frame_copy() to
+ * linearize only the first bytes of the frame.
+ * When the packets memory is reused (the realtime receiver packet pool),
+ * vp8_depay_detach() must be called before it, keeping only the first bytes
+ * (and the partition size table) of the incomplete frame.
+ *
+ */
+
+#include "vp8_depay.h"
+
+/**
+ *
+ * This function parses the VP8 payload descriptor (RFC 7741 section 4.2):
+ *
+ *       0 1 2 3 4 5 6 7
+ *      +-+-+-+-+-+-+-+-+
+ *      |X|R|N|S|R| PID | (REQUIRED)
+ *      +-+-+-+-+-+-+-+-+
+ * X:   |I|L|T|K| RSV   | (OPTIONAL)
+ *      +-+-+-+-+-+-+-+-+
+ * I:   |M| PictureID   | (OPTIONAL)
+ *      +-+-+-+-+-+-+-+-+
+ *      |   PictureID   | (OPTIONAL, when M is set)
+ *      +-+-+-+-+-+-+-+-+
+ * L:   |   TL0PICIDX   | (OPTIONAL)
+ *      +-+-+-+-+-+-+-+-+
+ * T/K: |TID|Y| KEYIDX  | (OPTIONAL)
+ *      +-+-+-+-+-+-+-+-+
+ *
+ * It returns FALSE when the packet has no payload after the descriptor.
+ *
+ */
+gboolean
+vp8_payload_descriptor_parse (const guint8 * data, guint len, Vp8PayloadDescriptor * descriptor)
+{
+  guint size = 1;
+
+  memset(descriptor, 0, sizeof(Vp8PayloadDescriptor));
+  if (len < 1) {
+    return FALSE;
+  }
+
+  descriptor->extended = (data[0] >> 7) & 0x1;
+  descriptor->nonReference = (data[0] >> 5) & 0x1;
+  descriptor->startOfPartition = (data[0] >> 4) & 0x1;
+  descriptor->partitionIndex = data[0] & 0x7;
+
+  if (descriptor->extended) {
+    guint8 ext;
+    if (len < 2) {
+      return FALSE;
+    }
+    ext = data[size++];
+    descriptor->hasPictureId = (ext >> 7) & 0x1;
+    descriptor->hasTl0PicIdx = (ext >> 6) & 0x1;
+    descriptor->hasTid = (ext >> 5) & 0x1;
+    descriptor->hasKeyIdx = (ext >> 4) & 0x1;
+
+    if (descriptor->hasPictureId) {
+      if (len < size + 1) {
+        return FALSE;
+      }
+      descriptor->longPictureId = (data[size] >> 7) & 0x1;
+      if (descriptor->longPictureId) {
+        if (len < size + 2) {
+          return FALSE;
+        }
+        descriptor->pictureId = ((data[size] & 0x7f) << 8) | data[size + 1];
+        size += 2;
+      } else {
+        descriptor->pictureId = data[size] & 0x7f;
+        size++;
+      }
+    }
+
+    if (descriptor->hasTl0PicIdx) {
+      if (len < size + 1) {
+        return FALSE;
+      }
+      descriptor->tl0PicIdx = data[size++];
+    }
+
+    if (descriptor->hasTid || descriptor->hasKeyIdx) {
+      if (len < size + 1) {
+        return FALSE;
+      }
+      descriptor->tid = data[size] >> 6;
+      descriptor->layerSync = (data[size] >> 5) & 0x1;
+      descriptor->keyIdx = data[size] & 0x1f;
+      size++;
+    }
+  }
+
+  descriptor->size = size;
+  return size < len;
+}
+
+void
+vp8_depay_init (Vp8Depay * depay)
+{
+  vp8_depay_init_sized(depay, VP8_DEPAY_DETACHED_SZ);
+}
+
+/**
+ *
+ * This function initializes a depayloader keeping only the first `detachedSize`
+ * bytes of the incomplete frames in vp8_depay_detach(). With many streams,
+ * vp8_header_prefix_size() of the parse depth is enough and saves most of the
+ * per-stream memory (64 bytes instead of 2KB for the reference depth).
+ *
+ */
+void
+vp8_depay_init_sized (Vp8Depay * depay, guint detachedSize)
+{
+  memset(depay, 0, sizeof(Vp8Depay));
+  depay->frame.maxSlices = VP8_DEPAY_MIN_SLICES;
+  depay->frame.slices = g_new(Vp8Slice, depay->frame.maxSlices);
+  depay->frame.detachedSize = MAX(detachedSize, FRAME_HEADER_SZ);
+  depay->frame.detached = g_malloc(depay->frame.detachedSize);
+}
+
+/* It forgets the stream state but keeps the buffers, so a new stream can reuse the depayloader */
+void
+vp8_depay_reset (Vp8Depay * depay)
+{
+  Vp8Slice * slices = depay->frame.slices;
+  guint maxSlices = depay->frame.maxSlices;
+  guint8 * detached = depay->frame.detached;
+  guint detachedSize = depay->frame.detachedSize;
+
+  memset(depay, 0, sizeof(Vp8Depay));
+  depay->frame.slices = slices;
+  depay->frame.maxSlices = maxSlices;
+  depay->frame.detached = detached;
+  depay->frame.detachedSize = detachedSize;
+}
+
+void
+vp8_depay_clear (Vp8Depay * depay)
+{
+  g_free(depay->frame.slices);
+  g_free(depay->frame.detached);
+  depay->frame.slices = NULL;
+  depay->frame.detached = NULL;
+}
+
+/* It drops the frame being assembled, its packets are not used anymore */
+void
+vp8_depay_drop_frame (Vp8Depay * depay)
+{
+  if (depay->started) {
+    depay->droppedFrames++;
+    depay->started = FALSE;
+  }
+}
+
+/**
+ *
+ * This function counts the frames that we never saw looking at the PictureID
+ * of each new frame. The PictureID wraps at 7 or 15 bits (the M bit), and small
+ * backward jumps (duplicated or reordered frames) are not counted as loss.
+ *
+ */
+static void
+vp8_depay_check_picture_id (Vp8Depay * depay, const Vp8PayloadDescriptor * descriptor)
+{
+  guint16 mask = descriptor->longPictureId ? 0x7fff : 0x7f;
+
+  if (!descriptor->hasPictureId) {
+    return;
+  }
+
+  if (depay->havePictureId) {
+    guint16 diff = (descriptor->pictureId - depay->lastPictureId) & mask;
+    if (diff > 1 && diff <= mask / 2) {
+      depay->lostPictures += diff - 1;
+    }
+  }
+
+  depay->havePictureId = TRUE;
+  depay->lastPictureId = descriptor->pictureId;
+}
+
+static void
+vp8_frame_append (Vp8Frame * frame, const guint8 * data, guint len)
+{
+  if (frame->numSlices == frame->maxSlices) {
+    frame->maxSlices *= 2;
+    frame->slices = g_renew(Vp8Slice, frame->slices, frame->maxSlices);
+  }
+  frame->slices[frame->numSlices].data = data;
+  frame->slices[frame->numSlices].len = len;
+  frame->slices[frame->numSlices].offset = frame->size;
+  frame->numSlices++;
+  frame->size += len;
+}
+
+/**
+ *
+ * This function pushes a RTP packet to the depayloader.
+ * It returns TRUE when a frame was completed, in that case the frame
+ * is available at depay->frame until the next push.
+ *
+ */
+gboolean
+vp8_depay_push (Vp8Depay * depay, const RtpPacket * rtp)
+{
+  Vp8PayloadDescriptor descriptor;
+
+  if (depay->haveSeq && rtp->seq != (guint16) (depay->lastSeq + 1)) {
+    gint16 gap = (gint16) (rtp->seq - depay->lastSeq - 1);
+    if (gap > 0) {
+      depay->lostPackets += gap;
+    }
+    vp8_depay_drop_frame(depay);
+  }
+  depay->haveSeq = TRUE;
+  depay->lastSeq = rtp->seq;
+
+  /* like rtpvp8depay, packets without payload are ignored */
+  if (!vp8_payload_descriptor_parse(rtp->payload, rtp->payloadLen, &descriptor)) {
+    return FALSE;
+  }
+
+  if (descriptor.startOfPartition && descriptor.partitionIndex == 0) {
+    /* a new frame before the marker of the previous one */
+    vp8_depay_drop_frame(depay);
+    vp8_depay_check_picture_id(depay, &descriptor);
+
+    depay->started = TRUE;
+    depay->frame.numSlices = 0;
+    depay->frame.size = 0;
+    depay->frame.timestamp = rtp->timestamp;
+    depay->frame.arrival = rtp->arrival;
+    depay->frame.offset = rtp->offset;
+    depay->frame.descriptor = descriptor;
+  }
+
+  if (!depay->started) {
+    return FALSE;
+  }
+
+  vp8_frame_append(&depay->frame, rtp->payload + descriptor.size, rtp->payloadLen - descriptor.size);
+  depay->frame.offset = MIN(depay->frame.offset, rtp->offset);
+
+  if (rtp->marker) {
+    depay->started = FALSE;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ *
+ * This function copies the first len bytes of the frame to dest,
+ * returning how many bytes were copied.
+ *
+ */
+guint
+vp8_frame_copy (const Vp8Frame * frame, guint8 * dest, guint len)
+{
+  return vp8_frame_copy_at(frame, 0, dest, len);
+}
+
+/**
+ *
+ * This function copies len bytes of the frame from offset to dest,
+ * returning how many bytes were copied. It stops at the end of the frame
+ * or at the bytes forgotten by vp8_depay_detach().
+ *
+ */
+guint
+vp8_frame_copy_at (const Vp8Frame * frame, guint offset, guint8 * dest, guint len)
+{
+  guint i, copied = 0;
+
+  for (i = 0; i < frame->numSlices && copied < len; i++) {
+    const Vp8Slice * slice = &frame->slices[i];
+    guint position = offset + copied;
+    if (slice->offset + slice->len <= position) {
+      continue;
+    }
+    if (slice->offset > position) {
+      break;
+    }
+    guint n = MIN(slice->offset + slice->len - position, len - copied);
+    memcpy(dest + copied, slice->data + (position - slice->offset), n);
+    copied += n;
+  }
+  return copied;
+}
+
+/* it copies the bytes of the slice in [start, start + len) to keep[] */
+static void
+vp8_slice_keep (const Vp8Slice * slice, guint start, guint len, guint8 * keep)
+{
+  guint from = MAX(slice->offset, start);
+  guint to = MIN(slice->offset + slice->len, start + len);
+
+  if (from < to) {
+    memcpy(keep + (from - start), slice->data + (from - slice->offset), to - from);
+  }
+}
+
+/**
+ *
+ * This function is called before the memory of the packets pushed so far is
+ * reused. The first detachedSize bytes of the incomplete frame and
+ * its partition size table (vp8_partition_table_offset()) are copied to the
+ * frame itself and the other slices are forgotten (only the frame size is
+ * kept). So after it, only the header prefix and the table can be copied.
+ *
+ */
+void
+vp8_depay_detach (Vp8Depay * depay)
+{
+  Vp8Frame * frame = &depay->frame;
+  guint8 tag[FRAME_HEADER_SZ];
+  guint i, tableOffset, tableStart, tableEnd;
+
+  if (!depay->started || frame->numSlices == 0) {
+    return;
+  }
+
+  tableOffset = vp8_partition_table_offset(tag, vp8_frame_copy(frame, tag, sizeof(tag)));
+  tableStart = MAX(tableOffset, frame->detachedSize);
+  tableEnd = tableOffset + PARTITION_TABLE_SZ;
+
+  /* the bytes already in the frame buffers are at the right place */
+  for (i = 0; i < frame->numSlices; i++) {
+    const Vp8Slice * slice = &frame->slices[i];
+    if (slice->data == frame->detached || (slice->data >= frame->detachedTable && slice->data < frame->detachedTable + PARTITION_TABLE_SZ)) {
+      continue;
+    }
+    vp8_slice_keep(slice, 0, frame->detachedSize, frame->detached);
+    if (tableOffset) {
+      vp8_slice_keep(slice, tableOffset, PARTITION_TABLE_SZ, frame->detachedTable);
+    }
+  }
+
+  frame->slices[0].data = frame->detached;
+  frame->slices[0].len = MIN(frame->size, frame->detachedSize);
+  frame->slices[0].offset = 0;
+  frame->numSlices = 1;
+
+  if (tableOffset && frame->size > tableStart && tableStart < tableEnd) {
+    frame->slices[1].data = frame->detachedTable + (tableStart - tableOffset);
+    frame->slices[1].len = MIN(frame->size, tableEnd) - tableStart;
+    frame->slices[1].offset = tableStart;
+    frame->numSlices = 2;
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef VP8_DEPAY_H
+#define VP8_DEPAY_H
+
+#include <glib.h>
+
+#include "rtp_parser.h"
+#include "vp8_parser.h"
+
+enum
+{
+  VP8_DEPAY_MIN_SLICES = 16,
+  VP8_DEPAY_DETACHED_SZ = 2048 /* bytes kept by vp8_depay_detach() by default, at least FRAME_HEADER_FULL_PREFIX_SZ */
+};
+
+typedef struct
+{
+  gboolean extended;         /* X */
+  gboolean nonReference;     /* N */
+  gboolean startOfPartition; /* S */
+  guint partitionIndex;      /* PID */
+  gboolean hasPictureId;     /* I */
+  gboolean longPictureId;    /* M, 15 bits PictureID */
+  guint16 pictureId;
+  gboolean hasTl0PicIdx;     /* L */
+  guint8 tl0PicIdx;
+  gboolean hasTid;           /* T */
+  guint8 tid;
+  gboolean layerSync;        /* Y */
+  gboolean hasKeyIdx;        /* K */
+  guint8 keyIdx;
+  guint size;                /* descriptor size in bytes */
+} Vp8PayloadDescriptor;
+
+typedef struct
+{
+  const guint8 * data;
+  guint len;
+  guint offset;  /* in the frame */
+} Vp8Slice;
+
+/* A frame is a list of slices pointing to the packets payloads, the frame data is never copied */
+typedef struct
+{
+  Vp8Slice * slices;
+  guint numSlices;
+  guint maxSlices;
+  guint size;
+  guint32 timestamp;
+  guint64 arrival;                 /* arrival of the first packet */
+  guint64 offset;                  /* lowest capture offset of its packets, see RtpPacket.offset */
+  Vp8PayloadDescriptor descriptor; /* descriptor of the first packet */
+  guint8 * detached;
+  guint detachedSize;               /* bytes kept by vp8_depay_detach() */
+  guint8 detachedTable[PARTITION_TABLE_SZ]; /* the partition size table, when it is after the detached bytes */
+} Vp8Frame;
+
+typedef struct
+{
+  Vp8Frame frame;
+  gboolean started;
+  gboolean haveSeq;
+  guint16 lastSeq;
+  gboolean havePictureId;
+  guint16 lastPictureId;
+  guint droppedFrames; /* incomplete frames, because of lost packets */
+  guint lostPictures;  /* PictureID gaps, frames that we never saw */
+  guint lostPackets;   /* sequence number gaps */
+} Vp8Depay;
+
+
+gboolean vp8_payload_descriptor_parse(const guint8 * data, guint len, Vp8PayloadDescriptor * descriptor);
+
+void vp8_depay_init(Vp8Depay * depay);
+void vp8_depay_init_sized(Vp8Depay * depay, guint detachedSize);
+void vp8_depay_clear(Vp8Depay * depay);
+void vp8_depay_reset(Vp8Depay * depay);
+gboolean vp8_depay_push(Vp8Depay * depay, const RtpPacket * rtp);
+void vp8_depay_detach(Vp8Depay * depay);
+void vp8_depay_drop_frame(Vp8Depay * depay);
+
+guint vp8_frame_copy(const Vp8Frame * frame, guint8 * dest, guint len);
+guint vp8_frame_copy_at(const Vp8Frame * frame, guint offset, guint8 * dest, guint len);
+
+#endif
@@ -1,5 +1,9 @@
+#include <string.h>
+
 #include "bool_decoder.h"
+#include "perf_counters.h"
 #include "vp8_parser.h"
+#include "vp8_tables.h"
 
 guint
 vp8_parse_frame_header(const unsigned char * data, const unsigned int len, FrameInfo * ctx)
@@ -18,7 +22,7 @@ vp8_parse_frame_header(const unsigned char * data, const unsigned int len, Frame
   ctx->partSize = (tmp >> 5) & 0x7FFFF;
 
   if (len <= ctx->partSize + (ctx->keyframe ? 10 : 3)) {
-    return VP8_CODEC_CORRUPT_FRAME;
+    return VP8_CODEC_TRUNCATED_FRAME;
   }
   
   if (ctx->keyframe) {
@@ -43,26 +47,26 @@ vp8_parse_frame_header(const unsigned char * data, const unsigned int len, Frame
 }
 
 guint
-vp8_parse_segmentation_header(struct bool_decoder *bool)
+vp8_parse_segmentation_header(struct bool_decoder *bool, SegmentationHeader * hdr)
 {      
-  int segmentationEnabled = bool_get_bit(bool);
+  hdr->enabled = bool_get_bit(bool);
 
-  if (segmentationEnabled) {
+  if (hdr->enabled) {
     int i;
-    int updateMap = bool_get_bit(bool);
-    int updateData = bool_get_bit(bool);
-    if (updateData) {
-      /*hdr->abs = */bool_get_bit(bool);
+    hdr->updateMap = bool_get_bit(bool);
+    hdr->updateData = bool_get_bit(bool);
+    if (hdr->updateData) {
+      hdr->absoluteDelta = bool_get_bit(bool);
       for (i = 0; i < MAX_MB_SEGMENTS; i++)
-        /*hdr->quant_idx[i] = */bool_maybe_get_int(bool, 7);
+        hdr->quantizer[i] = bool_maybe_get_int(bool, 7);
 
       for (i = 0; i < MAX_MB_SEGMENTS; i++)
-        /*hdr->lf_level[i] = */bool_maybe_get_int(bool, 6);
+        hdr->loopFilterLevel[i] = bool_maybe_get_int(bool, 6);
     }
 
-    if (updateMap) {
+    if (hdr->updateMap) {
       for (i = 0; i < MB_FEATURE_TREE_PROBS; i++) {
-        /*hdr->tree_probs[i] = */bool_get_bit(bool) ? bool_get_uint(bool, 8) : 255;
+        hdr->treeProbs[i] = bool_get_bit(bool) ? bool_get_uint(bool, 8) : 255;
       }
     }
   }
@@ -70,40 +74,41 @@ vp8_parse_segmentation_header(struct bool_decoder *bool)
 }
 
 guint
-vp8_parse_loopfilter_header(struct bool_decoder * bool)
+vp8_parse_loopfilter_header(struct bool_decoder * bool, LoopFilterHeader * hdr)
 {
-  bool_get_bit(bool); // filter_type
-  bool_get_uint(bool, 6); // loop_filter_level
-  bool_get_uint(bool, 3); // sharpness_level
-  int deltaEnabled = bool_get_bit(bool);
-  if (deltaEnabled && bool_get_bit(bool)) {
+  hdr->filterType = bool_get_bit(bool);
+  hdr->level = bool_get_uint(bool, 6);
+  hdr->sharpness = bool_get_uint(bool, 3);
+  hdr->deltaEnabled = bool_get_bit(bool);
+  hdr->deltaUpdate = hdr->deltaEnabled ? bool_get_bit(bool) : FALSE;
+  if (hdr->deltaUpdate) {
     int i;
     for (i = 0; i < BLOCK_CONTEXTS; i++)
-      bool_maybe_get_int(bool, 6); // ref_frame_delta_update_flag + delta_magnitude + delta_sign
+      hdr->refFrameDelta[i] = bool_maybe_get_int(bool, 6); // ref_frame_delta_update_flag + delta_magnitude + delta_sign
 
     for (i = 0; i < BLOCK_CONTEXTS; i++)
-      bool_maybe_get_int(bool, 6); // mb_mode_delta_update_flag + delta_magnitude + delta_sign
+      hdr->modeDelta[i] = bool_maybe_get_int(bool, 6); // mb_mode_delta_update_flag + delta_magnitude + delta_sign
   }
   return VP8_CODEC_OK;
 }
 
 guint
-vp8_parse_partitions(struct bool_decoder * bool)
+vp8_parse_partitions(struct bool_decoder * bool, FrameInfo * ctx)
 {
-  // NOTE: we should compare the buffer data size with the partitions, because we can find a corrupted frame!
-  bool_get_uint(bool, 2); // log2_nbr_of_dct_partitions
+  // NOTE: the partition sizes are validated by vp8_parse_partition_table()
+  ctx->partitions = 1 << bool_get_uint(bool, 2); // log2_nbr_of_dct_partitions
   return VP8_CODEC_OK;
 }
 
 guint
-vp8_parse_quantizer_header(struct bool_decoder * bool)
+vp8_parse_quantizer_header(struct bool_decoder * bool, QuantizerHeader * hdr)
 {
-  bool_get_uint(bool, 7); // y_ac_qi
-  bool_maybe_get_int(bool, 4); // y1_dc_delta_q
-  bool_maybe_get_int(bool, 4); // y2_dc_delta_q
-  bool_maybe_get_int(bool, 4); // y2_ac_delta_q
-  bool_maybe_get_int(bool, 4); // uv_dc_delta_q
-  bool_maybe_get_int(bool, 4); // uv_ac_delta_q
+  hdr->yAcQi = bool_get_uint(bool, 7);
+  hdr->y1DcDelta = bool_maybe_get_int(bool, 4);
+  hdr->y2DcDelta = bool_maybe_get_int(bool, 4);
+  hdr->y2AcDelta = bool_maybe_get_int(bool, 4);
+  hdr->uvDcDelta = bool_maybe_get_int(bool, 4);
+  hdr->uvAcDelta = bool_maybe_get_int(bool, 4);
   return VP8_CODEC_OK;
 }
 
@@ -115,42 +120,261 @@ vp8_parse_reference_header(struct bool_decoder * bool, FrameInfo * ctx)
   return VP8_CODEC_OK;
 }
 
+/**
+ * 
+ * This function parses the rest of the frame header, after the golden/altref
+ * refresh flags: buffer copies, sign bias, entropy/last refresh flags and
+ * the probability updates (token, skip, intra modes and motion vectors).
+ * The updated probabilities are not kept, only how many were updated.
+ * 
+ */
+guint
+vp8_parse_probability_updates(struct bool_decoder * bool, FrameInfo * ctx)
+{
+  ProbabilityUpdates * probs = &ctx->probs;
+  int i, j, k, l;
+
+  if (ctx->keyframe) {
+    ctx->refreshEntropyProbs = bool_get_bit(bool);
+    ctx->refreshLast = TRUE;
+  } else {
+    if (!ctx->refreshGoldenFrame)
+      ctx->copyBufferToGolden = bool_get_uint(bool, 2);
+    if (!ctx->refreshAltrefFrame)
+      ctx->copyBufferToAltref = bool_get_uint(bool, 2);
+    ctx->signBiasGolden = bool_get_bit(bool);
+    ctx->signBiasAltref = bool_get_bit(bool);
+    ctx->refreshEntropyProbs = bool_get_bit(bool);
+    ctx->refreshLast = bool_get_bit(bool);
+  }
+
+  for (i = 0; i < BLOCK_TYPES; i++)
+    for (j = 0; j < COEF_BANDS; j++)
+      for (k = 0; k < PREV_COEF_CONTEXTS; k++)
+        for (l = 0; l < ENTROPY_NODES; l++)
+          if (bool_get(bool, coeff_update_probs[i][j][k][l])) {
+            bool_get_uint(bool, 8);
+            probs->coeffUpdates++;
+          }
+
+  probs->mbNoCoeffSkip = bool_get_bit(bool);
+  if (probs->mbNoCoeffSkip) {
+    probs->probSkipFalse = bool_get_uint(bool, 8);
+  }
+
+  if (!ctx->keyframe) {
+    probs->probIntra = bool_get_uint(bool, 8);
+    probs->probLast = bool_get_uint(bool, 8);
+    probs->probGolden = bool_get_uint(bool, 8);
+
+    probs->intra16x16Update = bool_get_bit(bool);
+    if (probs->intra16x16Update) {
+      for (i = 0; i < INTRA_16X16_PROBS; i++)
+        probs->intra16x16Probs[i] = bool_get_uint(bool, 8);
+    }
+
+    probs->intraChromaUpdate = bool_get_bit(bool);
+    if (probs->intraChromaUpdate) {
+      for (i = 0; i < INTRA_CHROMA_PROBS; i++)
+        probs->intraChromaProbs[i] = bool_get_uint(bool, 8);
+    }
+
+    for (i = 0; i < MV_COMPONENTS; i++)
+      for (j = 0; j < MV_PROB_COUNT; j++)
+        if (bool_get(bool, mv_update_probs[i][j])) {
+          bool_get_uint(bool, 7);
+          probs->mvUpdates++;
+        }
+  }
+
+  return VP8_CODEC_OK;
+}
+
 guint
 vp8_parse_header(unsigned char * data, unsigned int len, FrameInfo * ctx)
+{
+  guint res = vp8_parse_header_prefix(data, len, len, VP8_PARSE_DEPTH_REFERENCE, ctx);
+  if (res != VP8_CODEC_OK) return res;
+
+  guint offset = vp8_partition_table_offset(data, len);
+  return vp8_parse_partition_table(data + offset, len - offset, len, ctx);
+}
+
+/**
+ * 
+ * This function returns the offset of the DCT partition sizes table,
+ * right after the first partition. Only the frame tag is needed, so the
+ * table can be fetched before parsing the frame.
+ * 
+ */
+guint
+vp8_partition_table_offset(const unsigned char * data, unsigned int available)
+{
+  if (available < FRAME_HEADER_SZ) {
+    return 0;
+  }
+
+  guint tmp = (data[2] << 16) | (data[1] << 8) | data[0];
+  guint header = (tmp & 0x1) ? FRAME_HEADER_SZ : FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ;
+  return header + ((tmp >> 5) & 0x7FFFF);
+}
+
+/**
+ * 
+ * This function reads the DCT partition sizes table (`table` points to the
+ * first `available` bytes at vp8_partition_table_offset()) and checks every
+ * partition against the frame length `len`. It needs ctx->partitions, so
+ * the header must be parsed at least up to the reference flags.
+ * 
+ * A frame with partitions (or the table itself) after its end is
+ * VP8_CODEC_TRUNCATED_FRAME. 
+ * 
+ */
+guint
+vp8_parse_partition_table(const unsigned char * table, unsigned int available, unsigned int len, FrameInfo * ctx)
+{
+  guint i, last, offset, end;
+
+  if (ctx->partitions == 0 || ctx->partitions > MAX_DCT_PARTITIONS) {
+    return VP8_CODEC_CORRUPT_FRAME;
+  }
+
+  last = ctx->partitions - 1;
+  offset = (ctx->keyframe ? FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ : FRAME_HEADER_SZ) + ctx->partSize + last * PARTITION_SIZE_SZ;
+  if (offset > len || available < last * PARTITION_SIZE_SZ) {
+    return VP8_CODEC_TRUNCATED_FRAME;
+  }
+
+  for (i = 0; i < last; i++) {
+    const unsigned char * p = table + i * PARTITION_SIZE_SZ;
+    guint size = p[0] | (p[1] << 8) | (p[2] << 16);
+    end = offset + size;
+    if (end > len) {
+      return VP8_CODEC_TRUNCATED_FRAME;
+    }
+    ctx->partitionOffset[i] = offset;
+    ctx->partitionSize[i] = size;
+    offset = end;
+  }
+
+  ctx->partitionOffset[last] = offset;
+  ctx->partitionSize[last] = len - offset;
+  return VP8_CODEC_OK;
+}
+
+/**
+ * 
+ * This function returns how many bytes of the frame are needed by
+ * vp8_parse_header_prefix() to parse the frame up to `depth`.
+ * 
+ */
+guint
+vp8_header_prefix_size(guint depth)
+{
+  switch (depth) {
+    case VP8_PARSE_DEPTH_TAG:
+      return FRAME_HEADER_SZ + KEYFRAME_HEADER_SZ;
+    case VP8_PARSE_DEPTH_REFERENCE:
+      return FRAME_HEADER_PREFIX_SZ;
+    default:
+      return FRAME_HEADER_FULL_PREFIX_SZ;
+  }
+}
+
+gboolean
+vp8_parse_depth_from_string(const gchar * name, guint * depth)
+{
+  if (name == NULL || g_strcmp0(name, "reference") == 0) {
+    *depth = VP8_PARSE_DEPTH_REFERENCE;
+  } else if (g_strcmp0(name, "tag") == 0) {
+    *depth = VP8_PARSE_DEPTH_TAG;
+  } else if (g_strcmp0(name, "full") == 0) {
+    *depth = VP8_PARSE_DEPTH_FULL;
+  } else {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * 
+ * Same as vp8_parse_header(), but only the first `available` bytes of
+ * a `len` bytes frame are readable. It allows us to parse frames that are
+ * not contiguous in memory copying only vp8_header_prefix_size() bytes.
+ * 
+ * The header is parsed up to `depth` (VP8_PARSE_DEPTH_*) and ctx->parseDepth
+ * is the depth really parsed: when the full header does not fit in the
+ * available bytes, the fields after the reference flags are left empty.
+ * 
+ */
+guint
+vp8_parse_header_prefix(const unsigned char * data, unsigned int available, unsigned int len, guint depth, FrameInfo * ctx)
 {
   guint res;
   struct bool_decoder bool;
 
+  ctx->parseDepth = VP8_PARSE_DEPTH_TAG;
+
+  if (available > len) {
+    available = len;
+  }
+
+  if (available < 10) {
+    return VP8_CODEC_CORRUPT_FRAME;
+  }
+
   res = vp8_parse_frame_header(data, len, ctx);
-  if (res != VP8_CODEC_OK) return res;
+  PERF_COUNTERS_MARK(PERF_STAGE_TAG);
+  if (res != VP8_CODEC_OK || depth == VP8_PARSE_DEPTH_TAG) return res;
 
   data += FRAME_HEADER_SZ;
-  len -= FRAME_HEADER_SZ;
+  available -= FRAME_HEADER_SZ;
   if (ctx->keyframe)
   {
     data += KEYFRAME_HEADER_SZ;
-    len -= KEYFRAME_HEADER_SZ;
+    available -= KEYFRAME_HEADER_SZ;
   }
 
-  init_bool_decoder(&bool, data, ctx->partSize);
+  init_bool_decoder(&bool, data, MIN(ctx->partSize, available));
 
-  /* Skip the colorspace and clamping bits */
   if (ctx->keyframe) {
-    bool_get_uint(&bool, 2);
+    ctx->colorSpace = bool_get_bit(&bool);
+    ctx->clampingType = bool_get_bit(&bool);
   }
 
-  res = vp8_parse_segmentation_header(&bool);
+  res = vp8_parse_segmentation_header(&bool, &ctx->segmentation);
   if (res != VP8_CODEC_OK) return res;
   
-  res = vp8_parse_loopfilter_header(&bool);
+  res = vp8_parse_loopfilter_header(&bool, &ctx->loopFilter);
   if (res != VP8_CODEC_OK) return res;
 
-  res = vp8_parse_partitions(&bool);
+  res = vp8_parse_partitions(&bool, ctx);
   if (res != VP8_CODEC_OK) return res;
 
-  res = vp8_parse_quantizer_header(&bool);
+  res = vp8_parse_quantizer_header(&bool, &ctx->quantizer);
   if (res != VP8_CODEC_OK) return res;
 
   res = vp8_parse_reference_header(&bool, ctx);
+  if (res != VP8_CODEC_OK) return res;
+  ctx->parseDepth = VP8_PARSE_DEPTH_REFERENCE;
+
+  if (depth < VP8_PARSE_DEPTH_FULL) return res;
+
+  res = vp8_parse_probability_updates(&bool, ctx);
+  if (res != VP8_CODEC_OK) return res;
+
+  /* the bool decoder shifted in zeros after the prefix, not the real partition bytes */
+  if (available < ctx->partSize && bool_overrun(&bool)) {
+    memset(&ctx->probs, 0, sizeof(ctx->probs));
+    ctx->refreshEntropyProbs = FALSE;
+    ctx->refreshLast = FALSE;
+    ctx->copyBufferToGolden = 0;
+    ctx->copyBufferToAltref = 0;
+    ctx->signBiasGolden = FALSE;
+    ctx->signBiasAltref = FALSE;
+    return res;
+  }
+
+  ctx->parseDepth = VP8_PARSE_DEPTH_FULL;
   return res;
-}
\ No newline at end of file
+}
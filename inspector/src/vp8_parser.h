@@ -1,11 +1,16 @@
+#ifndef VP8_PARSER_H
+#define VP8_PARSER_H
+
 #include <glib-unix.h>
-#include <gst/gst.h>
+
+#include "bool_decoder.h"
 
 enum 
 {
   VP8_CODEC_OK = 0,
   VP8_CODEC_CORRUPT_FRAME = 1,
-  VP8_CODEC_UNSUP_BITSTREAM = 2
+  VP8_CODEC_UNSUP_BITSTREAM = 2,
+  VP8_CODEC_TRUNCATED_FRAME = 3  /* a partition (or the partition size table) ends after the frame */
 };
 
 enum
@@ -14,6 +19,21 @@ enum
   KEYFRAME_HEADER_SZ = 7
 };
 
+/* Bytes needed to parse all headers up to the reference flags (see vp8_parse_header_prefix()) */
+enum
+{
+  FRAME_HEADER_PREFIX_SZ = 64,
+  FRAME_HEADER_FULL_PREFIX_SZ = 2048
+};
+
+/* How far the frame header is parsed (--parseDepth) */
+enum
+{
+  VP8_PARSE_DEPTH_TAG = 0,        /* frame tag and keyframe header: keyframe, show, resolution */
+  VP8_PARSE_DEPTH_REFERENCE = 1,  /* up to the golden/altref refresh flags */
+  VP8_PARSE_DEPTH_FULL = 2        /* the whole frame header, up to the probability updates */
+};
+
 enum
 {
   MB_FEATURE_TREE_PROBS = 3,
@@ -25,6 +45,26 @@ enum
   BLOCK_CONTEXTS = 4
 };
 
+/* The DCT partition sizes table follows the first partition, the last partition size is implicit */
+enum
+{
+  MAX_DCT_PARTITIONS = 8,
+  PARTITION_SIZE_SZ = 3,
+  PARTITION_TABLE_SZ = PARTITION_SIZE_SZ * (MAX_DCT_PARTITIONS - 1)
+};
+
+enum
+{
+  BLOCK_TYPES = 4,
+  COEF_BANDS = 8,
+  PREV_COEF_CONTEXTS = 3,
+  ENTROPY_NODES = 11,
+  MV_COMPONENTS = 2,
+  MV_PROB_COUNT = 19,
+  INTRA_16X16_PROBS = 4,
+  INTRA_CHROMA_PROBS = 3
+};
+
 
 typedef struct {
   guint width;
@@ -33,9 +73,57 @@ typedef struct {
   guint heightScale;
 } FrameResolution;
 
+typedef struct
+{
+  gboolean enabled;
+  gboolean updateMap;
+  gboolean updateData;
+  gboolean absoluteDelta;
+  gint8 quantizer[MAX_MB_SEGMENTS];
+  gint8 loopFilterLevel[MAX_MB_SEGMENTS];
+  guint8 treeProbs[MB_FEATURE_TREE_PROBS];
+} SegmentationHeader;
+
+typedef struct
+{
+  guint8 filterType;
+  guint8 level;
+  guint8 sharpness;
+  gboolean deltaEnabled;
+  gboolean deltaUpdate;
+  gint8 refFrameDelta[BLOCK_CONTEXTS];
+  gint8 modeDelta[BLOCK_CONTEXTS];
+} LoopFilterHeader;
+
+typedef struct
+{
+  guint8 yAcQi;
+  gint8 y1DcDelta;
+  gint8 y2DcDelta;
+  gint8 y2AcDelta;
+  gint8 uvDcDelta;
+  gint8 uvAcDelta;
+} QuantizerHeader;
+
+typedef struct
+{
+  guint16 coeffUpdates;    /* updated token probabilities */
+  gboolean mbNoCoeffSkip;
+  guint8 probSkipFalse;
+  guint8 probIntra;        /* interframes only */
+  guint8 probLast;
+  guint8 probGolden;
+  gboolean intra16x16Update;
+  guint8 intra16x16Probs[INTRA_16X16_PROBS];
+  gboolean intraChromaUpdate;
+  guint8 intraChromaProbs[INTRA_CHROMA_PROBS];
+  guint8 mvUpdates;        /* updated motion vector probabilities */
+} ProbabilityUpdates;
+
 typedef struct
 {
   gboolean ok;
+  guint error;      /* VP8_CODEC_* */
   gboolean keyframe;
   guint version;
   gboolean isExperimental;
@@ -45,15 +133,47 @@ typedef struct
   gboolean refreshGoldenFrame;
   gboolean refreshAltrefFrame;
 
-  GstClockTime pts;
+  /* filled according to parseDepth (the depth really parsed) */
+  guint parseDepth;
+  guint8 colorSpace;
+  guint8 clampingType;
+  SegmentationHeader segmentation;
+  LoopFilterHeader loopFilter;
+  guint8 partitions;             /* number of DCT partitions */
+  guint partitionOffset[MAX_DCT_PARTITIONS];  /* from the frame start, after the partition size table */
+  guint partitionSize[MAX_DCT_PARTITIONS];
+  QuantizerHeader quantizer;
+  gboolean refreshEntropyProbs;
+  gboolean refreshLast;
+  guint8 copyBufferToGolden;     /* 0: none, 1: last frame, 2: altref frame */
+  guint8 copyBufferToAltref;     /* 0: none, 1: last frame, 2: golden frame */
+  gboolean signBiasGolden;
+  gboolean signBiasAltref;
+  ProbabilityUpdates probs;
+
+  guint64 pts;      /* nanoseconds from the first frame of the stream, like a GstClockTime */
   guint frameNumber;
+  guint size;       /* size of the whole frame */
+  guint64 arrival;  /* arrival time of the frame in nanoseconds since the epoch, 0 when unknown */
 } FrameInfo;
 
+/* FrameInfo.pts units */
+#define FRAME_PTS_MSECOND G_GUINT64_CONSTANT(1000000)
+#define FRAME_PTS_SECOND G_GUINT64_CONSTANT(1000000000)
+
 
 guint vp8_parse_header(unsigned char * data, unsigned int len, FrameInfo * ctx);
+guint vp8_parse_header_prefix(const unsigned char * data, unsigned int available, unsigned int len, guint depth, FrameInfo * ctx);
+guint vp8_header_prefix_size(guint depth);
+guint vp8_partition_table_offset(const unsigned char * data, unsigned int available);
+guint vp8_parse_partition_table(const unsigned char * table, unsigned int available, unsigned int len, FrameInfo * ctx);
+gboolean vp8_parse_depth_from_string(const gchar * name, guint * depth);
 guint vp8_parse_frame_header(const unsigned char * data, const unsigned int len, FrameInfo * ctx);
-guint vp8_parse_segmentation_header(struct bool_decoder *bool);
-guint vp8_parse_loopfilter_header(struct bool_decoder *bool);
-guint vp8_parse_partitions(struct bool_decoder *bool);
-guint vp8_parse_quantizer_header(struct bool_decoder *bool);
-guint vp8_parse_reference_header(struct bool_decoder *bool, FrameInfo * ctx);
\ No newline at end of file
+guint vp8_parse_segmentation_header(struct bool_decoder *bool, SegmentationHeader * hdr);
+guint vp8_parse_loopfilter_header(struct bool_decoder *bool, LoopFilterHeader * hdr);
+guint vp8_parse_partitions(struct bool_decoder *bool, FrameInfo * ctx);
+guint vp8_parse_quantizer_header(struct bool_decoder *bool, QuantizerHeader * hdr);
+guint vp8_parse_reference_header(struct bool_decoder *bool, FrameInfo * ctx);
+guint vp8_parse_probability_updates(struct bool_decoder *bool, FrameInfo * ctx);
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ *
+ * libvp8inspect, the push-packets/pull-frames API on top of a NativeWorker.
+ *
+ * The context owns a worker that is never started: the caller thread pushes
+ * the packets, like the native PCAP engine does. The streams hand their frames
+ * to a callback instead of an output file, so nothing is written and nothing
+ * is formatted.
+ *
+ * Without a user callback, the results are queued and read back with
+ * vp8_inspect_next(). The queue is emptied when it is fully read, so once it
+ * has grown to the largest burst, pushing does no heap allocation.
+ *
+ */
+
+#include <stdlib.h>
+
+#include "native_worker.h"
+#include "rtp_parser.h"
+#include "vp8inspect.h"
+
+struct _Vp8Inspect
+{
+  NativeOptions options;
+  OutputSettings output;
+  NativeWorker worker;
+  volatile sig_atomic_t closing;
+  Vp8InspectCallback callback;
+  gpointer userData;
+  GArray * results;
+  guint next;
+};
+
+static void
+vp8_inspect_on_frame (guint32 ssrc, const FrameInfo * frame, gpointer userData)
+{
+  Vp8Inspect * ctx = (Vp8Inspect *) userData;
+
+  if (ctx->callback) {
+    ctx->callback(ssrc, frame, ctx->userData);
+    return;
+  }
+
+  Vp8InspectResult result;
+  result.ssrc = ssrc;
+  result.frame = *frame;
+  g_array_append_val(ctx->results, result);
+}
+
+/**
+ *
+ * This function creates a context for the RTP packets with the given payload type,
+ * inspected up to the given depth (VP8_PARSE_DEPTH_*).
+ *
+ */
+Vp8Inspect *
+vp8_inspect_new (guint payloadType, guint parseDepth)
+{
+  Vp8Inspect * ctx = calloc(1, sizeof(Vp8Inspect));
+
+  ctx->output.callback = vp8_inspect_on_frame;
+  ctx->output.userData = ctx;
+  ctx->options.payloadType = payloadType;
+  ctx->options.parseDepth = parseDepth;
+  ctx->options.output = &ctx->output;
+  ctx->options.closing = &ctx->closing;
+  ctx->results = g_array_new(FALSE, FALSE, sizeof(Vp8InspectResult));
+  native_worker_init(&ctx->worker, 0, &ctx->options);
+  return ctx;
+}
+
+void
+vp8_inspect_free (Vp8Inspect * ctx)
+{
+  native_worker_clear(&ctx->worker);
+  g_array_free(ctx->results, TRUE);
+  free(ctx);
+}
+
+/**
+ *
+ * This function sets the callback called with every inspected frame.
+ * With a callback, vp8_inspect_next() has nothing to return.
+ *
+ */
+void
+vp8_inspect_set_callback (Vp8Inspect * ctx, Vp8InspectCallback callback, gpointer userData)
+{
+  ctx->callback = callback;
+  ctx->userData = userData;
+}
+
+/**
+ *
+ * This function pushes a RTP packet (`arrival` is its receive time in nanoseconds
+ * since the epoch, 0 when unknown). Packets with another payload type are ignored.
+ * The packet memory can be reused as soon as this function returns.
+ * It returns TRUE when the packet completed a frame.
+ *
+ */
+gboolean
+vp8_inspect_push_packet (Vp8Inspect * ctx, const guint8 * data, guint len, guint64 arrival)
+{
+  RtpPacket rtp;
+
+  if (!rtp_packet_parse(data, len, &rtp) || rtp.payloadType != ctx->options.payloadType) {
+    return FALSE;
+  }
+  rtp.arrival = arrival;
+
+  guint64 frames = ctx->worker.frames;
+  NativeStream * stream = native_worker_push(&ctx->worker, &rtp);
+  /* the frame being assembled points at the caller memory */
+  vp8_depay_detach(&stream->depay);
+  return ctx->worker.frames != frames;
+}
+
+/**
+ *
+ * This function pushes a whole VP8 frame of a SSRC, already depayloaded.
+ *
+ */
+void
+vp8_inspect_push_frame (Vp8Inspect * ctx, guint32 ssrc, const guint8 * data, guint len, guint64 pts, guint64 arrival)
+{
+  NativeStream * stream = native_worker_stream(&ctx->worker, ssrc, ctx->options.payloadType);
+  guint offset = vp8_partition_table_offset(data, len);
+  guint available = MIN(len, vp8_header_prefix_size(ctx->options.parseDepth));
+  guint tableAvailable = offset < len ? MIN(len - offset, PARTITION_TABLE_SZ) : 0;
+
+  inspect_frame_info(stream->streamInspector, data, available, data + MIN(offset, len), tableAvailable, len, pts, arrival);
+  ctx->worker.frames++;
+}
+
+/**
+ *
+ * This function returns the next queued result, or NULL when there is none.
+ * The result is valid until the next push.
+ *
+ */
+const Vp8InspectResult *
+vp8_inspect_next (Vp8Inspect * ctx)
+{
+  if (ctx->next >= ctx->results->len) {
+    ctx->next = 0;
+    g_array_set_size(ctx->results, 0);
+    return NULL;
+  }
+  return &g_array_index(ctx->results, Vp8InspectResult, ctx->next++);
+}
+
+/**
+ *
+ * This function forgets a SSRC (its frame numbers start again from 0).
+ * It returns FALSE when there is no such stream.
+ *
+ */
+gboolean
+vp8_inspect_remove_stream (Vp8Inspect * ctx, guint32 ssrc)
+{
+  return native_worker_remove(&ctx->worker, ssrc);
+}
@@ -0,0 +1,47 @@
+#ifndef VP8INSPECT_H
+#define VP8INSPECT_H
+
+#include <glib.h>
+
+#include "vp8_parser.h"
+
+/**
+ *
+ * libvp8inspect: the VP8 inspector as a library.
+ *
+ * A Vp8Inspect context has its own streams (SSRC demux, depayloader and
+ * StreamInspector state), so a process can use as many contexts as it wants,
+ * each from one thread at a time. Some state is still per process, shared by
+ * the contexts and safe to use from several threads:
+ *  - the pool of released StreamInspectors (stream_inspector.c, under a mutex)
+ *  - the metrics registry (metrics.c): every stream is counted in the process
+ *    metrics, the mutex is only taken when a stream is created or removed
+ *  - the perf counters switch (perf_counters_enable(), off by default)
+ *  - the logs: the streams log their creation and removal to stderr
+ *
+ * RTP packets (or whole frames) are pushed in, and the inspected frames come out
+ * through a callback or, without one, through the vp8_inspect_next() iterator.
+ *
+ */
+
+typedef struct _Vp8Inspect Vp8Inspect;
+
+typedef struct
+{
+  guint32 ssrc;
+  FrameInfo frame;
+} Vp8InspectResult;
+
+/* Called with every inspected frame, the frame is only valid during the call */
+typedef void (*Vp8InspectCallback) (guint32 ssrc, const FrameInfo * frame, gpointer userData);
+
+
+Vp8Inspect * vp8_inspect_new(guint payloadType, guint parseDepth);
+void vp8_inspect_free(Vp8Inspect * ctx);
+void vp8_inspect_set_callback(Vp8Inspect * ctx, Vp8InspectCallback callback, gpointer userData);
+gboolean vp8_inspect_push_packet(Vp8Inspect * ctx, const guint8 * data, guint len, guint64 arrival);
+void vp8_inspect_push_frame(Vp8Inspect * ctx, guint32 ssrc, const guint8 * data, guint len, guint64 pts, guint64 arrival);
+const Vp8InspectResult * vp8_inspect_next(Vp8Inspect * ctx);
+gboolean vp8_inspect_remove_stream(Vp8Inspect * ctx, guint32 ssrc);
+
+#endif
@@ -0,0 +1,16 @@
+{
+  "targets": [
+    {
+      "target_name": "vp8inspect",
+      "sources": [ "src/addon.c" ],
+      "include_dirs": [
+        "../../../inspector/src",
+        "<!@(pkg-config --cflags-only-I glib-2.0 zlib | sed s/-I//g)"
+      ],
+      "libraries": [
+        "<(module_root_dir)/../../../inspector/out/libvp8inspect.a",
+        "<!@(pkg-config --libs glib-2.0 zlib)"
+      ]
+    }
+  ]
+}
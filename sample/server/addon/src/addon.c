@@ -0,0 +1,342 @@
+/**
+ *
+ * vp8inspect.node: the VP8 inspector (libvp8inspect) as a Node.js addon.
+ *
+ * Each inspector has its own Vp8Inspect context. The RTP packets are pushed
+ * in batches and every batch is inspected on the libuv worker pool, so the
+ * event loop only copies the packets into the batch. The frames come back
+ * as one ArrayBuffer of fixed-size frame records (the --format=binary
+ * records, see inspector/src/frame_record.h) per batch.
+ *
+ * A batch is a sequence of packets, each one preceded by a 12 bytes
+ * little-endian header:
+ *   0 u32 packet length
+ *   4 f64 arrival time (milliseconds since the epoch, 0 when unknown)
+ *
+ * A context is used by one batch at a time: push() throws while a batch
+ * is being inspected, the JS side queues the packets meanwhile.
+ *
+ * close() only releases the Vp8Inspect context (after the batch being
+ * inspected). The Addon struct is freed by the finalizer of the external,
+ * when JS no longer holds the inspector, so a closed inspector is still safe
+ * to pass to the other functions (they throw).
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+/* before node_api.h: the parser headers use `bool` as a name, stdbool.h makes it a type */
+#include "frame_record.h"
+#include "vp8inspect.h"
+
+#define NAPI_VERSION 4
+#include <node_api.h>
+
+enum
+{
+  ADDON_PACKET_HEADER_SZ = 12
+};
+
+typedef struct
+{
+  Vp8Inspect * inspect;
+  napi_async_work work;
+  napi_ref callback;
+  napi_ref batch;
+  napi_ref self;      /* the external is not collected while its batch is inspected */
+  const guint8 * data;
+  size_t len;
+  guint8 * records;
+  size_t recordsLen;
+  size_t recordsCap;
+  guint64 packets;
+  guint64 frames;
+  gboolean busy;
+  gboolean closed;
+} Addon;
+
+static void
+addon_release (Addon * addon)
+{
+  if (addon->inspect) {
+    vp8_inspect_free(addon->inspect);
+    addon->inspect = NULL;
+  }
+  free(addon->records);
+  addon->records = NULL;
+  addon->recordsCap = 0;
+}
+
+static void
+addon_finalize (napi_env env, void * data, void * hint)
+{
+  Addon * addon = (Addon *) data;
+
+  addon_release(addon);
+  free(addon);
+}
+
+static void
+addon_on_frame (guint32 ssrc, const FrameInfo * frame, gpointer userData)
+{
+  Addon * addon = (Addon *) userData;
+
+  if (addon->recordsLen + FRAME_RECORD_SZ > addon->recordsCap) {
+    size_t cap = addon->recordsCap ? addon->recordsCap * 2 : 64 * FRAME_RECORD_SZ;
+    guint8 * records = realloc(addon->records, cap);
+    if (!records) {
+      /* out of memory, the records of the batch so far are kept */
+      return;
+    }
+    addon->records = records;
+    addon->recordsCap = cap;
+  }
+  frame_record_encode(addon->records + addon->recordsLen, ssrc, frame);
+  addon->recordsLen += FRAME_RECORD_SZ;
+  addon->frames++;
+}
+
+static guint64
+read_arrival (const guint8 * p)
+{
+  guint64 bits = 0;
+  gdouble ms;
+  gint i;
+
+  for (i = 7; i >= 0; i--) {
+    bits = (bits << 8) | p[i];
+  }
+  memcpy(&ms, &bits, sizeof(ms));
+  return ms > 0 ? (guint64) (ms * 1000000) : 0;
+}
+
+/* on a libuv worker thread: nothing here can touch JS values */
+static void
+addon_execute (napi_env env, void * data)
+{
+  Addon * addon = (Addon *) data;
+  size_t offset = 0;
+
+  addon->recordsLen = 0;
+  while (offset + ADDON_PACKET_HEADER_SZ <= addon->len) {
+    const guint8 * header = addon->data + offset;
+    guint32 len = header[0] | (header[1] << 8) | (header[2] << 16) | ((guint32) header[3] << 24);
+    offset += ADDON_PACKET_HEADER_SZ;
+    if (len > addon->len - offset) {
+      break;
+    }
+    vp8_inspect_push_packet(addon->inspect, addon->data + offset, len, read_arrival(header + 4));
+    addon->packets++;
+    offset += len;
+  }
+}
+
+static void
+addon_complete (napi_env env, napi_status status, void * data)
+{
+  Addon * addon = (Addon *) data;
+  napi_value callback, global, records, argv[2];
+  void * buffer;
+
+  napi_get_reference_value(env, addon->callback, &callback);
+  napi_delete_reference(env, addon->callback);
+  napi_delete_reference(env, addon->batch);
+  napi_delete_reference(env, addon->self);
+  napi_delete_async_work(env, addon->work);
+  addon->busy = FALSE;
+
+  napi_get_null(env, &argv[0]);
+  if (status != napi_ok) {
+    napi_value message;
+    napi_create_string_utf8(env, "the batch was not inspected", NAPI_AUTO_LENGTH, &message);
+    napi_create_error(env, NULL, message, &argv[0]);
+    napi_get_undefined(env, &argv[1]);
+  } else {
+    napi_create_arraybuffer(env, addon->recordsLen, &buffer, &records);
+    memcpy(buffer, addon->records, addon->recordsLen);
+    argv[1] = records;
+  }
+
+  if (addon->closed) {
+    addon_release(addon);
+  }
+
+  napi_get_global(env, &global);
+  napi_call_function(env, global, callback, 2, argv, NULL);
+}
+
+static Addon *
+addon_get (napi_env env, napi_value value)
+{
+  Addon * addon = NULL;
+
+  if (napi_get_value_external(env, value, (void **) &addon) != napi_ok || !addon || addon->closed) {
+    napi_throw_error(env, NULL, "invalid or closed inspector");
+    return NULL;
+  }
+  return addon;
+}
+
+/* create(payloadType, parseDepth) */
+static napi_value
+addon_create (napi_env env, napi_callback_info info)
+{
+  size_t argc = 2;
+  napi_value argv[2], result;
+  guint32 payloadType = 0, parseDepth = VP8_PARSE_DEPTH_REFERENCE;
+
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  if (argc < 1 || napi_get_value_uint32(env, argv[0], &payloadType) != napi_ok || payloadType > 127) {
+    napi_throw_type_error(env, NULL, "payloadType must be a number between 0 and 127");
+    return NULL;
+  }
+  if (argc > 1 && (napi_get_value_uint32(env, argv[1], &parseDepth) != napi_ok || parseDepth > VP8_PARSE_DEPTH_FULL)) {
+    napi_throw_type_error(env, NULL, "invalid parseDepth");
+    return NULL;
+  }
+
+  Addon * addon = calloc(1, sizeof(Addon));
+  addon->inspect = vp8_inspect_new(payloadType, parseDepth);
+  vp8_inspect_set_callback(addon->inspect, addon_on_frame, addon);
+  napi_create_external(env, addon, addon_finalize, NULL, &result);
+  return result;
+}
+
+/* push(inspector, batch, callback(error, records)) */
+static napi_value
+addon_push (napi_env env, napi_callback_info info)
+{
+  size_t argc = 3;
+  napi_value argv[3], name;
+  napi_valuetype type;
+  bool isTypedArray = false;
+  void * data;
+  size_t len;
+
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  Addon * addon = argc == 3 ? addon_get(env, argv[0]) : NULL;
+  if (!addon) {
+    if (argc != 3) {
+      napi_throw_type_error(env, NULL, "push(inspector, batch, callback)");
+    }
+    return NULL;
+  }
+  napi_is_typedarray(env, argv[1], &isTypedArray);
+  napi_typeof(env, argv[2], &type);
+  if (!isTypedArray || type != napi_function) {
+    napi_throw_type_error(env, NULL, "push(inspector, batch, callback)");
+    return NULL;
+  }
+  if (addon->busy) {
+    napi_throw_error(env, NULL, "a batch is already being inspected");
+    return NULL;
+  }
+
+  napi_typedarray_type arrayType;
+  napi_get_typedarray_info(env, argv[1], &arrayType, &len, &data, NULL, NULL);
+  if (arrayType != napi_uint8_array) {
+    napi_throw_type_error(env, NULL, "the batch must be a Uint8Array");
+    return NULL;
+  }
+
+  addon->data = data;
+  addon->len = len;
+  addon->busy = TRUE;
+  /* the batch memory must stay alive until the work is completed */
+  napi_create_reference(env, argv[0], 1, &addon->self);
+  napi_create_reference(env, argv[1], 1, &addon->batch);
+  napi_create_reference(env, argv[2], 1, &addon->callback);
+  napi_create_string_utf8(env, "vp8inspect", NAPI_AUTO_LENGTH, &name);
+  napi_create_async_work(env, NULL, name, addon_execute, addon_complete, addon, &addon->work);
+  napi_queue_async_work(env, addon->work);
+  return NULL;
+}
+
+/* removeStream(inspector, ssrc) */
+static napi_value
+addon_remove_stream (napi_env env, napi_callback_info info)
+{
+  size_t argc = 2;
+  napi_value argv[2], result;
+  guint32 ssrc;
+
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  Addon * addon = argc == 2 ? addon_get(env, argv[0]) : NULL;
+  if (!addon || napi_get_value_uint32(env, argv[1], &ssrc) != napi_ok) {
+    if (addon) {
+      napi_throw_type_error(env, NULL, "removeStream(inspector, ssrc)");
+    }
+    return NULL;
+  }
+  if (addon->busy) {
+    napi_throw_error(env, NULL, "a batch is being inspected");
+    return NULL;
+  }
+
+  napi_get_boolean(env, vp8_inspect_remove_stream(addon->inspect, ssrc), &result);
+  return result;
+}
+
+/* stats(inspector): { packets, frames } */
+static napi_value
+addon_stats (napi_env env, napi_callback_info info)
+{
+  size_t argc = 1;
+  napi_value argv[1], result, value;
+
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  Addon * addon = argc == 1 ? addon_get(env, argv[0]) : NULL;
+  if (!addon) {
+    return NULL;
+  }
+
+  napi_create_object(env, &result);
+  napi_create_double(env, (double) addon->packets, &value);
+  napi_set_named_property(env, result, "packets", value);
+  napi_create_double(env, (double) addon->frames, &value);
+  napi_set_named_property(env, result, "frames", value);
+  return result;
+}
+
+/* close(inspector), the context is released once its batch is completed */
+static napi_value
+addon_close (napi_env env, napi_callback_info info)
+{
+  size_t argc = 1;
+  napi_value argv[1];
+
+  napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  Addon * addon = argc == 1 ? addon_get(env, argv[0]) : NULL;
+  if (!addon) {
+    return NULL;
+  }
+
+  addon->closed = TRUE;
+  if (!addon->busy) {
+    addon_release(addon);
+  }
+  return NULL;
+}
+
+static napi_value
+addon_init (napi_env env, napi_value exports)
+{
+  napi_property_descriptor properties[] = {
+    { "create", NULL, addon_create, NULL, NULL, NULL, napi_default, NULL },
+    { "push", NULL, addon_push, NULL, NULL, NULL, napi_default, NULL },
+    { "removeStream", NULL, addon_remove_stream, NULL, NULL, NULL, napi_default, NULL },
+    { "stats", NULL, addon_stats, NULL, NULL, NULL, napi_default, NULL },
+    { "close", NULL, addon_close, NULL, NULL, NULL, napi_default, NULL },
+  };
+  napi_value value;
+
+  napi_define_properties(env, exports, G_N_ELEMENTS(properties), properties);
+  napi_create_uint32(env, FRAME_RECORD_SZ, &value);
+  napi_set_named_property(env, exports, "FRAME_RECORD_SZ", value);
+  napi_create_uint32(env, ADDON_PACKET_HEADER_SZ, &value);
+  napi_set_named_property(env, exports, "PACKET_HEADER_SZ", value);
+  return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, addon_init)
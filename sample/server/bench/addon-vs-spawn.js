@@ -0,0 +1,186 @@
+/**
+ * Inspects the RTP packets of a pcap with the in-process addon and with a spawned
+ * `inspector` (the packets sent over localhost UDP and the results parsed from stdout,
+ * like the sample did before the addon).
+ *
+ * usage: node bench/addon-vs-spawn.js [pcap] [payloadType] [loops]
+ *
+ * It prints one JSON line per path. Each loop replays the capture with other SSRCs.
+ * The spawn path paces the packets (and may still lose some), its frame count is the
+ * number of result lines received and its time stops at the last one. The node cpu time
+ * does not include the child process. BENCH_NATIVE=1 spawns `inspector --native`.
+ */
+const childProcess = require('child_process');
+const dgram = require('dgram');
+const fs = require('fs');
+const path = require('path');
+
+const ADDON_PATH = path.join(__dirname, '../addon/build/Release/vp8inspect.node');
+const INSPECTOR_PATH = path.join(__dirname, '../../../inspector/out/inspector');
+const BENCH_PORT = 34999;
+const SEND_CHUNK = 64;
+const IDLE_TIMEOUT = 2000;
+
+const pcapPath = process.argv[2] || path.join(__dirname, '../../../inspector/sample.pcap');
+const payloadType = parseInt(process.argv[3] || '96', 10);
+const loops = parseInt(process.argv[4] || '10', 10);
+
+// UDP payloads of a pcap (Ethernet or Linux cooked, IPv4)
+function readPcap(file) {
+  const data = fs.readFileSync(file);
+  const magic = data.readUInt32LE(0);
+  const le = magic === 0xa1b2c3d4 || magic === 0xa1b23c4d;
+  const read32 = offset => le ? data.readUInt32LE(offset) : data.readUInt32BE(offset);
+  const linkType = read32(20);
+  const packets = [];
+
+  for (let offset = 24; offset + 16 <= data.length;) {
+    const captured = read32(offset + 8);
+    let ip = offset + 16 + (linkType === 113 ? 16 : linkType === 0 ? 4 : 14);
+    offset += 16 + captured;
+    if (ip + 28 > offset || (data[ip] >> 4) !== 4 || data[ip + 9] !== 17) {
+      continue;
+    }
+    const udp = ip + (data[ip] & 0x0f) * 4;
+    const end = Math.min(offset, udp + data.readUInt16BE(udp + 4));
+    const rtp = data.subarray(udp + 8, end);
+    if (rtp.length > 12 && (rtp[1] & 0x7f) === payloadType) {
+      packets.push(rtp);
+    }
+  }
+  return packets;
+}
+
+// every loop uses other SSRCs, so the streams start again
+function replay(packets) {
+  const result = [];
+  for (let loop = 0; loop < loops; loop++) {
+    packets.forEach(packet => {
+      const copy = Buffer.from(packet);
+      copy.writeUInt32BE((packet.readUInt32BE(8) + loop) >>> 0, 8);
+      result.push(copy);
+    });
+  }
+  return result;
+}
+
+function report(bench, packets, frames, start, cpuStart, end = process.hrtime.bigint()) {
+  const ms = Number(end - start) / 1e6;
+  const cpu = process.cpuUsage(cpuStart);
+  console.log(JSON.stringify({
+    bench, packets, frames, ms: +ms.toFixed(1),
+    'packets/s': Math.round(packets * 1000 / ms), 'frames/s': Math.round(frames * 1000 / ms),
+    'node cpu ms': Math.round((cpu.user + cpu.system) / 1000),
+  }));
+}
+
+function benchAddon(packets) {
+  const addon = require(ADDON_PATH);
+  const inspector = addon.create(payloadType);
+  const batchSize = 256;
+  let frames = 0;
+  let next = 0;
+  const start = process.hrtime.bigint();
+  const cpuStart = process.cpuUsage();
+
+  return new Promise(resolve => {
+    const pushNext = () => {
+      if (next >= packets.length) {
+        addon.close(inspector);
+        report('addon', packets.length, frames, start, cpuStart);
+        return resolve();
+      }
+      const chunk = packets.slice(next, next + batchSize);
+      next += chunk.length;
+      const batch = Buffer.alloc(chunk.reduce((size, packet) => size + addon.PACKET_HEADER_SZ + packet.length, 0));
+      let offset = 0;
+      const arrival = Date.now();
+      chunk.forEach(packet => {
+        batch.writeUInt32LE(packet.length, offset);
+        batch.writeDoubleLE(arrival, offset + 4);
+        packet.copy(batch, offset + addon.PACKET_HEADER_SZ);
+        offset += addon.PACKET_HEADER_SZ + packet.length;
+      });
+      addon.push(inspector, batch, (error, records) => {
+        frames += records.byteLength / addon.FRAME_RECORD_SZ;
+        pushNext();
+      });
+    };
+    pushNext();
+  });
+}
+
+function benchSpawn(packets) {
+  const args = [`--port=${BENCH_PORT}`, `--payloadType=${payloadType}`, '--stdout'];
+  if (process.env.BENCH_NATIVE) {
+    args.unshift('--native');
+  }
+  const child = childProcess.spawn(INSPECTOR_PATH, args);
+  const socket = dgram.createSocket('udp4');
+  let frames = 0;
+  let pending = '';
+  let start;
+  let cpuStart;
+  let lastResult;
+  let idleTimer;
+
+  return new Promise((resolve, reject) => {
+    const done = () => {
+      report('spawn', packets.length, frames, start, cpuStart, lastResult);
+      socket.close();
+      child.once('close', () => resolve());
+      child.kill('SIGINT');
+    };
+
+    child.once('error', reject);
+    child.stdout.setEncoding('utf-8');
+    child.stdout.on('data', data => {
+      const lines = (pending + data).split('\n');
+      pending = lines.pop();
+      lines.forEach(line => {
+        if (line === 'ready') {
+          start = process.hrtime.bigint();
+          cpuStart = process.cpuUsage();
+          send(0);
+          return;
+        }
+        // what the sample had to do with every result
+        const fields = {};
+        line.split(', ').forEach(field => {
+          const [key, value] = field.split(': ');
+          fields[key] = value;
+        });
+        if (fields.ssrc !== undefined) {
+          frames++;
+          lastResult = process.hrtime.bigint();
+        }
+      });
+      clearTimeout(idleTimer);
+      idleTimer = setTimeout(done, IDLE_TIMEOUT);
+    });
+
+    const send = offset => {
+      const chunk = packets.slice(offset, offset + SEND_CHUNK);
+      let sent = 0;
+      if (chunk.length === 0) {
+        clearTimeout(idleTimer);
+        idleTimer = setTimeout(done, IDLE_TIMEOUT);
+        return;
+      }
+      chunk.forEach(packet => socket.send(packet, BENCH_PORT, '127.0.0.1', () => {
+        if (++sent === chunk.length) {
+          setImmediate(() => send(offset + SEND_CHUNK));
+        }
+      }));
+    };
+  });
+}
+
+(async () => {
+  const packets = replay(readPcap(pcapPath));
+  await benchAddon(packets);
+  await benchSpawn(packets);
+})().catch(error => {
+  console.error(error);
+  process.exit(1);
+});
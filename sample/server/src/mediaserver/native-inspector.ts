@@ -0,0 +1,306 @@
+import { EventEmitter } from 'events';
+import fs from 'fs';
+import path from 'path';
+import { performance } from 'perf_hooks';
+import { types as mediasoupTypes } from 'mediasoup';
+import Settings from '../settings';
+
+// Packets queued while a batch is being inspected, over this they are dropped.
+const MAX_BATCH_SIZE = 4 * 1024 * 1024;
+const ADDON_PATH = path.join(__dirname, '../../addon/build/Release/vp8inspect.node');
+
+// The frame record fields used here (see inspector/src/frame_record.h).
+const FRAME_RECORD_MAGIC = [0x56, 0x50, 0x38, 0x52]; // VP8R
+const FRAME_RECORD_VERSION = 2;
+const FRAME_RECORD_HEADER_SZ = 16;
+const FRAME_RECORD_FLAG_OK = 1 << 0;
+const FRAME_RECORD_FLAG_KEYFRAME = 1 << 1;
+
+export type InspectorFrame = {
+  ssrc: number;
+  frameNumber: number;
+  pts: number;
+  size: number;
+  width: number;
+  height: number;
+  ok: boolean;
+  keyframe: boolean;
+};
+
+type Addon = {
+  FRAME_RECORD_SZ: number;
+  PACKET_HEADER_SZ: number;
+  create(payloadType: number, parseDepth?: number): object;
+  push(inspector: object, batch: Uint8Array, callback: (error: Error | null, records: ArrayBuffer) => void): void;
+  removeStream(inspector: object, ssrc: number): boolean;
+  stats(inspector: object): { packets: number, frames: number };
+  close(inspector: object): void;
+};
+
+let addon: Addon | undefined;
+
+export function loadAddon(): Addon {
+  if (!addon) {
+    addon = require(ADDON_PATH) as Addon;
+  }
+  return addon;
+}
+
+/**
+ * In-process inspector: the same results as the `inspector` child process,
+ * without the child process.
+ *
+ * The consumers use a DirectTransport, so the RTP packets come to us in JS.
+ * They are copied into a batch that the addon inspects on the libuv worker pool
+ * while the next batch is being filled. The results come back as binary frame
+ * records, appended to `<outputPath>/<ssrc>.bin` (like `--format=binary`) and
+ * emitted as 'frames' events.
+ *
+ * The records of a batch are grouped by SSRC and written with one write per
+ * file, through a WriteStream per SSRC, so the event loop never waits for
+ * the disk. The file of a removed SSRC is closed, and appended to when the
+ * SSRC comes back.
+ */
+export class NativeInspector extends EventEmitter {
+  private readonly router: mediasoupTypes.Router;
+
+  private transport?: mediasoupTypes.DirectTransport;
+  private consumers: Map<string, mediasoupTypes.Consumer> = new Map();
+  private files: Map<number, fs.WriteStream> = new Map();
+  // the files being closed, a SSRC that comes back waits for them before appending
+  private closingFiles: Map<number, Promise<void>> = new Map();
+
+  private inspector?: object;
+  private batches: Buffer[] = [Buffer.alloc(64 * 1024), Buffer.alloc(64 * 1024)];
+  private batchSize: number = 0;
+  private busy: boolean = false;
+  private flushScheduled: boolean = false;
+  private removedSsrcs: number[] = [];
+  private dropped: number = 0;
+  private closed: boolean = false;
+
+  constructor(
+    router: mediasoupTypes.Router
+  ) {
+    super();
+
+    this.router = router;
+  }
+
+  async load(): Promise<void> {
+    console.log('load()');
+    if (this.inspector) {
+      throw new Error('load() | inspector was already loaded');
+    }
+
+    this.inspector = loadAddon().create(Settings.getVP8PayloadType());
+    this.transport = await this.router.createDirectTransport();
+  }
+
+  async close(): Promise<void> {
+    console.log(`close()`);
+    if (this.closed) {
+      return;
+    }
+
+    this.closed = true;
+    this.transport?.close();
+    if (this.inspector) {
+      loadAddon().close(this.inspector);
+    }
+    this.files.forEach((_, ssrc) => this.closeFile(ssrc));
+    await Promise.all(this.closingFiles.values());
+    if (this.dropped > 0) {
+      console.log(`close() [dropped packets:${this.dropped}]`);
+    }
+  }
+
+  async createConsumer (producer: mediasoupTypes.Producer, displayName?: string) : Promise<void> {
+    const rtpCapabilities: mediasoupTypes.RtpCapabilities = {
+      codecs: Settings.getRouterOptions().mediaCodecs!.filter(codec => codec.mimeType === 'video/VP8'),
+    };
+
+    const consumer = await this.transport!.consume({
+      producerId: producer.id,
+      rtpCapabilities: rtpCapabilities,
+      paused: true,
+    });
+
+    const ssrc = consumer.rtpParameters!.encodings![0].ssrc!;
+    console.log(`inspector:createConsumer() [displayName:${displayName}, ssrc:${ssrc}, trackId:${producer.id}]`);
+    consumer.on('rtp', (packet: Buffer) => this.pushPacket(packet));
+    producer.observer.on('close', () => {
+      consumer.close();
+      this.consumers.delete(producer.id);
+      this.removeStream(ssrc);
+    })
+
+    this.consumers.set(producer.id, consumer);
+    await consumer.resume();
+  }
+
+  /**
+   * Queues a RTP packet from any source (a DirectTransport consumer, a pipe...),
+   * the packets queued in the same tick are inspected together.
+   * `arrival` is in milliseconds since the epoch.
+   */
+  pushPacket(packet: Buffer, arrival: number = performance.timeOrigin + performance.now()): void {
+    if (this.closed) {
+      return;
+    }
+
+    const headerSize = loadAddon().PACKET_HEADER_SZ;
+    const size = this.batchSize + headerSize + packet.length;
+    let batch = this.batches[0];
+    if (size > batch.length) {
+      if (size > MAX_BATCH_SIZE) {
+        this.dropped++;
+        return;
+      }
+      batch = Buffer.alloc(Math.min(MAX_BATCH_SIZE, batch.length * 2 > size ? batch.length * 2 : size));
+      this.batches[0].copy(batch, 0, 0, this.batchSize);
+      this.batches[0] = batch;
+    }
+
+    batch.writeUInt32LE(packet.length, this.batchSize);
+    batch.writeDoubleLE(arrival, this.batchSize + 4);
+    packet.copy(batch, this.batchSize + headerSize);
+    this.batchSize = size;
+
+    if (!this.flushScheduled && !this.busy) {
+      this.flushScheduled = true;
+      setImmediate(() => this.flush());
+    }
+  }
+
+  private removeStream(ssrc: number): void {
+    // the streams can not be removed while a batch is being inspected
+    this.removedSsrcs.push(ssrc);
+    if (!this.busy && !this.flushScheduled) {
+      this.flush();
+    }
+  }
+
+  private flush(): void {
+    this.flushScheduled = false;
+    if (this.busy || this.closed || !this.inspector) {
+      return;
+    }
+
+    const inspector = this.inspector;
+    const addon = loadAddon();
+    // the records of the removed streams were written by the previous batches
+    this.removedSsrcs.forEach(ssrc => {
+      addon.removeStream(inspector, ssrc);
+      this.closeFile(ssrc);
+    });
+    this.removedSsrcs = [];
+    if (this.batchSize === 0) {
+      return;
+    }
+
+    // the addon reads this batch while the other one is being filled
+    const batch = this.batches[0];
+    this.batches[0] = this.batches[1];
+    this.batches[1] = batch;
+    const size = this.batchSize;
+    this.batchSize = 0;
+    this.busy = true;
+
+    addon.push(inspector, batch.subarray(0, size), (error, records) => {
+      this.busy = false;
+      if (error) {
+        console.error(`flush() [error:${error}]`);
+      } else if (!this.closed && records.byteLength > 0) {
+        this.onRecords(records);
+      }
+      if (this.batchSize > 0 || this.removedSsrcs.length > 0) {
+        this.flush();
+      }
+    });
+  }
+
+  private onRecords(records: ArrayBuffer): void {
+    const recordSize = loadAddon().FRAME_RECORD_SZ;
+    const view = new DataView(records);
+    const bytes = new Uint8Array(records);
+    const frames: InspectorFrame[] = [];
+    const offsets: Map<number, number[]> = new Map();
+
+    for (let offset = 0; offset < records.byteLength; offset += recordSize) {
+      const flags = view.getUint8(offset + 39);
+      const frame: InspectorFrame = {
+        ssrc: view.getUint32(offset, true),
+        frameNumber: view.getUint32(offset + 4, true),
+        pts: view.getUint32(offset + 8, true) + view.getUint32(offset + 12, true) * 0x100000000,
+        size: view.getUint32(offset + 24, true),
+        width: view.getUint16(offset + 32, true),
+        height: view.getUint16(offset + 34, true),
+        ok: (flags & FRAME_RECORD_FLAG_OK) !== 0,
+        keyframe: (flags & FRAME_RECORD_FLAG_KEYFRAME) !== 0,
+      };
+      const ssrcOffsets = offsets.get(frame.ssrc);
+      if (ssrcOffsets) {
+        ssrcOffsets.push(offset);
+      } else {
+        offsets.set(frame.ssrc, [offset]);
+      }
+      frames.push(frame);
+    }
+
+    // one write per SSRC and batch
+    offsets.forEach((ssrcOffsets, ssrc) => {
+      const buffer = Buffer.allocUnsafe(ssrcOffsets.length * recordSize);
+      ssrcOffsets.forEach((offset, i) => buffer.set(bytes.subarray(offset, offset + recordSize), i * recordSize));
+      this.getFile(ssrc).write(buffer);
+    });
+
+    this.emit('frames', frames);
+  }
+
+  private getFile(ssrc: number): fs.WriteStream {
+    let file = this.files.get(ssrc);
+    if (file === undefined) {
+      const filename = path.join(Settings.getInspectorOutputPath(), `${ssrc}.bin`);
+      const closing = this.closingFiles.get(ssrc);
+      file = fs.createWriteStream(filename, { flags: 'a' });
+      file.on('error', error => console.error(`getFile() [ssrc:${ssrc}, error:${error}]`));
+      if (closing) {
+        // the previous file of the SSRC wrote the header, its last records go first
+        file.cork();
+        closing.then(() => file!.uncork());
+      } else if (!fs.existsSync(filename) || fs.statSync(filename).size === 0) {
+        const header = Buffer.alloc(FRAME_RECORD_HEADER_SZ);
+        Buffer.from(FRAME_RECORD_MAGIC).copy(header);
+        header.writeUInt16LE(FRAME_RECORD_VERSION, 4);
+        header.writeUInt16LE(loadAddon().FRAME_RECORD_SZ, 6);
+        file.write(header);
+      }
+      this.files.set(ssrc, file);
+    }
+    return file;
+  }
+
+  private closeFile(ssrc: number): void {
+    const file = this.files.get(ssrc);
+    if (file === undefined) {
+      return;
+    }
+
+    this.files.delete(ssrc);
+    const previous = this.closingFiles.get(ssrc);
+    const closed = new Promise<void>(resolve => file.once('close', () => resolve()));
+    this.closingFiles.set(ssrc, closed);
+    closed.then(() => {
+      if (this.closingFiles.get(ssrc) === closed) {
+        this.closingFiles.delete(ssrc);
+      }
+    });
+    // a corked file (see getFile()) ends after the previous one
+    if (previous) {
+      previous.then(() => file.end());
+    } else {
+      file.end();
+    }
+  }
+}
@@ -4,6 +4,8 @@ import { Socket } from "socket.io";
 import { v4 as uuidv4 } from 'uuid';
 import { WebRTCPeer } from "./webrtc-peer";
 import { Inspector } from "./inspector";
+import { NativeInspector, loadAddon } from "./native-inspector";
+import Settings from "../settings";
 import { 
   RoomData, 
   UserData, 
@@ -14,7 +16,7 @@ const MAX_IDLE_TIME = 600000
 export class Room extends EventEmitter {
   private readonly id: string;
   private readonly router: mediasoupTypes.Router;
-  private readonly inspector: Inspector;
+  private readonly inspector: Inspector | NativeInspector;
   private readonly transportOptions: mediasoupTypes.WebRtcTransportOptions;
   private readonly peers: Map<string, WebRTCPeer> = new Map();
   private idleTimer: ReturnType<typeof setTimeout> | null = null;
@@ -29,7 +31,20 @@ export class Room extends EventEmitter {
     this.appData = appData;
     this.router = router;
     this.transportOptions = transportOptions;
-    this.inspector = new Inspector(router);
+    this.inspector = Room.useAddon() ? new NativeInspector(router) : new Inspector(router);
+  }
+
+  private static useAddon () : boolean {
+    if (Settings.getInspectorEngine() !== 'addon') {
+      return false;
+    }
+    try {
+      loadAddon();
+      return true;
+    } catch (error) {
+      console.error(`the inspector addon is not built, spawning the inspector instead [error:${error}]`);
+      return false;
+    }
   }
 
   async load () : Promise<void> {
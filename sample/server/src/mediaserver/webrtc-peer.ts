@@ -12,6 +12,7 @@ import {
 } from '../types';
 
 import { Inspector } from "./inspector";
+import { NativeInspector } from "./native-inspector";
 
 export class WebRTCPeer extends EventEmitter {
   readonly id: string;
@@ -21,7 +22,7 @@ export class WebRTCPeer extends EventEmitter {
   private readonly transportOptions: mediasoupTypes.WebRtcTransportOptions;
   private readonly consumers: Map<string, mediasoupTypes.Consumer> = new Map();
   private readonly producers: Map<string, mediasoupTypes.Producer> = new Map();
-  private readonly inspector: Inspector;
+  private readonly inspector: Inspector | NativeInspector;
   private recvTransport?: mediasoupTypes.WebRtcTransport;
   private sendTransport?: mediasoupTypes.WebRtcTransport;
   private rtpCapabilities?: mediasoupTypes.RtpCapabilities;
@@ -35,7 +36,7 @@ export class WebRTCPeer extends EventEmitter {
     socket: Socket,
     router: mediasoupTypes.Router,
     transportOptions: mediasoupTypes.WebRtcTransportOptions,
-    inspector: Inspector
+    inspector: Inspector | NativeInspector
   ) {
     super()
     this.id = id;
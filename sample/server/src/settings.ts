@@ -52,6 +52,11 @@ export class Settings {
     return 35000;
   }
 
+  // 'addon' inspects the streams in this process (see addon/), 'process' spawns one inspector per room
+  static getInspectorEngine () : 'addon' | 'process' {
+    return process.env.INSPECTOR_ENGINE === 'process' ? 'process' : 'addon';
+  }
+
   static getInspectorOutputPath () : string {
     return '../../inspector-results';
   }